@@ -69,6 +69,7 @@ LIBADB_linux_SRC_FILES := \
     fdevent.cpp \
     get_my_path_linux.cpp \
     usb_linux.cpp \
+    usb_linux_urb.cpp \
 
 LIBADB_windows_SRC_FILES := \
     sysdeps_win32.cpp \
@@ -157,12 +158,22 @@ LOCAL_CFLAGS_windows := $(LIBADB_windows_CFLAGS)
 LOCAL_CFLAGS_linux := $(LIBADB_linux_CFLAGS)
 LOCAL_SRC_FILES := \
     $(LIBADB_TEST_SRCS) \
+    framebuffer_stream.cpp \
+    framebuffer_stream_test.cpp \
+    install_stream.cpp \
     services.cpp \
     shell_service_protocol.cpp \
     shell_service_protocol_test.cpp \
 
-LOCAL_SRC_FILES_linux := $(LIBADB_TEST_linux_SRCS)
-LOCAL_SRC_FILES_darwin := $(LIBADB_TEST_darwin_SRCS)
+LOCAL_SRC_FILES_linux := \
+    $(LIBADB_TEST_linux_SRCS) \
+    install_stream_test.cpp \
+    usb_linux_urb_test.cpp \
+
+LOCAL_SRC_FILES_darwin := \
+    $(LIBADB_TEST_darwin_SRCS) \
+    install_stream_test.cpp \
+
 LOCAL_SRC_FILES_windows := $(LIBADB_TEST_windows_SRCS)
 LOCAL_SANITIZE := $(adb_host_sanitize)
 LOCAL_SHARED_LIBRARIES := libbase
@@ -218,6 +229,8 @@ LOCAL_SRC_FILES := \
     console.cpp \
     commandline.cpp \
     file_sync_client.cpp \
+    framebuffer_stream.cpp \
+    install_stream.cpp \
     line_printer.cpp \
     services.cpp \
     shell_service_protocol.cpp \
@@ -266,6 +279,7 @@ LOCAL_SRC_FILES := \
     services.cpp \
     file_sync_service.cpp \
     framebuffer_service.cpp \
+    framebuffer_stream.cpp \
     remount_service.cpp \
     set_verity_enable_state_service.cpp \
     shell_service.cpp \
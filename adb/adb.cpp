@@ -80,11 +80,30 @@ void fatal_errno(const char* fmt, ...) {
     exit(-1);
 }
 
+// Freed packets are kept for reuse rather than returned to malloc. Every
+// packet carries a MAX_PAYLOAD buffer, so streaming data (forwarded ports in
+// particular) would otherwise allocate and free a quarter megabyte per packet.
+// The pool is bounded so a burst doesn't pin memory forever.
+static constexpr size_t kMaxPooledPackets = 16;
+static apacket* apacket_pool;
+static size_t apacket_pool_size;
+ADB_MUTEX_DEFINE(apacket_pool_lock);
+
 apacket* get_apacket(void)
 {
-    apacket* p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+    adb_mutex_lock(&apacket_pool_lock);
+    apacket* p = apacket_pool;
+    if (p != nullptr) {
+        apacket_pool = p->next;
+        --apacket_pool_size;
+    }
+    adb_mutex_unlock(&apacket_pool_lock);
+
     if (p == nullptr) {
-      fatal("failed to allocate an apacket");
+        p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+        if (p == nullptr) {
+          fatal("failed to allocate an apacket");
+        }
     }
 
     memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
@@ -93,6 +112,15 @@ apacket* get_apacket(void)
 
 void put_apacket(apacket *p)
 {
+    adb_mutex_lock(&apacket_pool_lock);
+    if (apacket_pool_size < kMaxPooledPackets) {
+        p->next = apacket_pool;
+        apacket_pool = p;
+        ++apacket_pool_size;
+        p = nullptr;
+    }
+    adb_mutex_unlock(&apacket_pool_lock);
+
     free(p);
 }
 
@@ -180,6 +180,7 @@ int handle_forward_request(const char* service, TransportType type, const char*
 
 #if !ADB_HOST
 void framebuffer_service(int fd, void *cookie);
+void framebuffer_stream_service(int fd, void *cookie);
 void set_verity_enabled_state_service(int fd, void* cookie);
 #endif
 
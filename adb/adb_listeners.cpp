@@ -75,6 +75,7 @@ static void listener_event_func(int _fd, unsigned ev, void* _l)
         s = create_local_socket(fd);
         if (s) {
             s->transport = listener->transport;
+            s->coalesce_reads = true;
             connect_to_remote(s, listener->connect_to);
             return;
         }
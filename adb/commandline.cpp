@@ -29,12 +29,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include <base/file.h>
 #include <base/logging.h>
 #include <base/stringprintf.h>
 #include <base/strings.h>
@@ -52,6 +55,8 @@
 #include "adb_io.h"
 #include "adb_utils.h"
 #include "file_sync_service.h"
+#include "framebuffer_stream.h"
+#include "install_stream.h"
 #include "services.h"
 #include "shell_service.h"
 #include "transport.h"
@@ -61,6 +66,7 @@ static int install_multiple_app(TransportType t, const char* serial, int argc, c
 static int uninstall_app(TransportType t, const char* serial, int argc, const char** argv);
 static int install_app_legacy(TransportType t, const char* serial, int argc, const char** argv);
 static int uninstall_app_legacy(TransportType t, const char* serial, int argc, const char** argv);
+static int framebuffer_stream(int argc, const char** argv);
 
 static std::string gProductOutPath;
 extern int gListenAll;
@@ -171,6 +177,13 @@ static void help() {
         "                                 ('-k' means keep the data and cache directories)\n"
         "  adb bugreport                - return all information from the device\n"
         "                                 that should be included in a bug report.\n"
+        "  adb screen-stream [-i <ms>] [-n <count>] [--raw] [<file>]\n"
+        "                               - stream <count> screen frames (default 60) at most\n"
+        "                                 every <ms> milliseconds, sending only the changed\n"
+        "                                 regions of each frame, and report frames/sec and\n"
+        "                                 bytes/frame. The last frame is written to <file>\n"
+        "                                 in the raw framebuffer format.\n"
+        "                                 (--raw: capture full frames one at a time instead)\n"
         "\n"
         "  adb backup [-f <file>] [-apk|-noapk] [-obb|-noobb] [-shared|-noshared] [-all] [-system|-nosystem] [<packages...>]\n"
         "                               - write an archive of the device's data to <file>.\n"
@@ -348,6 +361,12 @@ static void read_status_line(int fd, char* buf, size_t count)
     *buf = '\0';
 }
 
+static uint64_t current_time_ms() {
+    struct timeval tv;
+    gettimeofday(&tv, 0); // (Not clock_gettime because of Mac/Windows.)
+    return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
 static void copy_to_file(int inFd, int outFd) {
     const size_t BUFSIZE = 32 * 1024;
     char* buf = (char*) malloc(BUFSIZE);
@@ -1741,6 +1760,9 @@ int adb_commandline(int argc, const char **argv) {
         adb_trace_enable(AUTH);
         return adb_auth_keygen(argv[1]);
     }
+    else if (!strcmp(argv[0], "screen-stream")) {
+        return framebuffer_stream(argc, argv);
+    }
     else if (!strcmp(argv[0], "jdwp")) {
         return adb_connect_command("jdwp");
     }
@@ -1768,6 +1790,122 @@ int adb_commandline(int argc, const char **argv) {
     return 1;
 }
 
+static bool read_framebuffer_frame(int fd, FrameDecoder* decoder, uint64_t* bytes) {
+    FrameHeader header;
+    if (!ReadFdExactly(fd, &header, sizeof(header))) return false;
+    *bytes += sizeof(header);
+
+    std::vector<uint8_t> data;
+    for (uint32_t i = 0; i < header.rect_count; ++i) {
+        FrameRect rect;
+        if (!ReadFdExactly(fd, &rect, sizeof(rect))) return false;
+        if (!decoder->CheckRect(rect)) {
+            fprintf(stderr, "error: malformed frame %u\n", header.sequence);
+            return false;
+        }
+        data.resize(rect.encoded_size);
+        if (!ReadFdExactly(fd, data.data(), data.size())) return false;
+        if (!decoder->ApplyRect(rect, data.data(), data.size())) {
+            fprintf(stderr, "error: malformed frame %u\n", header.sequence);
+            return false;
+        }
+        *bytes += sizeof(rect) + data.size();
+    }
+    return true;
+}
+
+// Reads one snapshot from the one-shot framebuffer: service.
+static bool read_framebuffer_snapshot(struct fbinfo* fbinfo, std::vector<uint8_t>* pixels,
+                                      uint64_t* bytes) {
+    std::string error;
+    int fd = adb_connect("framebuffer:", &error);
+    if (fd < 0) {
+        fprintf(stderr, "error: %s\n", error.c_str());
+        return false;
+    }
+    bool ok = ReadFdExactly(fd, fbinfo, sizeof(*fbinfo));
+    if (ok) {
+        pixels->resize(fbinfo->size);
+        ok = ReadFdExactly(fd, pixels->data(), pixels->size());
+        *bytes += sizeof(*fbinfo) + pixels->size();
+    }
+    adb_close(fd);
+    return ok;
+}
+
+static int framebuffer_stream(int argc, const char** argv) {
+    int interval_ms = 0;
+    int count = 60;
+    bool raw = false;
+    const char* output = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            interval_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--raw")) {
+            raw = true;
+        } else if (argv[i][0] != '-' && output == nullptr) {
+            output = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (count <= 0) return usage();
+
+    struct fbinfo fbinfo;
+    std::vector<uint8_t> pixels;
+    uint64_t bytes = 0;
+    int frames = 0;
+    uint64_t start_ms = current_time_ms();
+
+    if (raw) {
+        // One full capture per frame, for comparison with the stream.
+        for (; frames < count; ++frames) {
+            if (!read_framebuffer_snapshot(&fbinfo, &pixels, &bytes)) break;
+        }
+    } else {
+        std::string error;
+        int fd = adb_connect(android::base::StringPrintf("framebuffer-stream:%d", interval_ms),
+                             &error);
+        if (fd < 0) {
+            fprintf(stderr, "error: %s\n", error.c_str());
+            return 1;
+        }
+        if (ReadFdExactly(fd, &fbinfo, sizeof(fbinfo)) && fbinfo.bpp >= 8) {
+            bytes += sizeof(fbinfo);
+            FrameDecoder decoder(fbinfo.width, fbinfo.height, fbinfo.bpp / 8);
+            for (; frames < count; ++frames) {
+                if (!read_framebuffer_frame(fd, &decoder, &bytes)) break;
+            }
+            pixels = decoder.frame();
+        }
+        adb_close(fd);
+    }
+
+    uint64_t ms = current_time_ms() - start_ms;
+    if (frames == 0) {
+        fprintf(stderr, "error: no frames received\n");
+        return 1;
+    }
+
+    double s = static_cast<double>(ms) / 1000LL;
+    printf("%d frames in %.3fs: %.1f fps, %" PRIu64 " bytes/frame (raw frame: %u bytes)\n",
+           frames, s, s > 0 ? frames / s : 0.0, bytes / frames, fbinfo.size);
+
+    // Write the last frame in the framebuffer: format.
+    if (output != nullptr) {
+        std::string data(reinterpret_cast<const char*>(&fbinfo), sizeof(fbinfo));
+        data.append(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+        if (!android::base::WriteStringToFile(data, output)) {
+            fprintf(stderr, "error: failed to write %s: %s\n", output, strerror(errno));
+            return 1;
+        }
+    }
+    return 0;
+}
+
 static int uninstall_app(TransportType transport, const char* serial, int argc, const char** argv) {
     // 'adb uninstall' takes the same arguments as 'cmd package uninstall' on device
     std::string cmd = "cmd package";
@@ -1847,51 +1985,21 @@ static int install_app(TransportType transport, const char* serial, int argc, co
     return 0;
 }
 
-static int install_multiple_app(TransportType transport, const char* serial, int argc,
-                                const char** argv)
-{
-    int i;
-    struct stat sb;
-    uint64_t total_size = 0;
-
-    // Find all APK arguments starting at end.
-    // All other arguments passed through verbatim.
-    int first_apk = -1;
-    for (i = argc - 1; i >= 0; i--) {
-        const char* file = argv[i];
-        const char* dot = strrchr(file, '.');
-        if (dot && !strcasecmp(dot, ".apk")) {
-            if (stat(file, &sb) == -1 || !S_ISREG(sb.st_mode)) {
-                fprintf(stderr, "Invalid APK file: %s\n", file);
-                return EXIT_FAILURE;
-            }
-
-            total_size += sb.st_size;
-            first_apk = i;
-        } else {
-            break;
-        }
-    }
-
-    if (first_apk == -1) {
-        fprintf(stderr, "Missing APK file\n");
-        return 1;
-    }
-
-    std::string cmd = android::base::StringPrintf("exec:pm install-create -S %" PRIu64, total_size);
-    for (i = 1; i < first_apk; i++) {
-        cmd += " " + escape_arg(argv[i]);
-    }
+// Creates a pm install session. |args| are passed through to install-create.
+// Returns the session id, or -1 with pm's response in |buf| on failure.
+static int create_install_session(const std::string& args, uint64_t total_size,
+                                  char* buf, size_t buf_size) {
+    std::string cmd = android::base::StringPrintf("exec:pm install-create -S %" PRIu64,
+                                                  total_size);
+    cmd += args;
 
-    // Create install session
     std::string error;
     int fd = adb_connect(cmd, &error);
     if (fd < 0) {
-        fprintf(stderr, "Connect error for create: %s\n", error.c_str());
-        return EXIT_FAILURE;
+        snprintf(buf, buf_size, "Connect error for create: %s\n", error.c_str());
+        return -1;
     }
-    char buf[BUFSIZ];
-    read_status_line(fd, buf, sizeof(buf));
+    read_status_line(fd, buf, buf_size);
     adb_close(fd);
 
     int session_id = -1;
@@ -1903,70 +2011,110 @@ static int install_multiple_app(TransportType transport, const char* serial, int
             session_id = strtol(start + 1, NULL, 10);
         }
     }
-    if (session_id < 0) {
-        fprintf(stderr, "Failed to create session\n");
-        fputs(buf, stderr);
-        return EXIT_FAILURE;
-    }
+    return session_id;
+}
 
-    // Valid session, now stream the APKs
-    int success = 1;
-    for (i = first_apk; i < argc; i++) {
-        const char* file = argv[i];
-        if (stat(file, &sb) == -1) {
-            fprintf(stderr, "Failed to stat %s\n", file);
-            success = 0;
-            goto finalize_session;
-        }
+// Maximum number of "pm install-write" streams open at once. Each one starts
+// its own pm process on the device, so this bounds the load we put there.
+static const size_t kMaxParallelInstallWrites = 4;
+
+// Streams |files| into |session_id|. Up to kMaxParallelInstallWrites splits
+// are written concurrently over separate exec: streams, each on its own
+// thread, so that pm's startup and each stream's flow control overlap.
+static bool write_install_session(int session_id, const std::vector<const char*>& files,
+                                  uint64_t* total_bytes) {
+    for (size_t batch = 0; batch < files.size(); batch += kMaxParallelInstallWrites) {
+        std::vector<InstallStream> streams;
+        bool success = true;
+
+        size_t batch_end = std::min(files.size(), batch + kMaxParallelInstallWrites);
+        for (size_t i = batch; i < batch_end; ++i) {
+            const char* file = files[i];
+            struct stat sb;
+            if (stat(file, &sb) == -1) {
+                fprintf(stderr, "Failed to stat %s\n", file);
+                success = false;
+                break;
+            }
 
-        std::string cmd = android::base::StringPrintf(
-                "exec:pm install-write -S %" PRIu64 " %d %d_%s -",
-                static_cast<uint64_t>(sb.st_size), session_id, i, adb_basename(file).c_str());
+            int localFd = adb_open(file, O_RDONLY);
+            if (localFd < 0) {
+                fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+                success = false;
+                break;
+            }
 
-        int localFd = adb_open(file, O_RDONLY);
-        if (localFd < 0) {
-            fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
-            success = 0;
-            goto finalize_session;
-        }
+            std::string cmd = android::base::StringPrintf(
+                    "exec:pm install-write -S %" PRIu64 " %d %d_%s -",
+                    static_cast<uint64_t>(sb.st_size), session_id, static_cast<int>(i),
+                    adb_basename(file).c_str());
+            std::string error;
+            int remoteFd = adb_connect(cmd, &error);
+            if (remoteFd < 0) {
+                fprintf(stderr, "Connect error for write: %s\n", error.c_str());
+                adb_close(localFd);
+                success = false;
+                break;
+            }
 
-        std::string error;
-        int remoteFd = adb_connect(cmd, &error);
-        if (remoteFd < 0) {
-            fprintf(stderr, "Connect error for write: %s\n", error.c_str());
-            adb_close(localFd);
-            success = 0;
-            goto finalize_session;
+            InstallStream s;
+            s.file = file;
+            s.size = static_cast<uint64_t>(sb.st_size);
+            s.local_fd = localFd;
+            s.remote_fd = remoteFd;
+            s.written = 0;
+            s.success = false;
+            streams.push_back(s);
         }
 
-        copy_to_file(localFd, remoteFd);
-        read_status_line(remoteFd, buf, sizeof(buf));
-
-        adb_close(localFd);
-        adb_close(remoteFd);
-
-        if (strncmp("Success", buf, 7)) {
-            fprintf(stderr, "Failed to write %s\n", file);
-            fputs(buf, stderr);
-            success = 0;
-            goto finalize_session;
+        if (success) {
+            WriteInstallStreams(&streams);
         }
+        for (InstallStream& s : streams) {
+            if (success && !s.success) {
+                fprintf(stderr, "Failed to write %s\n", s.file.c_str());
+                fputs(s.status.c_str(), stderr);
+                success = false;
+            }
+            *total_bytes += s.written;
+            adb_close(s.local_fd);
+            adb_close(s.remote_fd);
+        }
+
+        if (!success) return false;
     }
+    return true;
+}
+
+// Streams |files| into session |session_id|, then commits the session if that
+// worked and abandons it otherwise.
+static int finish_install_session(int session_id, const std::vector<const char*>& files) {
+    uint64_t start_ms = current_time_ms();
+    uint64_t total_bytes = 0;
+    bool success = write_install_session(session_id, files, &total_bytes);
+    uint64_t ms = current_time_ms() - start_ms;
 
-finalize_session:
     // Commit session if we streamed everything okay; otherwise abandon
     std::string service =
             android::base::StringPrintf("exec:pm install-%s %d",
                                         success ? "commit" : "abandon", session_id);
-    fd = adb_connect(service, &error);
+    std::string error;
+    int fd = adb_connect(service, &error);
     if (fd < 0) {
         fprintf(stderr, "Connect error for finalize: %s\n", error.c_str());
         return EXIT_FAILURE;
     }
+    char buf[BUFSIZ];
     read_status_line(fd, buf, sizeof(buf));
     adb_close(fd);
 
     if (!strncmp("Success", buf, 7)) {
+        if (ms > 0) {
+            double s = static_cast<double>(ms) / 1000LL;
+            double rate = (static_cast<double>(total_bytes) / s) / (1024*1024);
+            printf("%d file(s) streamed. %.1f MB/s (%" PRIu64 " bytes in %.3fs)\n",
+                   static_cast<int>(files.size()), rate, total_bytes, s);
+        }
         fputs(buf, stderr);
         return 0;
     } else {
@@ -1976,6 +2124,56 @@ finalize_session:
     }
 }
 
+static int install_multiple_app(TransportType transport, const char* serial, int argc,
+                                const char** argv)
+{
+    int i;
+    struct stat sb;
+    uint64_t total_size = 0;
+
+    // Find all APK arguments starting at end.
+    // All other arguments passed through verbatim.
+    int first_apk = -1;
+    for (i = argc - 1; i >= 0; i--) {
+        const char* file = argv[i];
+        const char* dot = strrchr(file, '.');
+        if (dot && !strcasecmp(dot, ".apk")) {
+            if (stat(file, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+                fprintf(stderr, "Invalid APK file: %s\n", file);
+                return EXIT_FAILURE;
+            }
+
+            total_size += sb.st_size;
+            first_apk = i;
+        } else {
+            break;
+        }
+    }
+
+    if (first_apk == -1) {
+        fprintf(stderr, "Missing APK file\n");
+        return 1;
+    }
+
+    std::string args;
+    for (i = 1; i < first_apk; i++) {
+        args += " " + escape_arg(argv[i]);
+    }
+
+    // Create install session
+    char buf[BUFSIZ];
+    int session_id = create_install_session(args, total_size, buf, sizeof(buf));
+    if (session_id < 0) {
+        fprintf(stderr, "Failed to create session\n");
+        fputs(buf, stderr);
+        return EXIT_FAILURE;
+    }
+
+    // Valid session, now stream the APKs
+    std::vector<const char*> files(argv + first_apk, argv + argc);
+    return finish_install_session(session_id, files);
+}
+
 static int pm_command(TransportType transport, const char* serial, int argc, const char** argv) {
     std::string cmd = "pm";
 
@@ -2045,6 +2243,21 @@ static int install_app_legacy(TransportType transport, const char* serial, int a
         return EXIT_FAILURE;
     }
 
+    // Stream the APK straight into a pm install session when the device
+    // supports it, rather than staging a copy on the device first.
+    if (last_apk == argc - 1) {
+        std::string args;
+        for (i = 1; i < last_apk; i++) {
+            args += " " + escape_arg(argv[i]);
+        }
+        char buf[BUFSIZ];
+        int session_id = create_install_session(args, sb.st_size, buf, sizeof(buf));
+        if (session_id >= 0) {
+            return finish_install_session(session_id, {argv[last_apk]});
+        }
+        D("install-create failed, falling back to push: %s", buf);
+    }
+
     int result = -1;
     std::vector<const char*> apk_file = {argv[last_apk]};
     std::string apk_dest = android::base::StringPrintf(
@@ -21,12 +21,15 @@
 #include "fdevent.h"
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <list>
 #include <unordered_map>
 #include <vector>
@@ -55,8 +58,11 @@ int SHELL_EXIT_NOTIFY_FD = -1;
 struct PollNode {
   fdevent* fde;
   ::pollfd pollfd;
+  // When to deliver FDE_TIMEOUT, if has_deadline.
+  std::chrono::steady_clock::time_point deadline;
+  bool has_deadline;
 
-  PollNode(fdevent* fde) : fde(fde) {
+  PollNode(fdevent* fde) : fde(fde), has_deadline(false) {
       memset(&pollfd, 0, sizeof(pollfd));
       pollfd.fd = fde->fd;
 
@@ -199,7 +205,7 @@ void fdevent_set(fdevent* fde, unsigned events) {
 
     if (fde->state & FDE_PENDING) {
         // If we are pending, make sure we don't signal an event that is no longer wanted.
-        fde->events &= events;
+        fde->events &= events | FDE_TIMEOUT;
         if (fde->events == 0) {
             g_pending_list.remove(fde);
             fde->state &= ~FDE_PENDING;
@@ -217,6 +223,19 @@ void fdevent_del(fdevent* fde, unsigned events) {
     fdevent_set(fde, (fde->state & FDE_EVENTMASK) & ~events);
 }
 
+void fdevent_set_timeout(fdevent* fde, int64_t timeout_ms) {
+    check_main_thread();
+    CHECK(fde->state & FDE_ACTIVE);
+    auto it = g_poll_node_map.find(fde->fd);
+    CHECK(it != g_poll_node_map.end());
+    PollNode& node = it->second;
+    node.has_deadline = (timeout_ms >= 0);
+    if (node.has_deadline) {
+        node.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+    D("fdevent_set_timeout: %s, timeout_ms = %" PRId64, dump_fde(fde).c_str(), timeout_ms);
+}
+
 static std::string dump_pollfds(const std::vector<pollfd>& pollfds) {
     std::string result;
     for (const auto& pollfd : pollfds) {
@@ -234,12 +253,26 @@ static std::string dump_pollfds(const std::vector<pollfd>& pollfds) {
 
 static void fdevent_process() {
     std::vector<pollfd> pollfds;
+    bool has_deadline = false;
+    std::chrono::steady_clock::time_point deadline;
     for (const auto& pair : g_poll_node_map) {
         pollfds.push_back(pair.second.pollfd);
+        if (pair.second.has_deadline && (!has_deadline || pair.second.deadline < deadline)) {
+            deadline = pair.second.deadline;
+            has_deadline = true;
+        }
     }
     CHECK_GT(pollfds.size(), 0u);
-    D("poll(), pollfds = %s", dump_pollfds(pollfds).c_str());
-    int ret = TEMP_FAILURE_RETRY(poll(&pollfds[0], pollfds.size(), -1));
+    int timeout_ms = -1;
+    if (has_deadline) {
+        auto remaining = deadline - std::chrono::steady_clock::now();
+        // Round up, so that we never wake up just short of the deadline.
+        auto remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                remaining + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1));
+        timeout_ms = std::max<int64_t>(0, remaining_ms.count());
+    }
+    D("poll(), pollfds = %s, timeout_ms = %d", dump_pollfds(pollfds).c_str(), timeout_ms);
+    int ret = TEMP_FAILURE_RETRY(poll(&pollfds[0], pollfds.size(), timeout_ms));
     if (ret == -1) {
         PLOG(ERROR) << "poll(), ret = " << ret;
         return;
@@ -276,6 +309,24 @@ static void fdevent_process() {
             g_pending_list.push_back(fde);
         }
     }
+
+    if (has_deadline) {
+        auto now = std::chrono::steady_clock::now();
+        for (auto& pair : g_poll_node_map) {
+            PollNode& node = pair.second;
+            if (!node.has_deadline || node.deadline > now) {
+                continue;
+            }
+            node.has_deadline = false;
+            fdevent* fde = node.fde;
+            fde->events |= FDE_TIMEOUT;
+            D("%s timed out", dump_fde(fde).c_str());
+            if (!(fde->state & FDE_PENDING)) {
+                fde->state |= FDE_PENDING;
+                g_pending_list.push_back(fde);
+            }
+        }
+    }
 }
 
 static void fdevent_call_fdfunc(fdevent* fde)
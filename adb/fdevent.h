@@ -24,6 +24,7 @@
 #define FDE_READ              0x0001
 #define FDE_WRITE             0x0002
 #define FDE_ERROR             0x0004
+#define FDE_TIMEOUT           0x0008
 
 /* features that may be set (via the events set/add/del interface) */
 #define FDE_DONT_CLOSE        0x0080
@@ -70,6 +71,11 @@ void fdevent_set(fdevent *fde, unsigned events);
 void fdevent_add(fdevent *fde, unsigned events);
 void fdevent_del(fdevent *fde, unsigned events);
 
+/* Deliver FDE_TIMEOUT to an installed fdevent once |timeout_ms| have passed,
+** whether or not any other event arrives first. A negative |timeout_ms|
+** cancels a pending timeout. Timeouts are one-shot. Not implemented by the
+** Windows fdevent loop in sysdeps_win32.cpp.
+*/
 void fdevent_set_timeout(fdevent *fde, int64_t  timeout_ms);
 
 /* loop forever, handling events.
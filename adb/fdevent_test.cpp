@@ -21,6 +21,7 @@
 #include <pthread.h>
 #include <signal.h>
 
+#include <chrono>
 #include <limits>
 #include <queue>
 #include <string>
@@ -190,3 +191,47 @@ TEST_F(FdeventTest, invalid_fd) {
                                 nullptr));
     ASSERT_EQ(0, pthread_join(thread, nullptr));
 }
+
+struct TimeoutArg {
+    fdevent fde;
+    std::vector<unsigned>* events;
+};
+
+static void TimeoutEventCallback(int, unsigned events, void* userdata) {
+    TimeoutArg* arg = reinterpret_cast<TimeoutArg*>(userdata);
+    arg->events->push_back(events);
+    pthread_exit(nullptr);
+}
+
+static void TimeoutThreadFunc(std::vector<unsigned>* events) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+
+    // Quiet, waiting for a read that never comes.
+    TimeoutArg arg;
+    arg.events = events;
+    fdevent_install(&arg.fde, fds[0], TimeoutEventCallback, &arg);
+    fdevent_add(&arg.fde, FDE_READ);
+    fdevent_set_timeout(&arg.fde, 50);
+
+    // A cancelled timeout never fires.
+    TimeoutArg cancelled;
+    cancelled.events = events;
+    fdevent_install(&cancelled.fde, fds[1], TimeoutEventCallback, &cancelled);
+    fdevent_set_timeout(&cancelled.fde, 10);
+    fdevent_set_timeout(&cancelled.fde, -1);
+
+    fdevent_loop();
+}
+
+TEST_F(FdeventTest, timeout) {
+    std::vector<unsigned> events;
+    pthread_t thread;
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(0, pthread_create(&thread, nullptr,
+                                reinterpret_cast<void* (*)(void*)>(TimeoutThreadFunc),
+                                &events));
+    ASSERT_EQ(0, pthread_join(thread, nullptr));
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    ASSERT_EQ(std::vector<unsigned>({FDE_TIMEOUT}), events);
+}
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#define TRACE_TAG SERVICES
+
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/fb.h>
@@ -22,54 +24,38 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <string>
+#include <vector>
+
 #include "sysdeps.h"
 
 #include "adb.h"
 #include "adb_io.h"
 #include "fdevent.h"
+#include "framebuffer_stream.h"
 
 /* TODO:
 ** - sync with vsync to avoid tearing
 */
-/* This version number defines the format of the fbinfo struct.
-   It must match versioning in ddms where this data is consumed. */
-#define DDMS_RAWIMAGE_VERSION 1
-struct fbinfo {
-    unsigned int version;
-    unsigned int bpp;
-    unsigned int size;
-    unsigned int width;
-    unsigned int height;
-    unsigned int red_offset;
-    unsigned int red_length;
-    unsigned int blue_offset;
-    unsigned int blue_length;
-    unsigned int green_offset;
-    unsigned int green_length;
-    unsigned int alpha_offset;
-    unsigned int alpha_length;
-} __attribute__((packed));
 
-void framebuffer_service(int fd, void *cookie)
-{
-    struct fbinfo fbinfo;
-    unsigned int i, bsize;
-    char buf[640];
-    int fd_screencap;
-    int w, h, f;
+// Starts screencap writing to a pipe, returning the read end.
+static int start_screencap(pid_t* pid) {
     int fds[2];
-    pid_t pid;
-
-    if (pipe2(fds, O_CLOEXEC) < 0) goto pipefail;
+    if (pipe2(fds, O_CLOEXEC) < 0) return -1;
 
-    pid = fork();
-    if (pid < 0) goto done;
+    *pid = fork();
+    if (*pid < 0) {
+        adb_close(fds[0]);
+        adb_close(fds[1]);
+        return -1;
+    }
 
-    if (pid == 0) {
+    if (*pid == 0) {
         dup2(fds[1], STDOUT_FILENO);
         adb_close(fds[0]);
         adb_close(fds[1]);
@@ -80,89 +66,107 @@ void framebuffer_service(int fd, void *cookie)
     }
 
     adb_close(fds[1]);
-    fd_screencap = fds[0];
+    return fds[0];
+}
 
-    /* read w, h & format */
-    if(!ReadFdExactly(fd_screencap, &w, 4)) goto done;
-    if(!ReadFdExactly(fd_screencap, &h, 4)) goto done;
-    if(!ReadFdExactly(fd_screencap, &f, 4)) goto done;
+// Reads screencap's w, h & format header and describes it in |fbinfo|.
+static bool read_fbinfo(int fd_screencap, struct fbinfo* fbinfo) {
+    int w, h, f;
+    if(!ReadFdExactly(fd_screencap, &w, 4)) return false;
+    if(!ReadFdExactly(fd_screencap, &h, 4)) return false;
+    if(!ReadFdExactly(fd_screencap, &f, 4)) return false;
 
-    fbinfo.version = DDMS_RAWIMAGE_VERSION;
+    fbinfo->version = DDMS_RAWIMAGE_VERSION;
     /* see hardware/hardware.h */
     switch (f) {
         case 1: /* RGBA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
             break;
         case 2: /* RGBX_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
             break;
         case 3: /* RGB_888 */
-            fbinfo.bpp = 24;
-            fbinfo.size = w * h * 3;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
+            fbinfo->bpp = 24;
+            fbinfo->size = w * h * 3;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
             break;
         case 4: /* RGB_565 */
-            fbinfo.bpp = 16;
-            fbinfo.size = w * h * 2;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 11;
-            fbinfo.red_length = 5;
-            fbinfo.green_offset = 5;
-            fbinfo.green_length = 6;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 5;
-            fbinfo.alpha_offset = 0;
-            fbinfo.alpha_length = 0;
+            fbinfo->bpp = 16;
+            fbinfo->size = w * h * 2;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 11;
+            fbinfo->red_length = 5;
+            fbinfo->green_offset = 5;
+            fbinfo->green_length = 6;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 5;
+            fbinfo->alpha_offset = 0;
+            fbinfo->alpha_length = 0;
             break;
         case 5: /* BGRA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 16;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 16;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
            break;
         default:
-            goto done;
+            return false;
     }
+    return true;
+}
+
+void framebuffer_service(int fd, void *cookie)
+{
+    struct fbinfo fbinfo;
+    unsigned int i, bsize;
+    char buf[640];
+    int fd_screencap;
+    pid_t pid;
+
+    fd_screencap = start_screencap(&pid);
+    if (fd_screencap < 0) goto pipefail;
+
+    if (!read_fbinfo(fd_screencap, &fbinfo)) goto done;
 
     /* write header */
     if(!WriteFdExactly(fd, &fbinfo, sizeof(fbinfo))) goto done;
@@ -177,9 +181,72 @@ void framebuffer_service(int fd, void *cookie)
     }
 
 done:
-    adb_close(fds[0]);
+    adb_close(fd_screencap);
 
     TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
 pipefail:
     adb_close(fd);
 }
+
+// Captures one frame into |pixels|. The first call fills in |fbinfo|; later
+// calls fail if the screen geometry or format changed.
+static bool capture_frame(struct fbinfo* fbinfo, bool first, std::vector<uint8_t>* pixels) {
+    pid_t pid;
+    int fd_screencap = start_screencap(&pid);
+    if (fd_screencap < 0) return false;
+
+    struct fbinfo info;
+    bool ok = read_fbinfo(fd_screencap, &info);
+    if (ok) {
+        if (first) {
+            *fbinfo = info;
+            pixels->resize(info.size);
+        } else if (memcmp(&info, fbinfo, sizeof(info))) {
+            D("framebuffer-stream: screen format changed");
+            ok = false;
+        }
+    }
+    if (ok) {
+        ok = ReadFdExactly(fd_screencap, pixels->data(), pixels->size());
+    }
+
+    adb_close(fd_screencap);
+    TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
+    return ok;
+}
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void framebuffer_stream_service(int fd, void* cookie) {
+    char* arg = reinterpret_cast<char*>(cookie);
+    int interval_ms = atoi(arg);
+    free(arg);
+    if (interval_ms < 0) interval_ms = 0;
+
+    struct fbinfo fbinfo;
+    std::vector<uint8_t> pixels;
+    if (capture_frame(&fbinfo, true, &pixels) &&
+        WriteFdExactly(fd, &fbinfo, sizeof(fbinfo))) {
+        FrameEncoder encoder(fbinfo.width, fbinfo.height, fbinfo.bpp / 8);
+        std::string out;
+        uint64_t start = now_ms();
+        while (true) {
+            out.clear();
+            encoder.Encode(pixels.data(), &out);
+            if (!WriteFdExactly(fd, out.data(), out.size())) break;
+
+            // Pace frames to the requested interval, counting capture time.
+            uint64_t elapsed = now_ms() - start;
+            if (elapsed < static_cast<uint64_t>(interval_ms)) {
+                usleep((interval_ms - elapsed) * 1000);
+            }
+            start = now_ms();
+            if (!capture_frame(&fbinfo, false, &pixels)) break;
+        }
+    }
+    adb_close(fd);
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "framebuffer_stream.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+static constexpr size_t kMaxLiteral = 128;
+static constexpr size_t kMaxRun = 129;
+
+constexpr size_t FrameEncoder::kTileSize;
+
+void EncodePixelRuns(const uint8_t* pixels, size_t count, size_t bpp, std::string* out) {
+    auto pixel = [pixels, bpp](size_t i) { return pixels + i * bpp; };
+    auto same = [&pixel, bpp](size_t a, size_t b) { return !memcmp(pixel(a), pixel(b), bpp); };
+
+    size_t i = 0;
+    while (i < count) {
+        size_t run = 1;
+        while (i + run < count && run < kMaxRun && same(i, i + run)) {
+            ++run;
+        }
+        if (run >= 2) {
+            out->push_back(static_cast<char>(126 + run));
+            out->append(reinterpret_cast<const char*>(pixel(i)), bpp);
+            i += run;
+            continue;
+        }
+
+        // Collect literals until the next run starts.
+        size_t start = i;
+        size_t n = 0;
+        while (i < count && n < kMaxLiteral) {
+            if (i + 1 < count && same(i, i + 1)) break;
+            ++i;
+            ++n;
+        }
+        out->push_back(static_cast<char>(n - 1));
+        out->append(reinterpret_cast<const char*>(pixel(start)), n * bpp);
+    }
+}
+
+bool DecodePixelRuns(const uint8_t** data, const uint8_t* end, size_t count, size_t bpp,
+                     uint8_t* out) {
+    const uint8_t* p = *data;
+    size_t decoded = 0;
+    while (decoded < count) {
+        if (p >= end) return false;
+        uint8_t c = *p++;
+        if (c < 128) {
+            size_t n = c + 1;
+            if (n > count - decoded || static_cast<size_t>(end - p) < n * bpp) return false;
+            memcpy(out + decoded * bpp, p, n * bpp);
+            p += n * bpp;
+            decoded += n;
+        } else {
+            size_t n = c - 126;
+            if (n > count - decoded || static_cast<size_t>(end - p) < bpp) return false;
+            for (size_t i = 0; i < n; ++i) {
+                memcpy(out + (decoded + i) * bpp, p, bpp);
+            }
+            p += bpp;
+            decoded += n;
+        }
+    }
+    *data = p;
+    return true;
+}
+
+FrameEncoder::FrameEncoder(size_t width, size_t height, size_t bytes_per_pixel)
+    : width_(width), height_(height), bpp_(bytes_per_pixel) {
+}
+
+void FrameEncoder::EncodeRect(const uint8_t* frame, size_t x, size_t y, size_t w, size_t h,
+                              std::string* out) {
+    FrameRect rect;
+    rect.x = x;
+    rect.y = y;
+    rect.width = w;
+    rect.height = h;
+    size_t rect_pos = out->size();
+    out->append(reinterpret_cast<const char*>(&rect), sizeof(rect));
+
+    size_t data_pos = out->size();
+    for (size_t row = y; row < y + h; ++row) {
+        EncodePixelRuns(frame + (row * width_ + x) * bpp_, w, bpp_, out);
+    }
+    rect.encoded_size = out->size() - data_pos;
+    memcpy(&(*out)[rect_pos], &rect, sizeof(rect));
+}
+
+void FrameEncoder::Encode(const uint8_t* frame, std::string* out) {
+    FrameHeader header;
+    header.sequence = sequence_++;
+    header.rect_count = 0;
+    size_t header_pos = out->size();
+    out->append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    size_t stride = width_ * bpp_;
+    if (previous_.empty()) {
+        EncodeRect(frame, 0, 0, width_, height_, out);
+        header.rect_count = 1;
+    } else {
+        // Compare tile by tile, and send each horizontal span of dirty tiles
+        // in a band as one rectangle.
+        size_t tiles = (width_ + kTileSize - 1) / kTileSize;
+        for (size_t y = 0; y < height_; y += kTileSize) {
+            size_t band_height = std::min(kTileSize, height_ - y);
+            size_t span_start = 0;
+            bool in_span = false;
+            // One extra iteration past the last tile closes any open span.
+            for (size_t tile = 0; tile <= tiles; ++tile) {
+                size_t x = tile * kTileSize;
+                bool dirty = false;
+                if (x < width_) {
+                    size_t tile_bytes = std::min(kTileSize, width_ - x) * bpp_;
+                    for (size_t row = y; row < y + band_height && !dirty; ++row) {
+                        size_t offset = row * stride + x * bpp_;
+                        dirty = memcmp(frame + offset, &previous_[offset], tile_bytes) != 0;
+                    }
+                }
+                if (dirty && !in_span) {
+                    span_start = x;
+                    in_span = true;
+                } else if (!dirty && in_span) {
+                    EncodeRect(frame, span_start, y, std::min(x, width_) - span_start,
+                               band_height, out);
+                    ++header.rect_count;
+                    in_span = false;
+                }
+            }
+        }
+    }
+    memcpy(&(*out)[header_pos], &header, sizeof(header));
+
+    previous_.assign(frame, frame + height_ * stride);
+}
+
+FrameDecoder::FrameDecoder(size_t width, size_t height, size_t bytes_per_pixel)
+    : width_(width), height_(height), bpp_(bytes_per_pixel),
+      frame_(width * height * bytes_per_pixel) {
+}
+
+bool FrameDecoder::CheckRect(const FrameRect& rect) const {
+    if (rect.x > width_ || rect.width > width_ - rect.x ||
+        rect.y > height_ || rect.height > height_ - rect.y) {
+        return false;
+    }
+    // Every token covers at least one pixel and costs one control byte on
+    // top of the pixels it carries.
+    return rect.encoded_size <= static_cast<uint64_t>(rect.width) * rect.height * (bpp_ + 1);
+}
+
+bool FrameDecoder::ApplyRect(const FrameRect& rect, const uint8_t* data, size_t size) {
+    if (!CheckRect(rect) || size != rect.encoded_size) {
+        return false;
+    }
+
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    for (size_t row = rect.y; row < rect.y + rect.height; ++row) {
+        uint8_t* out = &frame_[(row * width_ + rect.x) * bpp_];
+        if (!DecodePixelRuns(&p, end, rect.width, bpp_, out)) {
+            return false;
+        }
+    }
+    return p == end;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Wire format shared by adbd's framebuffer: and framebuffer-stream: services
+// and the adb client.
+//
+// framebuffer-stream: sends one fbinfo header, then a sequence of frames. Each
+// frame is a FrameHeader followed by |rect_count| FrameRects, each of them
+// followed by |encoded_size| bytes of pixel data. The first frame covers the
+// whole screen; later ones only the tiles that changed since the previous
+// frame. Pixel data is run-length encoded row by row (see FrameEncoder).
+
+#ifndef _ADB_FRAMEBUFFER_STREAM_H_
+#define _ADB_FRAMEBUFFER_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/* This version number defines the format of the fbinfo struct.
+   It must match versioning in ddms where this data is consumed. */
+#define DDMS_RAWIMAGE_VERSION 1
+struct fbinfo {
+    unsigned int version;
+    unsigned int bpp;
+    unsigned int size;
+    unsigned int width;
+    unsigned int height;
+    unsigned int red_offset;
+    unsigned int red_length;
+    unsigned int blue_offset;
+    unsigned int blue_length;
+    unsigned int green_offset;
+    unsigned int green_length;
+    unsigned int alpha_offset;
+    unsigned int alpha_length;
+} __attribute__((packed));
+
+struct FrameHeader {
+    uint32_t sequence;
+    uint32_t rect_count;
+} __attribute__((packed));
+
+struct FrameRect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    uint32_t encoded_size;
+} __attribute__((packed));
+
+// Diffs successive frames and encodes the changed tiles.
+//
+// Pixels are encoded per row as a sequence of tokens. A control byte c < 128
+// is followed by c + 1 literal pixels; c >= 128 is followed by one pixel that
+// is repeated c - 126 times. Runs never cross rows.
+class FrameEncoder {
+  public:
+    // Side of the square tiles that are compared between frames.
+    static constexpr size_t kTileSize = 32;
+
+    FrameEncoder(size_t width, size_t height, size_t bytes_per_pixel);
+
+    // Appends the encoded delta from the previous frame to |out|. |frame| must
+    // hold width * height pixels.
+    void Encode(const uint8_t* frame, std::string* out);
+
+  private:
+    void EncodeRect(const uint8_t* frame, size_t x, size_t y, size_t w, size_t h,
+                    std::string* out);
+
+    size_t width_;
+    size_t height_;
+    size_t bpp_;
+    uint32_t sequence_ = 0;
+    std::vector<uint8_t> previous_;
+};
+
+// Reassembles frames from the output of FrameEncoder.
+class FrameDecoder {
+  public:
+    FrameDecoder(size_t width, size_t height, size_t bytes_per_pixel);
+
+    // Returns false if |rect| is out of bounds or its encoded_size is more
+    // than FrameEncoder could produce for it, so that a reader can check a
+    // rect before allocating room for its pixel data.
+    bool CheckRect(const FrameRect& rect) const;
+
+    // Decodes |size| bytes of pixel data for |rect| into the current frame.
+    // Returns false if the data is malformed or out of bounds.
+    bool ApplyRect(const FrameRect& rect, const uint8_t* data, size_t size);
+
+    const std::vector<uint8_t>& frame() const { return frame_; }
+
+  private:
+    size_t width_;
+    size_t height_;
+    size_t bpp_;
+    std::vector<uint8_t> frame_;
+};
+
+// Appends the encoding of |count| pixels of |bpp| bytes each to |out|.
+void EncodePixelRuns(const uint8_t* pixels, size_t count, size_t bpp, std::string* out);
+
+// Decodes exactly |count| pixels into |out|, reading from |*data| (advanced
+// past the consumed bytes). Returns false if the input is malformed.
+bool DecodePixelRuns(const uint8_t** data, const uint8_t* end, size_t count, size_t bpp,
+                     uint8_t* out);
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "framebuffer_stream.h"
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// Feeds the output of FrameEncoder::Encode through |decoder|.
+static bool Decode(const std::string& encoded, FrameDecoder* decoder, uint32_t* rect_count) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(encoded.data());
+    const uint8_t* end = p + encoded.size();
+
+    FrameHeader header;
+    if (static_cast<size_t>(end - p) < sizeof(header)) return false;
+    memcpy(&header, p, sizeof(header));
+    p += sizeof(header);
+
+    for (uint32_t i = 0; i < header.rect_count; ++i) {
+        FrameRect rect;
+        if (static_cast<size_t>(end - p) < sizeof(rect)) return false;
+        memcpy(&rect, p, sizeof(rect));
+        p += sizeof(rect);
+        if (static_cast<size_t>(end - p) < rect.encoded_size) return false;
+        if (!decoder->ApplyRect(rect, p, rect.encoded_size)) return false;
+        p += rect.encoded_size;
+    }
+    *rect_count = header.rect_count;
+    return p == end;
+}
+
+TEST(framebuffer_stream, pixel_runs_round_trip) {
+    // Mix of literals, runs, and runs longer than one token can hold.
+    std::vector<uint32_t> pixels;
+    for (uint32_t i = 0; i < 10; ++i) pixels.push_back(i);
+    pixels.insert(pixels.end(), 300, 0xff00ff00);
+    pixels.push_back(1);
+    pixels.insert(pixels.end(), 2, 7);
+    for (uint32_t i = 0; i < 200; ++i) pixels.push_back(i * 3);
+
+    std::string encoded;
+    EncodePixelRuns(reinterpret_cast<uint8_t*>(pixels.data()), pixels.size(), 4, &encoded);
+    EXPECT_LT(encoded.size(), pixels.size() * 4);
+
+    std::vector<uint32_t> decoded(pixels.size());
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(encoded.data());
+    ASSERT_TRUE(DecodePixelRuns(&p, p + encoded.size(), decoded.size(), 4,
+                                reinterpret_cast<uint8_t*>(decoded.data())));
+    EXPECT_EQ(reinterpret_cast<const uint8_t*>(encoded.data()) + encoded.size(), p);
+    EXPECT_EQ(pixels, decoded);
+}
+
+TEST(framebuffer_stream, pixel_runs_truncated) {
+    std::vector<uint16_t> pixels = {1, 2, 3, 4, 4, 4, 4, 5};
+    std::string encoded;
+    EncodePixelRuns(reinterpret_cast<uint8_t*>(pixels.data()), pixels.size(), 2, &encoded);
+
+    std::vector<uint16_t> decoded(pixels.size());
+    for (size_t len = 0; len < encoded.size(); ++len) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(encoded.data());
+        EXPECT_FALSE(DecodePixelRuns(&p, p + len, decoded.size(), 2,
+                                     reinterpret_cast<uint8_t*>(decoded.data())));
+    }
+}
+
+TEST(framebuffer_stream, delta_frames) {
+    // Not a multiple of the tile size in either direction.
+    const size_t width = 100;
+    const size_t height = 70;
+    std::vector<uint32_t> frame(width * height);
+    srand(1);
+    for (uint32_t& pixel : frame) pixel = rand();
+
+    FrameEncoder encoder(width, height, 4);
+    FrameDecoder decoder(width, height, 4);
+    uint32_t rect_count;
+
+    // The first frame is sent in full.
+    std::string encoded;
+    encoder.Encode(reinterpret_cast<uint8_t*>(frame.data()), &encoded);
+    ASSERT_TRUE(Decode(encoded, &decoder, &rect_count));
+    EXPECT_EQ(1U, rect_count);
+    EXPECT_EQ(0, memcmp(frame.data(), decoder.frame().data(), frame.size() * 4));
+
+    // An unchanged frame carries no rectangles.
+    encoded.clear();
+    encoder.Encode(reinterpret_cast<uint8_t*>(frame.data()), &encoded);
+    EXPECT_EQ(sizeof(FrameHeader), encoded.size());
+    ASSERT_TRUE(Decode(encoded, &decoder, &rect_count));
+    EXPECT_EQ(0U, rect_count);
+
+    // Touch the bottom-right corner and one pixel in the first tile.
+    frame[(height - 1) * width + width - 1] ^= 1;
+    frame[5] ^= 1;
+    encoded.clear();
+    encoder.Encode(reinterpret_cast<uint8_t*>(frame.data()), &encoded);
+    ASSERT_TRUE(Decode(encoded, &decoder, &rect_count));
+    EXPECT_EQ(2U, rect_count);
+    EXPECT_LT(encoded.size(), frame.size() * 4 / 4);
+    EXPECT_EQ(0, memcmp(frame.data(), decoder.frame().data(), frame.size() * 4));
+}
+
+TEST(framebuffer_stream, rect_out_of_bounds) {
+    FrameDecoder decoder(10, 10, 4);
+    FrameRect rect = {5, 5, 6, 1, 0};
+    uint8_t data[1] = {};
+    EXPECT_FALSE(decoder.ApplyRect(rect, data, sizeof(data)));
+}
+
+TEST(framebuffer_stream, rect_encoded_size_bounded) {
+    FrameDecoder decoder(10, 10, 4);
+    // At worst one control byte per pixel on top of the pixels themselves.
+    FrameRect rect = {0, 0, 10, 2, 10 * 2 * 5};
+    EXPECT_TRUE(decoder.CheckRect(rect));
+    rect.encoded_size++;
+    EXPECT_FALSE(decoder.CheckRect(rect));
+    rect.encoded_size = UINT32_MAX;
+    EXPECT_FALSE(decoder.CheckRect(rect));
+}
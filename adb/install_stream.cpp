@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sysdeps.h"
+
+#include "install_stream.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <base/stringprintf.h>
+
+#include "adb_io.h"
+
+namespace {
+
+struct WriterArgs {
+    InstallStream* stream;
+    // Written to once the stream is done.
+    int done_fd;
+};
+
+}  // namespace
+
+static void write_install_stream(InstallStream* s) {
+    const size_t BUFSIZE = 32 * 1024;
+    std::unique_ptr<char[]> buf(new char[BUFSIZE]);
+
+    s->written = 0;
+    s->success = false;
+    while (s->written < s->size) {
+        size_t want = std::min<uint64_t>(BUFSIZE, s->size - s->written);
+        int len = adb_read(s->local_fd, buf.get(), want);
+        if (len <= 0) {
+            s->status = android::base::StringPrintf("Failed to read %s: %s\n", s->file.c_str(),
+                                                    len < 0 ? strerror(errno) : "unexpected EOF");
+            return;
+        }
+        if (!WriteFdExactly(s->remote_fd, buf.get(), len)) {
+            s->status = android::base::StringPrintf("Failed to write %s: %s\n", s->file.c_str(),
+                                                    strerror(errno));
+            return;
+        }
+        s->written += len;
+    }
+
+    // pm answers once it has all the data, and then closes the stream.
+    s->status.clear();
+    int len;
+    while (s->status.size() < BUFSIZ &&
+           (len = adb_read(s->remote_fd, buf.get(), BUFSIZ - s->status.size())) > 0) {
+        s->status.append(buf.get(), len);
+    }
+    s->success = s->status.compare(0, 7, "Success") == 0;
+}
+
+static void* install_stream_thread(void* arg) {
+    std::unique_ptr<WriterArgs> args(reinterpret_cast<WriterArgs*>(arg));
+    adb_thread_setname("install-write");
+    write_install_stream(args->stream);
+    WriteFdExactly(args->done_fd, "", 1);
+    return nullptr;
+}
+
+void WriteInstallStreams(std::vector<InstallStream>* streams) {
+    int done[2];
+    if (adb_socketpair(done) == -1) {
+        // Without a way to wait for the threads, do it one at a time.
+        for (InstallStream& s : *streams) {
+            write_install_stream(&s);
+        }
+        return;
+    }
+
+    size_t started = 0;
+    for (InstallStream& s : *streams) {
+        WriterArgs* args = new WriterArgs{&s, done[1]};
+        if (adb_thread_create(install_stream_thread, args)) {
+            ++started;
+        } else {
+            delete args;
+            write_install_stream(&s);
+        }
+    }
+
+    char c;
+    for (size_t i = 0; i < started; ++i) {
+        ReadFdExactly(done[0], &c, 1);
+    }
+    adb_close(done[0]);
+    adb_close(done[1]);
+}
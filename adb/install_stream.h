@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ADB_INSTALL_STREAM_H_
+#define _ADB_INSTALL_STREAM_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// One APK being written into a pm install session: |size| bytes are copied
+// from |local_fd| to |remote_fd|, the "pm install-write" stream, after which
+// pm's status line is read back from |remote_fd|. Neither fd is closed.
+struct InstallStream {
+    std::string file;
+    uint64_t size;
+    int local_fd;
+    int remote_fd;
+
+    // Filled in by WriteInstallStreams().
+    uint64_t written;
+    bool success;
+    // pm's response, or why the copy failed.
+    std::string status;
+};
+
+// Writes all of |streams| concurrently, one thread each, and returns once
+// every stream has finished or failed. A stream whose far end stops reading
+// only holds up itself.
+void WriteInstallStreams(std::vector<InstallStream>* streams);
+
+#endif
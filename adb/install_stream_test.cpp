@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "install_stream.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <base/file.h>
+#include <base/test_utils.h>
+
+#include "adb_io.h"
+#include "sysdeps.h"
+
+// Large enough that a stream nobody reads fills the socket buffers.
+static const size_t kApkSize = 4 * 1024 * 1024;
+
+// What pm install-write does with a stream: reads |size| bytes, then replies.
+static std::string FakePm(int fd, size_t size, const char* reply) {
+    std::string data(size, '\0');
+    if (!ReadFdExactly(fd, &data[0], size)) {
+        data.clear();
+    }
+    WriteFdExactly(fd, reply);
+    adb_close(fd);
+    return data;
+}
+
+class InstallStreamTest : public ::testing::Test {
+  protected:
+    void AddStream(const std::string& contents, int* far_end) {
+        files_.emplace_back(new TemporaryFile);
+        TemporaryFile* tf = files_.back().get();
+        ASSERT_TRUE(android::base::WriteStringToFd(contents, tf->fd));
+        ASSERT_EQ(0, adb_lseek(tf->fd, 0, SEEK_SET));
+
+        int fds[2];
+        ASSERT_EQ(0, adb_socketpair(fds));
+        InstallStream s;
+        s.file = tf->path;
+        s.size = contents.size();
+        s.local_fd = tf->fd;
+        s.remote_fd = fds[0];
+        streams_.push_back(s);
+        *far_end = fds[1];
+    }
+
+    void TearDown() override {
+        for (InstallStream& s : streams_) {
+            adb_close(s.remote_fd);
+        }
+    }
+
+    std::vector<std::unique_ptr<TemporaryFile>> files_;
+    std::vector<InstallStream> streams_;
+};
+
+TEST_F(InstallStreamTest, writes_data_and_reads_status) {
+    std::string first(kApkSize, 'a');
+    std::string second(1000, 'b');
+    int pm[2];
+    AddStream(first, &pm[0]);
+    AddStream(second, &pm[1]);
+
+    std::string received[2];
+    std::thread pm0([&]() { received[0] = FakePm(pm[0], first.size(), "Success\n"); });
+    std::thread pm1([&]() { received[1] = FakePm(pm[1], second.size(), "Failure [x]\n"); });
+    WriteInstallStreams(&streams_);
+    pm0.join();
+    pm1.join();
+
+    EXPECT_EQ(first, received[0]);
+    EXPECT_EQ(second, received[1]);
+    EXPECT_TRUE(streams_[0].success);
+    EXPECT_EQ(first.size(), streams_[0].written);
+    EXPECT_EQ("Success\n", streams_[0].status);
+    EXPECT_FALSE(streams_[1].success);
+    EXPECT_EQ("Failure [x]\n", streams_[1].status);
+}
+
+TEST_F(InstallStreamTest, stalled_stream_does_not_block_others) {
+    std::string stalled_apk(kApkSize, 's');
+    std::string apk(kApkSize, 'f');
+    int stalled_pm, pm;
+    AddStream(stalled_apk, &stalled_pm);
+    AddStream(apk, &pm);
+
+    // The first pm doesn't read anything until the second has everything,
+    // or until it has waited long enough for the test to fail.
+    std::atomic<bool> second_done(false);
+    bool second_done_first = false;
+    std::string received[2];
+    std::thread stalled_thread([&]() {
+        for (int i = 0; i < 1000 && !second_done; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        second_done_first = second_done;
+        received[0] = FakePm(stalled_pm, stalled_apk.size(), "Success\n");
+    });
+    std::thread pm_thread([&]() {
+        received[1] = FakePm(pm, apk.size(), "Success\n");
+        second_done = true;
+    });
+    WriteInstallStreams(&streams_);
+    stalled_thread.join();
+    pm_thread.join();
+
+    EXPECT_TRUE(second_done_first);
+    EXPECT_EQ(stalled_apk, received[0]);
+    EXPECT_EQ(apk, received[1]);
+    EXPECT_TRUE(streams_[0].success);
+    EXPECT_TRUE(streams_[1].success);
+}
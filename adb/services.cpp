@@ -303,6 +303,11 @@ int service_to_fd(const char* name, const atransport* transport) {
         ret = unix_open(name + 4, O_RDWR | O_CLOEXEC);
     } else if(!strncmp(name, "framebuffer:", 12)) {
         ret = create_service_thread(framebuffer_service, 0);
+    } else if(!strncmp(name, "framebuffer-stream:", 19)) {
+        void* arg = strdup(name + 19);
+        if (arg == NULL) return -1;
+        ret = create_service_thread(framebuffer_stream_service, arg);
+        if (ret < 0) free(arg);
     } else if (!strncmp(name, "jdwp:", 5)) {
         ret = create_jdwp_connection_fd(atoi(name+5));
     } else if(!strncmp(name, "shell", 5)) {
@@ -53,6 +53,18 @@ struct asocket {
         */
     int    exit_on_close;
 
+    // flag: set for sockets that relay forwarded ports. Short reads that
+    // arrive in the middle of a bulk transfer are briefly held back so that
+    // they go out as full packets.
+    bool coalesce_reads;
+
+    // Whether the last read filled a whole packet.
+    bool last_read_full;
+
+    // A short read that is being held back, or null. It is sent once it
+    // fills up, the stream ends, or the fdevent's timeout goes off.
+    apacket* coalesce_pkt;
+
         /* the asocket we are connected to
         */
 
@@ -18,9 +18,11 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <limits>
 #include <queue>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <pthread.h>
@@ -54,6 +56,7 @@ struct ThreadArg {
     int first_read_fd;
     int last_write_fd;
     size_t middle_pipe_count;
+    bool coalesce_reads;
 };
 
 static void FdEventThreadFunc(ThreadArg* arg) {
@@ -72,6 +75,7 @@ static void FdEventThreadFunc(ThreadArg* arg) {
     for (size_t i = 0; i < read_fds.size(); ++i) {
         asocket* reader = create_local_socket(read_fds[i]);
         ASSERT_TRUE(reader != nullptr);
+        reader->coalesce_reads = arg->coalesce_reads;
         asocket* writer = create_local_socket(write_fds[i]);
         ASSERT_TRUE(writer != nullptr);
         reader->peer = writer;
@@ -109,6 +113,7 @@ TEST_F(LocalSocketTest, smoke) {
     thread_arg.first_read_fd = fd_pair1[0];
     thread_arg.last_write_fd = fd_pair2[1];
     thread_arg.middle_pipe_count = PIPE_COUNT;
+    thread_arg.coalesce_reads = false;
     int writer = fd_pair1[1];
     int reader = fd_pair2[0];
 
@@ -133,6 +138,56 @@ TEST_F(LocalSocketTest, smoke) {
     ASSERT_EQ(0, pthread_join(thread, nullptr));
 }
 
+// Streams data of uneven chunk sizes through relaying sockets, which exercises
+// partial writes of queued packets and the coalescing of short reads.
+TEST_F(LocalSocketTest, relay_bulk_transfer) {
+    const size_t TOTAL_SIZE = 8 * 1024 * 1024;
+    int fd_pair1[2];
+    int fd_pair2[2];
+    ASSERT_EQ(0, adb_socketpair(fd_pair1));
+    ASSERT_EQ(0, adb_socketpair(fd_pair2));
+    pthread_t thread;
+    ThreadArg thread_arg;
+    thread_arg.first_read_fd = fd_pair1[0];
+    thread_arg.last_write_fd = fd_pair2[1];
+    thread_arg.middle_pipe_count = 2;
+    thread_arg.coalesce_reads = true;
+    int writer = fd_pair1[1];
+    int reader = fd_pair2[0];
+
+    ASSERT_EQ(0, pthread_create(&thread, nullptr,
+                                reinterpret_cast<void* (*)(void*)>(FdEventThreadFunc),
+                                &thread_arg));
+
+    std::string data(TOTAL_SIZE, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 7 + i / 4096);
+    }
+    std::thread write_thread([&]() {
+        size_t offset = 0;
+        size_t chunk = 1;
+        while (offset < data.size()) {
+            size_t n = std::min(chunk, data.size() - offset);
+            ASSERT_TRUE(WriteFdExactly(writer, &data[offset], n));
+            offset += n;
+            chunk = (chunk * 31 + 17) % 65536 + 1;
+        }
+    });
+
+    std::string received(TOTAL_SIZE, 'a');
+    ASSERT_TRUE(ReadFdExactly(reader, &received[0], received.size()));
+    write_thread.join();
+    ASSERT_EQ(data, received);
+
+    ASSERT_EQ(0, adb_close(writer));
+    ASSERT_EQ(0, adb_close(reader));
+    // Wait until the local sockets are closed.
+    sleep(1);
+
+    ASSERT_EQ(0, pthread_kill(thread, SIGUSR1));
+    ASSERT_EQ(0, pthread_join(thread, nullptr));
+}
+
 struct CloseWithPacketArg {
     int socket_fd;
     size_t bytes_written;
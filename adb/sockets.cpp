@@ -25,6 +25,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#endif
+
 #include <algorithm>
 
 #if !ADB_HOST
@@ -133,55 +137,96 @@ restart:
     adb_mutex_unlock(&socket_list_lock);
 }
 
+// Maximum number of queued packets handed to a single writev(2).
+static constexpr int kMaxWritePackets = 16;
+
+// How long a relay socket that is streaming waits for a short read to fill
+// up before sending it anyway.
+static constexpr int64_t kCoalesceTimeoutMs = 1;
+
+/* Writes as much of the packet queue as the fd will take, releasing packets
+** as they are completed. Returns 0 once the queue is empty, 1 if the fd
+** would block, and -1 on a write error.
+*/
+static int local_socket_flush(asocket* s, int fd)
+{
+    while (s->pkt_first != nullptr) {
+        apacket* p = s->pkt_first;
+        if (p->len == 0) {
+            s->pkt_first = p->next;
+            put_apacket(p);
+            continue;
+        }
+
+#if !defined(_WIN32)
+        iovec iov[kMaxWritePackets];
+        int count = 0;
+        for (; p != nullptr && count < kMaxWritePackets; p = p->next) {
+            iov[count].iov_base = p->ptr;
+            iov[count].iov_len = p->len;
+            ++count;
+        }
+        int r = TEMP_FAILURE_RETRY(writev(fd, iov, count));
+#else
+        int r = adb_write(fd, p->ptr, p->len);
+#endif
+        if (r == -1 && errno == EAGAIN) {
+            return 1;
+        }
+        if (r <= 0) {
+            D("LS(%d): write failed, r=%d errno=%d: %s", s->id, r, errno, strerror(errno));
+            return -1;
+        }
+
+        size_t written = r;
+        while (written > 0) {
+            p = s->pkt_first;
+            size_t n = std::min<size_t>(written, p->len);
+            p->ptr += n;
+            p->len -= n;
+            written -= n;
+            if (p->len == 0) {
+                s->pkt_first = p->next;
+                put_apacket(p);
+            }
+        }
+    }
+    s->pkt_last = nullptr;
+    return 0;
+}
+
 static int local_socket_enqueue(asocket *s, apacket *p)
 {
     D("LS(%d): enqueue %d", s->id, p->len);
 
     p->ptr = p->data;
+    p->next = 0;
 
         /* if there is already data queue'd, we will receive
         ** events when it's time to write.  just add this to
         ** the tail
         */
     if(s->pkt_first) {
-        goto enqueue;
+        s->pkt_last->next = p;
+        s->pkt_last = p;
+        return 1; /* not ready (backlog) */
     }
+    s->pkt_first = p;
+    s->pkt_last = p;
 
         /* write as much as we can, until we
         ** would block or there is an error/eof
         */
-    while(p->len > 0) {
-        int r = adb_write(s->fd, p->ptr, p->len);
-        if(r > 0) {
-            p->len -= r;
-            p->ptr += r;
-            continue;
-        }
-        if((r == 0) || (errno != EAGAIN)) {
-            D( "LS(%d): not ready, errno=%d: %s", s->id, errno, strerror(errno) );
-            put_apacket(p);
-            s->has_write_error = true;
-            s->close(s);
-            return 1; /* not ready (error) */
-        } else {
-            break;
-        }
+    int r = local_socket_flush(s, s->fd);
+    if (r < 0) {
+        s->has_write_error = true;
+        s->close(s);
+        return 1; /* not ready (error) */
     }
-
-    if(p->len == 0) {
-        put_apacket(p);
+    if (r == 0) {
         return 0; /* ready for more data */
     }
 
-enqueue:
-    p->next = 0;
-    if(s->pkt_first) {
-        s->pkt_last->next = p;
-    } else {
-        s->pkt_first = p;
-    }
-    s->pkt_last = p;
-
         /* make sure we are notified when we can drain the queue */
     fdevent_add(&s->fde, FDE_WRITE);
 
@@ -215,6 +260,10 @@ static void local_socket_destroy(asocket  *s)
         */
     fdevent_remove(&s->fde);
 
+    if (s->coalesce_pkt) {
+        put_apacket(s->coalesce_pkt);
+    }
+
         /* dispose of any unwritten data */
     for(p = s->pkt_first; p; p = n) {
         D("LS(%d): discarding %d bytes", s->id, p->len);
@@ -274,6 +323,34 @@ static void local_socket_close_locked(asocket *s)
     CHECK_EQ(FDE_WRITE, s->fde.state & FDE_WRITE);
 }
 
+/* Reads from |fd| into |buf| until |size| bytes have been read in total, the
+** fd would block, or the stream ends. |*len| is advanced by the amount read.
+** Returns the result of the last adb_read.
+*/
+static int local_socket_read(asocket* s, int fd, unsigned char* buf, size_t size,
+                             size_t* len, int* is_eof)
+{
+    int r = 0;
+    while (*len < size) {
+        r = adb_read(fd, buf + *len, size - *len);
+        D("LS(%d): post adb_read(fd=%d,...) r=%d (errno=%d) len=%zu",
+          s->id, s->fd, r, r < 0 ? errno : 0, *len);
+        if (r == -1) {
+            if (errno == EAGAIN) {
+                break;
+            }
+        } else if (r > 0) {
+            *len += r;
+            continue;
+        }
+
+        /* r = 0 or unhandled error */
+        *is_eof = 1;
+        break;
+    }
+    return r;
+}
+
 static void local_socket_event_func(int fd, unsigned ev, void* _s)
 {
     asocket* s = reinterpret_cast<asocket*>(_s);
@@ -283,36 +360,18 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
     ** in order to simplify the code.
     */
     if (ev & FDE_WRITE) {
-        apacket* p;
-        while ((p = s->pkt_first) != nullptr) {
-            while (p->len > 0) {
-                int r = adb_write(fd, p->ptr, p->len);
-                if (r == -1) {
-                    /* returning here is ok because FDE_READ will
-                    ** be processed in the next iteration loop
-                    */
-                    if (errno == EAGAIN) {
-                        return;
-                    }
-                } else if (r > 0) {
-                    p->ptr += r;
-                    p->len -= r;
-                    continue;
-                }
-
-                D(" closing after write because r=%d and errno is %d", r, errno);
-                s->has_write_error = true;
-                s->close(s);
-                return;
-            }
-
-            if (p->len == 0) {
-                s->pkt_first = p->next;
-                if (s->pkt_first == 0) {
-                    s->pkt_last = 0;
-                }
-                put_apacket(p);
-            }
+        int r = local_socket_flush(s, fd);
+        if (r > 0) {
+            /* returning here is ok because FDE_READ will
+            ** be processed in the next iteration loop
+            */
+            return;
+        }
+        if (r < 0) {
+            D(" closing after write because errno is %d", errno);
+            s->has_write_error = true;
+            s->close(s);
+            return;
         }
 
         /* if we sent the last packet of a closing socket,
@@ -333,38 +392,51 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
     }
 
 
-    if (ev & FDE_READ) {
-        apacket *p = get_apacket();
-        unsigned char *x = p->data;
+    if (ev & (FDE_READ | FDE_TIMEOUT)) {
+        apacket *p = s->coalesce_pkt;
         const size_t max_payload = s->get_max_payload();
-        size_t avail = max_payload;
-        int r = 0;
+        size_t len = 0;
         int is_eof = 0;
+        int r = -1;
 
-        while (avail > 0) {
-            r = adb_read(fd, x, avail);
-            D("LS(%d): post adb_read(fd=%d,...) r=%d (errno=%d) avail=%zu",
-              s->id, s->fd, r, r < 0 ? errno : 0, avail);
-            if (r == -1) {
-                if (errno == EAGAIN) {
-                    break;
-                }
-            } else if (r > 0) {
-                avail -= r;
-                x += r;
-                continue;
-            }
+        if (p != nullptr) {
+            s->coalesce_pkt = nullptr;
+            len = p->len;
+        } else {
+            p = get_apacket();
+        }
+        if (ev & FDE_READ) {
+            r = local_socket_read(s, fd, p->data, max_payload, &len, &is_eof);
+        }
 
-            /* r = 0 or unhandled error */
-            is_eof = 1;
-            break;
+#if !defined(_WIN32)
+        /* a relay that has just sent a full packet is in the middle of a
+        ** bulk transfer. rather than paying a round trip for a sliver of
+        ** data, hold it back for a moment and let the sender fill this
+        ** packet too. the fdevent loop carries on with other sockets, and
+        ** calls us again when more arrives or the timeout goes off.
+        */
+        if (s->coalesce_reads && s->last_read_full && !(ev & FDE_TIMEOUT) &&
+            !is_eof && len > 0 && len < max_payload && s->peer != 0) {
+            if (p->len == 0) {
+                fdevent_set_timeout(&s->fde, kCoalesceTimeoutMs);
+            }
+            p->len = len;
+            s->coalesce_pkt = p;
+            return;
         }
-        D("LS(%d): fd=%d post avail loop. r=%d is_eof=%d forced_eof=%d",
-          s->id, s->fd, r, is_eof, s->fde.force_eof);
-        if ((avail == max_payload) || (s->peer == 0)) {
+        if (p->len != 0 && !(ev & FDE_TIMEOUT)) {
+            fdevent_set_timeout(&s->fde, -1);
+        }
+#endif
+
+        s->last_read_full = (len == max_payload);
+        D("LS(%d): fd=%d post read loop. r=%d len=%zu is_eof=%d forced_eof=%d",
+          s->id, s->fd, r, len, is_eof, s->fde.force_eof);
+        if ((len == 0) || (s->peer == 0)) {
             put_apacket(p);
         } else {
-            p->len = max_payload - avail;
+            p->len = len;
 
             // s->peer->enqueue() may call s->close() and free s,
             // so save variables for debug printing below.
@@ -445,6 +517,11 @@ asocket *create_local_service_socket(const char *name,
     asocket* s = create_local_socket(fd);
     D("LS(%d): bound to '%s' via %d", s->id, name, fd);
 
+    // The far end of a forward or reverse.
+    if (!strncmp(name, "tcp:", 4) || !strncmp(name, "local", 5)) {
+        s->coalesce_reads = true;
+    }
+
 #if !ADB_HOST
     char debug[PROPERTY_VALUE_MAX];
     if (!strncmp(name, "root:", 5))
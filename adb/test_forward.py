@@ -0,0 +1,121 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2015 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+"""Port forwarding throughput benchmark for the adb host server.
+
+An iperf-style measurement over a loopback transport: a private adb server is
+connected to a fake device (see test_scale.py), and bulk data is pushed
+through 'adb forward' into the device and pulled from the device into a
+host port the way 'adb reverse' delivers it. Reports throughput and server
+CPU for each direction, with both large writes and a trickle of small ones.
+"""
+from __future__ import print_function
+
+import argparse
+import socket
+import time
+
+import test_scale
+
+
+def report(name, length, seconds, cpu):
+    print('{:<28} {:8.1f} MB/s  server cpu {:5.1f}%'.format(
+        name, length / seconds / (1024 * 1024), cpu * 100 / seconds))
+
+
+def measure_forward(server, device, port, length, chunk_size):
+    server.run('-s', device.serial, 'forward', 'tcp:{}'.format(port),
+               'tcp:5001')
+    try:
+        sock = socket.create_connection(('127.0.0.1', port))
+        received_before = device.bytes_received
+        chunk = b'\x5a' * chunk_size
+        cpu_before = server.cpu_seconds()
+        start = time.time()
+        sent = 0
+        while sent < length:
+            sock.sendall(chunk)
+            sent += len(chunk)
+        while device.bytes_received - received_before < sent:
+            time.sleep(0.001)
+        seconds = time.time() - start
+        cpu = server.cpu_seconds() - cpu_before
+        sock.close()
+        return sent, seconds, cpu
+    finally:
+        server.run('-s', device.serial, 'forward', '--remove',
+                   'tcp:{}'.format(port), check=False)
+
+
+def measure_reverse(server, device, length):
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.bind(('127.0.0.1', 0))
+    listener.listen(1)
+    port = listener.getsockname()[1]
+
+    cpu_before = server.cpu_seconds()
+    start = time.time()
+    server.connect_service('source:{}:{}'.format(port, length),
+                           serial=device.serial).close()
+    conn, _ = listener.accept()
+    received = 0
+    while True:
+        data = conn.recv(1024 * 1024)
+        if not data:
+            break
+        received += len(data)
+    seconds = time.time() - start
+    cpu = server.cpu_seconds() - cpu_before
+    conn.close()
+    listener.close()
+    if received != length:
+        raise RuntimeError('received {} of {} bytes'.format(received, length))
+    return received, seconds, cpu
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--adb', default='adb', help='adb binary to test')
+    parser.add_argument('--megabytes', type=int, default=256,
+                        help='amount of data per run')
+    parser.add_argument('--server-port', type=int, default=5097,
+                        help='port for the adb server under test')
+    parser.add_argument('--forward-port', type=int, default=5098,
+                        help='host port to forward from')
+    args = parser.parse_args()
+
+    length = args.megabytes * 1024 * 1024
+    server = test_scale.Server(args.adb, args.server_port)
+    device = test_scale.FakeDevice()
+    try:
+        server.run('connect', device.serial)
+        server.run('-s', device.serial, 'wait-for-device')
+
+        for chunk_size in (1024 * 1024, 1024):
+            # Small writes are the case that coalescing is for, but they are
+            # slow to generate from Python, so send less data.
+            n = length if chunk_size >= 64 * 1024 else length // 16
+            report('forward, {} byte writes'.format(chunk_size),
+                   *measure_forward(server, device, args.forward_port, n,
+                                    chunk_size))
+        report('reverse', *measure_reverse(server, device, length))
+    finally:
+        device.close()
+        server.kill()
+
+
+if __name__ == '__main__':
+    main()
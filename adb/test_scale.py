@@ -0,0 +1,332 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2015 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+"""Scale benchmark for the adb host server.
+
+Starts a private adb server, connects it to hundreds of fake devices that
+listen on loopback, and reports how long common commands take and how much
+CPU the server burns while doing it. Each fake device speaks just enough of
+the adb protocol to come online and answer 'shell:' services.
+
+Only the server under test is touched: it runs on its own port, so any
+server you already have running is left alone. Linux only, since server CPU
+time comes from /proc.
+"""
+from __future__ import print_function
+
+import argparse
+import os
+import socket
+import struct
+import subprocess
+import threading
+import time
+
+A_CNXN = 0x4e584e43
+A_OPEN = 0x4e45504f
+A_OKAY = 0x59414b4f
+A_CLSE = 0x45534c43
+A_WRTE = 0x45545257
+A_VERSION = 0x01000000
+MAX_PAYLOAD = 256 * 1024
+
+BANNER = (b'device::ro.product.name=scale;ro.product.model=scale;'
+          b'ro.product.device=scale;features=')
+
+
+def send_packet(sock, command, arg0, arg1, data=b''):
+    checksum = sum(bytearray(data)) & 0xffffffff
+    header = struct.pack('<6I', command, arg0, arg1, len(data), checksum,
+                         command ^ 0xffffffff)
+    sock.sendall(header + data)
+
+
+def recv_exactly(sock, length):
+    buf = b''
+    while len(buf) < length:
+        chunk = sock.recv(length - len(buf))
+        if not chunk:
+            return None
+        buf += chunk
+    return buf
+
+
+def recv_packet(sock):
+    header = recv_exactly(sock, 24)
+    if header is None:
+        return None
+    command, arg0, arg1, length, _, _ = struct.unpack('<6I', header)
+    data = recv_exactly(sock, length) if length else b''
+    if data is None:
+        return None
+    return command, arg0, arg1, data
+
+
+class FakeDevice(object):
+    """A device that accepts one host connection on a loopback port.
+
+    'tcp:' services discard whatever is written to them, for measuring
+    forwarding throughput. 'source:<port>:<bytes>' makes the device open
+    'tcp:<port>' on the host and write that many bytes to it, the way a
+    reversed port would. Every other service echoes its name and closes.
+    """
+
+    def __init__(self):
+        self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.listener.bind(('127.0.0.1', 0))
+        self.listener.listen(1)
+        self.port = self.listener.getsockname()[1]
+        self.serial = '127.0.0.1:{}'.format(self.port)
+        self.bytes_received = 0
+        thread = threading.Thread(target=self._accept_loop)
+        thread.daemon = True
+        thread.start()
+
+    def _accept_loop(self):
+        while True:
+            try:
+                conn, _ = self.listener.accept()
+            except socket.error:
+                return
+            thread = threading.Thread(target=self._serve, args=(conn,))
+            thread.daemon = True
+            thread.start()
+
+    def _serve(self, conn):
+        next_id = 1
+        max_payload = MAX_PAYLOAD
+        sinks = set()
+        sources = {}  # local id -> bytes left to send
+        try:
+            while True:
+                packet = recv_packet(conn)
+                if packet is None:
+                    break
+                command, arg0, arg1, data = packet
+                if command == A_CNXN:
+                    max_payload = min(arg1, MAX_PAYLOAD)
+                    send_packet(conn, A_CNXN, A_VERSION, MAX_PAYLOAD, BANNER)
+                elif command == A_OPEN:
+                    local_id = next_id
+                    next_id += 1
+                    service = data.rstrip(b'\0')
+                    send_packet(conn, A_OKAY, local_id, arg0)
+                    if service.startswith(b'tcp:'):
+                        sinks.add(local_id)
+                        continue
+                    send_packet(conn, A_WRTE, local_id, arg0, service + b'\n')
+                    send_packet(conn, A_CLSE, local_id, arg0)
+                    if service.startswith(b'source:'):
+                        _, port, length = service.split(b':')
+                        source_id = next_id
+                        next_id += 1
+                        sources[source_id] = int(length)
+                        send_packet(conn, A_OPEN, source_id, 0,
+                                    b'tcp:' + port + b'\0')
+                elif command == A_WRTE and arg1 in sinks:
+                    self.bytes_received += len(data)
+                    send_packet(conn, A_OKAY, arg1, arg0)
+                elif command == A_OKAY and arg1 in sources:
+                    # The host is ready for the next packet.
+                    left = sources[arg1]
+                    if left == 0:
+                        del sources[arg1]
+                        send_packet(conn, A_CLSE, arg1, arg0)
+                        continue
+                    n = min(left, max_payload)
+                    sources[arg1] = left - n
+                    send_packet(conn, A_WRTE, arg1, arg0, b'\xa5' * n)
+                elif command == A_CLSE:
+                    sinks.discard(arg1)
+                    sources.pop(arg1, None)
+        except socket.error:
+            pass
+        finally:
+            conn.close()
+
+    def close(self):
+        self.listener.close()
+
+
+class Server(object):
+    """A private adb server on its own port."""
+
+    def __init__(self, adb, port):
+        self.adb = adb
+        self.port = port
+        self.env = dict(os.environ, ANDROID_ADB_SERVER_PORT=str(port))
+        self.run('kill-server', check=False)
+        self.run('start-server')
+        self.pid = self._find_pid()
+
+    def run(self, *args, **kwargs):
+        check = kwargs.get('check', True)
+        cmd = [self.adb] + list(args)
+        p = subprocess.Popen(cmd, env=self.env, stdout=subprocess.PIPE,
+                             stderr=subprocess.STDOUT)
+        out, _ = p.communicate()
+        if check and p.returncode != 0:
+            raise RuntimeError('{} failed: {}'.format(' '.join(cmd), out))
+        return out
+
+    def _find_pid(self):
+        port = str(self.port).encode()
+        for pid in os.listdir('/proc'):
+            if not pid.isdigit():
+                continue
+            try:
+                with open('/proc/{}/cmdline'.format(pid), 'rb') as f:
+                    args = f.read().split(b'\0')
+                with open('/proc/{}/environ'.format(pid), 'rb') as f:
+                    environ = f.read().split(b'\0')
+            except (IOError, OSError):
+                continue
+            if (b'fork-server' in args and
+                    b'ANDROID_ADB_SERVER_PORT=' + port in environ):
+                return int(pid)
+        raise RuntimeError('could not find the adb server process')
+
+    def cpu_seconds(self):
+        with open('/proc/{}/stat'.format(self.pid)) as f:
+            # The command name may contain spaces, so split after it.
+            fields = f.read().rsplit(')', 1)[1].split()
+        utime, stime = int(fields[11]), int(fields[12])
+        return float(utime + stime) / os.sysconf('SC_CLK_TCK')
+
+    def connect_service(self, service, serial=None):
+        sock = socket.create_connection(('127.0.0.1', self.port))
+        services = [service]
+        if serial is not None:
+            services.insert(0, 'host:transport:' + serial)
+        for service in services:
+            sock.sendall('{:04x}{}'.format(len(service), service).encode())
+            if recv_exactly(sock, 4) != b'OKAY':
+                raise RuntimeError('{} refused'.format(service))
+        return sock
+
+    def kill(self):
+        self.run('kill-server', check=False)
+
+
+class DeviceTracker(object):
+    """Counts the updates a 'host:track-devices' client receives."""
+
+    def __init__(self, server):
+        self.sock = server.connect_service('host:track-devices')
+        self.updates = 0
+        self.online = 0
+        self.cv = threading.Condition()
+        thread = threading.Thread(target=self._read_loop)
+        thread.daemon = True
+        thread.start()
+
+    def _read_loop(self):
+        while True:
+            length = recv_exactly(self.sock, 4)
+            if length is None:
+                return
+            body = recv_exactly(self.sock, int(length, 16)) or b''
+            with self.cv:
+                self.updates += 1
+                self.online = body.count(b'\tdevice\n')
+                self.cv.notify_all()
+
+    def wait_for_online(self, count, timeout):
+        deadline = time.time() + timeout
+        with self.cv:
+            while self.online < count and time.time() < deadline:
+                self.cv.wait(deadline - time.time())
+            return self.online >= count
+
+
+def percentile(samples, fraction):
+    ordered = sorted(samples)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * fraction))]
+
+
+def measure(server, name, args_for, iterations):
+    latencies = []
+    cpu_before = server.cpu_seconds()
+    for i in range(iterations):
+        start = time.time()
+        server.run(*args_for(i))
+        latencies.append((time.time() - start) * 1000)
+    cpu = server.cpu_seconds() - cpu_before
+    print('{:<28} p50 {:7.2f} ms  p90 {:7.2f} ms  max {:7.2f} ms  '
+          'server cpu {:6.2f} ms/op'.format(
+              name, percentile(latencies, 0.5), percentile(latencies, 0.9),
+              max(latencies), cpu * 1000 / iterations))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--adb', default='adb', help='adb binary to test')
+    parser.add_argument('--devices', type=int, default=200,
+                        help='number of fake devices')
+    parser.add_argument('--iterations', type=int, default=50,
+                        help='runs of each command')
+    parser.add_argument('--server-port', type=int, default=5097,
+                        help='port for the adb server under test')
+    args = parser.parse_args()
+
+    server = Server(args.adb, args.server_port)
+    devices = []
+    try:
+        tracker = DeviceTracker(server)
+        devices = [FakeDevice() for _ in range(args.devices)]
+
+        cpu_before = server.cpu_seconds()
+        start = time.time()
+        for device in devices:
+            server.run('connect', device.serial)
+        if not tracker.wait_for_online(len(devices), 60):
+            raise RuntimeError('only {} of {} devices came online'.format(
+                tracker.online, len(devices)))
+        print('connected {} devices in {:.2f} s, server cpu {:.2f} s, '
+              '{} track-devices updates'.format(
+                  len(devices), time.time() - start,
+                  server.cpu_seconds() - cpu_before, tracker.updates))
+
+        # Spread lookups over the whole list so that list position matters.
+        def pick(i):
+            return devices[(i * 7919) % len(devices)].serial
+
+        measure(server, 'devices', lambda i: ['devices'], args.iterations)
+        measure(server, 'get-state -s', lambda i: ['-s', pick(i), 'get-state'],
+                args.iterations)
+        measure(server, 'shell -s', lambda i: ['-s', pick(i), 'shell', 'x'],
+                args.iterations)
+
+        updates_before = tracker.updates
+        cpu_before = server.cpu_seconds()
+        start = time.time()
+        server.run('disconnect')
+        deadline = time.time() + 60
+        while server.run('devices').count(b'\tdevice') and time.time() < deadline:
+            time.sleep(0.1)
+        print('disconnected everything in {:.2f} s, server cpu {:.2f} s, '
+              '{} track-devices updates'.format(
+                  time.time() - start, server.cpu_seconds() - cpu_before,
+                  tracker.updates - updates_before))
+    finally:
+        for device in devices:
+            device.close()
+        server.kill()
+
+
+if __name__ == '__main__':
+    main()
@@ -28,6 +28,8 @@
 
 #include <algorithm>
 #include <list>
+#include <unordered_map>
+#include <vector>
 
 #include <base/logging.h>
 #include <base/stringprintf.h>
@@ -41,8 +43,57 @@ static void transport_unref(atransport *t);
 static std::list<atransport*> transport_list;
 static std::list<atransport*> pending_list;
 
+// Indexes over the lists above so that lookups don't have to walk every
+// transport. All of them are protected by transport_lock, and must only be
+// changed through the transport_list_* and pending_list_* helpers below.
+// Serials aren't guaranteed to be unique (cheap devices often share one), so
+// these are multimaps.
+static std::unordered_map<atransport*, std::list<atransport*>::iterator> transport_positions;
+static std::unordered_multimap<std::string, atransport*> transports_by_serial;
+static std::unordered_multimap<std::string, atransport*> transports_by_devpath;
+static std::unordered_multimap<std::string, atransport*> pending_by_serial;
+
 ADB_MUTEX_DEFINE( transport_lock );
 
+template <typename Map>
+static void index_erase(Map* map, const char* key, atransport* t) {
+    if (key == nullptr) return;
+    auto range = map->equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == t) {
+            map->erase(it);
+            return;
+        }
+    }
+}
+
+/* Only call these functions if you already hold transport_lock. */
+static void pending_list_add_locked(atransport* t) {
+    pending_list.push_front(t);
+    if (t->serial) pending_by_serial.emplace(t->serial, t);
+}
+
+static void pending_list_remove_locked(atransport* t) {
+    pending_list.remove(t);
+    index_erase(&pending_by_serial, t->serial, t);
+}
+
+static void transport_list_add_locked(atransport* t) {
+    transport_list.push_front(t);
+    transport_positions[t] = transport_list.begin();
+    if (t->serial) transports_by_serial.emplace(t->serial, t);
+    if (t->devpath) transports_by_devpath.emplace(t->devpath, t);
+}
+
+static void transport_list_remove_locked(atransport* t) {
+    auto it = transport_positions.find(t);
+    if (it == transport_positions.end()) return;
+    transport_list.erase(it->second);
+    transport_positions.erase(it);
+    index_erase(&transports_by_serial, t->serial, t);
+    index_erase(&transports_by_devpath, t->devpath, t);
+}
+
 const char* const kFeatureShell2 = "shell_v2";
 const char* const kFeatureCmd = "cmd";
 
@@ -417,9 +468,34 @@ create_device_tracker(void)
 }
 
 
-// Call this function each time the transport list has changed.
-void update_transports() {
+/* Updates to the trackers are batched: update_transports() only wakes up the
+ * fdevent loop, and the list is sent once after every registration, state
+ * change and removal that was already queued has been handled. When hundreds
+ * of devices connect at once this sends one list instead of one per device.
+ */
+static fdevent update_fde;
+static int update_send_fd = -1;
+static int update_recv_fd = -1;
+static bool update_pending;
+static std::string last_transports;
+
+static void update_transports_func(int fd, unsigned ev, void*) {
+    if (!(ev & FDE_READ)) {
+        return;
+    }
+
+    char buf[64];
+    if (adb_read(fd, buf, sizeof(buf)) < 0) {
+        fatal_errno("cannot read transport update socket");
+    }
+    update_pending = false;
+
+    // Nothing to tell anyone if all that happened cancelled out.
     std::string transports = list_transports(false);
+    if (transports == last_transports) {
+        return;
+    }
+    last_transports = transports;
 
     device_tracker* tracker = device_tracker_list;
     while (tracker != nullptr) {
@@ -430,6 +506,31 @@ void update_transports() {
     }
 }
 
+static void init_transport_updates() {
+    int s[2];
+    if (adb_socketpair(s)) {
+        fatal_errno("cannot open transport update socketpair");
+    }
+    update_send_fd = s[0];
+    update_recv_fd = s[1];
+
+    fdevent_install(&update_fde, update_recv_fd, update_transports_func, nullptr);
+    fdevent_set(&update_fde, FDE_READ);
+}
+
+// Call this function each time the transport list has changed.
+void update_transports() {
+    if (update_pending || update_send_fd == -1) {
+        return;
+    }
+    update_pending = true;
+
+    char c = 0;
+    if (adb_write(update_send_fd, &c, 1) != 1) {
+        fatal_errno("cannot write transport update socket");
+    }
+}
+
 #else
 
 void update_transports() {
@@ -510,7 +611,7 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
         adb_close(t->fd);
 
         adb_mutex_lock(&transport_lock);
-        transport_list.remove(t);
+        transport_list_remove_locked(t);
         adb_mutex_unlock(&transport_lock);
 
         if (t->product)
@@ -561,8 +662,8 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
     }
 
     adb_mutex_lock(&transport_lock);
-    pending_list.remove(t);
-    transport_list.push_front(t);
+    pending_list_remove_locked(t);
+    transport_list_add_locked(t);
     adb_mutex_unlock(&transport_lock);
 
     update_transports();
@@ -586,6 +687,10 @@ void init_transport_registration(void)
                     0);
 
     fdevent_set(&transport_registration_fde, FDE_READ);
+
+#if ADB_HOST
+    init_transport_updates();
+#endif
 }
 
 /* the fdevent select pump is single threaded */
@@ -657,6 +762,59 @@ static int qual_match(const char *to_test,
     return !*to_test;
 }
 
+static atransport* check_acquired_transport(atransport* result, std::string* error_out) {
+    // Don't return unauthorized devices; the caller can't do anything with them.
+    if (result && result->connection_state == kCsUnauthorized) {
+        *error_out = "device unauthorized.\n";
+        char* ADB_VENDOR_KEYS = getenv("ADB_VENDOR_KEYS");
+        *error_out += "This adb server's $ADB_VENDOR_KEYS is ";
+        *error_out += ADB_VENDOR_KEYS ? ADB_VENDOR_KEYS : "not set";
+        *error_out += "\n";
+        *error_out += "Try 'adb kill-server' if that seems wrong.\n";
+        *error_out += "Otherwise check for a confirmation dialog on your device.";
+        result = nullptr;
+    }
+
+    // Don't return offline devices; the caller can't do anything with them.
+    if (result && result->connection_state == kCsOffline) {
+        *error_out = "device offline";
+        result = nullptr;
+    }
+
+    if (result) {
+        *error_out = "success";
+    }
+
+    return result;
+}
+
+// Looks up |serial| as an exact serial number or devpath using the indexes.
+// Returns false if no accessible transport matched, in which case the caller
+// has to scan the whole list (the error it reports depends on what else is
+// connected).
+static bool acquire_by_serial_locked(const char* serial, atransport** result,
+                                     bool* is_ambiguous, std::string* error_out) {
+    atransport* match = nullptr;
+    for (const auto* index : {&transports_by_serial, &transports_by_devpath}) {
+        auto range = index->equal_range(serial);
+        for (auto it = range.first; it != range.second; ++it) {
+            atransport* t = it->second;
+            if (t->connection_state == kCsNoPerm || t == match) {
+                continue;
+            }
+            if (match) {
+                *error_out = "more than one device";
+                if (is_ambiguous) *is_ambiguous = true;
+                *result = nullptr;
+                return true;
+            }
+            match = t;
+        }
+    }
+    *result = match;
+    return match != nullptr;
+}
+
 atransport* acquire_one_transport(TransportType type, const char* serial,
                                   bool* is_ambiguous, std::string* error_out) {
     atransport* result = nullptr;
@@ -672,6 +830,15 @@ atransport* acquire_one_transport(TransportType type, const char* serial,
     }
 
     adb_mutex_lock(&transport_lock);
+    // Qualified names (product:, model:, device:) can only be resolved by
+    // checking every transport, but plain serials are the common case.
+    bool qualified = serial && (*serial == '\0' || !strncmp(serial, "product:", 8) ||
+                                !strncmp(serial, "model:", 6) || !strncmp(serial, "device:", 7));
+    if (serial && !qualified && acquire_by_serial_locked(serial, &result, is_ambiguous, error_out)) {
+        adb_mutex_unlock(&transport_lock);
+        return check_acquired_transport(result, error_out);
+    }
+
     for (const auto& t : transport_list) {
         if (t->connection_state == kCsNoPerm) {
             *error_out = "insufficient permissions for device";
@@ -723,31 +890,10 @@ atransport* acquire_one_transport(TransportType type, const char* serial,
     }
     adb_mutex_unlock(&transport_lock);
 
-    // Don't return unauthorized devices; the caller can't do anything with them.
-    if (result && result->connection_state == kCsUnauthorized) {
-        *error_out = "device unauthorized.\n";
-        char* ADB_VENDOR_KEYS = getenv("ADB_VENDOR_KEYS");
-        *error_out += "This adb server's $ADB_VENDOR_KEYS is ";
-        *error_out += ADB_VENDOR_KEYS ? ADB_VENDOR_KEYS : "not set";
-        *error_out += "\n";
-        *error_out += "Try 'adb kill-server' if that seems wrong.\n";
-        *error_out += "Otherwise check for a confirmation dialog on your device.";
-        result = nullptr;
-    }
-
-    // Don't return offline devices; the caller can't do anything with them.
-    if (result && result->connection_state == kCsOffline) {
-        *error_out = "device offline";
-        result = nullptr;
-    }
-
-    if (result) {
-        *error_out = "success";
-    }
-
-    return result;
+    return check_acquired_transport(result, error_out);
 }
 
+
 const char* atransport::connection_state_name() const {
     switch (connection_state) {
     case kCsOffline: return "offline";
@@ -915,24 +1061,14 @@ int register_socket_transport(int s, const char *serial, int port, int local) {
     }
 
     adb_mutex_lock(&transport_lock);
-    for (const auto& transport : pending_list) {
-        if (transport->serial && strcmp(serial, transport->serial) == 0) {
-            adb_mutex_unlock(&transport_lock);
-            delete t;
-            return -1;
-        }
-    }
-
-    for (const auto& transport : transport_list) {
-        if (transport->serial && strcmp(serial, transport->serial) == 0) {
-            adb_mutex_unlock(&transport_lock);
-            delete t;
-            return -1;
-        }
+    if (pending_by_serial.count(serial) || transports_by_serial.count(serial)) {
+        adb_mutex_unlock(&transport_lock);
+        delete t;
+        return -1;
     }
 
-    pending_list.push_front(t);
     t->serial = strdup(serial);
+    pending_list_add_locked(t);
     adb_mutex_unlock(&transport_lock);
 
     register_transport(t);
@@ -944,11 +1080,9 @@ atransport *find_transport(const char *serial) {
     atransport* result = nullptr;
 
     adb_mutex_lock(&transport_lock);
-    for (auto& t : transport_list) {
-        if (t->serial && strcmp(serial, t->serial) == 0) {
-            result = t;
-            break;
-        }
+    auto it = transports_by_serial.find(serial);
+    if (it != transports_by_serial.end()) {
+        result = it->second;
     }
     adb_mutex_unlock(&transport_lock);
 
@@ -988,7 +1122,7 @@ void register_usb_transport(usb_handle* usb, const char* serial,
     }
 
     adb_mutex_lock(&transport_lock);
-    pending_list.push_front(t);
+    pending_list_add_locked(t);
     adb_mutex_unlock(&transport_lock);
 
     register_transport(t);
@@ -997,9 +1131,15 @@ void register_usb_transport(usb_handle* usb, const char* serial,
 // This should only be used for transports with connection_state == kCsNoPerm.
 void unregister_usb_transport(usb_handle *usb) {
     adb_mutex_lock(&transport_lock);
-    transport_list.remove_if([usb](atransport* t) {
-        return t->usb == usb && t->connection_state == kCsNoPerm;
-    });
+    std::vector<atransport*> matches;
+    for (const auto& t : transport_list) {
+        if (t->usb == usb && t->connection_state == kCsNoPerm) {
+            matches.push_back(t);
+        }
+    }
+    for (const auto& t : matches) {
+        transport_list_remove_locked(t);
+    }
     adb_mutex_unlock(&transport_lock);
 }
 
@@ -38,6 +38,7 @@
 #include <list>
 #include <mutex>
 #include <string>
+#include <thread>
 
 #include <base/file.h>
 #include <base/stringprintf.h>
@@ -45,6 +46,7 @@
 
 #include "adb.h"
 #include "transport.h"
+#include "usb_linux_urb.h"
 
 using namespace std::literals;
 
@@ -64,11 +66,13 @@ struct usb_handle {
     unsigned zero_mask;
     unsigned writeable = 1;
 
-    usbdevfs_urb urb_in;
-    usbdevfs_urb urb_out;
+    std::unique_ptr<UsbdevfsFd> usbdevfs;
+    std::unique_ptr<UrbQueue> urbs;
+
+    // Reaps URBs for |urbs| until the device is kicked or disconnected.
+    std::thread reaper;
+    bool reaper_done = false;
 
-    bool urb_in_busy = false;
-    bool urb_out_busy = false;
     bool dead = false;
 
     std::condition_variable cv;
@@ -76,9 +80,6 @@ struct usb_handle {
 
     // for garbage collecting disconnected devices
     bool mark;
-
-    // ID of thread currently in REAPURB
-    pthread_t reaper_thread = 0;
 };
 
 static std::mutex g_usb_handles_mutex;
@@ -293,127 +294,40 @@ static void find_usb_device(const std::string& base,
     }
 }
 
-static int usb_bulk_write(usb_handle* h, const void* data, int len) {
-    std::unique_lock<std::mutex> lock(h->mutex);
-    D("++ usb_bulk_write ++");
-
-    usbdevfs_urb* urb = &h->urb_out;
-    memset(urb, 0, sizeof(*urb));
-    urb->type = USBDEVFS_URB_TYPE_BULK;
-    urb->endpoint = h->ep_out;
-    urb->status = -1;
-    urb->buffer = const_cast<void*>(data);
-    urb->buffer_length = len;
-
-    if (h->dead) {
-        errno = EINVAL;
-        return -1;
-    }
-
-    if (TEMP_FAILURE_RETRY(ioctl(h->fd, USBDEVFS_SUBMITURB, urb)) == -1) {
-        return -1;
-    }
-
-    h->urb_out_busy = true;
-    while (true) {
-        auto now = std::chrono::system_clock::now();
-        if (h->cv.wait_until(lock, now + 5s) == std::cv_status::timeout || h->dead) {
-            // TODO: call USBDEVFS_DISCARDURB?
-            errno = ETIMEDOUT;
-            return -1;
-        }
-        if (!h->urb_out_busy) {
-            if (urb->status != 0) {
-                errno = -urb->status;
-                return -1;
-            }
-            return urb->actual_length;
-        }
-    }
+static size_t urb_depth(const char* env, size_t default_depth) {
+    const char* value = getenv(env);
+    if (value == nullptr) return default_depth;
+    char* end;
+    unsigned long depth = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || depth == 0) return default_depth;
+    return depth;
 }
 
-static int usb_bulk_read(usb_handle* h, void* data, int len) {
-    std::unique_lock<std::mutex> lock(h->mutex);
-    D("++ usb_bulk_read ++");
-
-    usbdevfs_urb* urb = &h->urb_in;
-    memset(urb, 0, sizeof(*urb));
-    urb->type = USBDEVFS_URB_TYPE_BULK;
-    urb->endpoint = h->ep_in;
-    urb->status = -1;
-    urb->buffer = data;
-    urb->buffer_length = len;
-
-    if (h->dead) {
-        errno = EINVAL;
-        return -1;
-    }
-
-    if (TEMP_FAILURE_RETRY(ioctl(h->fd, USBDEVFS_SUBMITURB, urb)) == -1) {
-        return -1;
+static void reaper_thread(usb_handle* h) {
+    adb_thread_setname("usb reaper");
+    D("[ reaper started for %s ]", h->path.c_str());
+    while (h->urbs->Reap()) {
     }
+    D("[ reaper exiting for %s ]", h->path.c_str());
 
-    h->urb_in_busy = true;
-    while (true) {
-        D("[ reap urb - wait ]");
-        h->reaper_thread = pthread_self();
-        int fd = h->fd;
-        lock.unlock();
-
-        // This ioctl must not have TEMP_FAILURE_RETRY because we send SIGALRM to break out.
-        usbdevfs_urb* out = nullptr;
-        int res = ioctl(fd, USBDEVFS_REAPURB, &out);
-        int saved_errno = errno;
-
-        lock.lock();
-        h->reaper_thread = 0;
-        if (h->dead) {
-            errno = EINVAL;
-            return -1;
-        }
-        if (res < 0) {
-            if (saved_errno == EINTR) {
-                continue;
-            }
-            D("[ reap urb - error ]");
-            errno = saved_errno;
-            return -1;
-        }
-        D("[ urb @%p status = %d, actual = %d ]", out, out->status, out->actual_length);
-
-        if (out == &h->urb_in) {
-            D("[ reap urb - IN complete ]");
-            h->urb_in_busy = false;
-            if (urb->status != 0) {
-                errno = -urb->status;
-                return -1;
-            }
-            return urb->actual_length;
-        }
-        if (out == &h->urb_out) {
-            D("[ reap urb - OUT compelete ]");
-            h->urb_out_busy = false;
-            h->cv.notify_all();
-        }
-    }
+    std::lock_guard<std::mutex> lock(h->mutex);
+    h->reaper_done = true;
+    h->cv.notify_all();
 }
 
-
 int usb_write(usb_handle *h, const void *_data, int len)
 {
     D("++ usb_write ++");
 
-    unsigned char *data = (unsigned char*) _data;
-    int n = usb_bulk_write(h, data, len);
-    if (n != len) {
-        D("ERROR: n = %d, errno = %d (%s)", n, errno, strerror(errno));
+    if (h->urbs->Write(_data, len) != 0) {
+        D("ERROR: errno = %d (%s)", errno, strerror(errno));
         return -1;
     }
 
     if (h->zero_mask && !(len & h->zero_mask)) {
         // If we need 0-markers and our transfer is an even multiple of the packet size,
         // then send a zero marker.
-        return usb_bulk_write(h, _data, 0);
+        return h->urbs->Write(_data, 0);
     }
 
     D("-- usb_write --");
@@ -422,34 +336,12 @@ int usb_write(usb_handle *h, const void *_data, int len)
 
 int usb_read(usb_handle *h, void *_data, int len)
 {
-    unsigned char *data = (unsigned char*) _data;
-    int n;
-
     D("++ usb_read ++");
-    while(len > 0) {
-        int xfer = len;
-
-        D("[ usb read %d fd = %d], path=%s", xfer, h->fd, h->path.c_str());
-        n = usb_bulk_read(h, data, xfer);
-        D("[ usb read %d ] = %d, path=%s", xfer, n, h->path.c_str());
-        if(n != xfer) {
-            if((errno == ETIMEDOUT) && (h->fd != -1)) {
-                D("[ timeout ]");
-                if(n > 0){
-                    data += n;
-                    len -= n;
-                }
-                continue;
-            }
-            D("ERROR: n = %d, errno = %d (%s)",
-                n, errno, strerror(errno));
-            return -1;
-        }
-
-        len -= xfer;
-        data += xfer;
+    D("[ usb read %d fd = %d], path=%s", len, h->fd, h->path.c_str());
+    if (h->urbs->Read(_data, len) != 0) {
+        D("ERROR: errno = %d (%s)", errno, strerror(errno));
+        return -1;
     }
-
     D("-- usb_read --");
     return 0;
 }
@@ -461,26 +353,17 @@ void usb_kick(usb_handle* h) {
         h->dead = true;
 
         if (h->writeable) {
+            // Discarding every in-flight URB hands them all back to the
+            // reaper and wakes up anyone blocked in usb_read/usb_write.
+            h->urbs->Kick();
+
             /* HACK ALERT!
             ** Sometimes we get stuck in ioctl(USBDEVFS_REAPURB).
             ** This is a workaround for that problem.
             */
-            if (h->reaper_thread) {
-                pthread_kill(h->reaper_thread, SIGALRM);
+            if (!h->reaper_done) {
+                pthread_kill(h->reaper.native_handle(), SIGALRM);
             }
-
-            /* cancel any pending transactions
-            ** these will quietly fail if the txns are not active,
-            ** but this ensures that a reader blocked on REAPURB
-            ** will get unblocked
-            */
-            ioctl(h->fd, USBDEVFS_DISCARDURB, &h->urb_in);
-            ioctl(h->fd, USBDEVFS_DISCARDURB, &h->urb_out);
-            h->urb_in.status = -ENODEV;
-            h->urb_out.status = -ENODEV;
-            h->urb_in_busy = false;
-            h->urb_out_busy = false;
-            h->cv.notify_all();
         } else {
             unregister_usb_transport(h);
         }
@@ -488,11 +371,27 @@ void usb_kick(usb_handle* h) {
 }
 
 int usb_close(usb_handle* h) {
-    std::lock_guard<std::mutex> lock(g_usb_handles_mutex);
-    g_usb_handles.remove(h);
+    {
+        std::lock_guard<std::mutex> lock(g_usb_handles_mutex);
+        g_usb_handles.remove(h);
+    }
 
     D("-- usb close %p (fd = %d) --", h, h->fd);
 
+    if (h->reaper.joinable()) {
+        // The URB buffers must outlive the reaper. Keep poking it in case our
+        // first SIGALRM arrived before it entered REAPURB.
+        h->urbs->Kick();
+        {
+            std::unique_lock<std::mutex> lock(h->mutex);
+            while (!h->reaper_done) {
+                pthread_kill(h->reaper.native_handle(), SIGALRM);
+                h->cv.wait_for(lock, 100ms);
+            }
+        }
+        h->reaper.join();
+    }
+
     delete h;
 
     return 0;
@@ -562,6 +461,17 @@ static void register_device(const char* dev_name, const char* dev_path,
     }
     serial = android::base::Trim(serial);
 
+    if (usb->writeable) {
+        usb->usbdevfs.reset(new UsbdevfsFd(usb->fd));
+        usb->urbs.reset(new UrbQueue(usb->usbdevfs.get(), usb->ep_in, usb->ep_out,
+                                     urb_depth("ADB_USB_OUT_URBS", UrbQueue::kDefaultOutDepth)));
+        if (!usb->urbs->Start()) {
+            D("[ usb %s: failed to queue initial read: %s ]", usb->path.c_str(), strerror(errno));
+            return;
+        }
+        usb->reaper = std::thread(reaper_thread, usb.get());
+    }
+
     // Add to the end of the active handles.
     usb_handle* done_usb = usb.release();
     {
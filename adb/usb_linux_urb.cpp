@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG USB
+
+#include "sysdeps.h"
+
+#include "usb_linux_urb.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "adb.h"
+
+using namespace std::literals;
+
+int UsbdevfsFd::SubmitUrb(usbdevfs_urb* urb) {
+    return TEMP_FAILURE_RETRY(ioctl(fd_, USBDEVFS_SUBMITURB, urb));
+}
+
+int UsbdevfsFd::ReapUrb(usbdevfs_urb** urb) {
+    // This ioctl must not have TEMP_FAILURE_RETRY because we send SIGALRM to break out.
+    return ioctl(fd_, USBDEVFS_REAPURB, urb);
+}
+
+int UsbdevfsFd::DiscardUrb(usbdevfs_urb* urb) {
+    return ioctl(fd_, USBDEVFS_DISCARDURB, urb);
+}
+
+UrbQueue::UrbQueue(Usbdevfs* usbdevfs, unsigned char ep_in, unsigned char ep_out,
+                   size_t out_depth)
+    : usbdevfs_(usbdevfs), ep_in_(ep_in), ep_out_(ep_out) {
+    out_depth = std::max<size_t>(out_depth, 1);
+
+    for (size_t i = 0; i < kInUrbs; ++i) {
+        in_urbs_.emplace_back(new Urb);
+        in_urbs_.back()->is_in = true;
+        in_free_.push_back(in_urbs_.back().get());
+    }
+    for (size_t i = 0; i < out_depth; ++i) {
+        out_urbs_.emplace_back(new Urb);
+        out_urbs_.back()->is_in = false;
+        out_free_.push_back(out_urbs_.back().get());
+    }
+}
+
+UrbQueue::~UrbQueue() {
+}
+
+bool UrbQueue::Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    SubmitInLocked();
+    return in_error_ == 0;
+}
+
+bool UrbQueue::dead() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dead_;
+}
+
+bool UrbQueue::SubmitLocked(Urb* u, unsigned char endpoint, const void* data, size_t length) {
+    u->buffer.resize(length);
+    u->consumed = 0;
+    if (data != nullptr && length > 0) {
+        memcpy(u->buffer.data(), data, length);
+    }
+
+    usbdevfs_urb* urb = &u->urb;
+    memset(urb, 0, sizeof(*urb));
+    urb->type = USBDEVFS_URB_TYPE_BULK;
+    urb->endpoint = endpoint;
+    urb->status = -1;
+    urb->buffer = u->buffer.data();
+    urb->buffer_length = length;
+    urb->usercontext = u;
+
+    if (usbdevfs_->SubmitUrb(urb) == -1) {
+        D("[ submit urb failed: %s ]", strerror(errno));
+        return false;
+    }
+    u->in_flight = true;
+    ++in_flight_;
+    return true;
+}
+
+// Keeps the IN pipe as full as the protocol allows: a pending payload can be
+// queued immediately, followed by the next header. Anything after a header has
+// to wait for it to complete.
+void UrbQueue::SubmitInLocked() {
+    while (!dead_ && in_error_ == 0 && !in_header_pending_ && !in_free_.empty()) {
+        Urb* u = in_free_.back();
+        bool is_header = (in_next_payload_ == 0);
+        size_t length = is_header ? sizeof(amessage) : in_next_payload_;
+
+        if (!SubmitLocked(u, ep_in_, nullptr, length)) {
+            in_error_ = errno;
+            cv_.notify_all();
+            return;
+        }
+        in_free_.pop_back();
+        u->is_header = is_header;
+        if (is_header) {
+            in_header_pending_ = true;
+        } else {
+            in_next_payload_ = 0;
+        }
+    }
+}
+
+void UrbQueue::CompleteInLocked(Urb* u) {
+    usbdevfs_urb* urb = &u->urb;
+    D("[ reap urb - IN complete, status = %d, actual = %d ]", urb->status, urb->actual_length);
+
+    if (u->is_header) {
+        in_header_pending_ = false;
+    }
+
+    // Once the stream is broken, drop everything that is still in flight.
+    if (in_error_ != 0 || dead_) {
+        in_free_.push_back(u);
+        cv_.notify_all();
+        return;
+    }
+
+    if (urb->status != 0) {
+        in_error_ = -urb->status;
+        in_free_.push_back(u);
+    } else if (urb->actual_length != urb->buffer_length) {
+        D("[ short IN transfer: %d of %d ]", urb->actual_length, urb->buffer_length);
+        in_error_ = EIO;
+        in_free_.push_back(u);
+    } else {
+        in_done_.push_back(u);
+        if (u->is_header) {
+            const amessage* msg = reinterpret_cast<const amessage*>(u->buffer.data());
+            if (msg->data_length > MAX_PAYLOAD) {
+                // Deliver the header so that check_header() reports it, but
+                // there is no sensible way to size the payload transfer.
+                in_error_ = EPROTO;
+            } else {
+                in_next_payload_ = msg->data_length;
+            }
+        }
+        SubmitInLocked();
+    }
+    cv_.notify_all();
+}
+
+void UrbQueue::CompleteOutLocked(Urb* u) {
+    usbdevfs_urb* urb = &u->urb;
+    D("[ reap urb - OUT complete, status = %d, actual = %d ]", urb->status, urb->actual_length);
+
+    if (out_error_ == 0) {
+        if (urb->status != 0) {
+            out_error_ = -urb->status;
+        } else if (urb->actual_length != urb->buffer_length) {
+            out_error_ = EIO;
+        }
+    }
+    out_free_.push_back(u);
+    cv_.notify_all();
+}
+
+bool UrbQueue::Reap() {
+    usbdevfs_urb* urb = nullptr;
+    int rc = usbdevfs_->ReapUrb(&urb);
+    int saved_errno = errno;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (rc == -1) {
+        if (saved_errno == EINTR && !dead_) {
+            return true;
+        }
+        D("[ reap urb - error: %s ]", strerror(saved_errno));
+        if (!dead_) {
+            // Most likely the device went away; fail readers and writers with
+            // the real error rather than waiting for a kick.
+            if (in_error_ == 0) in_error_ = saved_errno;
+            if (out_error_ == 0) out_error_ = saved_errno;
+            cv_.notify_all();
+        }
+        return false;
+    }
+
+    Urb* u = static_cast<Urb*>(urb->usercontext);
+    u->in_flight = false;
+    --in_flight_;
+    if (u->is_in) {
+        CompleteInLocked(u);
+    } else {
+        CompleteOutLocked(u);
+    }
+    return !(dead_ && in_flight_ == 0);
+}
+
+int UrbQueue::Read(void* data, size_t len) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    char* p = reinterpret_cast<char*>(data);
+
+    while (len > 0) {
+        if (dead_) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (!in_done_.empty()) {
+            Urb* u = in_done_.front();
+            size_t n = std::min(len, u->buffer.size() - u->consumed);
+            memcpy(p, u->buffer.data() + u->consumed, n);
+            u->consumed += n;
+            p += n;
+            len -= n;
+            if (u->consumed == u->buffer.size()) {
+                in_done_.pop_front();
+                in_free_.push_back(u);
+                SubmitInLocked();
+            }
+            continue;
+        }
+        if (in_error_ != 0) {
+            errno = in_error_;
+            return -1;
+        }
+        cv_.wait(lock);
+    }
+    return 0;
+}
+
+int UrbQueue::Write(const void* data, size_t len) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    auto deadline = std::chrono::system_clock::now() + 5s;
+    while (true) {
+        if (dead_) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (out_error_ != 0) {
+            errno = out_error_;
+            return -1;
+        }
+        if (!out_free_.empty()) {
+            break;
+        }
+        if (cv_.wait_until(lock, deadline) == std::cv_status::timeout) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    Urb* u = out_free_.back();
+    if (!SubmitLocked(u, ep_out_, data, len)) {
+        return -1;
+    }
+    out_free_.pop_back();
+    return 0;
+}
+
+void UrbQueue::Kick() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dead_) {
+        return;
+    }
+    dead_ = true;
+
+    // Cancel any pending transactions. These quietly fail if the URB already
+    // completed, but either way the reaper gets each of them back.
+    for (auto& urbs : {&in_urbs_, &out_urbs_}) {
+        for (auto& u : *urbs) {
+            if (u->in_flight) {
+                usbdevfs_->DiscardUrb(&u->urb);
+            }
+        }
+    }
+    cv_.notify_all();
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// URB queues for the Linux host usb backend.
+//
+// Instead of one URB per direction that is submitted and reaped by the caller
+// of usb_read()/usb_write(), each device keeps a ring of URBs per direction and
+// a dedicated reaper thread that hands completed transfers to the readers and
+// recycles finished writes. This keeps several transfers queued in the kernel
+// so that the bus is never idle while the transport threads catch up.
+//
+// Because a bulk IN URB only completes when its buffer is full or the device
+// sends a short packet, IN transfers are sized from the adb protocol itself:
+// a header URB of sizeof(amessage), followed by a payload URB of exactly
+// data_length bytes. The next header is queued behind each payload, so reads
+// run one transfer ahead of the protocol at all times. That also bounds the IN
+// pipe: a payload's size is unknown until its header has completed, so at most
+// two IN URBs (a payload and the header behind it) are ever with the kernel.
+// Larger IN URBs could be queued further ahead, but one only completes early on
+// a short packet, and devices don't send a zero-length packet after a payload
+// that is a multiple of the endpoint's packet size, so such a URB would sit
+// waiting for the next message. The IN ring is therefore fixed: the two URBs
+// the kernel can use, and room for one completed packet the reader hasn't
+// consumed yet.
+//
+// Completed IN data is copied out of the URB buffer by Read(), since usb_read()
+// fills a caller-provided buffer rather than handing over a whole apacket.
+
+#ifndef _ADB_USB_LINUX_URB_H_
+#define _ADB_USB_LINUX_URB_H_
+
+#include <linux/usbdevice_fs.h>
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <base/macros.h>
+
+// The usbdevfs ioctls used by UrbQueue, split out so tests can provide a mock.
+// All methods follow ioctl() conventions: -1 and errno on failure.
+class Usbdevfs {
+  public:
+    virtual ~Usbdevfs() = default;
+
+    virtual int SubmitUrb(usbdevfs_urb* urb) = 0;
+
+    // Blocks until a URB completes. Must be interruptible by a signal (EINTR).
+    virtual int ReapUrb(usbdevfs_urb** urb) = 0;
+
+    virtual int DiscardUrb(usbdevfs_urb* urb) = 0;
+};
+
+// Usbdevfs implementation backed by a usbdevfs file descriptor.
+class UsbdevfsFd : public Usbdevfs {
+  public:
+    explicit UsbdevfsFd(int fd) : fd_(fd) {}
+
+    int SubmitUrb(usbdevfs_urb* urb) override;
+    int ReapUrb(usbdevfs_urb** urb) override;
+    int DiscardUrb(usbdevfs_urb* urb) override;
+
+  private:
+    int fd_;
+
+    DISALLOW_COPY_AND_ASSIGN(UsbdevfsFd);
+};
+
+class UrbQueue {
+  public:
+    // IN URBs per device (see above).
+    static constexpr size_t kInUrbs = 4;
+    // Default number of OUT URBs, overridable with the ADB_USB_OUT_URBS
+    // environment variable.
+    static constexpr size_t kDefaultOutDepth = 8;
+
+    // |usbdevfs| must outlive the queue.
+    UrbQueue(Usbdevfs* usbdevfs, unsigned char ep_in, unsigned char ep_out, size_t out_depth);
+    ~UrbQueue();
+
+    // Queues the first IN transfer. Returns false if it couldn't be submitted.
+    bool Start();
+
+    // Copies exactly |len| bytes of received data into |data|, blocking until
+    // they arrive. Returns 0 on success, -1 and errno on failure.
+    int Read(void* data, size_t len);
+
+    // Queues |len| bytes for transmission; |data| may be reused as soon as
+    // this returns. Blocks only while every OUT URB is busy. Returns 0 on
+    // success, -1 and errno on failure, including the failure of an earlier
+    // queued write.
+    int Write(const void* data, size_t len);
+
+    // Reaps and dispatches one completed URB. Intended to be called in a loop
+    // from the reaper thread; returns false once the thread should exit.
+    bool Reap();
+
+    // Marks the queue dead, discards all in-flight URBs and wakes up any
+    // blocked readers and writers. Callers must also interrupt the reaper
+    // thread (e.g. with a signal) in case it is blocked in Reap().
+    void Kick();
+
+    bool dead();
+
+  private:
+    struct Urb {
+        std::vector<char> buffer;
+        // Bytes of |buffer| already handed to Read().
+        size_t consumed = 0;
+        bool is_in;
+        bool is_header = false;
+        bool in_flight = false;
+        // Last: usbdevfs_urb ends in a flexible array member.
+        usbdevfs_urb urb;
+    };
+
+    void SubmitInLocked();
+    // Copies |length| bytes of |data| (if non-null) into |u| and submits it.
+    bool SubmitLocked(Urb* u, unsigned char endpoint, const void* data, size_t length);
+    void CompleteInLocked(Urb* u);
+    void CompleteOutLocked(Urb* u);
+
+    Usbdevfs* usbdevfs_;
+    unsigned char ep_in_;
+    unsigned char ep_out_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool dead_ = false;
+    size_t in_flight_ = 0;
+
+    std::vector<std::unique_ptr<Urb>> in_urbs_;
+    std::vector<Urb*> in_free_;
+    // Completed IN transfers in arrival order, waiting to be consumed.
+    std::deque<Urb*> in_done_;
+    // A header transfer is in flight; nothing can be queued behind it until
+    // we know its payload length.
+    bool in_header_pending_ = false;
+    // Length of the payload transfer to submit next, or 0 for a header.
+    size_t in_next_payload_ = 0;
+    // First error seen on the IN pipe, reported once its data is drained.
+    int in_error_ = 0;
+
+    std::vector<std::unique_ptr<Urb>> out_urbs_;
+    std::vector<Urb*> out_free_;
+    int out_error_ = 0;
+
+    DISALLOW_COPY_AND_ASSIGN(UrbQueue);
+};
+
+#endif
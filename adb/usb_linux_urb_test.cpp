@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "usb_linux_urb.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "adb.h"
+
+using namespace std::literals;
+
+static constexpr unsigned char kEpIn = 0x81;
+static constexpr unsigned char kEpOut = 0x01;
+static constexpr int kHeaderSize = sizeof(amessage);
+
+// A fake usbdevfs: OUT URBs complete as soon as they are submitted, IN URBs
+// stay pending until the test "sends" data from the device with Send().
+class MockUsbdevfs : public Usbdevfs {
+  public:
+    int SubmitUrb(usbdevfs_urb* urb) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (urb->endpoint & 0x80) {
+            pending_in_.push_back(urb);
+        } else {
+            written_.append(static_cast<char*>(urb->buffer), urb->buffer_length);
+            ++out_transfers_;
+            urb->status = out_status_;
+            urb->actual_length = urb->buffer_length;
+            completed_.push_back(urb);
+        }
+        cv_.notify_all();
+        return 0;
+    }
+
+    int ReapUrb(usbdevfs_urb** urb) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return !completed_.empty() || interrupted_; });
+        if (interrupted_) {
+            interrupted_ = false;
+            errno = EINTR;
+            return -1;
+        }
+        *urb = completed_.front();
+        completed_.pop_front();
+        return 0;
+    }
+
+    int DiscardUrb(usbdevfs_urb* urb) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find(pending_in_.begin(), pending_in_.end(), urb);
+        if (it == pending_in_.end()) {
+            errno = EINVAL;
+            return -1;
+        }
+        pending_in_.erase(it);
+        urb->status = -ENOENT;
+        completed_.push_back(urb);
+        cv_.notify_all();
+        return 0;
+    }
+
+    // Completes the oldest pending IN URB with |data|, as if the device had
+    // written it. Returns false if no IN URB was queued in time.
+    bool Send(const std::string& data, int status = 0) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!cv_.wait_for(lock, 5s, [this]() { return !pending_in_.empty(); })) {
+            return false;
+        }
+        usbdevfs_urb* urb = pending_in_.front();
+        pending_in_.pop_front();
+        size_t n = std::min<size_t>(data.size(), urb->buffer_length);
+        memcpy(urb->buffer, data.data(), n);
+        urb->actual_length = n;
+        urb->status = status;
+        completed_.push_back(urb);
+        cv_.notify_all();
+        return true;
+    }
+
+    // Waits until exactly |count| IN URBs are queued and returns their sizes.
+    std::vector<int> WaitForPendingIn(size_t count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, 5s, [this, count]() { return pending_in_.size() == count; });
+        std::vector<int> sizes;
+        for (usbdevfs_urb* urb : pending_in_) {
+            sizes.push_back(urb->buffer_length);
+        }
+        return sizes;
+    }
+
+    void Interrupt() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        interrupted_ = true;
+        cv_.notify_all();
+    }
+
+    std::string written() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return written_;
+    }
+
+    size_t out_transfers() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return out_transfers_;
+    }
+
+    void set_out_status(int status) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out_status_ = status;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<usbdevfs_urb*> pending_in_;
+    std::deque<usbdevfs_urb*> completed_;
+    std::string written_;
+    size_t out_transfers_ = 0;
+    int out_status_ = 0;
+    bool interrupted_ = false;
+};
+
+class UrbQueueTest : public ::testing::Test {
+  protected:
+    void Start(size_t out_depth) {
+        queue_.reset(new UrbQueue(&usbdevfs_, kEpIn, kEpOut, out_depth));
+        ASSERT_TRUE(queue_->Start());
+        reaper_ = std::thread([this]() {
+            while (queue_->Reap()) {
+            }
+        });
+    }
+
+    void TearDown() override {
+        if (queue_) {
+            queue_->Kick();
+            usbdevfs_.Interrupt();
+            reaper_.join();
+        }
+    }
+
+    static std::string Header(uint32_t data_length) {
+        amessage msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.command = A_WRTE;
+        msg.data_length = data_length;
+        msg.magic = A_WRTE ^ 0xffffffff;
+        return std::string(reinterpret_cast<char*>(&msg), sizeof(msg));
+    }
+
+    MockUsbdevfs usbdevfs_;
+    std::unique_ptr<UrbQueue> queue_;
+    std::thread reaper_;
+};
+
+TEST_F(UrbQueueTest, read_sizes_transfers_from_header) {
+    Start(8);
+
+    // Only a header can be queued until we know what follows it.
+    EXPECT_EQ(std::vector<int>({kHeaderSize}), usbdevfs_.WaitForPendingIn(1));
+
+    // Once the header arrives, the payload and the next header are queued.
+    ASSERT_TRUE(usbdevfs_.Send(Header(5)));
+    EXPECT_EQ(std::vector<int>({5, kHeaderSize}), usbdevfs_.WaitForPendingIn(2));
+    ASSERT_TRUE(usbdevfs_.Send("hello"));
+
+    amessage msg;
+    ASSERT_EQ(0, queue_->Read(&msg, sizeof(msg)));
+    EXPECT_EQ(5U, msg.data_length);
+    char data[5];
+    ASSERT_EQ(0, queue_->Read(data, sizeof(data)));
+    EXPECT_EQ("hello", std::string(data, sizeof(data)));
+}
+
+TEST_F(UrbQueueTest, read_ahead_of_consumer) {
+    Start(8);
+
+    // The device can send a packet, and the next header, before anyone reads.
+    ASSERT_TRUE(usbdevfs_.Send(Header(3)));
+    ASSERT_TRUE(usbdevfs_.Send("foo"));
+    ASSERT_TRUE(usbdevfs_.Send(Header(0)));
+    EXPECT_EQ(std::vector<int>({kHeaderSize}), usbdevfs_.WaitForPendingIn(1));
+
+    amessage msg;
+    char data[3];
+    ASSERT_EQ(0, queue_->Read(&msg, sizeof(msg)));
+    ASSERT_EQ(0, queue_->Read(data, sizeof(data)));
+    EXPECT_EQ("foo", std::string(data, sizeof(data)));
+    ASSERT_EQ(0, queue_->Read(&msg, sizeof(msg)));
+    EXPECT_EQ(0U, msg.data_length);
+
+    ASSERT_TRUE(usbdevfs_.Send(Header(3)));
+    ASSERT_TRUE(usbdevfs_.Send("bar"));
+    ASSERT_EQ(0, queue_->Read(&msg, sizeof(msg)));
+    ASSERT_EQ(0, queue_->Read(data, sizeof(data)));
+    EXPECT_EQ("bar", std::string(data, sizeof(data)));
+}
+
+TEST_F(UrbQueueTest, read_backpressure) {
+    Start(1);
+
+    ASSERT_TRUE(usbdevfs_.Send(Header(4)));
+    ASSERT_TRUE(usbdevfs_.Send("data"));
+    ASSERT_TRUE(usbdevfs_.Send(Header(4)));
+    // Every IN URB is in use: three hold unread transfers, one waits for the
+    // second payload.
+    EXPECT_EQ(std::vector<int>({4}), usbdevfs_.WaitForPendingIn(1));
+    ASSERT_TRUE(usbdevfs_.Send("more"));
+    EXPECT_TRUE(usbdevfs_.WaitForPendingIn(0).empty());
+
+    // Consuming the first header frees a URB for the next one.
+    amessage msg;
+    ASSERT_EQ(0, queue_->Read(&msg, sizeof(msg)));
+    EXPECT_EQ(std::vector<int>({kHeaderSize}), usbdevfs_.WaitForPendingIn(1));
+
+    char data[4];
+    ASSERT_EQ(0, queue_->Read(data, sizeof(data)));
+    EXPECT_EQ("data", std::string(data, sizeof(data)));
+    ASSERT_EQ(0, queue_->Read(&msg, sizeof(msg)));
+    ASSERT_EQ(0, queue_->Read(data, sizeof(data)));
+    EXPECT_EQ("more", std::string(data, sizeof(data)));
+}
+
+TEST_F(UrbQueueTest, read_short_transfer) {
+    Start(8);
+
+    ASSERT_TRUE(usbdevfs_.Send(Header(8)));
+    ASSERT_TRUE(usbdevfs_.Send("short"));
+
+    amessage msg;
+    ASSERT_EQ(0, queue_->Read(&msg, sizeof(msg)));
+    char data[8];
+    ASSERT_EQ(-1, queue_->Read(data, sizeof(data)));
+    EXPECT_EQ(EIO, errno);
+}
+
+TEST_F(UrbQueueTest, read_error_status) {
+    Start(8);
+
+    ASSERT_TRUE(usbdevfs_.Send("", -EPIPE));
+    amessage msg;
+    ASSERT_EQ(-1, queue_->Read(&msg, sizeof(msg)));
+    EXPECT_EQ(EPIPE, errno);
+}
+
+TEST_F(UrbQueueTest, write) {
+    Start(2);
+
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(0, queue_->Write("abc", 3));
+    }
+    ASSERT_EQ(0, queue_->Write(nullptr, 0));
+
+    // Writes are asynchronous, but the mock completes them as they arrive.
+    for (int i = 0; i < 500 && usbdevfs_.out_transfers() < 11; ++i) {
+        std::this_thread::sleep_for(10ms);
+    }
+    EXPECT_EQ(11U, usbdevfs_.out_transfers());
+    std::string expected;
+    for (int i = 0; i < 10; ++i) {
+        expected += "abc";
+    }
+    EXPECT_EQ(expected, usbdevfs_.written());
+}
+
+TEST_F(UrbQueueTest, write_error_is_reported) {
+    Start(1);
+
+    usbdevfs_.set_out_status(-EPIPE);
+    ASSERT_EQ(0, queue_->Write("abc", 3));
+
+    // The failure of the first write surfaces on a later one.
+    int result = 0;
+    for (int i = 0; i < 500 && result == 0; ++i) {
+        result = queue_->Write("def", 3);
+        std::this_thread::sleep_for(10ms);
+    }
+    EXPECT_EQ(-1, result);
+    EXPECT_EQ(EPIPE, errno);
+}
+
+TEST_F(UrbQueueTest, kick_wakes_reader) {
+    Start(8);
+
+    std::thread reader([this]() {
+        amessage msg;
+        EXPECT_EQ(-1, queue_->Read(&msg, sizeof(msg)));
+        EXPECT_EQ(EINVAL, errno);
+    });
+
+    usbdevfs_.WaitForPendingIn(1);
+    queue_->Kick();
+    reader.join();
+
+    // The discarded header URB is handed back to the reaper, which exits.
+    EXPECT_TRUE(usbdevfs_.WaitForPendingIn(0).empty());
+    EXPECT_TRUE(queue_->dead());
+    EXPECT_EQ(-1, queue_->Write("abc", 3));
+}
@@ -64,11 +64,16 @@ void* hashmapPut(Hashmap* map, void* key, void* value);
 /**
  * Gets a value from the map. Returns NULL if no entry for the given key is
  * found or if the value itself is NULL.
+ *
+ * Does not need the lock: lookups may run concurrently with one thread that
+ * modifies the map while holding it. A key or value removed or replaced
+ * concurrently must stay valid until such lookups are done with it.
  */
 void* hashmapGet(Hashmap* map, void* key);
 
 /**
- * Returns true if the map contains an entry for the given key.
+ * Returns true if the map contains an entry for the given key. Like
+ * hashmapGet(), does not need the lock.
  */
 bool hashmapContainsKey(Hashmap* map, void* key);
 
@@ -95,7 +100,8 @@ size_t hashmapSize(Hashmap* map);
 
 /**
  * Invokes the given callback on each entry in the map. Stops iterating if
- * the callback returns false.
+ * the callback returns false. The callback may remove the entry it was
+ * given, but must not otherwise modify the map.
  */
 void hashmapForEach(Hashmap* map, 
         bool (*callback)(void* key, void* value, void* context),
@@ -106,7 +112,8 @@ void hashmapForEach(Hashmap* map,
  */
 
 /**
- * Locks the hash map so only the current thread can access it.
+ * Locks the hash map so only the current thread can modify it. Threads that
+ * only call hashmapGet() or hashmapContainsKey() need not take it.
  */
 void hashmapLock(Hashmap* map);
 
@@ -145,6 +152,72 @@ size_t hashmapCountCollisions(Hashmap* map);
 
 #ifdef __cplusplus
 }
+
+#include <functional>
+
+namespace android {
+
+/**
+ * Type-safe view of a Hashmap for C++ callers. Like the C API it stores
+ * pointers: the map owns neither keys nor values.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename Equal = std::equal_to<K> >
+class TypedHashmap {
+public:
+    explicit TypedHashmap(size_t initialCapacity = 0)
+            : mMap(hashmapCreate(initialCapacity, hashKey, equalKeys)) {
+    }
+
+    ~TypedHashmap() {
+        if (mMap != NULL) {
+            hashmapFree(mMap);
+        }
+    }
+
+    /** False if the map could not be allocated. */
+    bool isValid() const { return mMap != NULL; }
+
+    V* put(K* key, V* value) { return static_cast<V*>(hashmapPut(mMap, key, value)); }
+    V* get(const K& key) const { return static_cast<V*>(hashmapGet(mMap, const_cast<K*>(&key))); }
+    bool contains(const K& key) const { return hashmapContainsKey(mMap, const_cast<K*>(&key)); }
+    V* remove(const K& key) { return static_cast<V*>(hashmapRemove(mMap, const_cast<K*>(&key))); }
+    size_t size() const { return hashmapSize(mMap); }
+
+    void lock() { hashmapLock(mMap); }
+    void unlock() { hashmapUnlock(mMap); }
+
+    /**
+     * Calls |f(K*, V*)| on each entry until it returns false.
+     */
+    template <typename F>
+    void forEach(F f) {
+        hashmapForEach(mMap, callForEach<F>, &f);
+    }
+
+    Hashmap* get() const { return mMap; }
+
+private:
+    TypedHashmap(const TypedHashmap&);
+    TypedHashmap& operator=(const TypedHashmap&);
+
+    static int hashKey(void* key) {
+        return static_cast<int>(Hash()(*static_cast<K*>(key)));
+    }
+
+    static bool equalKeys(void* keyA, void* keyB) {
+        return Equal()(*static_cast<K*>(keyA), *static_cast<K*>(keyB));
+    }
+
+    template <typename F>
+    static bool callForEach(void* key, void* value, void* context) {
+        return (*static_cast<F*>(context))(static_cast<K*>(key), static_cast<V*>(value));
+    }
+
+    Hashmap* mMap;
+};
+
+} // namespace android
 #endif
 
 #endif /* __HASHMAP_H */ 
@@ -106,9 +106,71 @@ int32_t property_get_int32(const char *key, int32_t default_value);
 /* property_set: returns 0 on success, < 0 on failure
 */
 int property_set(const char *key, const char *value);
+
+/* property_set_many: sets |count| properties, at most 128, in one round
+** trip to init rather than one each.  Each is checked and set just as
+** property_set() would; results[i] is 0 if keys[i] was set, or -1 if
+** not.  Returns 0 if init answered, or -1 without touching |results|.
+*/
+int property_set_many(const char * const *keys, const char * const *values, size_t count,
+                      int *results);
     
 int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);    
 
+/* property_snapshot_create: copies every property whose name starts with
+** prefix ("" for all of them) in one pass over the property area, instead
+** of one property_get() per key.  The copy is consistent: if a property
+** is set while it is being taken, it is taken again, so it never mixes
+** values from before and after a change.  Properties that keep changing
+** make it give up after a few tries and return the last pass anyway;
+** property_snapshot_serial() tells whether it is stale.
+**
+** Entries are sorted by name.  Returns NULL if out of memory.
+*/
+struct property_snapshot;
+
+struct property_snapshot *property_snapshot_create(const char *prefix);
+void property_snapshot_free(struct property_snapshot *snapshot);
+
+size_t property_snapshot_count(const struct property_snapshot *snapshot);
+const char *property_snapshot_name(const struct property_snapshot *snapshot, size_t i);
+const char *property_snapshot_value(const struct property_snapshot *snapshot, size_t i);
+
+/* property_snapshot_get: property_get() against the snapshot.
+*/
+int property_snapshot_get(const struct property_snapshot *snapshot, const char *key,
+                          char *value, const char *default_value);
+
+/* property_snapshot_serial: the serial of the whole property area the
+** snapshot matches.  It is out of date once this differs from
+** __system_property_area_serial(), and property_snapshot_wait() blocks
+** until it does.
+*/
+uint32_t property_snapshot_serial(const struct property_snapshot *snapshot);
+void property_snapshot_wait(const struct property_snapshot *snapshot);
+
+/* property_wait_for_change: blocks until at least one of the watched
+** properties is set, or is created if it did not exist yet, and returns
+** how many were.  Those have their changed flag set; the others have it
+** cleared.
+**
+** It sleeps on the serial of the whole property area, which every set
+** bumps, so it is woken by unrelated properties too, but only returns
+** once one of the watched ones has changed.  There is no timeout.
+**
+** Fill each watch in with property_watch_init() first.  Changes are
+** counted from then, or from the previous call.
+*/
+struct property_watch {
+    const char *key;
+    const prop_info *pi;
+    uint32_t serial;
+    int changed;
+};
+
+void property_watch_init(struct property_watch *watch, const char *key);
+int property_wait_for_change(struct property_watch *watches, size_t count);
+
 #if defined(__BIONIC_FORTIFY)
 
 extern int __property_get_real(const char *, char *, const char *)
@@ -26,14 +26,39 @@ extern "C" {
 #endif
 
 
+#include <stddef.h>
+
 typedef struct RecordStream RecordStream;
 
 extern RecordStream *record_stream_new(int fd, size_t maxRecordLen);
+
+/*
+ * Like record_stream_new(), but maps the ring buffer twice back to back so
+ * records that wrap around its end are still contiguous and are never
+ * copied. Falls back to a plain ring buffer if the mapping fails.
+ */
+extern RecordStream *record_stream_new_mapped(int fd, size_t maxRecordLen);
+
 extern void record_stream_free(RecordStream *p_rs);
 
 extern int record_stream_get_next (RecordStream *p_rs, void ** p_outRecord, 
                                     size_t *p_outRecordLen);
 
+struct record_stream_record {
+    void *data;
+    size_t len;
+};
+
+/*
+ * Returns up to maxRecords records at once, with the same return values as
+ * record_stream_get_next(): 0 with *p_count set to 0 at end of stream, -1 /
+ * errno = EAGAIN if it needs to read again. Reads only if no whole record is
+ * buffered. The records stay valid until the next call on the stream.
+ */
+extern int record_stream_get_batch (RecordStream *p_rs,
+                                    struct record_stream_record *p_records,
+                                    size_t maxRecords, size_t *p_count);
+
 #ifdef __cplusplus
 }
 #endif
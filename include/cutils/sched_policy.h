@@ -17,6 +17,9 @@
 #ifndef __CUTILS_SCHED_POLICY_H
 #define __CUTILS_SCHED_POLICY_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -56,6 +59,45 @@ extern int get_sched_policy(int tid, SchedPolicy *policy);
  */
 extern const char *get_sched_policy_name(SchedPolicy policy);
 
+/* Moves several threads at once, as set_sched_policy() and set_cpuset_policy()
+ * would one at a time. A tid of 0 means the calling thread.
+ *
+ * Threads that this process already moved to the same group are skipped
+ * without a system call. A thread moved by another process since, or a tid
+ * reused by a new thread, is not noticed; use set_sched_policy() when that
+ * matters.
+ *
+ * Every thread is tried. Returns 0, or the error of the first move that
+ * failed, as a negative errno.
+ */
+extern int set_sched_policy_tids(const int *tids, size_t count, SchedPolicy policy);
+
+extern int set_cpuset_policy_tids(const int *tids, size_t count, SchedPolicy policy);
+
+/* Moves every thread of a process with a single write to cgroup.procs,
+ * falling back to one write per thread on kernels without it. Skipped if
+ * this process already moved all of its threads to the same group.
+ */
+extern int set_process_sched_policy(int pid, SchedPolicy policy);
+
+extern int set_process_cpuset_policy(int pid, SchedPolicy policy);
+
+/* Counters for the calls above and for set_sched_policy() and
+ * set_cpuset_policy(), since the process started or the last reset.
+ */
+struct sched_policy_stats {
+    uint64_t moves;        /* threads and processes asked to move */
+    uint64_t skipped;      /* moves skipped, already in place */
+    uint64_t writes;       /* writes to cgroup files */
+    uint64_t errors;       /* writes that failed */
+    uint64_t write_ns;     /* time spent in those writes */
+    uint64_t max_write_ns; /* longest of them */
+};
+
+extern void get_sched_policy_stats(struct sched_policy_stats *stats);
+
+extern void reset_sched_policy_stats(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -110,6 +110,71 @@ void atrace_set_debuggable(bool debuggable);
  */
 void atrace_set_tracing_enabled(bool enabled);
 
+/**
+ * Buffered tracing: an opt-in alternative to writing every event to
+ * trace_marker as text.
+ *
+ * While it is on, trace events are recorded as fixed-size binary records in a
+ * per-thread buffer, with CLOCK_MONOTONIC timestamps taken in user space and
+ * names replaced by interned ids. A thread's buffer is written to the
+ * collector's fd with a single writev() when it fills, when the thread calls
+ * atrace_buffered_flush(), and when the thread exits. Events recorded since a
+ * thread's last flush are dropped by atrace_buffered_stop().
+ *
+ * The stream is a sequence of batches, each an atrace_batch_header followed by
+ * |size| bytes of payload:
+ *  - ATRACE_BATCH_NAME: a uint32_t name id followed by the name, without a
+ *    terminating NUL. Ids are scoped to the pid in the header, and a name is
+ *    always sent before the first batch that uses its id.
+ *  - ATRACE_BATCH_EVENTS: an array of atrace_event records from one thread.
+ * No batch is larger than PIPE_BUF, so batches from different threads do not
+ * interleave when |fd| is a pipe, a datagram socket or an O_APPEND file.
+ */
+#define ATRACE_BATCH_MAGIC  0x42525441  // "ATRB"
+#define ATRACE_BATCH_EVENTS 1
+#define ATRACE_BATCH_NAME   2
+
+struct atrace_batch_header {
+    uint32_t magic;
+    uint16_t kind;
+    uint16_t reserved;
+    int32_t pid;
+    int32_t tid;
+    uint32_t size;
+};
+
+struct atrace_event {
+    uint64_t timestamp_ns;
+    uint32_t name_id;       // 0 for 'E'
+    char type;              // 'B', 'E', 'S', 'F' or 'C', as in the text format
+    char reserved[3];
+    int64_t value;          // the cookie for 'S' and 'F', the value for 'C'
+};
+
+/**
+ * Switches this process to buffered tracing into |fd|, which is duplicated.
+ * Returns 0 on success or a negative errno. Tags are still controlled by
+ * debug.atrace.tags.enableflags.
+ *
+ * The first call reserves an fd number that buffered tracing keeps for the
+ * life of the process; later calls dup3() |fd| onto it, so a thread that is
+ * mid-event during the switch writes to a trace stream and never to an
+ * unrelated file that reused the number.
+ */
+int atrace_buffered_start(int fd);
+
+/**
+ * Goes back to writing to trace_marker and releases the stream passed to
+ * atrace_buffered_start(). Events that a thread is recording while this runs
+ * may be lost.
+ */
+void atrace_buffered_stop();
+
+/**
+ * Writes out the calling thread's buffered events.
+ */
+void atrace_buffered_flush();
+
 /**
  * Flag indicating whether setup has been completed, initialized to 0.
  * Nonzero indicates setup has completed.
@@ -187,8 +252,8 @@ static inline void atrace_begin(uint64_t tag, const char* name)
 static inline void atrace_end(uint64_t tag)
 {
     if (CC_UNLIKELY(atrace_is_tag_enabled(tag))) {
-        char c = 'E';
-        write(atrace_marker_fd, &c, 1);
+        void atrace_end_body();
+        atrace_end_body();
     }
 }
 
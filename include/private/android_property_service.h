@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file is used to define the parts of init's property service protocol
+ * that bionic's sys/_system_properties.h does not. */
+
+#ifndef _SYSTEM_CORE_INCLUDE_PRIVATE_ANDROID_PROPERTY_SERVICE_H_
+#define _SYSTEM_CORE_INCLUDE_PRIVATE_ANDROID_PROPERTY_SERVICE_H_
+
+#include <stdint.h>
+
+#include <sys/system_properties.h>
+
+/* Sets up to PROP_MSG_SETPROPS_MAX properties in one connection: the
+ * client sends a prop_msg_setprops_header, then |count| entries, and init
+ * answers with |count| int32_t, each 0 if that property was set or -1 if
+ * not, before closing the connection. Every property is checked as if it
+ * had been set on its own. */
+#define PROP_MSG_SETPROPS 0x00010002
+#define PROP_MSG_SETPROPS_MAX 128
+
+typedef struct {
+    uint32_t cmd;
+    uint32_t count;
+} prop_msg_setprops_header;
+
+typedef struct {
+    char name[PROP_NAME_MAX];
+    char value[PROP_VALUE_MAX];
+} prop_msg_setprops_entry;
+
+#endif /* _SYSTEM_CORE_INCLUDE_PRIVATE_ANDROID_PROPERTY_SERVICE_H_ */
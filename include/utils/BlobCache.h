@@ -19,9 +19,11 @@
 
 #include <stddef.h>
 
+#include <unordered_set>
+
 #include <utils/Flattenable.h>
 #include <utils/RefBase.h>
-#include <utils/SortedVector.h>
+#include <utils/TypeHelpers.h>
 #include <utils/threads.h>
 
 namespace android {
@@ -40,9 +42,20 @@ public:
     // Create an empty blob cache. The blob cache will cache key/value pairs
     // with key and value sizes less than or equal to maxKeySize and
     // maxValueSize, respectively. The total combined size of ALL cache entries
-    // (key sizes plus value sizes) will not exceed maxTotalSize.
+    // (key sizes plus value sizes) will not exceed maxTotalSize.  When an
+    // insertion would exceed it, the least recently used entries are evicted
+    // until the total is no more than maxTotalSize/2 and the new entry fits.
     BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize);
 
+    // As above, but eviction stops once the total size is no more than
+    // lowWatermark, which should be less than maxTotalSize, and there is room
+    // for the new entry.  A watermark close to maxTotalSize keeps more of the
+    // cache warm at the cost of evicting more often.
+    BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize,
+            size_t lowWatermark);
+
+    ~BlobCache();
+
     // set inserts a new binary value into the cache and associates it with the
     // given binary key.  If the key or value are too large for the cache then
     // the cache remains unchanged.  This includes the case where a different
@@ -63,7 +76,8 @@ public:
 
     // get retrieves from the cache the binary value associated with a given
     // binary key.  If the key is present in the cache then the length of the
-    // binary value associated with that key is returned.  If the value argument
+    // binary value associated with that key is returned, and the entry
+    // becomes the most recently used.  If the value argument
     // is non-NULL and the size of the cached value is less than valueSize bytes
     // then the cached value is copied into the buffer pointed to by the value
     // argument.  If the key is not present in the cache then 0 is returned and
@@ -87,7 +101,8 @@ public:
     // flatten serializes the current contents of the cache into the memory
     // pointed to by 'buffer'.  The serialized cache contents can later be
     // loaded into a BlobCache object using the unflatten method.  The contents
-    // of the BlobCache object will not be modified.
+    // of the BlobCache object will not be modified.  Entries are written
+    // least recently used first, so unflatten restores their recency.
     //
     // Preconditions:
     //   size >= this.getFlattenedSize()
@@ -106,67 +121,80 @@ private:
     BlobCache(const BlobCache&);
     void operator=(const BlobCache&);
 
-    // A random function helper to get around MinGW not having nrand48()
-    long int blob_random();
+    // clean evicts the least recently used entries from the cache until the
+    // total size of all remaining entries is no more than mLowWatermark, and
+    // leaves room for at least 'needed' more bytes.
+    void clean(size_t needed);
 
-    // clean evicts a randomly chosen set of entries from the cache such that
-    // the total size of all remaining entries is less than mMaxTotalSize/2.
-    void clean();
+    // isCleanable returns true if the cache is full enough for
+    // clean(needed) to have some effect, and false otherwise.
+    bool isCleanable(size_t needed) const;
 
-    // isCleanable returns true if the cache is full enough for the clean method
-    // to have some effect, and false otherwise.
-    bool isCleanable() const;
+    // cleanTarget returns the total size that clean(needed) evicts down to.
+    size_t cleanTarget(size_t needed) const;
 
-    // A Blob is an immutable sized unstructured data blob.
-    class Blob : public RefBase {
+    // clear evicts every entry.
+    void clear();
+
+    // An Entry is a single key/value pair in the cache.  Resident entries own
+    // a copy of their key and value and are linked, in order of use, into a
+    // list running from mOldest to mYoungest.
+    class Entry {
     public:
-        Blob(const void* data, size_t size, bool copyData);
-        ~Blob();
+        // Creates an entry that refers to the caller's key, for lookups.
+        Entry(const void* key, size_t keySize);
+        ~Entry();
+
+        // Creates a resident entry, or returns NULL if memory runs out.
+        static Entry* create(const void* key, size_t keySize,
+                const void* value, size_t valueSize);
 
-        bool operator<(const Blob& rhs) const;
+        // Replaces the value, returning false and leaving the entry
+        // unchanged if memory runs out.
+        bool setValue(const void* value, size_t valueSize);
 
-        const void* getData() const;
-        size_t getSize() const;
+        const void* getKey() const { return mKey; }
+        size_t getKeySize() const { return mKeySize; }
+        const void* getValue() const { return mValue; }
+        size_t getValueSize() const { return mValueSize; }
+        hash_t getHash() const { return mHash; }
+
+        Entry* mOlder;
+        Entry* mYounger;
 
     private:
         // Copying is not allowed.
-        Blob(const Blob&);
-        void operator=(const Blob&);
-
-        // mData points to the buffer containing the blob data.
-        const void* mData;
+        Entry(const Entry&);
+        void operator=(const Entry&);
 
-        // mSize is the size of the blob data in bytes.
-        size_t mSize;
+        // mKey and mValue point to the key and value data.  In a resident
+        // entry mData holds both, key first.
+        const void* mKey;
+        size_t mKeySize;
+        const void* mValue;
+        size_t mValueSize;
+        uint8_t* mData;
 
-        // mOwnsData indicates whether or not this Blob object should free the
-        // memory pointed to by mData when the Blob gets destructed.
-        bool mOwnsData;
+        // mHash caches the hash of the key.
+        hash_t mHash;
     };
 
-    // A CacheEntry is a single key/value pair in the cache.
-    class CacheEntry {
-    public:
-        CacheEntry();
-        CacheEntry(const sp<Blob>& key, const sp<Blob>& value);
-        CacheEntry(const CacheEntry& ce);
-
-        bool operator<(const CacheEntry& rhs) const;
-        const CacheEntry& operator=(const CacheEntry&);
-
-        sp<Blob> getKey() const;
-        sp<Blob> getValue() const;
-
-        void setValue(const sp<Blob>& value);
+    struct HashForEntry {
+        size_t operator()(const Entry* entry) const {
+            return entry->getHash();
+        }
+    };
 
-    private:
+    struct EqualityForEntries {
+        bool operator()(const Entry* lhs, const Entry* rhs) const;
+    };
 
-        // mKey is the key that identifies the cache entry.
-        sp<Blob> mKey;
+    typedef std::unordered_set<Entry*, HashForEntry, EqualityForEntries> EntrySet;
 
-        // mValue is the cached data associated with the key.
-        sp<Blob> mValue;
-    };
+    // attach links a resident entry in as the most recently used; detach
+    // unlinks it.
+    void attach(Entry* entry);
+    void detach(Entry* entry);
 
     // A Header is the header for the entire BlobCache serialization format. No
     // need to make this portable, so we simply write the struct out.
@@ -231,17 +259,21 @@ private:
     // will be evicted from the cache to make room for the new entry.
     const size_t mMaxTotalSize;
 
+    // mLowWatermark is the total size that clean() evicts entries down to.
+    const size_t mLowWatermark;
+
     // mTotalSize is the total combined size of all keys and values currently in
     // the cache.
     size_t mTotalSize;
 
-    // mRandState is the pseudo-random number generator state. It is passed to
-    // nrand48 to generate random numbers when needed.
-    unsigned short mRandState[3];
+    // mEntries indexes all the cache entries that are resident in memory by
+    // key.  Cache entries are added to it by the 'set' method.
+    EntrySet mEntries;
 
-    // mCacheEntries stores all the cache entries that are resident in memory.
-    // Cache entries are added to it by the 'set' method.
-    SortedVector<CacheEntry> mCacheEntries;
+    // mOldest and mYoungest are the ends of the list of resident entries in
+    // order of use.
+    Entry* mOldest;
+    Entry* mYoungest;
 };
 
 }
@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_FIXED_LRU_CACHE_H
+#define ANDROID_UTILS_FIXED_LRU_CACHE_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#include <cutils/log.h>
+
+#include "utils/LruCache.h"     // OnEntryRemoved
+#include "utils/TypeHelpers.h"  // hash_t
+
+namespace android {
+
+/*
+ * An LruCache with a capacity fixed at construction time that never
+ * allocates after it.
+ *
+ * Entries live in a slab of nodes allocated up front and are found through
+ * an open-addressed table of node indices, so put() and eviction only move
+ * indices around instead of allocating and freeing a node per entry. Use it
+ * for caches that churn; LruCache remains the choice when the capacity is
+ * unlimited or the cache is usually far from full, since this one reserves
+ * memory for every entry it may ever hold.
+ *
+ * The interface and OnEntryRemoved semantics match LruCache, except that
+ * put() of a key that is already cached returns false without evicting
+ * anything, and the Iterator walks entries from oldest to youngest.
+ */
+template <typename TKey, typename TValue>
+class FixedLruCache {
+public:
+    explicit FixedLruCache(uint32_t capacity);
+    virtual ~FixedLruCache();
+
+    void setOnEntryRemovedListener(OnEntryRemoved<TKey, TValue>* listener);
+    size_t size() const { return mSize; }
+    size_t capacity() const { return mCapacity; }
+    const TValue& get(const TKey& key);
+    bool put(const TKey& key, const TValue& value);
+    bool remove(const TKey& key);
+    bool removeOldest();
+    void clear();
+    const TValue& peekOldestValue();
+
+private:
+    FixedLruCache(const FixedLruCache& that);  // disallow copy constructor
+    FixedLruCache& operator=(const FixedLruCache& that);
+
+    static const uint32_t kNone = UINT32_MAX;
+
+    struct Entry {
+        TKey key;
+        TValue value;
+
+        Entry(const TKey& key_, const TValue& value_) : key(key_), value(value_) {
+        }
+    };
+
+    // Unused nodes are chained through |child| on the free list.
+    struct Node {
+        typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type storage;
+        uint32_t parent;
+        uint32_t child;
+        uint32_t hash;
+
+        Entry& entry() { return *reinterpret_cast<Entry*>(&storage); }
+    };
+
+    // Fibonacci hashing spreads the identity hashes hash_type() gives
+    // integers over the whole table.
+    uint32_t homeSlot(uint32_t hash) const {
+        return uint32_t(hash * 2654435769u) >> mShift;
+    }
+
+    uint32_t findSlot(const TKey& key, uint32_t hash);
+    void eraseSlot(uint32_t slot);
+    void removeAt(uint32_t slot);
+    void attachToCache(uint32_t index);
+    void detachFromCache(uint32_t index);
+
+    std::unique_ptr<Node[]> mNodes;
+    // Linear probing table of node indices, at most half full.
+    std::unique_ptr<uint32_t[]> mSlots;
+    uint32_t mSlotMask;
+    uint32_t mShift;
+    uint32_t mCapacity;
+    uint32_t mSize;
+    uint32_t mFree;
+    uint32_t mOldest;
+    uint32_t mYoungest;
+    OnEntryRemoved<TKey, TValue>* mListener;
+    TValue mNullValue;
+
+public:
+    // To be used like:
+    // while (it.next()) {
+    //   it.value(); it.key();
+    // }
+    class Iterator {
+    public:
+        Iterator(const FixedLruCache<TKey, TValue>& cache)
+                : mCache(cache), mIndex(kNone), mBeginReturned(false) {
+        }
+
+        bool next() {
+            if (!mBeginReturned) {
+                mBeginReturned = true;
+                mIndex = mCache.mOldest;
+            } else if (mIndex != kNone) {
+                mIndex = mCache.mNodes[mIndex].child;
+            }
+            return mIndex != kNone;
+        }
+
+        const TValue& value() const {
+            return mCache.mNodes[mIndex].entry().value;
+        }
+
+        const TKey& key() const {
+            return mCache.mNodes[mIndex].entry().key;
+        }
+    private:
+        const FixedLruCache<TKey, TValue>& mCache;
+        uint32_t mIndex;
+        bool mBeginReturned;
+    };
+};
+
+// Implementation is here, because it's fully templated
+template <typename TKey, typename TValue>
+const uint32_t FixedLruCache<TKey, TValue>::kNone;
+
+template <typename TKey, typename TValue>
+FixedLruCache<TKey, TValue>::FixedLruCache(uint32_t capacity)
+    : mCapacity(capacity)
+    , mSize(0)
+    , mFree(0)
+    , mOldest(kNone)
+    , mYoungest(kNone)
+    , mListener(NULL)
+    , mNullValue(NULL) {
+    LOG_ALWAYS_FATAL_IF(capacity == 0 || capacity > (1u << 30),
+            "FixedLruCache: invalid capacity %u", capacity);
+    uint32_t slots = 2;
+    mShift = 31;
+    while (slots < capacity * 2) {
+        slots *= 2;
+        mShift--;
+    }
+    mSlotMask = slots - 1;
+    mSlots.reset(new uint32_t[slots]);
+    std::fill(mSlots.get(), mSlots.get() + slots, kNone);
+
+    mNodes.reset(new Node[capacity]);
+    for (uint32_t i = 0; i < capacity; i++) {
+        mNodes[i].child = i + 1 < capacity ? i + 1 : kNone;
+    }
+}
+
+template <typename TKey, typename TValue>
+FixedLruCache<TKey, TValue>::~FixedLruCache() {
+    clear();
+}
+
+template <typename K, typename V>
+void FixedLruCache<K, V>::setOnEntryRemovedListener(OnEntryRemoved<K, V>* listener) {
+    mListener = listener;
+}
+
+template <typename TKey, typename TValue>
+const TValue& FixedLruCache<TKey, TValue>::get(const TKey& key) {
+    uint32_t index = mSlots[findSlot(key, hash_type(key))];
+    if (index == kNone) {
+        return mNullValue;
+    }
+    if (index != mYoungest) {
+        detachFromCache(index);
+        attachToCache(index);
+    }
+    return mNodes[index].entry().value;
+}
+
+template <typename TKey, typename TValue>
+bool FixedLruCache<TKey, TValue>::put(const TKey& key, const TValue& value) {
+    uint32_t hash = hash_type(key);
+    uint32_t slot = findSlot(key, hash);
+    if (mSlots[slot] != kNone) {
+        return false;
+    }
+    if (mSize == mCapacity) {
+        removeOldest();
+        // Eviction may have shifted entries into our probe sequence.
+        slot = findSlot(key, hash);
+    }
+
+    uint32_t index = mFree;
+    Node& node = mNodes[index];
+    mFree = node.child;
+    new (&node.storage) Entry(key, value);
+    node.hash = hash;
+    mSlots[slot] = index;
+    mSize++;
+    attachToCache(index);
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool FixedLruCache<TKey, TValue>::remove(const TKey& key) {
+    uint32_t slot = findSlot(key, hash_type(key));
+    if (mSlots[slot] == kNone) {
+        return false;
+    }
+    removeAt(slot);
+    return true;
+}
+
+template <typename TKey, typename TValue>
+bool FixedLruCache<TKey, TValue>::removeOldest() {
+    if (mOldest == kNone) {
+        return false;
+    }
+    Node& node = mNodes[mOldest];
+    uint32_t slot = homeSlot(node.hash);
+    while (mSlots[slot] != mOldest) {
+        slot = (slot + 1) & mSlotMask;
+    }
+    removeAt(slot);
+    return true;
+}
+
+template <typename TKey, typename TValue>
+const TValue& FixedLruCache<TKey, TValue>::peekOldestValue() {
+    if (mOldest != kNone) {
+        return mNodes[mOldest].entry().value;
+    }
+    return mNullValue;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::clear() {
+    if (mListener) {
+        for (uint32_t i = mOldest; i != kNone; i = mNodes[i].child) {
+            Entry& entry = mNodes[i].entry();
+            (*mListener)(entry.key, entry.value);
+        }
+    }
+    for (uint32_t i = mOldest; i != kNone;) {
+        Node& node = mNodes[i];
+        uint32_t next = node.child;
+        node.entry().~Entry();
+        node.child = mFree;
+        mFree = i;
+        i = next;
+    }
+    std::fill(mSlots.get(), mSlots.get() + mSlotMask + 1, kNone);
+    mOldest = kNone;
+    mYoungest = kNone;
+    mSize = 0;
+}
+
+// Returns the slot holding |key|, or the empty slot that ends its probe
+// sequence if the key is not cached.
+template <typename TKey, typename TValue>
+uint32_t FixedLruCache<TKey, TValue>::findSlot(const TKey& key, uint32_t hash) {
+    uint32_t slot = homeSlot(hash);
+    for (;;) {
+        uint32_t index = mSlots[slot];
+        if (index == kNone) {
+            return slot;
+        }
+        Node& node = mNodes[index];
+        if (node.hash == hash && node.entry().key == key) {
+            return slot;
+        }
+        slot = (slot + 1) & mSlotMask;
+    }
+}
+
+// Backward-shift deletion: pull later members of the cluster into the hole
+// so that lookups never need tombstones.
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::eraseSlot(uint32_t slot) {
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & mSlotMask; mSlots[next] != kNone;
+            next = (next + 1) & mSlotMask) {
+        uint32_t home = homeSlot(mNodes[mSlots[next]].hash);
+        if (((next - home) & mSlotMask) >= ((next - hole) & mSlotMask)) {
+            mSlots[hole] = mSlots[next];
+            hole = next;
+        }
+    }
+    mSlots[hole] = kNone;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::removeAt(uint32_t slot) {
+    uint32_t index = mSlots[slot];
+    Node& node = mNodes[index];
+    if (mListener) {
+        (*mListener)(node.entry().key, node.entry().value);
+    }
+    detachFromCache(index);
+    eraseSlot(slot);
+    node.entry().~Entry();
+    node.child = mFree;
+    mFree = index;
+    mSize--;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::attachToCache(uint32_t index) {
+    Node& node = mNodes[index];
+    node.parent = mYoungest;
+    node.child = kNone;
+    if (mYoungest == kNone) {
+        mOldest = index;
+    } else {
+        mNodes[mYoungest].child = index;
+    }
+    mYoungest = index;
+}
+
+template <typename TKey, typename TValue>
+void FixedLruCache<TKey, TValue>::detachFromCache(uint32_t index) {
+    Node& node = mNodes[index];
+    if (node.parent != kNone) {
+        mNodes[node.parent].child = node.child;
+    } else {
+        mOldest = node.child;
+    }
+    if (node.child != kNone) {
+        mNodes[node.child].parent = node.parent;
+    } else {
+        mYoungest = node.parent;
+    }
+}
+
+}
+#endif // ANDROID_UTILS_FIXED_LRU_CACHE_H
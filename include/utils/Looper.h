@@ -24,6 +24,9 @@
 
 #include <sys/epoll.h>
 
+#include <unordered_map>
+#include <vector>
+
 namespace android {
 
 /*
@@ -317,6 +320,36 @@ public:
     int addFd(int fd, int ident, int events, Looper_callbackFunc callback, void* data);
     int addFd(int fd, int ident, int events, const sp<LooperCallback>& callback, void* data);
 
+    /**
+     * One entry in a call to addFds().  The fields have the same meaning as the
+     * corresponding arguments of addFd().
+     */
+    struct FdRegistration {
+        FdRegistration() : fd(-1), ident(0), events(0), data(NULL) { }
+        FdRegistration(int fd, int ident, int events, const sp<LooperCallback>& callback,
+                void* data) : fd(fd), ident(ident), events(events), callback(callback),
+                data(data) {
+        }
+
+        int fd;
+        int ident;
+        int events;
+        sp<LooperCallback> callback;
+        void* data;
+    };
+
+    /**
+     * Adds several file descriptors at once, taking the lock only once.
+     * Each entry is handled exactly as by addFd(); an entry that fails is skipped
+     * and does not prevent the others from being added.
+     *
+     * Returns the number of file descriptors that were added.
+     *
+     * This method can be called on any thread.
+     * This method may block briefly if it needs to wake the poll.
+     */
+    size_t addFds(const FdRegistration* registrations, size_t count);
+
     /**
      * Removes a previously added file descriptor from the looper.
      *
@@ -434,13 +467,21 @@ private:
     };
 
     struct MessageEnvelope {
-        MessageEnvelope() : uptime(0) { }
+        MessageEnvelope() : uptime(0), seq(0) { }
+
+        MessageEnvelope(nsecs_t uptime, uint64_t seq, const sp<MessageHandler> handler,
+                const Message& message) : uptime(uptime), seq(seq), handler(handler),
+                message(message) {
+        }
 
-        MessageEnvelope(nsecs_t uptime, const sp<MessageHandler> handler,
-                const Message& message) : uptime(uptime), handler(handler), message(message) {
+        // Heap ordering: true if this envelope is due after |other|. Messages
+        // for the same time are delivered in the order they were sent.
+        bool operator>(const MessageEnvelope& other) const {
+            return uptime > other.uptime || (uptime == other.uptime && seq > other.seq);
         }
 
         nsecs_t uptime;
+        uint64_t seq;
         sp<MessageHandler> handler;
         Message message;
     };
@@ -450,7 +491,10 @@ private:
     int mWakeEventFd;  // immutable
     Mutex mLock;
 
-    Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    // Min-heap of pending messages (see MessageEnvelope::operator>), so the
+    // next message due is always at the front.
+    std::vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    uint64_t mNextMessageSeq; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
     // Whether we are currently waiting for work.  Not protected by a lock,
@@ -460,20 +504,25 @@ private:
     int mEpollFd; // guarded by mLock but only modified on the looper thread
     bool mEpollRebuildRequired; // guarded by mLock
 
-    // Locked list of file descriptor monitoring requests.
-    KeyedVector<int, Request> mRequests;  // guarded by mLock
+    // Locked table of file descriptor monitoring requests, keyed by fd.
+    std::unordered_map<int, Request> mRequests;  // guarded by mLock
     int mNextRequestSeq;
 
     // This state is only used privately by pollOnce and does not require a lock since
-    // it runs on a single thread.
-    Vector<Response> mResponses;
+    // it runs on a single thread.  The response buffer keeps its capacity across polls.
+    std::vector<Response> mResponses;
     size_t mResponseIndex;
     nsecs_t mNextMessageUptime; // set to LLONG_MAX when none
 
     int pollInner(int timeoutMillis);
+    bool checkFdArgs(int ident, const sp<LooperCallback>& callback) const;
+    int addFdLocked(int fd, int ident, int events, const sp<LooperCallback>& callback,
+            void* data);
     int removeFd(int fd, int seq);
     void awoken();
     void pushResponse(int events, const Request& request);
+    template <typename Predicate>
+    void removeMessagesLocked(Predicate shouldRemove);
     void rebuildEpollLocked();
     void scheduleEpollRebuildLocked();
 
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UTILS_THREAD_POOL_H
+#define UTILS_THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include <utils/Condition.h>
+#include <utils/Errors.h>
+#include <utils/Looper.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+class ThreadPool;
+
+/**
+ * A unit of work for a ThreadPool.
+ *
+ * Subclasses implement run(). A task can be submitted once; after that it
+ * doubles as its own future: wait for it, poll isDone(), or have the pool
+ * post a message to a Looper when it completes.
+ */
+class Task : public virtual RefBase {
+protected:
+    Task();
+    virtual ~Task();
+
+    /**
+     * Does the work. Called at most once, on a pool thread.
+     */
+    virtual void run() = 0;
+
+public:
+    /**
+     * Waits until the task has run or was cancelled.
+     *
+     * When called from a thread of the pool, other queued tasks are run while
+     * waiting, so tasks may wait on the tasks they submit.
+     */
+    void wait();
+
+    /**
+     * Like wait(), but gives up after a timeout.
+     *
+     * Returns OK once the task is done, or TIMED_OUT.
+     */
+    status_t waitRelative(nsecs_t timeout);
+
+    /**
+     * Returns true once the task has run or was cancelled.
+     */
+    bool isDone() const;
+
+    /**
+     * Keeps the task from running if no thread has started it yet.
+     *
+     * Returns true if the task was cancelled, false if it already ran or is
+     * running. A cancelled task counts as done, and its completion message,
+     * if any, is still sent.
+     */
+    bool cancel();
+
+    bool isCancelled() const;
+
+    /**
+     * Sends a message to a handler on a Looper once the task is done, so the
+     * result can be picked up on the thread that owns the Looper.
+     *
+     * Must be called before the task is submitted.
+     */
+    void setCompletionMessage(const sp<Looper>& looper, const sp<MessageHandler>& handler,
+            const Message& message);
+
+private:
+    friend class ThreadPool;
+
+    enum {
+        STATE_IDLE,
+        STATE_QUEUED,
+        STATE_RUNNING,
+        STATE_DONE,
+        STATE_CANCELLED,
+    };
+
+    Task(const Task&);
+    Task& operator=(const Task&);
+
+    // Called by the pool on the thread that dequeued the task.
+    void execute();
+    void finish(int state);
+
+    std::atomic<int> mState;
+    int mPriority;
+    mutable Mutex mLock;
+    Condition mDoneCondition;
+    sp<Looper> mLooper;
+    sp<MessageHandler> mHandler;
+    Message mMessage;
+};
+
+/**
+ * A Task that calls a function and keeps its result.
+ */
+template <typename T>
+class FutureTask : public Task {
+public:
+    explicit FutureTask(const std::function<T()>& function)
+            : mFunction(function), mResult() {
+    }
+
+    /**
+     * Waits for the task and returns its result, or a value-initialized T
+     * if the task was cancelled.
+     */
+    const T& get() {
+        wait();
+        return mResult;
+    }
+
+protected:
+    virtual void run() {
+        mResult = mFunction();
+        mFunction = nullptr;
+    }
+
+private:
+    std::function<T()> mFunction;
+    T mResult;
+};
+
+template <>
+class FutureTask<void> : public Task {
+public:
+    explicit FutureTask(const std::function<void()>& function) : mFunction(function) {
+    }
+
+    void get() {
+        wait();
+    }
+
+protected:
+    virtual void run() {
+        mFunction();
+        mFunction = nullptr;
+    }
+
+private:
+    std::function<void()> mFunction;
+};
+
+/**
+ * A fixed-size pool of threads that run Tasks.
+ *
+ * Every thread has its own queues. Tasks submitted from a pool thread go to
+ * that thread's queues and are run newest first, which keeps recursive work
+ * hot in the cache; idle threads steal the oldest tasks from the others.
+ * Tasks submitted from elsewhere are spread over the threads round robin.
+ *
+ * Each task has a priority class. Threads always pick a task of the most
+ * urgent class available, and switch their own scheduling priority to match
+ * it with androidSetThreadPriority before running it.
+ */
+class ThreadPool : public virtual RefBase {
+public:
+    enum Priority {
+        PRIORITY_FOREGROUND,  // ANDROID_PRIORITY_FOREGROUND
+        PRIORITY_NORMAL,      // ANDROID_PRIORITY_NORMAL
+        PRIORITY_BACKGROUND,  // ANDROID_PRIORITY_BACKGROUND
+        PRIORITY_COUNT,
+    };
+
+    /**
+     * Starts |threadCount| threads, or one per online CPU if it is 0. The
+     * threads are named |name| followed by their index.
+     */
+    explicit ThreadPool(size_t threadCount = 0, const char* name = "ThreadPool");
+
+    /**
+     * Calls shutdown().
+     */
+    virtual ~ThreadPool();
+
+    /**
+     * Queues a task.
+     *
+     * Returns INVALID_OPERATION if the task was submitted before, or if the
+     * pool is shutting down and the caller is not one of its threads.
+     */
+    status_t submit(const sp<Task>& task, Priority priority = PRIORITY_NORMAL);
+
+    /**
+     * Queues a function, and returns the task that holds its result, or NULL
+     * if the pool is shutting down.
+     */
+    template <typename F>
+    sp<FutureTask<typename std::result_of<F()>::type>> async(const F& function,
+            Priority priority = PRIORITY_NORMAL) {
+        sp<FutureTask<typename std::result_of<F()>::type>> task =
+                new FutureTask<typename std::result_of<F()>::type>(function);
+        return submit(task, priority) == OK ? task : NULL;
+    }
+
+    /**
+     * Stops accepting tasks from outside the pool, runs everything already
+     * queued, including tasks those tasks submit, and joins the threads.
+     *
+     * Returns WOULD_BLOCK if called from one of the pool's own threads.
+     */
+    status_t shutdown();
+
+    size_t getThreadCount() const { return mThreadCount; }
+
+    /**
+     * Returns the pool that owns the calling thread, or NULL.
+     */
+    static ThreadPool* getForThread();
+
+private:
+    struct Worker {
+        ThreadPool* pool;
+        size_t index;
+        pthread_t thread;
+        String8 name;
+        int nice;
+        // Guards the queues. Owners take from the back, thieves the front.
+        Mutex lock;
+        std::deque<sp<Task>> queues[PRIORITY_COUNT];
+    };
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    static void* threadMain(void* arg);
+    static Worker* currentWorker();
+
+    void loop(Worker* worker);
+    sp<Task> takeTask(Worker* worker);
+    bool runOneTask(Worker* worker);
+    size_t pendingCount() const;
+
+    const size_t mThreadCount;
+    std::unique_ptr<Worker[]> mWorkers;
+    std::atomic<size_t> mNextWorker;
+    // Queued tasks per priority class, so empty classes are skipped without
+    // looking at every queue.
+    std::atomic<size_t> mPending[PRIORITY_COUNT];
+    std::atomic<size_t> mIdleCount;
+    std::atomic<bool> mStopping;
+    // Outside threads in the middle of submit(), which shutdown() waits out.
+    std::atomic<size_t> mSubmitters;
+
+    Mutex mIdleLock;
+    Condition mIdleCondition;
+    Mutex mShutdownLock;  // serializes shutdown()
+    bool mJoined;
+
+    friend class Task;
+};
+
+} // namespace android
+
+#endif // UTILS_THREAD_POOL_H
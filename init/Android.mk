@@ -45,14 +45,18 @@ include $(CLEAR_VARS)
 LOCAL_CPPFLAGS := $(init_cflags)
 LOCAL_SRC_FILES:= \
     action.cpp \
+    coldboot.cpp \
     import_parser.cpp \
     init_parser.cpp \
     log.cpp \
     parser.cpp \
+    path_matcher.cpp \
+    persistent_properties.cpp \
+    property_server.cpp \
     service.cpp \
     util.cpp \
 
-LOCAL_STATIC_LIBRARIES := libbase
+LOCAL_STATIC_LIBRARIES := libbase libz
 LOCAL_MODULE := libinit
 LOCAL_SANITIZE := integer
 LOCAL_CLANG := true
@@ -117,14 +121,43 @@ include $(BUILD_EXECUTABLE)
 include $(CLEAR_VARS)
 LOCAL_MODULE := init_tests
 LOCAL_SRC_FILES := \
+    action_test.cpp \
+    coldboot_test.cpp \
     init_parser_test.cpp \
+    path_matcher_replay.cpp \
+    path_matcher_test.cpp \
+    persistent_properties_test.cpp \
+    property_server_test.cpp \
     util_test.cpp \
 
 LOCAL_SHARED_LIBRARIES += \
     libcutils \
     libbase \
+    libz \
 
 LOCAL_STATIC_LIBRARIES := libinit
 LOCAL_SANITIZE := integer
 LOCAL_CLANG := true
 include $(BUILD_NATIVE_TEST)
+
+# Build the benchmarks. Run with:
+#   adb shell init_benchmarks
+include $(CLEAR_VARS)
+LOCAL_MODULE := init_benchmarks
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../liblog/tests
+LOCAL_SRC_FILES := \
+    ../liblog/tests/benchmark_main.cpp \
+    action_benchmark.cpp \
+    path_matcher_benchmark.cpp \
+    path_matcher_replay.cpp \
+    persistent_properties_benchmark.cpp \
+    property_server_benchmark.cpp \
+
+LOCAL_SHARED_LIBRARIES += \
+    libcutils \
+    libbase \
+    libz \
+
+LOCAL_STATIC_LIBRARIES := libinit
+LOCAL_CLANG := true
+include $(BUILD_NATIVE_TEST)
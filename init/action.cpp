@@ -18,6 +18,8 @@
 
 #include <errno.h>
 
+#include <algorithm>
+
 #include <base/strings.h>
 #include <base/stringprintf.h>
 
@@ -190,32 +192,35 @@ bool Action::InitSingleTrigger(const std::string& trigger) {
 //
 // It takes an optional (name, value) pair, which if provided must
 // be present in property_triggers_; it skips the check of the current
-// property value for this pair.
+// property value for this pair.  That pair is checked first, as it is the
+// one that usually rules the action out, and costs no property_get().
 bool Action::CheckPropertyTriggers(const std::string& name,
                                    const std::string& value) const {
     if (property_triggers_.empty()) {
         return true;
     }
 
-    bool found = name.empty();
+    if (!name.empty()) {
+        auto it = property_triggers_.find(name);
+        if (it == property_triggers_.end() ||
+            (it->second != "*" && it->second != value)) {
+            return false;
+        }
+    }
+
     for (const auto& t : property_triggers_) {
         const auto& trigger_name = t.first;
         const auto& trigger_value = t.second;
         if (trigger_name == name) {
-            if (trigger_value != "*" && trigger_value != value) {
-                return false;
-            } else {
-                found = true;
-            }
-        } else {
-            std::string prop_val = property_get(trigger_name.c_str());
-            if (prop_val.empty() || (trigger_value != "*" &&
-                                     trigger_value != prop_val)) {
-                return false;
-            }
+            continue;
+        }
+        std::string prop_val = property_get(trigger_name.c_str());
+        if (prop_val.empty() || (trigger_value != "*" &&
+                                 trigger_value != prop_val)) {
+            return false;
         }
     }
-    return found;
+    return true;
 }
 
 bool Action::CheckEventTrigger(const std::string& trigger) const {
@@ -262,6 +267,75 @@ void Action::DumpState() const {
     INFO("\n");
 }
 
+void ActionIndex::Add(Action* action) {
+    if (!action->event_trigger().empty()) {
+        event_actions_[action->event_trigger()].push_back(action);
+        return;
+    }
+    if (action->property_triggers().empty()) {
+        untriggered_actions_.push_back(action);
+        for (auto& it : property_actions_) {
+            it.second.push_back(action);
+        }
+    }
+    for (const auto& t : action->property_triggers()) {
+        auto it = property_actions_.find(t.first);
+        if (it == property_actions_.end()) {
+            // Starts out with the actions added before that match anything.
+            it = property_actions_.emplace(t.first, untriggered_actions_).first;
+        }
+        it->second.push_back(action);
+    }
+    all_property_actions_.push_back(action);
+}
+
+void ActionIndex::Remove(const Action* action) {
+    auto remove_from = [action] (std::vector<Action*>* actions) {
+        actions->erase(std::remove(actions->begin(), actions->end(), action),
+                       actions->end());
+    };
+
+    if (!action->event_trigger().empty()) {
+        auto it = event_actions_.find(action->event_trigger());
+        if (it != event_actions_.end()) {
+            remove_from(&it->second);
+        }
+        return;
+    }
+    if (action->property_triggers().empty()) {
+        remove_from(&untriggered_actions_);
+        for (auto& it : property_actions_) {
+            remove_from(&it.second);
+        }
+    }
+    for (const auto& t : action->property_triggers()) {
+        auto it = property_actions_.find(t.first);
+        if (it != property_actions_.end()) {
+            remove_from(&it->second);
+        }
+    }
+    remove_from(&all_property_actions_);
+}
+
+const std::vector<Action*>& ActionIndex::Find(
+        const std::map<std::string, std::vector<Action*>>& map, const std::string& key) {
+    const static std::vector<Action*> none;
+    auto it = map.find(key);
+    return it != map.end() ? it->second : none;
+}
+
+const std::vector<Action*>& ActionIndex::EventActions(const std::string& trigger) const {
+    return Find(event_actions_, trigger);
+}
+
+const std::vector<Action*>& ActionIndex::PropertyActions(const std::string& name) const {
+    if (name.empty()) {
+        return all_property_actions_;
+    }
+    auto it = property_actions_.find(name);
+    return it != property_actions_.end() ? it->second : untriggered_actions_;
+}
+
 class EventTrigger : public Trigger {
 public:
     EventTrigger(const std::string& trigger) : trigger_(trigger) {
@@ -269,6 +343,9 @@ public:
     bool CheckTriggers(const Action& action) const override {
         return action.CheckEventTrigger(trigger_);
     }
+    const std::vector<Action*>& Candidates(const ActionIndex& index) const override {
+        return index.EventActions(trigger_);
+    }
 private:
     const std::string trigger_;
 };
@@ -281,6 +358,9 @@ public:
     bool CheckTriggers(const Action& action) const override {
         return action.CheckPropertyTrigger(name_, value_);
     }
+    const std::vector<Action*>& Candidates(const ActionIndex& index) const override {
+        return index.PropertyActions(name_);
+    }
 private:
     const std::string name_;
     const std::string value_;
@@ -288,13 +368,26 @@ private:
 
 class BuiltinTrigger : public Trigger {
 public:
-    BuiltinTrigger(Action* action) : action_(action) {
+    BuiltinTrigger(Action* action)
+        : actions_{action}, event_trigger_(action->event_trigger()) {
     }
     bool CheckTriggers(const Action& action) const override {
-        return action_ == &action;
+        return actions_[0] == &action;
+    }
+    const std::vector<Action*>& Candidates(const ActionIndex& index) const override {
+        // An earlier trigger that matched the action has already run and
+        // freed it.
+        const static std::vector<Action*> none;
+        const auto& indexed = event_trigger_.empty() ? index.PropertyActions("")
+                                                     : index.EventActions(event_trigger_);
+        if (std::find(indexed.begin(), indexed.end(), actions_[0]) == indexed.end()) {
+            return none;
+        }
+        return actions_;
     }
 private:
-    const Action* action_;
+    const std::vector<Action*> actions_;
+    const std::string event_trigger_;
 };
 
 ActionManager::ActionManager() : current_command_(0) {
@@ -306,15 +399,23 @@ ActionManager& ActionManager::GetInstance() {
 }
 
 void ActionManager::AddAction(std::unique_ptr<Action> action) {
+    // Any action with the same triggers is indexed under the same event
+    // trigger, or the same first property.
+    const std::vector<Action*>& candidates =
+        !action->event_trigger().empty()
+            ? index_.EventActions(action->event_trigger())
+            : index_.PropertyActions(action->property_triggers().empty()
+                                     ? "" : action->property_triggers().begin()->first);
     auto old_action_it =
-        std::find_if(actions_.begin(), actions_.end(),
-                     [&action] (std::unique_ptr<Action>& a) {
+        std::find_if(candidates.begin(), candidates.end(),
+                     [&action] (Action* a) {
                          return action->TriggersEqual(*a);
                      });
 
-    if (old_action_it != actions_.end()) {
+    if (old_action_it != candidates.end()) {
         (*old_action_it)->CombineAction(*action);
     } else {
+        index_.Add(action.get());
         actions_.emplace_back(std::move(action));
     }
 }
@@ -344,15 +445,17 @@ void ActionManager::QueueBuiltinAction(BuiltinFunction func,
     action->AddCommand(func, name_vector);
 
     trigger_queue_.push(std::make_unique<BuiltinTrigger>(action.get()));
+    index_.Add(action.get());
     actions_.emplace_back(std::move(action));
 }
 
 void ActionManager::ExecuteOneCommand() {
     // Loop through the trigger queue until we have an action to execute
     while (current_executing_actions_.empty() && !trigger_queue_.empty()) {
-        for (const auto& action : actions_) {
-            if (trigger_queue_.front()->CheckTriggers(*action)) {
-                current_executing_actions_.emplace(action.get());
+        const auto& trigger = trigger_queue_.front();
+        for (const auto action : trigger->Candidates(index_)) {
+            if (trigger->CheckTriggers(*action)) {
+                current_executing_actions_.emplace(action);
             }
         }
         trigger_queue_.pop();
@@ -379,6 +482,7 @@ void ActionManager::ExecuteOneCommand() {
         current_executing_actions_.pop();
         current_command_ = 0;
         if (action->oneshot()) {
+            index_.Remove(action);
             auto eraser = [&action] (std::unique_ptr<Action>& a) {
                 return a.get() == action;
             };
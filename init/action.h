@@ -65,6 +65,10 @@ public:
     void DumpState() const;
 
     bool oneshot() const { return oneshot_; }
+    const std::string& event_trigger() const { return event_trigger_; }
+    const std::map<std::string, std::string>& property_triggers() const {
+        return property_triggers_;
+    }
     static void set_function_map(const KeywordMap<BuiltinFunction>* function_map) {
         function_map_ = function_map;
     }
@@ -83,14 +87,43 @@ private:
     static const KeywordMap<BuiltinFunction>* function_map_;
 };
 
+// Actions by the triggers that can start them, so that a queued trigger
+// only checks the actions that name it.  Every list keeps the order the
+// actions were added in, which is the order they run in.
+class ActionIndex {
+public:
+    void Add(Action* action);
+    void Remove(const Action* action);
+
+    const std::vector<Action*>& EventActions(const std::string& trigger) const;
+    // Actions without an event trigger that have a trigger on |name|, or
+    // all of them if |name| is empty.  Actions without any trigger at all
+    // match every property change, so they are in every one of these lists.
+    const std::vector<Action*>& PropertyActions(const std::string& name) const;
+
+private:
+    static const std::vector<Action*>& Find(
+        const std::map<std::string, std::vector<Action*>>& map, const std::string& key);
+
+    std::map<std::string, std::vector<Action*>> event_actions_;
+    std::map<std::string, std::vector<Action*>> property_actions_;
+    std::vector<Action*> all_property_actions_;
+    std::vector<Action*> untriggered_actions_;
+};
+
 class Trigger {
 public:
     virtual ~Trigger() { }
     virtual bool CheckTriggers(const Action& action) const = 0;
+    // The actions CheckTriggers() may be true for.
+    virtual const std::vector<Action*>& Candidates(const ActionIndex& index) const = 0;
 };
 
 class ActionManager {
 public:
+    // init uses the one from GetInstance(); tests make their own.
+    ActionManager();
+
     static ActionManager& GetInstance();
 
     void AddAction(std::unique_ptr<Action> action);
@@ -103,12 +136,11 @@ public:
     void DumpState() const;
 
 private:
-    ActionManager();
-
     ActionManager(ActionManager const&) = delete;
     void operator=(ActionManager const&) = delete;
 
     std::vector<std::unique_ptr<Action>> actions_;
+    ActionIndex index_;
     std::queue<std::unique_ptr<Trigger>> trigger_queue_;
     std::queue<const Action*> current_executing_actions_;
     std::size_t current_command_;
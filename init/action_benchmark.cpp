@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "action.h"
+
+#include "init_parser.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <base/macros.h>
+#include <base/stringprintf.h>
+
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+using android::base::StringPrintf;
+
+// property_service.cpp is not part of libinit: property triggers are
+// checked against these instead.
+static std::map<std::string, std::string> properties;
+
+std::string property_get(const char* name) {
+    auto it = properties.find(name);
+    return it != properties.end() ? it->second : "";
+}
+
+static int do_nop(const std::vector<std::string>& args) {
+    return 0;
+}
+
+class NopFunctionMap : public KeywordMap<BuiltinFunction> {
+private:
+    Map& map() const override {
+        constexpr std::size_t kMax = std::numeric_limits<std::size_t>::max();
+        static const Map nop_map = {
+            {"nop", {0, kMax, do_nop}},
+        };
+        return nop_map;
+    }
+};
+
+static const char* kEventTriggers[] = {
+    "early-init", "init", "late-init", "early-fs", "fs", "post-fs", "post-fs-data",
+    "zygote-start", "early-boot", "boot", "charger", "nonencrypted",
+    "load_persist_props_action", "firmware_mounts_complete", "verity-logging",
+    "load_system_props_action", "restart_framework", "shutdown",
+};
+
+// Writes .rc files about the size of a device's init.rc plus vendor and
+// hardware ones: 12 files, ~1500 "on" sections, a third of them on event
+// triggers, the rest on one or two of ~500 properties.
+static void WriteRcFiles(const std::string& dir, std::vector<std::string>* trigger_props) {
+    unsigned int seed = 1;
+    auto rand = [&seed](unsigned int n) { return (seed = seed * 1103515245 + 12345) / 65536 % n; };
+    for (int i = 0; i < 500; i++) {
+        trigger_props->push_back(StringPrintf("vendor.hw%d.state%d", i % 40, i));
+    }
+    for (int file = 0; file < 12; file++) {
+        std::string data;
+        for (int section = 0; section < 125; section++) {
+            const std::string& prop = (*trigger_props)[rand(trigger_props->size())];
+            const char* value = rand(4) == 0 ? "*" : (rand(2) ? "1" : "0");
+            switch (rand(6)) {
+            case 0:
+            case 1:
+                data += StringPrintf("on %s\n", kEventTriggers[rand(arraysize(kEventTriggers))]);
+                break;
+            case 2:
+                data += StringPrintf("on %s && property:%s=%s\n",
+                                     kEventTriggers[rand(arraysize(kEventTriggers))],
+                                     prop.c_str(), value);
+                break;
+            case 3:
+                data += StringPrintf("on property:%s=%s && property:%s=1\n", prop.c_str(), value,
+                                     (*trigger_props)[rand(trigger_props->size())].c_str());
+                break;
+            default:
+                data += StringPrintf("on property:%s=%s\n", prop.c_str(), value);
+                break;
+            }
+            for (int command = 0; command < 3; command++) {
+                data += StringPrintf("    nop /sys/class/x%d/y %d\n", section, command);
+            }
+            data += "\n";
+        }
+        std::string path = StringPrintf("%s/init.vendor%d.rc", dir.c_str(), file);
+        if (write_file(path.c_str(), data.c_str()) != 0) {
+            abort();
+        }
+    }
+}
+
+// One trigger of a boot's worth of property traffic: an event, or a set of
+// |name| to |value|.
+struct ReplayTrigger {
+    const char* event;
+    std::string name;
+    std::string value;
+};
+
+// Loads the .rc files into init's own ActionManager, once, and returns the
+// triggers of a boot to replay against it: the event triggers in order,
+// interleaved with 20000 sets, 70% of them of properties no action is
+// waiting on.
+static const std::vector<ReplayTrigger>& LoadBoot() {
+    static std::vector<ReplayTrigger> replay;
+    if (!replay.empty()) {
+        return replay;
+    }
+
+    static const NopFunctionMap function_map;
+    Action::set_function_map(&function_map);
+
+    char dir[] = "/data/local/tmp/action_benchmark.XXXXXX";
+    char host_dir[] = "/tmp/action_benchmark.XXXXXX";
+    char* rc_dir = mkdtemp(dir) ? dir : mkdtemp(host_dir);
+    if (rc_dir == nullptr) {
+        abort();
+    }
+    std::vector<std::string> trigger_props;
+    WriteRcFiles(rc_dir, &trigger_props);
+    Parser& parser = Parser::GetInstance();
+    parser.AddSectionParser("on", std::make_unique<ActionParser>());
+    if (!parser.ParseConfig(rc_dir)) {
+        abort();
+    }
+    for (int file = 0; file < 12; file++) {
+        unlink(StringPrintf("%s/init.vendor%d.rc", rc_dir, file).c_str());
+    }
+    rmdir(rc_dir);
+
+    unsigned int seed = 2;
+    auto rand = [&seed](unsigned int n) { return (seed = seed * 1103515245 + 12345) / 65536 % n; };
+    static const int kSets = 20000;
+    const size_t sets_per_event = kSets / arraysize(kEventTriggers) + 1;
+    for (int i = 0; i < kSets; i++) {
+        if (i % sets_per_event == 0) {
+            replay.push_back({kEventTriggers[i / sets_per_event], "", ""});
+        }
+        std::string name = rand(10) < 3
+            ? trigger_props[rand(trigger_props.size())]
+            : StringPrintf("persist.sys.setting%d", rand(2000));
+        replay.push_back({nullptr, name, rand(2) ? "1" : "0"});
+    }
+    return replay;
+}
+
+// Queues the triggers of a boot one at a time, running the commands of the
+// actions each one starts.
+static void BM_action_boot_replay(int iters) {
+    const std::vector<ReplayTrigger>& replay = LoadBoot();
+    ActionManager& am = ActionManager::GetInstance();
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        const ReplayTrigger& trigger = replay[i % replay.size()];
+        if (trigger.event != nullptr) {
+            am.QueueEventTrigger(trigger.event);
+        } else {
+            properties[trigger.name] = trigger.value;
+            am.QueuePropertyTrigger(trigger.name, trigger.value);
+        }
+        while (am.HasMoreCommands()) {
+            am.ExecuteOneCommand();
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_action_boot_replay);
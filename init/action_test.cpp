@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "action.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// property_service.cpp is not part of libinit: property triggers are
+// checked against these instead.
+static std::map<std::string, std::string> properties;
+
+std::string property_get(const char* name) {
+    auto it = properties.find(name);
+    return it != properties.end() ? it->second : "";
+}
+
+static std::vector<std::string> recorded;
+
+static int do_record(const std::vector<std::string>& args) {
+    recorded.push_back(args[1]);
+    return 0;
+}
+
+class TestFunctionMap : public KeywordMap<BuiltinFunction> {
+private:
+    Map& map() const override {
+        static const Map test_map = {
+            {"record", {1, 1, do_record}},
+        };
+        return test_map;
+    }
+};
+
+class ActionManagerTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        static const TestFunctionMap function_map;
+        Action::set_function_map(&function_map);
+        properties.clear();
+        recorded.clear();
+    }
+
+    // Adds "on <triggers>" with one "record <name>" command.
+    void AddAction(const std::vector<std::string>& triggers, const std::string& name) {
+        auto action = std::make_unique<Action>(false);
+        std::string err;
+        ASSERT_TRUE(action->InitTriggers(triggers, &err)) << err;
+        ASSERT_TRUE(action->AddCommand({"record", name}, "test.rc", 1, &err)) << err;
+        am_.AddAction(std::move(action));
+    }
+
+    std::vector<std::string> Run() {
+        recorded.clear();
+        while (am_.HasMoreCommands()) {
+            am_.ExecuteOneCommand();
+        }
+        return recorded;
+    }
+
+    ActionManager am_;
+};
+
+TEST_F(ActionManagerTest, EventTriggers) {
+    AddAction({"boot"}, "a");
+    AddAction({"early-init"}, "b");
+    AddAction({"boot", "&&", "property:ro.x=1"}, "c");
+    AddAction({"boot"}, "d");  // joins "a"
+    AddAction({"property:boot=1"}, "e");
+
+    am_.QueueEventTrigger("boot");
+    EXPECT_EQ(std::vector<std::string>({"a", "d"}), Run());
+
+    properties["ro.x"] = "1";
+    am_.QueueEventTrigger("boot");
+    am_.QueueEventTrigger("early-init");
+    am_.QueueEventTrigger("nothing");
+    EXPECT_EQ(std::vector<std::string>({"a", "d", "c", "b"}), Run());
+}
+
+TEST_F(ActionManagerTest, PropertyTriggers) {
+    AddAction({"property:a=1"}, "a=1");
+    AddAction({"property:a=*"}, "a=*");
+    AddAction({"property:b=2", "&&", "property:a=1"}, "a=1,b=2");
+    AddAction({"property:b=2"}, "b=2");
+    AddAction({"boot", "&&", "property:a=1"}, "boot,a=1");
+
+    properties["a"] = "1";
+    am_.QueuePropertyTrigger("a", "1");
+    EXPECT_EQ(std::vector<std::string>({"a=1", "a=*"}), Run());
+
+    properties["b"] = "2";
+    am_.QueuePropertyTrigger("b", "2");
+    EXPECT_EQ(std::vector<std::string>({"a=1,b=2", "b=2"}), Run());
+
+    properties["a"] = "0";
+    am_.QueuePropertyTrigger("a", "0");
+    am_.QueuePropertyTrigger("c", "1");
+    EXPECT_EQ(std::vector<std::string>({"a=*"}), Run());
+
+    // Every property action whose properties all match, in the order
+    // they were added.
+    properties["a"] = "1";
+    am_.QueueAllPropertyTriggers();
+    EXPECT_EQ(std::vector<std::string>({"a=1", "a=*", "a=1,b=2", "b=2"}), Run());
+}
+
+static int do_builtin(const std::vector<std::string>& args) {
+    recorded.push_back("builtin " + args[0]);
+    return 0;
+}
+
+TEST_F(ActionManagerTest, BuiltinActionsRunOnce) {
+    AddAction({"wait_for_coldboot_done"}, "rc");
+    am_.QueueBuiltinAction(do_builtin, "wait_for_coldboot_done");
+    am_.QueueEventTrigger("wait_for_coldboot_done");
+    am_.QueueEventTrigger("wait_for_coldboot_done");
+    // Until it has run, the builtin action also answers its name as an
+    // event trigger; after that, it is gone.
+    EXPECT_EQ(std::vector<std::string>({"builtin wait_for_coldboot_done", "rc",
+                                        "rc"}), Run());
+}
+
+TEST_F(ActionManagerTest, BuiltinActionRunByAnEarlierTrigger) {
+    am_.QueueEventTrigger("console_init");
+    am_.QueueBuiltinAction(do_builtin, "console_init");
+    // The event trigger runs it, and the builtin's own trigger then finds
+    // nothing to run.
+    EXPECT_EQ(std::vector<std::string>({"builtin console_init"}), Run());
+}
+
+TEST_F(ActionManagerTest, BuiltinActionsWithoutTriggersMatchEveryPropertyChange) {
+    AddAction({"property:a=1"}, "a=1");
+    properties["a"] = "1";
+
+    // Queued ahead of the builtin's own trigger, a change to a property no
+    // action waits on runs it.
+    am_.QueuePropertyTrigger("c", "1");
+    am_.QueueBuiltinAction(do_builtin, "");
+    EXPECT_EQ(std::vector<std::string>({"builtin "}), Run());
+
+    // So does one that other actions wait on, in the order they were added.
+    am_.QueuePropertyTrigger("a", "1");
+    am_.QueueBuiltinAction(do_builtin, "");
+    AddAction({"property:a=*"}, "a=*");
+    EXPECT_EQ(std::vector<std::string>({"a=1", "builtin ", "a=*"}), Run());
+}
@@ -608,6 +608,7 @@ static int do_powerctl(const std::vector<std::string>& args) {
         return -EINVAL;
     }
 
+    sync_persistent_properties();
     return android_reboot_with_callback(cmd, 0, reboot_target,
                                         callback_on_ro_remount);
 }
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "coldboot.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+#include "log.h"
+
+// Directories still to be walked, shared by the walking threads.
+class WalkQueue {
+public:
+    WalkQueue(const std::vector<std::string>& roots)
+        : paths_(roots.rbegin(), roots.rend()), pending_(roots.size()) {
+    }
+
+    // Takes the next directory, or returns false once the walk is over.
+    bool Pop(std::string* path) {
+        std::unique_lock<std::mutex> lock(lock_);
+        cond_.wait(lock, [this] { return !paths_.empty() || pending_ == 0; });
+        if (paths_.empty()) {
+            return false;
+        }
+        *path = std::move(paths_.back());
+        paths_.pop_back();
+        return true;
+    }
+
+    // Replaces a directory that was popped with its subdirectories.
+    void Done(std::vector<std::string>* subdirs) {
+        std::lock_guard<std::mutex> lock(lock_);
+        pending_ += subdirs->size();
+        std::move(subdirs->rbegin(), subdirs->rend(), std::back_inserter(paths_));
+        if (--pending_ == 0 || !subdirs->empty()) {
+            cond_.notify_all();
+        }
+    }
+
+    bool finished() {
+        std::lock_guard<std::mutex> lock(lock_);
+        return pending_ == 0;
+    }
+
+private:
+    std::mutex lock_;
+    std::condition_variable cond_;
+    std::vector<std::string> paths_;
+    // Directories pushed but not finished with yet.
+    size_t pending_;
+};
+
+// Events asked for and not read yet. Walking threads take a slot before
+// each visit and block while there are none; draining gives them back.
+class InFlight {
+public:
+    InFlight(size_t max) : max_(max), visiting_(0), unread_(0) {
+    }
+
+    void Acquire() {
+        std::unique_lock<std::mutex> lock(lock_);
+        cond_.wait(lock, [this] { return visiting_ + unread_ < max_; });
+        visiting_++;
+    }
+
+    // Ends a visit that |poked| or not.
+    void Visited(bool poked) {
+        std::lock_guard<std::mutex> lock(lock_);
+        visiting_--;
+        unread_ += poked;
+        cond_.notify_all();
+    }
+
+    void Read(size_t n) {
+        std::lock_guard<std::mutex> lock(lock_);
+        unread_ -= std::min(n, unread_);
+        cond_.notify_all();
+    }
+
+    // The kernel queues an event before the write that asked for it
+    // returns, so with nothing left to read, those of finished visits were
+    // lost.
+    void Lost() {
+        Read(SIZE_MAX);
+    }
+
+private:
+    std::mutex lock_;
+    std::condition_variable cond_;
+    const size_t max_;
+    // Visits under way, whose events may or may not have been read.
+    size_t visiting_;
+    size_t unread_;
+};
+
+// Visits the directory at |path|, then calls |subdir| with the path of
+// each of its subdirectories. Returns false if it could not be opened.
+static bool walk_one(const std::string& path, const std::function<void(int)>& visit,
+                     const std::function<void(std::string&&)>& subdir) {
+    DIR* d = opendir(path.c_str());
+    if (d == nullptr) {
+        return false;
+    }
+
+    visit(dirfd(d));
+
+    struct dirent* de;
+    while ((de = readdir(d))) {
+        if (de->d_type != DT_DIR || de->d_name[0] == '.') {
+            continue;
+        }
+        subdir(path + "/" + de->d_name);
+    }
+    closedir(d);
+    return true;
+}
+
+size_t coldboot_walk(const std::vector<std::string>& roots, unsigned threads,
+                     size_t max_in_flight, const std::function<bool(int dfd)>& visit,
+                     const std::function<size_t()>& drain) {
+    size_t visited = 0;
+
+    if (threads <= 1) {
+        // Depth first, like it always was.
+        std::function<void(std::string&&)> walk = [&](std::string&& path) {
+            visited += walk_one(path, [&](int dfd) {
+                visit(dfd);
+                drain();
+            }, walk);
+        };
+        for (const auto& root : roots) {
+            walk(std::string(root));
+        }
+        return visited;
+    }
+
+    WalkQueue queue(roots);
+    InFlight in_flight(std::max<size_t>(max_in_flight, 1));
+    auto limited_visit = [&](int dfd) {
+        in_flight.Acquire();
+        in_flight.Visited(visit(dfd));
+    };
+    std::mutex visited_lock;
+    std::vector<std::thread> walkers;
+    for (unsigned i = 0; i < threads; i++) {
+        walkers.emplace_back([&]() {
+            size_t count = 0;
+            std::string path;
+            std::vector<std::string> subdirs;
+            while (queue.Pop(&path)) {
+                count += walk_one(path, limited_visit, [&subdirs](std::string&& subdir) {
+                    subdirs.push_back(std::move(subdir));
+                });
+                queue.Done(&subdirs);
+                subdirs.clear();
+            }
+            std::lock_guard<std::mutex> lock(visited_lock);
+            visited += count;
+        });
+    }
+
+    while (!queue.finished()) {
+        size_t drained = drain();
+        if (drained == 0) {
+            in_flight.Lost();
+        } else {
+            in_flight.Read(drained);
+        }
+    }
+    for (auto& walker : walkers) {
+        walker.join();
+    }
+    drain();
+    return visited;
+}
+
+void coldboot_handle(const std::vector<std::string>& events, unsigned workers,
+                     const std::function<bool(const std::string&)>& handle_first,
+                     const std::function<void(const std::string&)>& handle) {
+    std::vector<std::vector<const std::string*>> shares(workers > 0 ? workers : 1);
+    size_t next = 0;
+    for (const auto& event : events) {
+        if (handle_first(event)) {
+            handle(event);
+        } else {
+            shares[next++ % shares.size()].push_back(&event);
+        }
+    }
+
+    if (shares.size() == 1) {
+        for (auto event : shares[0]) {
+            handle(*event);
+        }
+        return;
+    }
+
+    // ueventd ignores SIGCHLD, which would make the workers impossible to
+    // wait for.
+    struct sigaction old_action;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &action, &old_action);
+
+    std::vector<pid_t> pids;
+    for (const auto& share : shares) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            for (auto event : share) {
+                handle(*event);
+            }
+            _exit(0);
+        }
+        if (pid == -1) {
+            ERROR("coldboot: could not fork a worker: %s\n", strerror(errno));
+            for (auto event : share) {
+                handle(*event);
+            }
+            continue;
+        }
+        pids.push_back(pid);
+    }
+
+    for (pid_t pid : pids) {
+        int status;
+        if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) == -1) {
+            ERROR("coldboot: waitpid %d failed: %s\n", pid, strerror(errno));
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ERROR("coldboot: worker %d failed with status %#x\n", pid, status);
+        }
+    }
+
+    sigaction(SIGCHLD, &old_action, nullptr);
+}
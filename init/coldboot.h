@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_COLDBOOT_H
+#define _INIT_COLDBOOT_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Walks the directory trees under |roots| with |threads| threads, calling
+// |visit| with an open fd for every directory. A directory is always
+// visited before its subdirectories; symlinks are not followed. |visit|
+// returns true if it asked the kernel for an event.
+//
+// |drain| is called on the calling thread over and over while the walk goes
+// on, and once more at the end, so that it can empty the uevent socket as
+// the kernel fills it; it should block for a little while when there is
+// nothing to read, and returns the number of events it read. No more than
+// |max_in_flight| events are asked for and not yet read at any time, so
+// that the socket's buffer cannot overflow however many threads there are;
+// once |drain| finds nothing to read, any that are missing are given up on.
+// With one thread, the walk runs on the calling thread and |drain| is
+// called after each directory instead.
+//
+// Returns the number of directories visited.
+size_t coldboot_walk(const std::vector<std::string>& roots, unsigned threads,
+                     size_t max_in_flight, const std::function<bool(int dfd)>& visit,
+                     const std::function<size_t()>& drain);
+
+// Hands |events| to |handle|: first, in this process and in order, those
+// for which |handle_first| is true, then the rest split between |workers|
+// forked processes. Each worker handles its share in the order given, so
+// an event is never handled before one that came earlier for the same
+// worker. Falls back to handling a share in this process if the worker
+// cannot be forked.
+//
+// Anything |handle| keeps in memory is lost with the worker it ran in:
+// events whose handling later ones depend on, like platform devices, have
+// to be handled first.
+void coldboot_handle(const std::vector<std::string>& events, unsigned workers,
+                     const std::function<bool(const std::string&)>& handle_first,
+                     const std::function<void(const std::string&)>& handle);
+
+#endif
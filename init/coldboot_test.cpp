@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "coldboot.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <base/file.h>
+#include <base/stringprintf.h>
+#include <base/strings.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+using android::base::StringPrintf;
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+static std::string FdPath(int fd) {
+    char path[PATH_MAX];
+    ssize_t len = readlink(StringPrintf("/proc/self/fd/%d", fd).c_str(), path, sizeof(path) - 1);
+    return std::string(path, len > 0 ? len : 0);
+}
+
+// A scratch directory standing in for /sys, with a uevent file in every
+// device directory.
+class ColdbootTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        const char* tmpdir = getenv("TMPDIR");
+        root_ = std::string(tmpdir ? tmpdir : "/data/local/tmp") + "/coldboot_test.XXXXXX";
+        ASSERT_TRUE(mkdtemp(&root_[0]) != nullptr);
+    }
+
+    virtual void TearDown() {
+        nftw(root_.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    void AddDevice(const std::string& path) {
+        std::string dir = root_;
+        for (const auto& part : android::base::Split(path.substr(1), "/")) {
+            dir += "/" + part;
+            mkdir(dir.c_str(), 0755);
+        }
+        ASSERT_TRUE(android::base::WriteStringToFile("", dir + "/uevent"));
+    }
+
+    // Something like /sys/devices on a phone: a few buses with nested
+    // devices, and deep chains of them.
+    void AddDevices(std::vector<std::string>* paths) {
+        for (int bus = 0; bus < 4; bus++) {
+            for (int dev = 0; dev < 10; dev++) {
+                for (int child = 0; child < 5; child++) {
+                    std::string path = StringPrintf("/sys/devices/platform/bus%d/dev%d/sub%d",
+                                                    bus, dev, child);
+                    if (child == 0) {
+                        path += "/deep/er/and/deeper";
+                    }
+                    AddDevice(path);
+                    paths->push_back(path);
+                }
+            }
+        }
+        AddDevice("/sys/class/misc");
+        paths->push_back("/sys/class/misc");
+    }
+
+    std::string root_;
+};
+
+TEST_F(ColdbootTest, WalkVisitsParentsBeforeChildren) {
+    std::vector<std::string> devices;
+    AddDevices(&devices);
+    // Neither symlinks nor dot directories are followed.
+    ASSERT_EQ(0, symlink((root_ + "/sys/devices/platform").c_str(),
+                         (root_ + "/sys/class/misc/link").c_str()));
+    AddDevice("/sys/devices/.hidden");
+
+    for (unsigned threads : { 1, 4 }) {
+        std::mutex lock;
+        std::map<std::string, int> order;
+        std::atomic<int> drains(0);
+        size_t visited = coldboot_walk(
+            { root_ + "/sys/class", root_ + "/sys/block", root_ + "/sys/devices" }, threads, 8,
+            [&](int dfd) {
+                int fd = openat(dfd, "uevent", O_WRONLY | O_APPEND | O_CLOEXEC);
+                if (fd >= 0) {
+                    write(fd, "add\n", 4);
+                    close(fd);
+                }
+                std::lock_guard<std::mutex> guard(lock);
+                EXPECT_TRUE(order.emplace(FdPath(dfd).substr(root_.size()), order.size()).second);
+                return false;
+            },
+            [&]() -> size_t {
+                drains++;
+                if (threads > 1) usleep(1000);
+                return 0;
+            });
+
+        // /sys/block does not exist here.
+        EXPECT_EQ(order.size(), visited);
+        EXPECT_GT(drains.load(), 0);
+        EXPECT_EQ(0U, order.count("/sys/devices/.hidden"));
+        EXPECT_EQ(0U, order.count("/sys/class/misc/link"));
+        for (const auto& entry : order) {
+            std::string parent = entry.first.substr(0, entry.first.rfind('/'));
+            if (order.count(parent)) {
+                EXPECT_LT(order[parent], entry.second) << entry.first;
+            }
+        }
+        for (const auto& device : devices) {
+            ASSERT_EQ(1U, order.count(device)) << device;
+            std::string uevent;
+            ASSERT_TRUE(android::base::ReadFileToString(root_ + device + "/uevent", &uevent));
+            EXPECT_EQ(threads == 1 ? "add\n" : "add\nadd\n", uevent) << device;
+        }
+    }
+}
+
+// Stands in for the uevent socket: a poke queues an event, unless the
+// buffer is full, and a drain reads a few of them.
+class FakeUeventSocket {
+public:
+    explicit FakeUeventSocket(size_t capacity)
+        : capacity_(capacity), queued_(0), max_queued_(0), lost_(0) {
+    }
+
+    bool Poke(int dfd) {
+        int fd = openat(dfd, "uevent", O_WRONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        close(fd);
+        std::lock_guard<std::mutex> guard(lock_);
+        if (queued_ == capacity_) {
+            lost_++;
+        } else {
+            max_queued_ = std::max(max_queued_, ++queued_);
+        }
+        return true;
+    }
+
+    // Slower than the walk, as ueventd is when it has many threads poking.
+    size_t Drain() {
+        usleep(1000);
+        std::lock_guard<std::mutex> guard(lock_);
+        size_t n = std::min<size_t>(queued_, 4);
+        queued_ -= n;
+        return n;
+    }
+
+    size_t max_queued() const { return max_queued_; }
+    size_t lost() const { return lost_; }
+
+private:
+    std::mutex lock_;
+    const size_t capacity_;
+    size_t queued_;
+    size_t max_queued_;
+    size_t lost_;
+};
+
+TEST_F(ColdbootTest, WalkBoundsEventsInFlight) {
+    std::vector<std::string> devices;
+    AddDevices(&devices);
+
+    FakeUeventSocket socket(16);
+    size_t visited = coldboot_walk({ root_ + "/sys" }, 4, 8,
+                                   [&](int dfd) { return socket.Poke(dfd); },
+                                   [&]() { return socket.Drain(); });
+    EXPECT_LT(devices.size(), visited);
+    EXPECT_EQ(0U, socket.lost());
+    EXPECT_LE(socket.max_queued(), 8U);
+    EXPECT_GT(socket.max_queued(), 0U);
+}
+
+TEST_F(ColdbootTest, WalkGivesUpOnLostEvents) {
+    std::vector<std::string> devices;
+    AddDevices(&devices);
+
+    // The kernel drops everything: once a drain comes up empty, the walk
+    // goes on rather than waiting for them.
+    std::atomic<size_t> pokes(0);
+    size_t visited = coldboot_walk({ root_ + "/sys" }, 4, 8,
+                                   [&](int) { pokes++; return true; },
+                                   []() -> size_t { usleep(1000); return 0; });
+    EXPECT_EQ(visited, pokes.load());
+    EXPECT_LT(devices.size(), visited);
+}
+
+TEST_F(ColdbootTest, HandleRunsFirstEventsHereAndSplitsTheRest) {
+    std::vector<std::string> events;
+    for (int i = 0; i < 200; i++) {
+        events.push_back(StringPrintf(i % 20 == 0 ? "platform %d" : "device %d", i));
+    }
+    std::string log = root_ + "/log";
+    int log_fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    ASSERT_GE(log_fd, 0);
+
+    pid_t self = getpid();
+    std::vector<std::string> handled_here;
+    coldboot_handle(events, 4,
+        [](const std::string& event) { return event.compare(0, 8, "platform") == 0; },
+        [&](const std::string& event) {
+            if (getpid() == self) {
+                handled_here.push_back(event);
+            }
+            std::string line = StringPrintf("%d %s\n", getpid(), event.c_str());
+            write(log_fd, line.data(), line.size());
+        });
+    close(log_fd);
+
+    std::string data;
+    ASSERT_TRUE(android::base::ReadFileToString(log, &data));
+    std::vector<std::string> lines = android::base::Split(data, "\n");
+    lines.pop_back();
+    ASSERT_EQ(events.size(), lines.size());
+
+    // The platform events came first, from this process, in order.
+    ASSERT_EQ(10U, handled_here.size());
+    for (size_t i = 0; i < handled_here.size(); i++) {
+        EXPECT_EQ(StringPrintf("platform %zu", i * 20), handled_here[i]);
+        EXPECT_EQ(StringPrintf("%d platform %zu", self, i * 20), lines[i]);
+    }
+
+    // Then each worker took its share, in the order given.
+    std::map<std::string, int> last;
+    std::set<std::string> seen;
+    for (size_t i = handled_here.size(); i < lines.size(); i++) {
+        size_t space = lines[i].find(' ');
+        std::string pid = lines[i].substr(0, space);
+        int n = atoi(lines[i].c_str() + space + 8);
+        EXPECT_NE(StringPrintf("%d", self), pid);
+        EXPECT_TRUE(seen.insert(lines[i].substr(space + 1)).second) << lines[i];
+        if (last.count(pid)) {
+            EXPECT_LT(last[pid], n);
+        }
+        last[pid] = n;
+    }
+    EXPECT_EQ(190U, seen.size());
+    EXPECT_EQ(4U, last.size());
+}
@@ -15,7 +15,6 @@
  */
 
 #include <errno.h>
-#include <fnmatch.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +23,7 @@
 
 #include <fcntl.h>
 #include <dirent.h>
+#include <poll.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -43,7 +43,13 @@
 #include <cutils/list.h>
 #include <cutils/uevent.h>
 
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "coldboot.h"
 #include "devices.h"
+#include "path_matcher.h"
 #include "ueventd_parser.h"
 #include "util.h"
 #include "log.h"
@@ -79,11 +85,6 @@ struct perms_ {
     unsigned short wildcard;
 };
 
-struct perm_node {
-    struct perms_ dp;
-    struct listnode plist;
-};
-
 struct platform_node {
     char *name;
     char *path;
@@ -91,38 +92,44 @@ struct platform_node {
     struct listnode list;
 };
 
-static list_declare(sys_perms);
-static list_declare(dev_perms);
+// The rules from ueventd.rc, in order, and their patterns compiled into
+// matchers; sys_matcher holds the sys_perms names without their "/sys".
+static std::vector<perms_> sys_perms;
+static std::vector<perms_> dev_perms;
+static PathMatcher sys_matcher;
+static PathMatcher dev_matcher;
 static list_declare(platform_names);
 
 int add_dev_perms(const char *name, const char *attr,
                   mode_t perm, unsigned int uid, unsigned int gid,
                   unsigned short prefix,
                   unsigned short wildcard) {
-    struct perm_node *node = (perm_node*) calloc(1, sizeof(*node));
-    if (!node)
-        return -ENOMEM;
+    struct perms_ dp;
 
-    node->dp.name = strdup(name);
-    if (!node->dp.name)
+    dp.name = strdup(name);
+    if (!dp.name)
         return -ENOMEM;
 
+    dp.attr = NULL;
     if (attr) {
-        node->dp.attr = strdup(attr);
-        if (!node->dp.attr)
+        dp.attr = strdup(attr);
+        if (!dp.attr)
             return -ENOMEM;
     }
 
-    node->dp.perm = perm;
-    node->dp.uid = uid;
-    node->dp.gid = gid;
-    node->dp.prefix = prefix;
-    node->dp.wildcard = wildcard;
+    dp.perm = perm;
+    dp.uid = uid;
+    dp.gid = gid;
+    dp.prefix = prefix;
+    dp.wildcard = wildcard;
 
-    if (attr)
-        list_add_tail(&sys_perms, &node->plist);
-    else
-        list_add_tail(&dev_perms, &node->plist);
+    if (attr) {
+        sys_perms.push_back(dp);
+        sys_matcher.Add(name + 4, prefix, wildcard);
+    } else {
+        dev_perms.push_back(dp);
+        dev_matcher.Add(name, prefix, wildcard);
+    }
 
     return 0;
 }
@@ -130,24 +137,14 @@ int add_dev_perms(const char *name, const char *attr,
 void fixup_sys_perms(const char *upath)
 {
     char buf[512];
-    struct listnode *node;
-    struct perms_ *dp;
+    std::vector<int> rules;
 
     /* upaths omit the "/sys" that paths in this list
-     * contain, so we add 4 when comparing...
+     * contain, which sys_matcher does too.
      */
-    list_for_each(node, &sys_perms) {
-        dp = &(node_to_item(node, struct perm_node, plist))->dp;
-        if (dp->prefix) {
-            if (strncmp(upath, dp->name + 4, strlen(dp->name + 4)))
-                continue;
-        } else if (dp->wildcard) {
-            if (fnmatch(dp->name + 4, upath, FNM_PATHNAME) != 0)
-                continue;
-        } else {
-            if (strcmp(upath, dp->name + 4))
-                continue;
-        }
+    sys_matcher.FindAll(upath, &rules);
+    for (int rule : rules) {
+        struct perms_ *dp = &sys_perms[rule];
 
         if ((strlen(upath) + strlen(dp->attr) + 6) > sizeof(buf))
             break;
@@ -170,58 +167,20 @@ void fixup_sys_perms(const char *upath)
     }
 }
 
-static bool perm_path_matches(const char *path, struct perms_ *dp)
-{
-    if (dp->prefix) {
-        if (strncmp(path, dp->name, strlen(dp->name)) == 0)
-            return true;
-    } else if (dp->wildcard) {
-        if (fnmatch(dp->name, path, FNM_PATHNAME) == 0)
-            return true;
-    } else {
-        if (strcmp(path, dp->name) == 0)
-            return true;
-    }
-
-    return false;
-}
-
 static mode_t get_device_perm(const char *path, const char **links,
                 unsigned *uid, unsigned *gid)
 {
-    struct listnode *node;
-    struct perm_node *perm_node;
-    struct perms_ *dp;
-
-    /* search the perms list in reverse so that ueventd.$hardware can
+    /* the last rule to match wins, so that ueventd.$hardware can
      * override ueventd.rc
      */
-    list_for_each_reverse(node, &dev_perms) {
-        bool match = false;
-
-        perm_node = node_to_item(node, struct perm_node, plist);
-        dp = &perm_node->dp;
-
-        if (perm_path_matches(path, dp)) {
-            match = true;
-        } else {
-            if (links) {
-                int i;
-                for (i = 0; links[i]; i++) {
-                    if (perm_path_matches(links[i], dp)) {
-                        match = true;
-                        break;
-                    }
-                }
-            }
-        }
-
-        if (match) {
-            *uid = dp->uid;
-            *gid = dp->gid;
-            return dp->perm;
-        }
+    int rule = dev_matcher.FindLast(path, links);
+    if (rule != -1) {
+        struct perms_ *dp = &dev_perms[rule];
+        *uid = dp->uid;
+        *gid = dp->gid;
+        return dp->perm;
     }
+
     /* Default if nothing found. */
     *uid = 0;
     *gid = 0;
@@ -890,32 +849,63 @@ static void handle_firmware_event(struct uevent *uevent)
     }
 }
 
+static void handle_uevent_msg(const char *msg)
+{
+    struct uevent uevent;
+    parse_event(msg, &uevent);
+
+    handle_device_event(&uevent);
+    handle_firmware_event(&uevent);
+}
+
+static void check_selinux_status()
+{
+    if (selinux_status_updated() > 0) {
+        struct selabel_handle *sehandle2;
+        sehandle2 = selinux_android_file_context_handle();
+        if (sehandle2) {
+            selabel_close(sehandle);
+            sehandle = sehandle2;
+        }
+    }
+}
+
 #define UEVENT_MSG_LEN  2048
-void handle_device_fd()
+/* Calls fn with each message waiting on the socket, terminated by two \0s.
+** Returns false if the socket's buffer overflowed, losing events, since
+** the last call. */
+static bool read_device_fd(const std::function<void(const char *msg, int len)>& fn)
 {
     char msg[UEVENT_MSG_LEN+2];
     int n;
-    while ((n = uevent_kernel_multicast_recv(device_fd, msg, UEVENT_MSG_LEN)) > 0) {
+    bool overflowed = false;
+    for (;;) {
+        n = uevent_kernel_multicast_recv(device_fd, msg, UEVENT_MSG_LEN);
+        if (n <= 0) {
+            /* the error is reported once; the events after it can still be read */
+            if (n < 0 && errno == ENOBUFS) {
+                overflowed = true;
+                continue;
+            }
+            break;
+        }
         if(n >= UEVENT_MSG_LEN)   /* overflow -- discard */
             continue;
 
         msg[n] = '\0';
         msg[n+1] = '\0';
+        fn(msg, n);
+    }
+    return !overflowed;
+}
 
-        struct uevent uevent;
-        parse_event(msg, &uevent);
-
-        if (selinux_status_updated() > 0) {
-            struct selabel_handle *sehandle2;
-            sehandle2 = selinux_android_file_context_handle();
-            if (sehandle2) {
-                selabel_close(sehandle);
-                sehandle = sehandle2;
-            }
-        }
-
-        handle_device_event(&uevent);
-        handle_firmware_event(&uevent);
+void handle_device_fd()
+{
+    if (!read_device_fd([](const char *msg, int) {
+        check_selinux_status();
+        handle_uevent_msg(msg);
+    })) {
+        ERROR("uevent socket overflowed, some device events were lost\n");
     }
 }
 
@@ -923,52 +913,92 @@ void handle_device_fd()
 ** to cause the kernel to regenerate device add events that happened
 ** before init's device manager was started
 **
-** We drain any pending events from the netlink socket every time
-** we poke another uevent file to make sure we don't overrun the
-** socket's buffer.
+** The walk runs on a thread per CPU, always poking a directory before
+** its subdirectories, while this thread drains the events from the
+** netlink socket.  No more than COLDBOOT_MAX_IN_FLIGHT pokes wait to be
+** drained at any time, which keeps them well inside the socket's buffer;
+** if it overflows all the same, the walk is done again on this thread
+** alone, draining after every poke, as it was before it ran in parallel.
+**
+** The events are only collected then; once the walk is over, platform
+** devices are added here, in order, as the paths of other devices are
+** matched against them, and the rest are split between a worker process
+** per CPU.  Those are processes rather than threads because make_device()
+** sets the egid of the whole process and the SELinux label handle is not
+** safe to share between threads.
+**
+** Only the platform devices keep the walk's parent-before-child order.
+** The rest are dealt round robin to the workers, so a child may be added
+** before its parent.  That is enough: the list of platform devices, which
+** the names of block and character device links come from, is the only
+** state that the handling of one event leaves for the next, and each
+** device node is made from its own event alone.
 */
 
-static void do_coldboot(DIR *d)
-{
-    struct dirent *de;
-    int dfd, fd;
-
-    dfd = dirfd(d);
+/* Each event takes a few KiB of the socket's 256KiB buffer. */
+#define COLDBOOT_MAX_IN_FLIGHT 32
 
-    fd = openat(dfd, "uevent", O_WRONLY);
-    if(fd >= 0) {
-        write(fd, "add\n", 4);
-        close(fd);
-        handle_device_fd();
+static bool poke_uevent(int dfd)
+{
+    int fd = openat(dfd, "uevent", O_WRONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
     }
+    bool poked = write(fd, "add\n", 4) == 4;
+    close(fd);
+    return poked;
+}
 
-    while((de = readdir(d))) {
-        DIR *d2;
-
-        if(de->d_type != DT_DIR || de->d_name[0] == '.')
-            continue;
-
-        fd = openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY);
-        if(fd < 0)
-            continue;
-
-        d2 = fdopendir(fd);
-        if(d2 == 0)
-            close(fd);
-        else {
-            do_coldboot(d2);
-            closedir(d2);
-        }
-    }
+static bool is_platform_event(const std::string& msg)
+{
+    struct uevent uevent;
+    parse_event(msg.c_str(), &uevent);
+    return !strncmp(uevent.subsystem, "platform", 8);
 }
 
-static void coldboot(const char *path)
+static void coldboot()
 {
-    DIR *d = opendir(path);
-    if(d) {
-        do_coldboot(d);
-        closedir(d);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = cpus > 0 ? cpus : 1;
+    std::vector<std::string> events;
+
+    Timer t;
+    bool overflowed = false;
+    auto walk = [&](unsigned walk_threads) {
+        return coldboot_walk({ "/sys/class", "/sys/block", "/sys/devices" }, walk_threads,
+                             COLDBOOT_MAX_IN_FLIGHT, poke_uevent,
+                             [&events, &overflowed, walk_threads]() {
+            if (walk_threads > 1) {
+                pollfd ufd = { device_fd, POLLIN, 0 };
+                poll(&ufd, 1, 10);
+            }
+            size_t before = events.size();
+            if (!read_device_fd([&events](const char *msg, int len) {
+                /* keep both terminating \0s for parse_event() */
+                events.emplace_back(msg, len + 2);
+            })) {
+                overflowed = true;
+            }
+            return events.size() - before;
+        });
+    };
+    size_t dirs = walk(threads);
+    if (overflowed && threads > 1) {
+        ERROR("uevent socket overflowed during coldboot, walking again on one thread\n");
+        events.clear();
+        dirs = walk(1);
     }
+    double walk_time = t.duration();
+
+    check_selinux_status();
+    Timer handle_timer;
+    coldboot_handle(events, threads, is_platform_event, [](const std::string& msg) {
+        handle_uevent_msg(msg.c_str());
+    });
+
+    NOTICE("Coldboot walked %zu directories in %.2fs with %u threads, "
+           "then handled %zu events in %.2fs with %u processes.\n",
+           dirs, walk_time, threads, events.size(), handle_timer.duration(), threads);
 }
 
 void device_init() {
@@ -988,9 +1018,7 @@ void device_init() {
     }
 
     Timer t;
-    coldboot("/sys/class");
-    coldboot("/sys/block");
-    coldboot("/sys/devices");
+    coldboot();
     close(open(COLDBOOT_DONE, O_WRONLY|O_CREAT|O_CLOEXEC, 0000));
     NOTICE("Coldboot took %.2fs.\n", t.duration());
 }
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "path_matcher.h"
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include <algorithm>
+
+PathMatcher::PathMatcher() : nodes_(1) {
+}
+
+int PathMatcher::Child(int node, char c) const {
+    for (int child = nodes_[node].first_child; child != -1; child = nodes_[child].next_sibling) {
+        if (nodes_[child].c == c) {
+            return child;
+        }
+    }
+    return -1;
+}
+
+void PathMatcher::Add(const std::string& pattern, bool prefix, bool wildcard) {
+    int rule = patterns_.size();
+    patterns_.push_back(pattern);
+    size_t special = pattern.find_last_of("*?[]\\");
+    literal_suffixes_.push_back(special == std::string::npos ? 0 : pattern.size() - special - 1);
+
+    // Prefix rules are checked with strncmp() even if they have special
+    // characters in them; only wildcards go to fnmatch().
+    size_t literal = pattern.size();
+    if (!prefix && wildcard) {
+        literal = std::min(literal, pattern.find_first_of("*?[\\"));
+    }
+
+    int node = 0;
+    for (size_t i = 0; i < literal; i++) {
+        int child = Child(node, pattern[i]);
+        if (child == -1) {
+            child = nodes_.size();
+            nodes_.emplace_back();
+            nodes_[child].c = pattern[i];
+            nodes_[child].next_sibling = nodes_[node].first_child;
+            nodes_[node].first_child = child;
+        }
+        node = child;
+    }
+
+    Node& n = nodes_[node];
+    if (prefix) {
+        n.prefix_rules.push_back(rule);
+    } else if (wildcard) {
+        n.wildcard_rules.push_back(rule);
+    } else {
+        n.exact_rules.push_back(rule);
+    }
+}
+
+bool PathMatcher::WildcardMatches(int rule, const char* path) const {
+    const std::string& pattern = patterns_[rule];
+    size_t suffix = literal_suffixes_[rule];
+    size_t len = strlen(path);
+    if (len < suffix || memcmp(path + len - suffix, pattern.data() + pattern.size() - suffix,
+                               suffix) != 0) {
+        return false;
+    }
+    return fnmatch(pattern.c_str(), path, FNM_PATHNAME) == 0;
+}
+
+int PathMatcher::FindLastAfter(const char* path, int best) const {
+    int node = 0;
+    for (const char* p = path; node != -1; node = *p ? Child(node, *p++) : -1) {
+        const Node& n = nodes_[node];
+        if (!n.prefix_rules.empty()) {
+            best = std::max(best, n.prefix_rules.back());
+        }
+        if (!*p && !n.exact_rules.empty()) {
+            best = std::max(best, n.exact_rules.back());
+        }
+        // Only the wildcards that would win are worth an fnmatch().
+        for (auto it = n.wildcard_rules.rbegin(); it != n.wildcard_rules.rend() && *it > best; ++it) {
+            if (WildcardMatches(*it, path)) {
+                best = *it;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+int PathMatcher::FindLast(const char* path, const char* const* links) const {
+    int best = FindLastAfter(path, -1);
+    for (int i = 0; links && links[i]; i++) {
+        best = FindLastAfter(links[i], best);
+    }
+    return best;
+}
+
+void PathMatcher::FindAll(const char* path, std::vector<int>* rules) const {
+    rules->clear();
+    int node = 0;
+    for (const char* p = path; node != -1; node = *p ? Child(node, *p++) : -1) {
+        const Node& n = nodes_[node];
+        rules->insert(rules->end(), n.prefix_rules.begin(), n.prefix_rules.end());
+        if (!*p) {
+            rules->insert(rules->end(), n.exact_rules.begin(), n.exact_rules.end());
+        }
+        for (int rule : n.wildcard_rules) {
+            if (WildcardMatches(rule, path)) {
+                rules->push_back(rule);
+            }
+        }
+    }
+    std::sort(rules->begin(), rules->end());
+}
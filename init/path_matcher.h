@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_PATH_MATCHER_H
+#define _INIT_PATH_MATCHER_H
+
+#include <string>
+#include <vector>
+
+// The path patterns of ueventd.rc rules, kept in a character trie so that
+// a path is matched against all of them in one walk down it rather than
+// one strcmp(), strncmp() or fnmatch() per rule.
+//
+// A rule is exact (strcmp), a prefix (strncmp), or a wildcard
+// (fnmatch(FNM_PATHNAME)), as ueventd_parser sorts them. Wildcard rules
+// sit under the literal part of the pattern in front of the first
+// special character, and only those along the path that end the same way
+// as it does still go to fnmatch().
+//
+// Rules are numbered in the order they are added.
+class PathMatcher {
+public:
+    PathMatcher();
+
+    void Add(const std::string& pattern, bool prefix, bool wildcard);
+
+    // The last rule that matches |path| or any of the null-terminated
+    // |links|, or -1 if none do.
+    int FindLast(const char* path, const char* const* links = nullptr) const;
+    // Every rule that matches |path|, in order.
+    void FindAll(const char* path, std::vector<int>* rules) const;
+
+    size_t size() const { return patterns_.size(); }
+
+private:
+    struct Node {
+        Node() : first_child(-1), next_sibling(-1), c(0) {
+        }
+        int first_child;
+        int next_sibling;
+        char c;
+        // The rules whose pattern, or for wildcards the literal part of it,
+        // ends here, in order.
+        std::vector<int> prefix_rules;
+        std::vector<int> exact_rules;
+        std::vector<int> wildcard_rules;
+    };
+
+    int Child(int node, char c) const;
+    // The last rule after |best| that matches |path|, or |best|.
+    int FindLastAfter(const char* path, int best) const;
+    bool WildcardMatches(int rule, const char* path) const;
+
+    std::vector<Node> nodes_;
+    std::vector<std::string> patterns_;
+    // Indexed by rule: for wildcards, how much of the end of the pattern
+    // is literal, which a path has to end with to match.
+    std::vector<size_t> literal_suffixes_;
+};
+
+#endif
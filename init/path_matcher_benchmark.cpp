@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "path_matcher.h"
+
+#include <vector>
+
+#include "benchmark.h"
+#include "path_matcher_replay.h"
+
+// Compiles the rules of a ueventd.rc plus a ueventd.$hardware.rc.
+static void BM_path_matcher_compile(int iters) {
+    std::vector<Rule> rules;
+    std::vector<Device> devices;
+    MakeColdboot(&rules, &devices);
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        Compile(rules);
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_path_matcher_compile);
+
+// Finds the permissions rule for one device of a coldboot, the way
+// devices.cpp did before it had a PathMatcher.
+static void BM_path_matcher_coldboot_linear(int iters) {
+    std::vector<Rule> rules;
+    std::vector<Device> devices;
+    MakeColdboot(&rules, &devices);
+    std::vector<std::vector<const char*>> links = LinkArrays(devices);
+
+    volatile int found;
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        size_t device = i % devices.size();
+        found = LinearFindLast(rules, devices[device].path.c_str(), links[device].data());
+    }
+    StopBenchmarkTiming();
+    (void)found;
+}
+BENCHMARK(BM_path_matcher_coldboot_linear);
+
+// The same, with a PathMatcher.
+static void BM_path_matcher_coldboot_matcher(int iters) {
+    std::vector<Rule> rules;
+    std::vector<Device> devices;
+    MakeColdboot(&rules, &devices);
+    std::vector<std::vector<const char*>> links = LinkArrays(devices);
+    PathMatcher matcher = Compile(rules);
+
+    volatile int found;
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        size_t device = i % devices.size();
+        found = matcher.FindLast(devices[device].path.c_str(), links[device].data());
+    }
+    StopBenchmarkTiming();
+    (void)found;
+}
+BENCHMARK(BM_path_matcher_coldboot_matcher);
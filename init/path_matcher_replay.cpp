@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "path_matcher_replay.h"
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include <base/stringprintf.h>
+
+using android::base::StringPrintf;
+
+// How devices.cpp matched a rule before it had a PathMatcher.
+static bool RuleMatches(const Rule& rule, const char* path) {
+    if (rule.prefix) {
+        return strncmp(path, rule.name.c_str(), rule.name.size()) == 0;
+    } else if (rule.wildcard) {
+        return fnmatch(rule.name.c_str(), path, FNM_PATHNAME) == 0;
+    }
+    return strcmp(path, rule.name.c_str()) == 0;
+}
+
+int LinearFindLast(const std::vector<Rule>& rules, const char* path,
+                   const char* const* links) {
+    for (int i = rules.size() - 1; i >= 0; i--) {
+        if (RuleMatches(rules[i], path)) {
+            return i;
+        }
+        for (int j = 0; links && links[j]; j++) {
+            if (RuleMatches(rules[i], links[j])) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+Rule ParseRule(std::string name) {
+    size_t star = name.find('*');
+    bool prefix = star != std::string::npos && star == name.size() - 1;
+    if (prefix) {
+        name.pop_back();
+    }
+    return Rule{name, prefix, !prefix && star != std::string::npos};
+}
+
+PathMatcher Compile(const std::vector<Rule>& rules) {
+    PathMatcher matcher;
+    for (const auto& rule : rules) {
+        matcher.Add(rule.name, rule.prefix, rule.wildcard);
+    }
+    return matcher;
+}
+
+void MakeColdboot(std::vector<Rule>* rules, std::vector<Device>* devices) {
+    static const char* kRules[] = {
+        "/dev/null", "/dev/zero", "/dev/full", "/dev/ptmx", "/dev/tty", "/dev/random",
+        "/dev/urandom", "/dev/ashmem", "/dev/binder", "/dev/hw_random", "/dev/uinput",
+        "/dev/alarm", "/dev/rtc0", "/dev/tty0", "/dev/graphics/*", "/dev/msm_hw3dm",
+        "/dev/input/*", "/dev/eac", "/dev/cam", "/dev/pmem", "/dev/pmem_adsp*",
+        "/dev/pmem_camera*", "/dev/oncrpc/*", "/dev/adsp/*", "/dev/snd/*", "/dev/mt9t013",
+        "/dev/msm_camera/*", "/dev/akm8976_daemon", "/dev/akm8973_aot", "/dev/bma150",
+        "/dev/cm3602", "/dev/lightsensor", "/dev/audience_a1026*", "/dev/tpa2018d1*",
+        "/dev/video*", "/dev/dri/*", "/dev/bus/usb/*", "/dev/mtp_usb", "/dev/usb_accessory",
+        "/dev/tun", "/dev/cpuctl", "/dev/fuse", "/dev/kgsl*", "/dev/qseecom", "/dev/tty*",
+        "/dev/block/platform/*/by-name/system", "/dev/block/platform/*/by-name/userdata",
+        "/dev/block/platform/*/by-name/cache", "/dev/block/platform/*/by-name/persist",
+        "/dev/block/platform/*/by-name/modem*", "/dev/block/platform/*/by-name/frp",
+        "/dev/block/platform/*/by-name/misc", "/dev/block/platform/*/by-num/p*",
+        "/dev/ttyHS*", "/dev/ttyMSM*", "/dev/smd*", "/dev/hw_random", "/dev/ion",
+        "/dev/block/zram*", "/dev/block/loop*", "/dev/block/dm-*", "/dev/media*",
+        "/dev/v4l-subdev*", "/dev/iio:device*", "/dev/sensors", "/dev/diag", "/dev/rmnet_ctrl",
+        "/dev/snd/pcmC*D*c", "/dev/snd/pcmC*D*p", "/dev/snd/controlC*", "/dev/input/event*",
+    };
+    for (const char* name : kRules) {
+        rules->push_back(ParseRule(name));
+    }
+    for (int i = 0; i < 250; i++) {
+        switch (i % 5) {
+        case 0:
+            rules->push_back(ParseRule(StringPrintf("/dev/vendor_hw%d", i)));
+            break;
+        case 1:
+            rules->push_back(ParseRule(StringPrintf("/dev/vendor_bus%d/*", i)));
+            break;
+        case 2:
+            rules->push_back(ParseRule(StringPrintf("/dev/block/platform/*/by-name/vendor%d", i)));
+            break;
+        case 3:
+            rules->push_back(ParseRule(StringPrintf("/dev/vendor_*_port%d", i)));
+            break;
+        default:
+            rules->push_back(ParseRule(StringPrintf("/dev/input/event%d", i % 32)));
+            break;
+        }
+    }
+
+    for (int i = 0; i < 1500; i++) {
+        Device device;
+        switch (i % 6) {
+        case 0:
+            device.path = StringPrintf("/dev/block/mmcblk0p%d", i / 6);
+            device.links.push_back(StringPrintf("/dev/block/platform/soc.0/7824900.sdhci/by-num/p%d",
+                                                i / 6));
+            device.links.push_back(StringPrintf("/dev/block/platform/soc.0/7824900.sdhci/by-name/vendor%d",
+                                                i / 3 % 250));
+            device.links.push_back(StringPrintf("/dev/block/platform/7824900.sdhci/by-name/vendor%d",
+                                                i / 3 % 250));
+            break;
+        case 1:
+            device.path = StringPrintf("/dev/input/event%d", i % 40);
+            break;
+        case 2:
+            device.path = StringPrintf("/dev/tty%d", i % 64);
+            break;
+        case 3:
+            device.path = StringPrintf("/dev/snd/pcmC0D%d%c", i % 30, i % 2 ? 'c' : 'p');
+            break;
+        case 4:
+            device.path = StringPrintf("/dev/vendor_hw%d", i % 300);
+            break;
+        default:
+            device.path = StringPrintf("/dev/vendor_bus%d/%d", i % 250, i);
+            break;
+        }
+        devices->push_back(device);
+    }
+}
+
+std::vector<std::vector<const char*>> LinkArrays(const std::vector<Device>& devices) {
+    std::vector<std::vector<const char*>> links(devices.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+        for (const auto& link : devices[i].links) {
+            links[i].push_back(link.c_str());
+        }
+        links[i].push_back(nullptr);
+    }
+    return links;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_PATH_MATCHER_REPLAY_H
+#define _INIT_PATH_MATCHER_REPLAY_H
+
+#include <string>
+#include <vector>
+
+#include "path_matcher.h"
+
+// A ueventd.rc rule, as ueventd_parser sorts it.
+struct Rule {
+    std::string name;
+    bool prefix;
+    bool wildcard;
+};
+
+// The last of |rules| that matches |path| or one of the null-terminated
+// |links|, searched for the way devices.cpp did before it had a
+// PathMatcher, or -1.
+int LinearFindLast(const std::vector<Rule>& rules, const char* path, const char* const* links);
+
+// Sorts a ueventd.rc name the way ueventd_parser does.
+Rule ParseRule(std::string name);
+
+PathMatcher Compile(const std::vector<Rule>& rules);
+
+struct Device {
+    std::string path;
+    std::vector<std::string> links;
+};
+
+// The rules of a ueventd.rc plus a ueventd.$hardware.rc, a few hundred in
+// all, and the devices of a phone's coldboot as ueventd sees them: every
+// block device with its by-name and by-num links, input, tty, sound,
+// video and a long tail of vendor misc devices.
+void MakeColdboot(std::vector<Rule>* rules, std::vector<Device>* devices);
+
+// The links of each device as the null-terminated arrays FindLast() takes.
+std::vector<std::vector<const char*>> LinkArrays(const std::vector<Device>& devices);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "path_matcher.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "path_matcher_replay.h"
+
+TEST(PathMatcherTest, LastMatchWins) {
+    std::vector<Rule> rules;
+    for (const char* name : { "/dev/null", "/dev/*", "/dev/input/*", "/dev/input/event0",
+                              "/dev/block/platform/*/by-name/system", "/dev/tty*",
+                              "/dev/input/*" }) {
+        rules.push_back(ParseRule(name));
+    }
+    PathMatcher matcher = Compile(rules);
+    ASSERT_EQ(7U, matcher.size());
+
+    EXPECT_EQ(1, matcher.FindLast("/dev/null"));
+    EXPECT_EQ(6, matcher.FindLast("/dev/input/event0"));
+    EXPECT_EQ(1, matcher.FindLast("/dev/input"));
+    EXPECT_EQ(5, matcher.FindLast("/dev/tty"));
+    EXPECT_EQ(-1, matcher.FindLast("/sys/dev/null"));
+    EXPECT_EQ(-1, matcher.FindLast(""));
+
+    // A wildcard's '*' stops at a '/'.
+    const char* links[] = { "/dev/block/platform/soc.0/by-num/p1",
+                            "/dev/block/platform/soc.0/by-name/system", nullptr };
+    EXPECT_EQ(4, matcher.FindLast("/dev/block/mmcblk0p1", links));
+    links[1] = "/dev/block/platform/soc.0/f9824900.sdhci/by-name/system";
+    EXPECT_EQ(1, matcher.FindLast("/dev/block/mmcblk0p1", links));
+}
+
+TEST(PathMatcherTest, SpecialCharacters) {
+    std::vector<Rule> rules = {
+        { "/dev/video?", true, false },       // literal '?' to strncmp()
+        { "/dev/video[0-3]", false, true },
+        { "/dev/audio?", false, true },
+        { "/dev/snd/pcm*c", false, true },
+        { "/dev/a\\*b", false, true },
+        { "/dev/exact?", false, false },
+    };
+    PathMatcher matcher = Compile(rules);
+
+    EXPECT_EQ(0, matcher.FindLast("/dev/video?1"));
+    EXPECT_EQ(1, matcher.FindLast("/dev/video2"));
+    EXPECT_EQ(-1, matcher.FindLast("/dev/video4"));
+    EXPECT_EQ(2, matcher.FindLast("/dev/audio1"));
+    EXPECT_EQ(3, matcher.FindLast("/dev/snd/pcmC0D0c"));
+    EXPECT_EQ(-1, matcher.FindLast("/dev/snd/pcmC0D0p"));
+    EXPECT_EQ(4, matcher.FindLast("/dev/a*b"));
+    EXPECT_EQ(-1, matcher.FindLast("/dev/axb"));
+    EXPECT_EQ(5, matcher.FindLast("/dev/exact?"));
+    EXPECT_EQ(-1, matcher.FindLast("/dev/exact1"));
+}
+
+TEST(PathMatcherTest, FindAllInOrder) {
+    std::vector<Rule> rules;
+    for (const char* name : { "/devices/system/cpu/cpu*", "/devices/system/cpu/cpu0",
+                              "/devices/system/*/cpu0", "/devices/*", "/devices/system/cpu/cpu0",
+                              "/devices/system/cpu/cpu1" }) {
+        rules.push_back(ParseRule(name));
+    }
+    PathMatcher matcher = Compile(rules);
+
+    std::vector<int> matches;
+    matcher.FindAll("/devices/system/cpu/cpu0", &matches);
+    EXPECT_EQ(std::vector<int>({ 0, 1, 2, 3, 4 }), matches);
+    matcher.FindAll("/devices/system/memory/cpu0", &matches);
+    EXPECT_EQ(std::vector<int>({ 2, 3 }), matches);
+    matcher.FindAll("/class/misc", &matches);
+    EXPECT_TRUE(matches.empty());
+}
+
+// The matcher finds the same rule as the linear search devices.cpp used to
+// do for every device of a coldboot.
+TEST(PathMatcherTest, AgreesWithLinearSearch) {
+    std::vector<Rule> rules;
+    std::vector<Device> devices;
+    MakeColdboot(&rules, &devices);
+    std::vector<std::vector<const char*>> links = LinkArrays(devices);
+
+    PathMatcher matcher = Compile(rules);
+    for (size_t i = 0; i < devices.size(); i++) {
+        ASSERT_EQ(LinearFindLast(rules, devices[i].path.c_str(), links[i].data()),
+                  matcher.FindLast(devices[i].path.c_str(), links[i].data()))
+                << devices[i].path;
+    }
+}
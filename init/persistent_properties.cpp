@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "persistent_properties.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/system_properties.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include <base/file.h>
+#include <zlib.h>
+
+#include "log.h"
+
+#define JOURNAL_NAME "persistent_properties"
+#define JOURNAL_TEMP_NAME ".persistent_properties.tmp"
+
+// The journal starts with this, then holds records: a record_header, the
+// name, a '\0' and the value.
+static const char kMagic[8] = { 'p', 'r', 'o', 'p', 'j', 'r', 'n', '1' };
+
+struct record_header {
+    uint32_t size;  // of the name, '\0' and value
+    uint32_t crc;   // crc32 of the same
+};
+
+static const size_t kMaxRecordSize = PROP_NAME_MAX + PROP_VALUE_MAX;
+
+// Don't bother compacting journals smaller than this.
+static const size_t kCompactSize = 32 * 1024;
+
+static size_t record_size(const std::string& name, const std::string& value) {
+    return sizeof(record_header) + name.size() + 1 + value.size();
+}
+
+static void append_record(const std::string& name, const std::string& value, std::string* out) {
+    size_t start = out->size();
+    out->resize(start + sizeof(record_header));
+    out->append(name);
+    out->push_back('\0');
+    out->append(value);
+
+    record_header header;
+    header.size = out->size() - start - sizeof(header);
+    header.crc = crc32(0, reinterpret_cast<const Bytef*>(out->data() + start + sizeof(header)),
+                       header.size);
+    memcpy(&(*out)[start], &header, sizeof(header));
+}
+
+// Persistent property files must not be accessible to others, must be
+// owned by init, and must not be a hard link to any other file.
+static bool is_secure(int fd, const char* name) {
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        ERROR("fstat on property file \"%s\" failed: %s\n", name, strerror(errno));
+        return false;
+    }
+    if (((sb.st_mode & (S_IRWXG | S_IRWXO)) != 0) || (sb.st_uid != geteuid()) ||
+            (sb.st_gid != getegid()) || (sb.st_nlink != 1)) {
+        ERROR("skipping insecure property file %s (uid=%u gid=%u nlink=%u mode=%o)\n",
+              name, (unsigned int)sb.st_uid, (unsigned int)sb.st_gid,
+              (unsigned int)sb.st_nlink, sb.st_mode);
+        return false;
+    }
+    return true;
+}
+
+static void fsync_dir(const std::string& dir) {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+PersistentProperties::PersistentProperties(const std::string& dir)
+    : dir_(dir), journal_path_(dir + "/" JOURNAL_NAME), fd_(-1), dirty_(false),
+      journal_size_(0), live_size_(0) {
+}
+
+PersistentProperties::~PersistentProperties() {
+    if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+void PersistentProperties::LoadLegacyFiles(std::vector<std::string>* files) {
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(dir_.c_str()), closedir);
+    if (!dir) {
+        ERROR("Unable to open persistent property directory \"%s\": %s\n",
+              dir_.c_str(), strerror(errno));
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir.get())) != NULL) {
+        if (strncmp("persist.", entry->d_name, strlen("persist."))) {
+            continue;
+        }
+        if (entry->d_type != DT_REG) {
+            continue;
+        }
+
+        // Open the file and read the property value.
+        int fd = openat(dirfd(dir.get()), entry->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) {
+            ERROR("Unable to open persistent property file \"%s\": %s\n",
+                  entry->d_name, strerror(errno));
+            continue;
+        }
+        if (!is_secure(fd, entry->d_name)) {
+            close(fd);
+            continue;
+        }
+
+        char value[PROP_VALUE_MAX];
+        int length = read(fd, value, sizeof(value) - 1);
+        if (length >= 0) {
+            values_[entry->d_name].assign(value, length);
+            files->push_back(entry->d_name);
+        } else {
+            ERROR("Unable to read persistent property file %s: %s\n",
+                  entry->d_name, strerror(errno));
+        }
+        close(fd);
+    }
+}
+
+bool PersistentProperties::LoadJournal() {
+    int fd = open(journal_path_.c_str(), O_RDWR | O_APPEND | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            ERROR("Unable to open %s: %s\n", journal_path_.c_str(), strerror(errno));
+        }
+        return false;
+    }
+
+    std::string data;
+    if (!is_secure(fd, journal_path_.c_str())) {
+        close(fd);
+        return false;
+    }
+    if (!android::base::ReadFdToString(fd, &data)) {
+        ERROR("Unable to read %s: %s\n", journal_path_.c_str(), strerror(errno));
+        close(fd);
+        return false;
+    }
+    if (data.size() < sizeof(kMagic) || memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+        ERROR("%s is not a property journal\n", journal_path_.c_str());
+        close(fd);
+        return false;
+    }
+
+    // Replay the records up to the first that was not completely written.
+    size_t pos = sizeof(kMagic);
+    while (data.size() - pos >= sizeof(record_header)) {
+        record_header header;
+        memcpy(&header, &data[pos], sizeof(header));
+        const char* payload = &data[pos + sizeof(header)];
+        if (header.size > kMaxRecordSize || header.size > data.size() - pos - sizeof(header) ||
+                crc32(0, reinterpret_cast<const Bytef*>(payload), header.size) != header.crc) {
+            break;
+        }
+        const char* end = static_cast<const char*>(memchr(payload, '\0', header.size));
+        if (end == nullptr) {
+            break;
+        }
+        values_[std::string(payload, end)].assign(end + 1, payload + header.size);
+        pos += sizeof(header) + header.size;
+    }
+
+    if (pos != data.size()) {
+        ERROR("Dropping %zu bytes from the end of %s\n", data.size() - pos,
+              journal_path_.c_str());
+        if (ftruncate(fd, pos) == -1 || fsync(fd) == -1) {
+            ERROR("Unable to truncate %s: %s\n", journal_path_.c_str(), strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+
+    fd_ = fd;
+    journal_size_ = pos;
+    return true;
+}
+
+void PersistentProperties::Load(
+        const std::function<void(const std::string&, const std::string&)>& fn) {
+    // On an encrypted device this runs twice: first against the tmpfs
+    // mounted on /data while vold waits for the password, then again once
+    // the real /data is mounted over it. Nothing may carry over, and the
+    // tmpfs journal must not be held open or vold cannot unmount it.
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+    values_.clear();
+    dirty_ = false;
+    journal_size_ = 0;
+    live_size_ = 0;
+
+    std::vector<std::string> legacy_files;
+    LoadLegacyFiles(&legacy_files);
+    bool have_journal = LoadJournal();
+
+    live_size_ = sizeof(kMagic);
+    for (const auto& entry : values_) {
+        live_size_ += record_size(entry.first, entry.second);
+    }
+
+    // The journal is written before the old files are removed, so if this
+    // is interrupted they are all read again next time, and the journal's
+    // values still win.
+    if ((!have_journal || !legacy_files.empty()) && Compact()) {
+        for (const auto& file : legacy_files) {
+            unlink((dir_ + "/" + file).c_str());
+        }
+        if (!legacy_files.empty()) {
+            NOTICE("Moved %zu persistent properties into %s\n", legacy_files.size(),
+                   journal_path_.c_str());
+            fsync_dir(dir_);
+        }
+    }
+
+    for (const auto& entry : values_) {
+        fn(entry.first, entry.second);
+    }
+}
+
+bool PersistentProperties::Write(const std::string& name, const std::string& value) {
+    if (fd_ == -1) {
+        ERROR("Unable to write persistent property %s: no journal\n", name.c_str());
+        return false;
+    }
+
+    auto it = values_.find(name);
+    if (it != values_.end() && it->second == value) {
+        return true;
+    }
+
+    std::string record;
+    append_record(name, value, &record);
+    if (!android::base::WriteFully(fd_, record.data(), record.size())) {
+        ERROR("Unable to write persistent property %s: %s\n", name.c_str(), strerror(errno));
+        // Don't leave a partial record for later ones to be appended after.
+        if (ftruncate(fd_, journal_size_) == -1) {
+            ERROR("Unable to truncate %s: %s\n", journal_path_.c_str(), strerror(errno));
+        }
+        return false;
+    }
+
+    journal_size_ += record.size();
+    if (it != values_.end()) {
+        live_size_ -= record_size(name, it->second);
+        it->second = value;
+    } else {
+        values_.emplace(name, value);
+    }
+    live_size_ += record.size();
+    dirty_ = true;
+    return true;
+}
+
+void PersistentProperties::Sync() {
+    if (!dirty_) {
+        return;
+    }
+    if (journal_size_ > kCompactSize && journal_size_ > 2 * live_size_ && Compact()) {
+        return;
+    }
+    if (fdatasync(fd_) == -1) {
+        ERROR("Unable to sync %s: %s\n", journal_path_.c_str(), strerror(errno));
+    }
+    dirty_ = false;
+}
+
+bool PersistentProperties::Compact() {
+    std::string data(kMagic, sizeof(kMagic));
+    for (const auto& entry : values_) {
+        append_record(entry.first, entry.second, &data);
+    }
+
+    std::string temp_path = dir_ + "/" JOURNAL_TEMP_NAME;
+    int fd = open(temp_path.c_str(),
+                  O_WRONLY | O_APPEND | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        ERROR("Unable to create %s: %s\n", temp_path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!android::base::WriteFully(fd, data.data(), data.size()) || fsync(fd) == -1) {
+        ERROR("Unable to write %s: %s\n", temp_path.c_str(), strerror(errno));
+        close(fd);
+        unlink(temp_path.c_str());
+        return false;
+    }
+    if (rename(temp_path.c_str(), journal_path_.c_str()) == -1) {
+        ERROR("Unable to rename %s to %s: %s\n", temp_path.c_str(), journal_path_.c_str(),
+              strerror(errno));
+        close(fd);
+        unlink(temp_path.c_str());
+        return false;
+    }
+    fsync_dir(dir_);
+
+    if (fd_ != -1) {
+        close(fd_);
+    }
+    fd_ = fd;
+    journal_size_ = data.size();
+    live_size_ = data.size();
+    dirty_ = false;
+    return true;
+}
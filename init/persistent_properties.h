@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_PERSISTENT_PROPERTIES_H
+#define _INIT_PERSISTENT_PROPERTIES_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// The persist.* properties, kept in one append-only journal in |dir|
+// rather than a file per property.
+//
+// Each record carries a checksum, so a record torn by a crash is dropped
+// along with anything after it when the journal is next loaded. Write()
+// only appends: the records are not durable until Sync(), which lets a
+// burst of sets share one fsync. Once the journal is mostly values that
+// have since been overwritten, Sync() writes a new one and renames it
+// over the old.
+class PersistentProperties {
+public:
+    PersistentProperties(const std::string& dir);
+    ~PersistentProperties();
+
+    // Reads the journal, and calls |fn| with every property in it. Files
+    // left in |dir| from the file-per-property layout are read first,
+    // moved into the journal and removed. Loading again starts over from
+    // what is in |dir| now, as when /data is mounted over a tmpfs one.
+    void Load(const std::function<void(const std::string&, const std::string&)>& fn);
+
+    // Appends |name|=|value| to the journal, unless that is its value
+    // already. Returns false if the journal could not be written.
+    bool Write(const std::string& name, const std::string& value);
+
+    // Whether anything has been written since the last Sync().
+    bool dirty() const { return dirty_; }
+
+    void Sync();
+
+private:
+    // Writes every property into a new journal, and renames it over the
+    // old one.
+    bool Compact();
+    void LoadLegacyFiles(std::vector<std::string>* files);
+    bool LoadJournal();
+
+    std::string dir_;
+    std::string journal_path_;
+    int fd_;
+    bool dirty_;
+    // Bytes in the journal, and how many of them a compacted one would need.
+    size_t journal_size_;
+    size_t live_size_;
+    std::map<std::string, std::string> values_;
+};
+
+#endif
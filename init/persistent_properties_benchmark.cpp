@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "persistent_properties.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/system_properties.h>
+#include <unistd.h>
+
+#include <base/file.h>
+#include <base/stringprintf.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "benchmark.h"
+
+using android::base::StringPrintf;
+
+typedef std::map<std::string, std::string> PropertyMap;
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+// A scratch directory standing in for /data/property.
+class ScratchDir {
+public:
+    ScratchDir() {
+        const char* tmpdir = getenv("TMPDIR");
+        path_ = std::string(tmpdir ? tmpdir : "/data/local/tmp") + "/persistent_properties.XXXXXX";
+        if (mkdtemp(&path_[0]) == nullptr) {
+            abort();
+        }
+    }
+
+    ~ScratchDir() {
+        nftw(path_.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+};
+
+// What property_service did for every persistent set before the journal.
+static void WriteOneFile(const std::string& dir, const std::string& name,
+                         const std::string& value) {
+    std::string temp_path = dir + "/.temp.XXXXXX";
+    int fd = mkstemp(&temp_path[0]);
+    if (fd == -1 || !android::base::WriteFully(fd, value.data(), value.size())) {
+        abort();
+    }
+    fsync(fd);
+    close(fd);
+    rename(temp_path.c_str(), (dir + "/" + name).c_str());
+}
+
+// And what it did at boot to read them back.
+static PropertyMap LoadOneFiles(const std::string& dir) {
+    PropertyMap loaded;
+    std::unique_ptr<DIR, int(*)(DIR*)> d(opendir(dir.c_str()), closedir);
+    struct dirent* entry;
+    while ((entry = readdir(d.get())) != NULL) {
+        if (strncmp("persist.", entry->d_name, strlen("persist."))) {
+            continue;
+        }
+        int fd = openat(dirfd(d.get()), entry->d_name, O_RDONLY | O_NOFOLLOW);
+        char value[PROP_VALUE_MAX];
+        int length = read(fd, value, sizeof(value) - 1);
+        loaded[entry->d_name].assign(value, length > 0 ? length : 0);
+        close(fd);
+    }
+    return loaded;
+}
+
+static PropertyMap LoadJournal(const std::string& dir) {
+    PropertyMap loaded;
+    PersistentProperties store(dir);
+    store.Load([&loaded](const std::string& name, const std::string& value) {
+        loaded[name] = value;
+    });
+    return loaded;
+}
+
+// The sets of a settings restore, spread over 200 persistent properties.
+static std::string SettingName(int i) {
+    return StringPrintf("persist.sys.setting%d", i % 200);
+}
+
+// Each set written to a file of its own and synced.
+static void BM_persistent_properties_set_one_file(int iters) {
+    ScratchDir dir;
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        WriteOneFile(dir.path(), SettingName(i), std::to_string(i));
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_persistent_properties_set_one_file);
+
+// Each set appended to the journal, which is what the setter waits for;
+// the syncs are left out.
+static void BM_persistent_properties_set_journal(int iters) {
+    ScratchDir dir;
+    PersistentProperties store(dir.path());
+    store.Load([](const std::string&, const std::string&) { });
+
+    for (int i = 0; i < iters; i++) {
+        StartBenchmarkTiming();
+        store.Write(SettingName(i), std::to_string(i));
+        StopBenchmarkTiming();
+        if (i % 50 == 49) {
+            store.Sync();
+        }
+    }
+}
+BENCHMARK(BM_persistent_properties_set_journal);
+
+// The same with the syncs, as sets arrive in bursts of |burst| that each
+// share one.
+static void BM_persistent_properties_set_journal_synced(int iters, int burst) {
+    ScratchDir dir;
+    PersistentProperties store(dir.path());
+    store.Load([](const std::string&, const std::string&) { });
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        store.Write(SettingName(i), std::to_string(i));
+        if (i % burst == burst - 1) {
+            store.Sync();
+        }
+    }
+    store.Sync();
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_persistent_properties_set_journal_synced)->Arg(1)->Arg(50);
+
+static const int kBootProperties = 500;
+
+// Loads |kBootProperties| persistent properties at boot from a file each.
+static void BM_persistent_properties_boot_load_one_files(int iters) {
+    ScratchDir dir;
+    for (int i = 0; i < kBootProperties; i++) {
+        WriteOneFile(dir.path(), StringPrintf("persist.vendor.hw%d.setting", i),
+                     std::to_string(i));
+    }
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        LoadOneFiles(dir.path());
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_persistent_properties_boot_load_one_files);
+
+// And from the journal.
+static void BM_persistent_properties_boot_load_journal(int iters) {
+    ScratchDir dir;
+    for (int i = 0; i < kBootProperties; i++) {
+        WriteOneFile(dir.path(), StringPrintf("persist.vendor.hw%d.setting", i),
+                     std::to_string(i));
+    }
+    // Migrates the files into the journal.
+    if (LoadJournal(dir.path()).size() != size_t(kBootProperties)) {
+        abort();
+    }
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        LoadJournal(dir.path());
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_persistent_properties_boot_load_journal);
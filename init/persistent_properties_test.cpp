@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "persistent_properties.h"
+
+#include <dirent.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <base/file.h>
+#include <base/stringprintf.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+using android::base::StringPrintf;
+
+typedef std::map<std::string, std::string> PropertyMap;
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+class PersistentPropertiesTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        const char* tmpdir = getenv("TMPDIR");
+        dir_ = std::string(tmpdir ? tmpdir : "/data/local/tmp") + "/persistent_properties.XXXXXX";
+        ASSERT_TRUE(mkdtemp(&dir_[0]) != nullptr);
+        journal_ = dir_ + "/persistent_properties";
+    }
+
+    virtual void TearDown() {
+        nftw(dir_.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    PropertyMap Load(PersistentProperties* store) {
+        PropertyMap loaded;
+        store->Load([&loaded](const std::string& name, const std::string& value) {
+            loaded[name] = value;
+        });
+        return loaded;
+    }
+
+    PropertyMap Reload() {
+        PersistentProperties store(dir_);
+        return Load(&store);
+    }
+
+    // A property the way write_persistent_property used to store them.
+    void WriteLegacyFile(const std::string& name, const std::string& value) {
+        std::string path = dir_ + "/" + name;
+        ASSERT_TRUE(android::base::WriteStringToFile(value, path, 0600, getuid(), getgid()));
+    }
+
+    off_t JournalSize() {
+        struct stat sb;
+        return stat(journal_.c_str(), &sb) == 0 ? sb.st_size : -1;
+    }
+
+    std::string dir_;
+    std::string journal_;
+};
+
+TEST_F(PersistentPropertiesTest, WriteSyncAndLoad) {
+    {
+        PersistentProperties store(dir_);
+        EXPECT_TRUE(Load(&store).empty());
+        EXPECT_FALSE(store.dirty());
+
+        EXPECT_TRUE(store.Write("persist.sys.a", "1"));
+        EXPECT_TRUE(store.Write("persist.sys.b", ""));
+        EXPECT_TRUE(store.Write("persist.sys.a", "2"));
+        EXPECT_TRUE(store.dirty());
+        store.Sync();
+        EXPECT_FALSE(store.dirty());
+
+        // Setting a property to the value it has already writes nothing.
+        off_t size = JournalSize();
+        EXPECT_TRUE(store.Write("persist.sys.b", ""));
+        EXPECT_FALSE(store.dirty());
+        EXPECT_EQ(size, JournalSize());
+    }
+    EXPECT_EQ(PropertyMap({{"persist.sys.a", "2"}, {"persist.sys.b", ""}}), Reload());
+}
+
+TEST_F(PersistentPropertiesTest, TornRecordsAreDropped) {
+    {
+        PersistentProperties store(dir_);
+        Load(&store);
+        EXPECT_TRUE(store.Write("persist.sys.a", "1"));
+        EXPECT_TRUE(store.Write("persist.sys.b", "2"));
+        EXPECT_TRUE(store.Write("persist.sys.c", "3"));
+        store.Sync();
+    }
+
+    // As if a crash cut the last write short.
+    ASSERT_EQ(0, truncate(journal_.c_str(), JournalSize() - 2));
+    off_t torn_size = JournalSize();
+    EXPECT_EQ(PropertyMap({{"persist.sys.a", "1"}, {"persist.sys.b", "2"}}), Reload());
+    EXPECT_LT(JournalSize(), torn_size);
+
+    // Garbage in a record loses it and everything after it, but what is
+    // written next is read back.
+    std::string data;
+    ASSERT_TRUE(android::base::ReadFileToString(journal_, &data));
+    data[data.size() - 3] ^= 1;
+    ASSERT_TRUE(android::base::WriteStringToFile(data, journal_, 0600, getuid(), getgid()));
+    {
+        PersistentProperties store(dir_);
+        EXPECT_EQ(PropertyMap({{"persist.sys.a", "1"}}), Load(&store));
+        EXPECT_TRUE(store.Write("persist.sys.d", "4"));
+        store.Sync();
+    }
+    EXPECT_EQ(PropertyMap({{"persist.sys.a", "1"}, {"persist.sys.d", "4"}}), Reload());
+}
+
+TEST_F(PersistentPropertiesTest, CompactsStaleJournal) {
+    PersistentProperties store(dir_);
+    Load(&store);
+    for (int i = 0; i < 4000; i++) {
+        EXPECT_TRUE(store.Write(StringPrintf("persist.sys.setting%d", i % 10), std::to_string(i)));
+    }
+    off_t before = JournalSize();
+    store.Sync();
+    EXPECT_LT(JournalSize(), before / 100);
+
+    // Writes after the compaction go to the new journal.
+    EXPECT_TRUE(store.Write("persist.sys.setting0", "after"));
+    store.Sync();
+    PropertyMap loaded = Reload();
+    EXPECT_EQ(10U, loaded.size());
+    EXPECT_EQ("after", loaded["persist.sys.setting0"]);
+    EXPECT_EQ("3999", loaded["persist.sys.setting9"]);
+}
+
+TEST_F(PersistentPropertiesTest, MigratesLegacyFiles) {
+    WriteLegacyFile("persist.sys.a", "1");
+    WriteLegacyFile("persist.sys.b", "2");
+    WriteLegacyFile("not.persist", "3");
+    ASSERT_TRUE(android::base::WriteStringToFile("4", dir_ + "/persist.sys.insecure", 0644,
+                                                 getuid(), getgid()));
+
+    EXPECT_EQ(PropertyMap({{"persist.sys.a", "1"}, {"persist.sys.b", "2"}}), Reload());
+    EXPECT_EQ(-1, access((dir_ + "/persist.sys.a").c_str(), F_OK));
+    EXPECT_EQ(-1, access((dir_ + "/persist.sys.b").c_str(), F_OK));
+    EXPECT_EQ(0, access((dir_ + "/not.persist").c_str(), F_OK));
+    EXPECT_EQ(0, access((dir_ + "/persist.sys.insecure").c_str(), F_OK));
+    EXPECT_EQ(PropertyMap({{"persist.sys.a", "1"}, {"persist.sys.b", "2"}}), Reload());
+
+    // A file left by a migration that was cut short loses to the journal.
+    WriteLegacyFile("persist.sys.a", "stale");
+    WriteLegacyFile("persist.sys.c", "5");
+    EXPECT_EQ(PropertyMap({{"persist.sys.a", "1"}, {"persist.sys.b", "2"},
+                           {"persist.sys.c", "5"}}), Reload());
+    EXPECT_EQ(-1, access((dir_ + "/persist.sys.c").c_str(), F_OK));
+}
+
+// Whether this process has a file in |dir| open.
+static bool HasFdIn(const std::string& dir) {
+    std::unique_ptr<DIR, int(*)(DIR*)> d(opendir("/proc/self/fd"), closedir);
+    struct dirent* entry;
+    while ((entry = readdir(d.get())) != NULL) {
+        char target[PATH_MAX];
+        ssize_t length = readlinkat(dirfd(d.get()), entry->d_name, target, sizeof(target) - 1);
+        if (length > 0) {
+            target[length] = '\0';
+            if (strncmp(target, (dir + "/").c_str(), dir.size() + 1) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+TEST_F(PersistentPropertiesTest, LoadAgainAfterRemount) {
+    PersistentProperties store(dir_);
+    Load(&store);
+    EXPECT_TRUE(store.Write("persist.sys.tmpfs", "1"));
+    store.Sync();
+
+    // As if the real /data were mounted over the tmpfs one.
+    std::string tmpfs_dir = dir_ + ".tmpfs";
+    ASSERT_EQ(0, rename(dir_.c_str(), tmpfs_dir.c_str()));
+    ASSERT_EQ(0, mkdir(dir_.c_str(), 0700));
+    {
+        PersistentProperties data(dir_);
+        Load(&data);
+        EXPECT_TRUE(data.Write("persist.sys.data", "2"));
+        data.Sync();
+    }
+
+    EXPECT_EQ(PropertyMap({{"persist.sys.data", "2"}}), Load(&store));
+    EXPECT_FALSE(HasFdIn(tmpfs_dir));
+    EXPECT_TRUE(store.Write("persist.sys.b", "3"));
+    store.Sync();
+    EXPECT_EQ(PropertyMap({{"persist.sys.data", "2"}, {"persist.sys.b", "3"}}), Reload());
+
+    nftw(tmpfs_dir.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "property_server.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
+#include <private/android_property_service.h>
+
+#include "log.h"
+#include "util.h"
+
+// Past this, the oldest connection is dropped for each new one.
+static const size_t kMaxConnections = 256;
+
+// Events handled per HandleEvents(), so that init gets on with other
+// things in between.
+static const int kMaxEvents = 16;
+
+PropertyServer::PropertyServer(int listen_fd, const PropertySetHandler& handler, int timeout_ms)
+    : listen_fd_(listen_fd),
+      epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      timer_fd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      handler_(handler),
+      timeout_ns_(timeout_ms * UINT64_C(1000000)),
+      timer_deadline_ns_(0) {
+    if (epoll_fd_ == -1 || timer_fd_ == -1) {
+        ERROR("sys_prop: unable to create epoll or timer fd: %s\n", strerror(errno));
+        return;
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) == -1) {
+        ERROR("sys_prop: epoll_ctl failed: %s\n", strerror(errno));
+    }
+    ev.data.ptr = &timer_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev) == -1) {
+        ERROR("sys_prop: epoll_ctl failed: %s\n", strerror(errno));
+    }
+}
+
+PropertyServer::~PropertyServer() {
+    for (auto& c : connections_) {
+        close(c.fd);
+    }
+    if (timer_fd_ != -1) {
+        close(timer_fd_);
+    }
+    if (epoll_fd_ != -1) {
+        close(epoll_fd_);
+    }
+}
+
+void PropertyServer::HandleEvents() {
+    epoll_event events[kMaxEvents];
+    int nr = TEMP_FAILURE_RETRY(epoll_wait(epoll_fd_, events, kMaxEvents, 0));
+    if (nr == -1) {
+        ERROR("sys_prop: epoll_wait failed: %s\n", strerror(errno));
+        return;
+    }
+
+    // Connections first: accepting and expiring can close other
+    // connections, whose events may be later in |events|.
+    bool accept = false;
+    bool expire = false;
+    for (int i = 0; i < nr; i++) {
+        void* ptr = events[i].data.ptr;
+        if (ptr == &listen_fd_) {
+            accept = true;
+        } else if (ptr == &timer_fd_) {
+            expire = true;
+        } else {
+            Connection* c = reinterpret_cast<Connection*>(ptr);
+            if (c->writing) {
+                Write(c);
+            } else {
+                Read(c);
+            }
+        }
+    }
+    if (expire) {
+        uint64_t expirations;
+        read(timer_fd_, &expirations, sizeof(expirations));
+        timer_deadline_ns_ = 0;
+        ExpireConnections();
+    }
+    if (accept) {
+        Accept();
+    }
+    ArmTimer();
+}
+
+void PropertyServer::Accept() {
+    for (int i = 0; i < kMaxEvents; i++) {
+        int s = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (s == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ERROR("sys_prop: accept failed: %s\n", strerror(errno));
+            }
+            return;
+        }
+
+        /* Check socket options here */
+        ucred cr;
+        socklen_t cr_size = sizeof(cr);
+        if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
+            close(s);
+            ERROR("Unable to receive socket options\n");
+            continue;
+        }
+
+        if (connections_.size() >= kMaxConnections) {
+            ERROR("sys_prop: too many connections, dropping uid=%d's\n",
+                  connections_.front().cr.uid);
+            Close(&connections_.front());
+        }
+
+        connections_.emplace_back();
+        Connection* c = &connections_.back();
+        c->fd = s;
+        c->cr = cr;
+        c->deadline_ns = gettime_ns() + timeout_ns_;
+        c->writing = false;
+        c->buffer.resize(sizeof(uint32_t));
+        c->done = 0;
+        c->self = std::prev(connections_.end());
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, s, &ev) == -1) {
+            ERROR("sys_prop: epoll_ctl failed: %s\n", strerror(errno));
+            Close(c);
+        }
+    }
+}
+
+size_t PropertyServer::MessageSize(const Connection& c) {
+    uint32_t cmd;
+    memcpy(&cmd, c.buffer.data(), sizeof(cmd));
+    switch (cmd) {
+    case PROP_MSG_SETPROP:
+        return sizeof(prop_msg);
+
+    case PROP_MSG_SETPROPS: {
+        if (c.buffer.size() < sizeof(prop_msg_setprops_header)) {
+            return sizeof(prop_msg_setprops_header);
+        }
+        prop_msg_setprops_header header;
+        memcpy(&header, c.buffer.data(), sizeof(header));
+        if (header.count == 0 || header.count > PROP_MSG_SETPROPS_MAX) {
+            ERROR("sys_prop: uid=%d sent %u properties to set\n", c.cr.uid, header.count);
+            return 0;
+        }
+        return sizeof(header) + header.count * sizeof(prop_msg_setprops_entry);
+    }
+
+    default:
+        return 0;
+    }
+}
+
+void PropertyServer::Read(Connection* c) {
+    while (true) {
+        size_t want = c->buffer.size();
+        ssize_t r = TEMP_FAILURE_RETRY(recv(c->fd, &c->buffer[c->done], want - c->done,
+                                            MSG_DONTWAIT));
+        if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (r <= 0) {
+            ERROR("sys_prop: mis-match msg size received: %zu expected: %zu: %s\n",
+                  c->done, want, r == 0 ? "connection closed" : strerror(errno));
+            Close(c);
+            return;
+        }
+        c->done += r;
+        if (c->done < want) {
+            continue;
+        }
+
+        size_t size = MessageSize(*c);
+        if (size == 0) {
+            Close(c);
+            return;
+        }
+        if (size > want) {
+            c->buffer.resize(size);
+            continue;
+        }
+        Handle(c);
+        return;
+    }
+}
+
+void PropertyServer::Handle(Connection* c) {
+    PropertySetRequest request;
+    request.fd = c->fd;
+    request.cr = c->cr;
+
+    char* data = &c->buffer[0];
+    uint32_t cmd;
+    memcpy(&cmd, data, sizeof(cmd));
+    if (cmd == PROP_MSG_SETPROP) {
+        char* name = data + offsetof(prop_msg, name);
+        char* value = data + offsetof(prop_msg, value);
+        name[PROP_NAME_MAX - 1] = 0;
+        value[PROP_VALUE_MAX - 1] = 0;
+        request.properties.emplace_back(name, value);
+    } else {
+        size_t count = (c->buffer.size() - sizeof(prop_msg_setprops_header)) /
+                sizeof(prop_msg_setprops_entry);
+        char* entry = data + sizeof(prop_msg_setprops_header);
+        for (size_t i = 0; i < count; i++, entry += sizeof(prop_msg_setprops_entry)) {
+            char* name = entry + offsetof(prop_msg_setprops_entry, name);
+            char* value = entry + offsetof(prop_msg_setprops_entry, value);
+            name[PROP_NAME_MAX - 1] = 0;
+            value[PROP_VALUE_MAX - 1] = 0;
+            request.properties.emplace_back(name, value);
+        }
+    }
+
+    std::vector<int32_t> results;
+    handler_(request, &results);
+
+    // Note: bionic's property client code assumes that the
+    // property server will not close the socket until *AFTER*
+    // the property is written to memory.
+    if (cmd == PROP_MSG_SETPROP) {
+        Close(c);
+        return;
+    }
+
+    results.resize(request.properties.size(), -1);
+    c->buffer.assign(reinterpret_cast<const char*>(results.data()),
+                     results.size() * sizeof(results[0]));
+    c->done = 0;
+    Write(c);
+}
+
+void PropertyServer::Write(Connection* c) {
+    while (c->done < c->buffer.size()) {
+        ssize_t r = TEMP_FAILURE_RETRY(send(c->fd, &c->buffer[c->done],
+                                            c->buffer.size() - c->done,
+                                            MSG_DONTWAIT | MSG_NOSIGNAL));
+        if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!c->writing) {
+                c->writing = true;
+                epoll_event ev;
+                ev.events = EPOLLOUT;
+                ev.data.ptr = c;
+                if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+                    ERROR("sys_prop: epoll_ctl failed: %s\n", strerror(errno));
+                    Close(c);
+                }
+            }
+            return;
+        }
+        if (r <= 0) {
+            ERROR("sys_prop: unable to send results to uid=%d: %s\n", c->cr.uid,
+                  strerror(errno));
+            break;
+        }
+        c->done += r;
+    }
+    Close(c);
+}
+
+void PropertyServer::Close(Connection* c) {
+    close(c->fd);
+    connections_.erase(c->self);
+}
+
+void PropertyServer::ExpireConnections() {
+    uint64_t now = gettime_ns();
+    while (!connections_.empty() && connections_.front().deadline_ns <= now) {
+        Connection* c = &connections_.front();
+        if (c->writing) {
+            ERROR("sys_prop: timeout waiting for uid=%d to read property results.\n",
+                  c->cr.uid);
+        } else {
+            ERROR("sys_prop: timeout waiting for uid=%d to send property message.\n",
+                  c->cr.uid);
+        }
+        Close(c);
+    }
+}
+
+void PropertyServer::ArmTimer() {
+    // A timer left set for a connection that has since closed just goes
+    // off early, and is set again from here.
+    if (timer_deadline_ns_ != 0 || connections_.empty()) {
+        return;
+    }
+
+    uint64_t deadline = connections_.front().deadline_ns;
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / UINT64_C(1000000000);
+    its.it_value.tv_nsec = deadline % UINT64_C(1000000000);
+    if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr) == -1) {
+        ERROR("sys_prop: timerfd_settime failed: %s\n", strerror(errno));
+        return;
+    }
+    timer_deadline_ns_ = deadline;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_PROPERTY_SERVER_H
+#define _INIT_PROPERTY_SERVER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <functional>
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+// One message from a property service client.
+struct PropertySetRequest {
+    // The client's socket, for getpeercon().
+    int fd;
+    ucred cr;
+    // Null-terminated, but otherwise as the client sent them.
+    std::vector<std::pair<char*, char*>> properties;
+};
+
+// Sets the properties of |request|, appending 0 to |results| for each
+// that was set and -1 for each that was not.
+typedef std::function<void(const PropertySetRequest& request,
+                           std::vector<int32_t>* results)> PropertySetHandler;
+
+// The client side of the property service socket, without ever blocking on
+// a client: a connection is read as its bytes arrive, however they are
+// split up, and is handled once it holds a whole PROP_MSG_SETPROP or
+// PROP_MSG_SETPROPS message. A client that has not sent one within
+// |timeout_ms| of connecting is dropped.
+//
+// fd() is an epoll fd that is readable whenever HandleEvents() has
+// something to do, for init's own epoll loop to wait on.
+class PropertyServer {
+public:
+    PropertyServer(int listen_fd, const PropertySetHandler& handler, int timeout_ms = 2000);
+    ~PropertyServer();
+
+    int fd() const { return epoll_fd_; }
+    void HandleEvents();
+
+    size_t connections() const { return connections_.size(); }
+
+private:
+    struct Connection {
+        int fd;
+        ucred cr;
+        uint64_t deadline_ns;
+        bool writing;
+        // The message read so far, or the reply still to be written.
+        std::string buffer;
+        size_t done;
+        std::list<Connection>::iterator self;
+    };
+
+    void Accept();
+    void Read(Connection* c);
+    void Write(Connection* c);
+    // Returns how big the message that starts |c|'s buffer is, or 0 if
+    // it is no message at all.
+    size_t MessageSize(const Connection& c);
+    void Handle(Connection* c);
+    void Close(Connection* c);
+    void ExpireConnections();
+    void ArmTimer();
+
+    int listen_fd_;
+    int epoll_fd_;
+    int timer_fd_;
+    PropertySetHandler handler_;
+    uint64_t timeout_ns_;
+    // When timer_fd_ is set to go off, or 0.
+    uint64_t timer_deadline_ns_;
+    // Oldest first, which is also soonest deadline first.
+    std::list<Connection> connections_;
+};
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "property_server.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
+#include <base/file.h>
+#include <base/stringprintf.h>
+#include <private/android_property_service.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark.h"
+
+using android::base::StringPrintf;
+
+// A PropertyServer on a socket of its own, run the way init runs it, on
+// a thread of its own, with |stalled| clients sitting on connections
+// without sending anything, like a stuck or hostile process.
+class Server {
+public:
+    explicit Server(int stalled) : sets_(0), stop_(false) {
+        const char* tmpdir = getenv("TMPDIR");
+        path_ = StringPrintf("%s/property_server_benchmark.%d",
+                             tmpdir ? tmpdir : "/data/local/tmp", getpid());
+        unlink(path_.c_str());
+        listen_fd_ = socket(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        sockaddr_un addr = Address();
+        if (listen_fd_ == -1 ||
+            bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 ||
+            listen(listen_fd_, 128) == -1) {
+            abort();
+        }
+
+        server_.reset(new PropertyServer(listen_fd_,
+            [this](const PropertySetRequest& request, std::vector<int32_t>* results) {
+                results->resize(results->size() + request.properties.size(), 0);
+                sets_ += request.properties.size();
+            }));
+        thread_ = std::thread([this]() {
+            pollfd pfd = { server_->fd(), POLLIN, 0 };
+            while (!stop_) {
+                if (poll(&pfd, 1, 10) > 0) {
+                    server_->HandleEvents();
+                }
+            }
+        });
+
+        for (int i = 0; i < stalled; i++) {
+            stalled_.push_back(Connect());
+        }
+    }
+
+    ~Server() {
+        for (int fd : stalled_) {
+            close(fd);
+        }
+        stop_ = true;
+        thread_.join();
+        close(listen_fd_);
+        unlink(path_.c_str());
+    }
+
+    size_t sets() const { return sets_; }
+
+    // Like bionic's __system_property_set(): one property, then wait for
+    // init to close the connection.
+    void SetOne(const std::string& name, const std::string& value) {
+        prop_msg msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.cmd = PROP_MSG_SETPROP;
+        strncpy(msg.name, name.c_str(), sizeof(msg.name) - 1);
+        strncpy(msg.value, value.c_str(), sizeof(msg.value) - 1);
+        int fd = Connect();
+        char c;
+        if (!android::base::WriteFully(fd, &msg, sizeof(msg)) ||
+            TEMP_FAILURE_RETRY(read(fd, &c, 1)) != 0) {
+            abort();
+        }
+        close(fd);
+    }
+
+    // |count| properties in one PROP_MSG_SETPROPS message.
+    void SetMany(const std::string& prefix, int count, const std::string& value) {
+        std::string msg(sizeof(prop_msg_setprops_header), '\0');
+        prop_msg_setprops_header header = { PROP_MSG_SETPROPS, static_cast<uint32_t>(count) };
+        memcpy(&msg[0], &header, sizeof(header));
+        for (int i = 0; i < count; i++) {
+            prop_msg_setprops_entry entry;
+            memset(&entry, 0, sizeof(entry));
+            snprintf(entry.name, sizeof(entry.name), "%s%d", prefix.c_str(), i);
+            strncpy(entry.value, value.c_str(), sizeof(entry.value) - 1);
+            msg.append(reinterpret_cast<char*>(&entry), sizeof(entry));
+        }
+        int fd = Connect();
+        std::string reply;
+        if (!android::base::WriteFully(fd, msg.data(), msg.size()) ||
+            !android::base::ReadFdToString(fd, &reply) ||
+            reply.size() != count * sizeof(int32_t)) {
+            abort();
+        }
+        close(fd);
+    }
+
+private:
+    sockaddr_un Address() {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+        return addr;
+    }
+
+    int Connect() {
+        int fd = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr = Address();
+        if (fd == -1 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+            abort();
+        }
+        return fd;
+    }
+
+    std::string path_;
+    int listen_fd_;
+    std::unique_ptr<PropertyServer> server_;
+    std::atomic<size_t> sets_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+    std::vector<int> stalled_;
+};
+
+// |iters| requests shared between |setters| threads at once, with 8
+// clients stalled all the while. Every |batch_every|th request of a
+// setter sets 8 properties in one message; the rest set one each.
+static void SetConcurrently(int iters, int setters, int batch_every) {
+    Server server(8);
+    std::vector<int> requests(setters, iters / setters);
+    requests[0] += iters % setters;
+    size_t expected = 0;
+    for (int count : requests) {
+        for (int i = 0; i < count; i++) {
+            expected += (batch_every && i % batch_every == batch_every - 1) ? 8 : 1;
+        }
+    }
+
+    std::vector<std::thread> threads;
+    StartBenchmarkTiming();
+    for (int t = 0; t < setters; t++) {
+        threads.emplace_back([&server, t, &requests, batch_every]() {
+            for (int i = 0; i < requests[t]; i++) {
+                std::string value = std::to_string(i);
+                if (batch_every && i % batch_every == batch_every - 1) {
+                    server.SetMany(StringPrintf("test.setter%d.batch", t), 8, value);
+                } else {
+                    server.SetOne(StringPrintf("test.setter%d.one", t), value);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    StopBenchmarkTiming();
+
+    if (server.sets() != expected) {
+        abort();
+    }
+}
+
+// One property per request, as every __system_property_set() caller does.
+static void BM_property_server_set_one(int iters, int setters) {
+    SetConcurrently(iters, setters, 0);
+}
+BENCHMARK(BM_property_server_set_one)->Arg(1)->Arg(4)->Arg(16);
+
+// Three requests in four of a single property, the rest of 8 at a time.
+static void BM_property_server_set_mixed(int iters, int setters) {
+    SetConcurrently(iters, setters, 4);
+}
+BENCHMARK(BM_property_server_set_mixed)->Arg(1)->Arg(4)->Arg(16);
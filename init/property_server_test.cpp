@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "property_server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
+#include <gtest/gtest.h>
+
+#include <base/file.h>
+#include <base/stringprintf.h>
+#include <private/android_property_service.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using android::base::StringPrintf;
+
+typedef std::vector<std::pair<std::string, std::string>> PropertyList;
+
+static double NowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// A PropertyServer on a socket of its own, run the way init runs it, on
+// a thread of its own. Properties whose names start with "bad." are
+// refused.
+class PropertyServerTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        const char* tmpdir = getenv("TMPDIR");
+        path_ = StringPrintf("%s/property_server_test.%d", tmpdir ? tmpdir : "/data/local/tmp",
+                             getpid());
+        unlink(path_.c_str());
+        listen_fd_ = socket(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        ASSERT_NE(-1, listen_fd_);
+        sockaddr_un addr = Address();
+        ASSERT_EQ(0, bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+        ASSERT_EQ(0, listen(listen_fd_, 128));
+    }
+
+    virtual void TearDown() {
+        Stop();
+        close(listen_fd_);
+        unlink(path_.c_str());
+    }
+
+    sockaddr_un Address() {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+        return addr;
+    }
+
+    void Start(int timeout_ms) {
+        server_.reset(new PropertyServer(listen_fd_,
+            [this](const PropertySetRequest& request, std::vector<int32_t>* results) {
+                for (const auto& property : request.properties) {
+                    bool bad = strncmp(property.first, "bad.", 4) == 0;
+                    if (!bad) {
+                        properties_[property.first] = property.second;
+                    }
+                    results->push_back(bad ? -1 : 0);
+                }
+                sets_ += request.properties.size();
+            }, timeout_ms));
+        stop_ = false;
+        thread_ = std::thread([this]() {
+            pollfd pfd = { server_->fd(), POLLIN, 0 };
+            while (!stop_) {
+                if (poll(&pfd, 1, 10) > 0) {
+                    server_->HandleEvents();
+                }
+            }
+        });
+    }
+
+    void Stop() {
+        if (thread_.joinable()) {
+            stop_ = true;
+            thread_.join();
+        }
+    }
+
+    int Connect() {
+        int fd = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr = Address();
+        EXPECT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+        return fd;
+    }
+
+    // Like bionic's __system_property_set(): one property, then wait for
+    // init to close the connection.
+    void SetOne(const std::string& name, const std::string& value) {
+        prop_msg msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.cmd = PROP_MSG_SETPROP;
+        strncpy(msg.name, name.c_str(), sizeof(msg.name) - 1);
+        strncpy(msg.value, value.c_str(), sizeof(msg.value) - 1);
+        int fd = Connect();
+        ASSERT_TRUE(android::base::WriteFully(fd, &msg, sizeof(msg)));
+        char c;
+        EXPECT_EQ(0, TEMP_FAILURE_RETRY(read(fd, &c, 1)));
+        close(fd);
+    }
+
+    // Returns init's answer.
+    std::vector<int32_t> SetMany(const PropertyList& properties) {
+        std::string msg(sizeof(prop_msg_setprops_header), '\0');
+        prop_msg_setprops_header header = { PROP_MSG_SETPROPS,
+                                            static_cast<uint32_t>(properties.size()) };
+        memcpy(&msg[0], &header, sizeof(header));
+        for (const auto& property : properties) {
+            prop_msg_setprops_entry entry;
+            memset(&entry, 0, sizeof(entry));
+            strncpy(entry.name, property.first.c_str(), sizeof(entry.name) - 1);
+            strncpy(entry.value, property.second.c_str(), sizeof(entry.value) - 1);
+            msg.append(reinterpret_cast<char*>(&entry), sizeof(entry));
+        }
+        int fd = Connect();
+        EXPECT_TRUE(android::base::WriteFully(fd, msg.data(), msg.size()));
+        std::string reply;
+        EXPECT_TRUE(android::base::ReadFdToString(fd, &reply));
+        close(fd);
+        std::vector<int32_t> results(reply.size() / sizeof(int32_t));
+        memcpy(results.data(), reply.data(), results.size() * sizeof(int32_t));
+        return results;
+    }
+
+    std::string path_;
+    int listen_fd_;
+    std::unique_ptr<PropertyServer> server_;
+    std::thread thread_;
+    std::atomic<bool> stop_;
+    std::map<std::string, std::string> properties_;
+    std::atomic<size_t> sets_{0};
+};
+
+TEST_F(PropertyServerTest, SetOneAndMany) {
+    Start(2000);
+    SetOne("test.one", "1");
+    EXPECT_EQ(std::vector<int32_t>({0, -1, 0}),
+              SetMany({{"test.a", "a"}, {"bad.b", "b"}, {"test.c", "c"}}));
+    // Names and values that fill the whole field are cut short.
+    std::string long_value(PROP_VALUE_MAX, 'v');
+    EXPECT_EQ(std::vector<int32_t>({0}), SetMany({{"test.long", long_value}}));
+    Stop();
+
+    EXPECT_EQ("1", properties_["test.one"]);
+    EXPECT_EQ("a", properties_["test.a"]);
+    EXPECT_EQ(0U, properties_.count("bad.b"));
+    EXPECT_EQ("c", properties_["test.c"]);
+    EXPECT_EQ(long_value.substr(0, PROP_VALUE_MAX - 1), properties_["test.long"]);
+    EXPECT_EQ(0U, server_->connections());
+}
+
+TEST_F(PropertyServerTest, StalledClientsDoNotBlockOthers) {
+    Start(200);
+
+    // Half a message each, and then nothing.
+    std::vector<int> stalled;
+    for (int i = 0; i < 10; i++) {
+        stalled.push_back(Connect());
+        uint32_t cmd = PROP_MSG_SETPROP;
+        ASSERT_EQ(static_cast<ssize_t>(sizeof(cmd)), write(stalled.back(), &cmd, sizeof(cmd)));
+    }
+
+    // A message that arrives a byte at a time still gets through.
+    prop_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.cmd = PROP_MSG_SETPROP;
+    strncpy(msg.name, "test.slow", sizeof(msg.name) - 1);
+    strncpy(msg.value, "1", sizeof(msg.value) - 1);
+    int slow = Connect();
+    for (size_t i = 0; i < sizeof(msg); i++) {
+        ASSERT_EQ(1, write(slow, reinterpret_cast<char*>(&msg) + i, 1));
+        if (i % 32 == 0) usleep(1000);
+    }
+
+    double start = NowNs();
+    SetOne("test.fast", "1");
+    EXPECT_LT(NowNs() - start, 100e6);
+
+    char c;
+    EXPECT_EQ(0, TEMP_FAILURE_RETRY(read(slow, &c, 1)));
+    close(slow);
+
+    // The stalled ones are dropped once they time out.
+    for (int fd : stalled) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        EXPECT_EQ(1, poll(&pfd, 1, 1000));
+        EXPECT_EQ(0, TEMP_FAILURE_RETRY(read(fd, &c, 1)));
+        close(fd);
+    }
+    Stop();
+
+    EXPECT_EQ("1", properties_["test.slow"]);
+    EXPECT_EQ("1", properties_["test.fast"]);
+    EXPECT_EQ(0U, server_->connections());
+}
+
+TEST_F(PropertyServerTest, BadMessagesAreDropped) {
+    Start(2000);
+    prop_msg_setprops_header headers[] = {
+        { 0x1234, 1 },
+        { PROP_MSG_SETPROPS, 0 },
+        { PROP_MSG_SETPROPS, PROP_MSG_SETPROPS_MAX + 1 },
+    };
+    for (const auto& header : headers) {
+        int fd = Connect();
+        ASSERT_TRUE(android::base::WriteFully(fd, &header, sizeof(header)));
+        // Closed without an answer; if it was closed with bytes still
+        // unread, that is a reset.
+        char c;
+        ssize_t r = TEMP_FAILURE_RETRY(read(fd, &c, 1));
+        EXPECT_TRUE(r == 0 || (r == -1 && errno == ECONNRESET)) << header.cmd;
+        close(fd);
+    }
+
+    // Hanging up halfway through is no problem either.
+    int fd = Connect();
+    uint32_t cmd = PROP_MSG_SETPROP;
+    ASSERT_TRUE(android::base::WriteFully(fd, &cmd, sizeof(cmd)));
+    close(fd);
+
+    SetOne("test.after", "1");
+    Stop();
+    EXPECT_EQ(1U, sets_.load());
+}
@@ -21,10 +21,9 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdarg.h>
-#include <dirent.h>
 #include <limits.h>
 #include <errno.h>
-#include <sys/poll.h>
+#include <sys/timerfd.h>
 
 #include <memory>
 
@@ -50,6 +49,8 @@
 #include <base/file.h>
 #include "bootimg.h"
 
+#include "persistent_properties.h"
+#include "property_server.h"
 #include "property_service.h"
 #include "init.h"
 #include "util.h"
@@ -63,6 +64,10 @@ static int persistent_properties_loaded = 0;
 static bool property_area_initialized = false;
 
 static int property_set_fd = -1;
+static int persistent_sync_fd = -1;
+static std::unique_ptr<PropertyServer> property_server;
+
+static PersistentProperties persistent_properties(PERSISTENT_PROPERTY_DIR);
 
 struct workspace {
     size_t size;
@@ -151,27 +156,38 @@ std::string property_get(const char* name) {
     return value;
 }
 
-static void write_persistent_property(const char *name, const char *value)
+// Persistent sets within this long of each other share one fsync.
+static const int kPersistentSyncDelayMs = 50;
+
+static bool persistent_sync_pending = false;
+
+static void handle_persistent_sync_fd()
 {
-    char tempPath[PATH_MAX];
-    char path[PATH_MAX];
-    int fd;
+    uint64_t expirations;
+    read(persistent_sync_fd, &expirations, sizeof(expirations));
+    persistent_sync_pending = false;
+    persistent_properties.Sync();
+}
 
-    snprintf(tempPath, sizeof(tempPath), "%s/.temp.XXXXXX", PERSISTENT_PROPERTY_DIR);
-    fd = mkstemp(tempPath);
-    if (fd < 0) {
-        ERROR("Unable to write persistent property to temp file %s: %s\n", tempPath, strerror(errno));
+static void schedule_persistent_sync()
+{
+    if (persistent_sync_pending || !persistent_properties.dirty()) {
         return;
     }
-    write(fd, value, strlen(value));
-    fsync(fd);
-    close(fd);
 
-    snprintf(path, sizeof(path), "%s/%s", PERSISTENT_PROPERTY_DIR, name);
-    if (rename(tempPath, path)) {
-        unlink(tempPath);
-        ERROR("Unable to rename persistent property file %s to %s\n", tempPath, path);
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = kPersistentSyncDelayMs * 1000000;
+    if (persistent_sync_fd == -1 || timerfd_settime(persistent_sync_fd, 0, &its, NULL) == -1) {
+        persistent_properties.Sync();
+        return;
     }
+    persistent_sync_pending = true;
+}
+
+void sync_persistent_properties()
+{
+    persistent_properties.Sync();
 }
 
 static bool is_legal_property_name(const char* name, size_t namelen)
@@ -247,7 +263,9 @@ static int property_set_impl(const char* name, const char* value) {
          * Don't write properties to disk until after we have read all default properties
          * to prevent them from being overwritten by default values.
          */
-        write_persistent_property(name, value);
+        if (persistent_properties.Write(name, value)) {
+            schedule_persistent_sync();
+        }
     }
     property_changed(name, value);
     return 0;
@@ -261,96 +279,47 @@ int property_set(const char* name, const char* value) {
     return rc;
 }
 
-static void handle_property_set_fd()
+static int handle_property_set(const char* name, const char* value, char* source_ctx,
+                               struct ucred* cr)
 {
-    prop_msg msg;
-    int s;
-    int r;
-    struct ucred cr;
-    struct sockaddr_un addr;
-    socklen_t addr_size = sizeof(addr);
-    socklen_t cr_size = sizeof(cr);
-    char * source_ctx = NULL;
-    struct pollfd ufds[1];
-    const int timeout_ms = 2 * 1000;  /* Default 2 sec timeout for caller to send property. */
-    int nr;
-
-    if ((s = accept(property_set_fd, (struct sockaddr *) &addr, &addr_size)) < 0) {
-        return;
+    if (!is_legal_property_name(name, strlen(name))) {
+        ERROR("sys_prop: illegal property name. Got: \"%s\"\n", name);
+        return -1;
     }
 
-    /* Check socket options here */
-    if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
-        close(s);
-        ERROR("Unable to receive socket options\n");
-        return;
-    }
-
-    ufds[0].fd = s;
-    ufds[0].events = POLLIN;
-    ufds[0].revents = 0;
-    nr = TEMP_FAILURE_RETRY(poll(ufds, 1, timeout_ms));
-    if (nr == 0) {
-        ERROR("sys_prop: timeout waiting for uid=%d to send property message.\n", cr.uid);
-        close(s);
-        return;
-    } else if (nr < 0) {
-        ERROR("sys_prop: error waiting for uid=%d to send property message: %s\n", cr.uid, strerror(errno));
-        close(s);
-        return;
+    if (memcmp(name, "ctl.", 4) == 0) {
+        if (!check_control_mac_perms(value, source_ctx, cr)) {
+            ERROR("sys_prop: Unable to %s service ctl [%s] uid:%d gid:%d pid:%d\n",
+                    name + 4, value, cr->uid, cr->gid, cr->pid);
+            return -1;
+        }
+        handle_control_message(name + 4, value);
+        return 0;
     }
 
-    r = TEMP_FAILURE_RETRY(recv(s, &msg, sizeof(msg), MSG_DONTWAIT));
-    if(r != sizeof(prop_msg)) {
-        ERROR("sys_prop: mis-match msg size received: %d expected: %zu: %s\n",
-              r, sizeof(prop_msg), strerror(errno));
-        close(s);
-        return;
+    if (!check_perms(name, source_ctx, cr)) {
+        ERROR("sys_prop: permission denied uid:%d  name:%s\n", cr->uid, name);
+        return -1;
     }
+    return property_set(name, value) == 0 ? 0 : -1;
+}
 
-    switch(msg.cmd) {
-    case PROP_MSG_SETPROP:
-        msg.name[PROP_NAME_MAX-1] = 0;
-        msg.value[PROP_VALUE_MAX-1] = 0;
-
-        if (!is_legal_property_name(msg.name, strlen(msg.name))) {
-            ERROR("sys_prop: illegal property name. Got: \"%s\"\n", msg.name);
-            close(s);
-            return;
-        }
-
-        getpeercon(s, &source_ctx);
-
-        if(memcmp(msg.name,"ctl.",4) == 0) {
-            // Keep the old close-socket-early behavior when handling
-            // ctl.* properties.
-            close(s);
-            if (check_control_mac_perms(msg.value, source_ctx, &cr)) {
-                handle_control_message((char*) msg.name + 4, (char*) msg.value);
-            } else {
-                ERROR("sys_prop: Unable to %s service ctl [%s] uid:%d gid:%d pid:%d\n",
-                        msg.name + 4, msg.value, cr.uid, cr.gid, cr.pid);
-            }
-        } else {
-            if (check_perms(msg.name, source_ctx, &cr)) {
-                property_set((char*) msg.name, (char*) msg.value);
-            } else {
-                ERROR("sys_prop: permission denied uid:%d  name:%s\n",
-                      cr.uid, msg.name);
-            }
-
-            // Note: bionic's property client code assumes that the
-            // property server will not close the socket until *AFTER*
-            // the property is written to memory.
-            close(s);
-        }
-        freecon(source_ctx);
-        break;
+static void handle_property_set_request(const PropertySetRequest& request,
+                                        std::vector<int32_t>* results)
+{
+    char* source_ctx = NULL;
+    struct ucred cr = request.cr;
 
-    default:
-        close(s);
-        break;
+    getpeercon(request.fd, &source_ctx);
+    for (const auto& property : request.properties) {
+        results->push_back(handle_property_set(property.first, property.second, source_ctx, &cr));
     }
+    freecon(source_ctx);
+}
+
+static void handle_property_set_fd()
+{
+    property_server->HandleEvents();
 }
 
 void get_property_workspace(int *fd, int *sz)
@@ -438,59 +407,11 @@ static void load_properties_from_file(const char* filename, const char* filter)
 static void load_persistent_properties() {
     persistent_properties_loaded = 1;
 
-    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(PERSISTENT_PROPERTY_DIR), closedir);
-    if (!dir) {
-        ERROR("Unable to open persistent property directory \"%s\": %s\n",
-              PERSISTENT_PROPERTY_DIR, strerror(errno));
-        return;
-    }
-
-    struct dirent* entry;
-    while ((entry = readdir(dir.get())) != NULL) {
-        if (strncmp("persist.", entry->d_name, strlen("persist."))) {
-            continue;
-        }
-        if (entry->d_type != DT_REG) {
-            continue;
-        }
-
-        // Open the file and read the property value.
-        int fd = openat(dirfd(dir.get()), entry->d_name, O_RDONLY | O_NOFOLLOW);
-        if (fd == -1) {
-            ERROR("Unable to open persistent property file \"%s\": %s\n",
-                  entry->d_name, strerror(errno));
-            continue;
-        }
-
-        struct stat sb;
-        if (fstat(fd, &sb) == -1) {
-            ERROR("fstat on property file \"%s\" failed: %s\n", entry->d_name, strerror(errno));
-            close(fd);
-            continue;
-        }
-
-        // File must not be accessible to others, be owned by root/root, and
-        // not be a hard link to any other file.
-        if (((sb.st_mode & (S_IRWXG | S_IRWXO)) != 0) || (sb.st_uid != 0) || (sb.st_gid != 0) ||
-                (sb.st_nlink != 1)) {
-            ERROR("skipping insecure property file %s (uid=%u gid=%u nlink=%u mode=%o)\n",
-                  entry->d_name, (unsigned int)sb.st_uid, (unsigned int)sb.st_gid,
-                  (unsigned int)sb.st_nlink, sb.st_mode);
-            close(fd);
-            continue;
-        }
-
-        char value[PROP_VALUE_MAX];
-        int length = read(fd, value, sizeof(value) - 1);
-        if (length >= 0) {
-            value[length] = 0;
-            property_set(entry->d_name, value);
-        } else {
-            ERROR("Unable to read persistent property file %s: %s\n",
-                  entry->d_name, strerror(errno));
-        }
-        close(fd);
-    }
+    Timer t;
+    persistent_properties.Load([](const std::string& name, const std::string& value) {
+        property_set(name.c_str(), value.c_str());
+    });
+    NOTICE("(Loading persistent properties took %.2fs.)\n", t.duration());
 }
 
 void property_load_boot_defaults() {
@@ -574,7 +495,16 @@ void start_property_service() {
         exit(1);
     }
 
-    listen(property_set_fd, 8);
+    listen(property_set_fd, 128);
+
+    property_server.reset(new PropertyServer(property_set_fd, handle_property_set_request));
 
-    register_epoll_handler(property_set_fd, handle_property_set_fd);
+    register_epoll_handler(property_server->fd(), handle_property_set_fd);
+
+    persistent_sync_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (persistent_sync_fd == -1) {
+        ERROR("start_property_service timerfd creation failed: %s\n", strerror(errno));
+    } else {
+        register_epoll_handler(persistent_sync_fd, handle_persistent_sync_fd);
+    }
 }
@@ -35,6 +35,7 @@ extern void start_property_service(void);
 void get_property_workspace(int *fd, int *sz);
 std::string property_get(const char* name);
 extern int property_set(const char *name, const char *value);
+void sync_persistent_properties();
 extern bool properties_initialized();
 
 
@@ -33,6 +33,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <cutils/threads.h>
 #include <log/log.h>
 #include <private/android_filesystem_config.h>
 #include <utils/Compat.h>
@@ -155,114 +156,366 @@ static const struct fs_path_config android_files[] = {
     { 00644, AID_ROOT,      AID_ROOT,      0, 0 },
 };
 
-static int fs_config_open(int dir, const char *target_out_path)
+/* fs_config() is called once per file by image builders and by adb sync,
+** so the rules are indexed once per process instead of being scanned on
+** every call. Each table gets a character trie over its prefixes; every
+** node remembers the first rule, in table order, whose prefix ends there.
+** A lookup walks the path down the trie and keeps the earliest rule seen,
+** which is the rule a first-match scan of the table would have picked.
+**
+** The index of a config file is rebuilt when the file's identity, size
+** or modification time changes.
+*/
+
+struct fs_config_rule {
+    unsigned mode;
+    unsigned uid;
+    unsigned gid;
+    uint64_t capabilities;
+};
+
+/* Children of a node are chained through |sibling|. |prefix_rule| is the
+** first rule matching any path that starts with the node's prefix (every
+** directory rule, and file rules ending in *); |exact_rule| is the first
+** file rule matching only the prefix itself. -1 if none.
+*/
+struct fs_config_node {
+    int child;
+    int sibling;
+    int prefix_rule;
+    int exact_rule;
+    char c;
+};
+
+struct fs_config_index {
+    struct fs_config_node *nodes;
+    size_t node_count;
+    size_t node_alloc;
+    struct fs_config_rule *rules;
+    size_t rule_count;
+    size_t rule_alloc;
+};
+
+struct fs_config_cache {
+    bool builtin_loaded;
+    struct fs_config_index builtin;
+    /* Config file the index below was read from, NULL if none. */
+    char *conf_name;
+    struct stat conf_stat;
+    struct fs_config_index conf;
+};
+
+static mutex_t fs_config_lock = MUTEX_INITIALIZER;
+static struct fs_config_cache fs_config_caches[2]; /* files, dirs */
+
+static void fs_config_index_free(struct fs_config_index *index)
+{
+    free(index->nodes);
+    free(index->rules);
+    memset(index, 0, sizeof(*index));
+}
+
+static int fs_config_index_new_node(struct fs_config_index *index, char c)
+{
+    struct fs_config_node *node;
+
+    if (index->node_count == index->node_alloc) {
+        size_t alloc = index->node_alloc ? index->node_alloc * 2 : 64;
+        struct fs_config_node *nodes = realloc(index->nodes, alloc * sizeof(*nodes));
+        if (!nodes) {
+            return -1;
+        }
+        index->nodes = nodes;
+        index->node_alloc = alloc;
+    }
+    node = &index->nodes[index->node_count];
+    node->child = -1;
+    node->sibling = -1;
+    node->prefix_rule = -1;
+    node->exact_rule = -1;
+    node->c = c;
+    return index->node_count++;
+}
+
+/* Adds a rule after all the rules added before. Returns false if out of memory. */
+static bool fs_config_index_add(struct fs_config_index *index, bool dir,
+                                const char *prefix, size_t len,
+                                const struct fs_config_rule *rule)
+{
+    bool wildcard = dir;
+    int node, rule_index;
+    size_t i;
+
+    if (!dir && len > 0 && prefix[len - 1] == '*') {
+        wildcard = true;
+        len--;
+    }
+
+    if (index->node_count == 0 && fs_config_index_new_node(index, 0) < 0) {
+        return false;
+    }
+    if (index->rule_count == index->rule_alloc) {
+        size_t alloc = index->rule_alloc ? index->rule_alloc * 2 : 16;
+        struct fs_config_rule *rules = realloc(index->rules, alloc * sizeof(*rules));
+        if (!rules) {
+            return false;
+        }
+        index->rules = rules;
+        index->rule_alloc = alloc;
+    }
+    rule_index = index->rule_count++;
+    index->rules[rule_index] = *rule;
+
+    node = 0;
+    for (i = 0; i < len; i++) {
+        int child = index->nodes[node].child;
+        while (child >= 0 && index->nodes[child].c != prefix[i]) {
+            child = index->nodes[child].sibling;
+        }
+        if (child < 0) {
+            child = fs_config_index_new_node(index, prefix[i]);
+            if (child < 0) {
+                return false;
+            }
+            index->nodes[child].sibling = index->nodes[node].child;
+            index->nodes[node].child = child;
+        }
+        node = child;
+    }
+
+    if (wildcard) {
+        if (index->nodes[node].prefix_rule < 0) {
+            index->nodes[node].prefix_rule = rule_index;
+        }
+    } else if (index->nodes[node].exact_rule < 0) {
+        index->nodes[node].exact_rule = rule_index;
+    }
+    return true;
+}
+
+/* Returns the first rule matching path, or NULL. */
+static const struct fs_config_rule *fs_config_index_find(const struct fs_config_index *index,
+                                                         const char *path)
+{
+    int best = -1;
+    int node = 0;
+
+    if (index->node_count == 0) {
+        return NULL;
+    }
+    for (;;) {
+        const struct fs_config_node *n = &index->nodes[node];
+        if (n->prefix_rule >= 0 && (best < 0 || n->prefix_rule < best)) {
+            best = n->prefix_rule;
+        }
+        if (*path == '\0') {
+            if (n->exact_rule >= 0 && (best < 0 || n->exact_rule < best)) {
+                best = n->exact_rule;
+            }
+            break;
+        }
+        for (node = n->child; node >= 0; node = index->nodes[node].sibling) {
+            if (index->nodes[node].c == *path) {
+                break;
+            }
+        }
+        if (node < 0) {
+            break;
+        }
+        path++;
+    }
+    return best >= 0 ? &index->rules[best] : NULL;
+}
+
+static bool fs_config_load_builtin(struct fs_config_index *index, bool dir)
 {
-    int fd = -1;
+    const struct fs_path_config *pc = dir ? android_dirs : android_files;
+
+    for (;; pc++) {
+        struct fs_config_rule rule;
+        rule.mode = pc->mode;
+        rule.uid = pc->uid;
+        rule.gid = pc->gid;
+        rule.capabilities = pc->capabilities;
+        if (!pc->prefix) {
+            /* The catch-all entry at the end. */
+            return fs_config_index_add(index, true, "", 0, &rule);
+        }
+        if (!fs_config_index_add(index, dir, pc->prefix, strlen(pc->prefix), &rule)) {
+            return false;
+        }
+    }
+}
+
+/* Indexes the records of a config file, up to the first corrupt one. */
+static void fs_config_load_file(struct fs_config_index *index, bool dir,
+                                const char *name, int fd, size_t size)
+{
+    char *buffer, *p;
+    size_t remaining;
+    ssize_t n;
+
+    buffer = malloc(size ? size : 1);
+    if (!buffer) {
+        ALOGE("%s out of memory", dir ? conf_dir : conf_file);
+        return;
+    }
+    for (remaining = 0; remaining < size; remaining += n) {
+        n = TEMP_FAILURE_RETRY(read(fd, buffer + remaining, size - remaining));
+        if (n <= 0) {
+            break;
+        }
+    }
+
+    p = buffer;
+    while (remaining >= sizeof(struct fs_path_config_from_file)) {
+        struct fs_path_config_from_file header;
+        struct fs_config_rule rule;
+        const char *prefix;
+        uint16_t host_len;
+        ssize_t len, remainder;
+
+        memcpy(&header, p, sizeof(header));
+        p += sizeof(header);
+        remaining -= sizeof(header);
+        host_len = get2LE((const uint8_t *)&header.len);
+        remainder = host_len - sizeof(header);
+        if (remainder <= 0) {
+            ALOGE("%s len is corrupted", name);
+            break;
+        }
+        if ((size_t)remainder > remaining) {
+            ALOGE("%s prefix is truncated", name);
+            break;
+        }
+        prefix = p;
+        len = strnlen(prefix, remainder);
+        if (len >= remainder) { /* missing a terminating null */
+            ALOGE("%s is corrupted", name);
+            break;
+        }
+        p += remainder;
+        remaining -= remainder;
+
+        rule.uid = get2LE((const uint8_t *)&(header.uid));
+        rule.gid = get2LE((const uint8_t *)&(header.gid));
+        rule.mode = get2LE((const uint8_t *)&(header.mode));
+        rule.capabilities = get8LE((const uint8_t *)&(header.capabilities));
+        if (!fs_config_index_add(index, dir, prefix, len, &rule)) {
+            ALOGE("%s out of memory", name);
+            break;
+        }
+    }
+    free(buffer);
+}
+
+static bool fs_config_same_file(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size && a->st_mtime == b->st_mtime;
+}
+
+/* Brings the index of the config file that applies up to date. Tries the
+** same files, in the same order, that reading the config file on every
+** call used to.
+*/
+static void fs_config_update_conf(struct fs_config_cache *cache, bool dir,
+                                  const char *target_out_path)
+{
+    const char *names[2];
+    char *target_name = NULL;
+    size_t i;
 
     if (target_out_path && *target_out_path) {
         /* target_out_path is the path to the directory holding content of system partition
            but as we cannot guaranty it ends with '/system' we need this below skip_len logic */
-        char *name = NULL;
         int target_out_path_len = strlen(target_out_path);
         int skip_len = strlen("/system");
 
         if (target_out_path[target_out_path_len] == '/') {
             skip_len++;
         }
-        if (asprintf(&name, "%s%s", target_out_path, (dir ? conf_dir : conf_file) + skip_len) != -1) {
-            fd = TEMP_FAILURE_RETRY(open(name, O_RDONLY | O_BINARY));
-            free(name);
+        if (asprintf(&target_name, "%s%s", target_out_path,
+                     (dir ? conf_dir : conf_file) + skip_len) == -1) {
+            target_name = NULL;
         }
     }
-    if (fd < 0) {
-        fd = TEMP_FAILURE_RETRY(open(dir ? conf_dir : conf_file, O_RDONLY | O_BINARY));
-    }
-    return fd;
-}
+    names[0] = target_name;
+    names[1] = dir ? conf_dir : conf_file;
 
-static bool fs_config_cmp(bool dir, const char *prefix, size_t len,
-                                    const char *path, size_t plen)
-{
-    if (dir) {
-        if (plen < len) {
-            return false;
+    for (i = 0; i < 2; i++) {
+        struct stat st;
+        int fd;
+
+        if (!names[i] || stat(names[i], &st) < 0) {
+            continue;
         }
-    } else {
-        /* If name ends in * then allow partial matches. */
-        if (prefix[len - 1] == '*') {
-            return !strncmp(prefix, path, len - 1);
+        if (cache->conf_name && !strcmp(cache->conf_name, names[i]) &&
+                fs_config_same_file(&cache->conf_stat, &st)) {
+            free(target_name);
+            return;
         }
-        if (plen != len) {
-            return false;
+        fd = TEMP_FAILURE_RETRY(open(names[i], O_RDONLY | O_BINARY));
+        if (fd < 0) {
+            continue;
         }
+        fs_config_index_free(&cache->conf);
+        free(cache->conf_name);
+        cache->conf_name = strdup(names[i]);
+        /* Go by the size of the file as read, should it change under us. */
+        if (fstat(fd, &st) == 0) {
+            fs_config_load_file(&cache->conf, dir, names[i], fd, st.st_size);
+        }
+        cache->conf_stat = st;
+        close(fd);
+        free(target_name);
+        return;
     }
-    return !strncmp(prefix, path, len);
+
+    fs_config_index_free(&cache->conf);
+    free(cache->conf_name);
+    cache->conf_name = NULL;
+    free(target_name);
 }
 
 void fs_config(const char *path, int dir, const char *target_out_path,
                unsigned *uid, unsigned *gid, unsigned *mode, uint64_t *capabilities)
 {
-    const struct fs_path_config *pc;
-    int fd, plen;
+    static const struct fs_config_rule default_rules[2] = {
+        { 00644, AID_ROOT, AID_ROOT, 0 },
+        { 00755, AID_ROOT, AID_ROOT, 0 },
+    };
+    struct fs_config_cache *cache;
+    const struct fs_config_rule *rule;
 
     if (path[0] == '/') {
         path++;
     }
 
-    plen = strlen(path);
+    dir = !!dir;
+    cache = &fs_config_caches[dir];
 
-    fd = fs_config_open(dir, target_out_path);
-    if (fd >= 0) {
-        struct fs_path_config_from_file header;
-
-        while (TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)) {
-            char *prefix;
-            uint16_t host_len = get2LE((const uint8_t *)&header.len);
-            ssize_t len, remainder = host_len - sizeof(header);
-            if (remainder <= 0) {
-                ALOGE("%s len is corrupted", dir ? conf_dir : conf_file);
-                break;
-            }
-            prefix = calloc(1, remainder);
-            if (!prefix) {
-                ALOGE("%s out of memory", dir ? conf_dir : conf_file);
-                break;
-            }
-            if (TEMP_FAILURE_RETRY(read(fd, prefix, remainder)) != remainder) {
-                free(prefix);
-                ALOGE("%s prefix is truncated", dir ? conf_dir : conf_file);
-                break;
+    mutex_lock(&fs_config_lock);
+    fs_config_update_conf(cache, dir, target_out_path);
+    rule = fs_config_index_find(&cache->conf, path);
+    if (!rule) {
+        if (!cache->builtin_loaded) {
+            cache->builtin_loaded = fs_config_load_builtin(&cache->builtin, dir);
+            if (!cache->builtin_loaded) {
+                fs_config_index_free(&cache->builtin);
             }
-            len = strnlen(prefix, remainder);
-            if (len >= remainder) { /* missing a terminating null */
-                free(prefix);
-                ALOGE("%s is corrupted", dir ? conf_dir : conf_file);
-                break;
-            }
-            if (fs_config_cmp(dir, prefix, len, path, plen)) {
-                free(prefix);
-                close(fd);
-                *uid = get2LE((const uint8_t *)&(header.uid));
-                *gid = get2LE((const uint8_t *)&(header.gid));
-                *mode = (*mode & (~07777)) | get2LE((const uint8_t *)&(header.mode));
-                *capabilities = get8LE((const uint8_t *)&(header.capabilities));
-                return;
-            }
-            free(prefix);
         }
-        close(fd);
+        rule = fs_config_index_find(&cache->builtin, path);
     }
-
-    pc = dir ? android_dirs : android_files;
-    for(; pc->prefix; pc++){
-        if (fs_config_cmp(dir, pc->prefix, strlen(pc->prefix), path, plen)) {
-            break;
-        }
+    if (!rule) {
+        /* Only when out of memory. */
+        rule = &default_rules[dir];
     }
-    *uid = pc->uid;
-    *gid = pc->gid;
-    *mode = (*mode & (~07777)) | pc->mode;
-    *capabilities = pc->capabilities;
+    *uid = rule->uid;
+    *gid = rule->gid;
+    *mode = (*mode & (~07777)) | rule->mode;
+    *capabilities = rule->capabilities;
+    mutex_unlock(&fs_config_lock);
 }
 
 ssize_t fs_config_generate(char *buffer, size_t length, const struct fs_path_config *pc)
@@ -18,64 +18,103 @@
 #include <assert.h>
 #include <errno.h>
 #include <cutils/threads.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <sys/types.h>
 
-typedef struct Entry Entry;
-struct Entry {
-    void* key;
-    int hash;
-    void* value;
-    Entry* next;
+/*
+ * Open addressing with linear probing. Each slot caches the key's hash, and
+ * a hash of 0 marks an empty slot, so lookups compare keys only on a full
+ * hash match and never chase pointers between slots.
+ *
+ * Lookups take no lock and may run concurrently with one writer:
+ *  - A new entry is published by storing its hash last, with release
+ *    semantics. A replaced value is a single atomic store.
+ *  - Removal shifts later entries of the cluster back into the hole. That is
+ *    done inside a seqlock, and a lookup that overlapped it starts over.
+ *  - Expansion fills a new table and then publishes it. The old table is
+ *    never modified again, and it stays allocated until hashmapFree(), so a
+ *    lookup still probing it sees a consistent snapshot. The retired tables
+ *    together are smaller than the live one.
+ */
+
+typedef struct Slot Slot;
+struct Slot {
+    atomic_int hash;
+    atomic_uintptr_t key;
+    atomic_uintptr_t value;
+};
+
+typedef struct Table Table;
+struct Table {
+    size_t slotCount;
+    Table* retired;
+    Slot slots[0];
 };
 
 struct Hashmap {
-    Entry** buckets;
-    size_t bucketCount;
+    atomic_uintptr_t table;
+    // Odd while the writer is moving entries around.
+    atomic_uint seq;
     int (*hash)(void* key);
     bool (*equals)(void* keyA, void* keyB);
-    mutex_t lock; 
+    mutex_t lock;
     size_t size;
 };
 
+static Table* createTable(size_t slotCount) {
+    Table* table = calloc(1, sizeof(Table) + slotCount * sizeof(Slot));
+    if (table != NULL) {
+        table->slotCount = slotCount;
+    }
+    return table;
+}
+
+static inline Table* currentTable(Hashmap* map) {
+    return (Table*) atomic_load_explicit(&map->table, memory_order_acquire);
+}
+
 Hashmap* hashmapCreate(size_t initialCapacity,
         int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
     assert(hash != NULL);
     assert(equals != NULL);
-    
+
     Hashmap* map = malloc(sizeof(Hashmap));
     if (map == NULL) {
         return NULL;
     }
-    
-    // 0.75 load factor.
-    size_t minimumBucketCount = initialCapacity * 4 / 3;
-    map->bucketCount = 1;
-    while (map->bucketCount <= minimumBucketCount) {
-        // Bucket count must be power of 2.
-        map->bucketCount <<= 1; 
+
+    // 0.75 load factor, and at least one slot always empty.
+    size_t minimumSlotCount = initialCapacity * 4 / 3;
+    size_t slotCount = 2;
+    while (slotCount <= minimumSlotCount) {
+        // Slot count must be power of 2.
+        slotCount <<= 1;
     }
 
-    map->buckets = calloc(map->bucketCount, sizeof(Entry*));
-    if (map->buckets == NULL) {
+    Table* table = createTable(slotCount);
+    if (table == NULL) {
         free(map);
         return NULL;
     }
-    
+    atomic_init(&map->table, (uintptr_t) table);
+    atomic_init(&map->seq, 0);
+
     map->size = 0;
 
     map->hash = hash;
     map->equals = equals;
-    
+
     mutex_init(&map->lock);
-    
+
     return map;
 }
 
 /**
- * Hashes the given key.
+ * Hashes the given key. Never returns 0, which marks empty slots.
  */
 #ifdef __clang__
 __attribute__((no_sanitize("integer")))
@@ -89,47 +128,123 @@ static inline int hashKey(Hashmap* map, void* key) {
     h ^= (((unsigned int) h) >> 14);
     h += (h << 4);
     h ^= (((unsigned int) h) >> 10);
-       
-    return h;
+
+    return h != 0 ? h : 1;
 }
 
 size_t hashmapSize(Hashmap* map) {
     return map->size;
 }
 
-static inline size_t calculateIndex(size_t bucketCount, int hash) {
-    return ((size_t) hash) & (bucketCount - 1);
+static inline size_t calculateIndex(size_t slotCount, int hash) {
+    return ((size_t) hash) & (slotCount - 1);
+}
+
+static inline int slotHash(Slot* slot) {
+    return atomic_load_explicit(&slot->hash, memory_order_acquire);
+}
+
+static inline void* slotKey(Slot* slot) {
+    return (void*) atomic_load_explicit(&slot->key, memory_order_relaxed);
+}
+
+static inline void* slotValue(Slot* slot) {
+    return (void*) atomic_load_explicit(&slot->value, memory_order_relaxed);
+}
+
+static inline void setSlot(Slot* slot, int hash, void* key, void* value) {
+    atomic_store_explicit(&slot->key, (uintptr_t) key, memory_order_relaxed);
+    atomic_store_explicit(&slot->value, (uintptr_t) value, memory_order_relaxed);
+    atomic_store_explicit(&slot->hash, hash, memory_order_release);
+}
+
+static inline bool equalKeys(void* keyA, void* keyB, bool (*equals)(void*, void*)) {
+    return keyA == keyB || equals(keyA, keyB);
+}
+
+/**
+ * Returns the slot holding the key, or the empty slot where it would go.
+ */
+static Slot* findSlot(Hashmap* map, Table* table, void* key, int hash) {
+    size_t mask = table->slotCount - 1;
+    size_t index = calculateIndex(table->slotCount, hash);
+    while (true) {
+        Slot* slot = &table->slots[index];
+        int h = slotHash(slot);
+        if (h == 0 || (h == hash && equalKeys(slotKey(slot), key, map->equals))) {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+/**
+ * Looks up a key without taking the lock. Returns true if it was found.
+ */
+static bool lookup(Hashmap* map, void* key, void** value) {
+    int hash = hashKey(map, key);
+    while (true) {
+        unsigned int seq = atomic_load_explicit(&map->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+
+        Slot* slot = findSlot(map, currentTable(map), key, hash);
+        bool found = slotHash(slot) != 0;
+        void* result = found ? slotValue(slot) : NULL;
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&map->seq, memory_order_relaxed) == seq) {
+            *value = result;
+            return found;
+        }
+    }
+}
+
+static void beginMove(Hashmap* map) {
+    unsigned int seq = atomic_load_explicit(&map->seq, memory_order_relaxed);
+    atomic_store_explicit(&map->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 }
 
-static void expandIfNecessary(Hashmap* map) {
-    // If the load factor exceeds 0.75...
-    if (map->size > (map->bucketCount * 3 / 4)) {
-        // Start off with a 0.33 load factor.
-        size_t newBucketCount = map->bucketCount << 1;
-        Entry** newBuckets = calloc(newBucketCount, sizeof(Entry*));
-        if (newBuckets == NULL) {
-            // Abort expansion.
-            return;
+static void endMove(Hashmap* map) {
+    unsigned int seq = atomic_load_explicit(&map->seq, memory_order_relaxed);
+    atomic_store_explicit(&map->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * Makes room for one more entry. Returns false if there is none.
+ */
+static bool reserve(Hashmap* map) {
+    Table* table = currentTable(map);
+    // If the load factor would exceed 0.75...
+    if (map->size + 1 > table->slotCount * 3 / 4) {
+        size_t newSlotCount = table->slotCount << 1;
+        Table* newTable = createTable(newSlotCount);
+        if (newTable == NULL) {
+            // Abort expansion, but keep one slot empty for lookups to stop at.
+            return map->size + 2 <= table->slotCount;
         }
-        
-        // Move over existing entries.
+
+        // Move over existing entries. Hashes are cached, so no callbacks.
         size_t i;
-        for (i = 0; i < map->bucketCount; i++) {
-            Entry* entry = map->buckets[i];
-            while (entry != NULL) {
-                Entry* next = entry->next;
-                size_t index = calculateIndex(newBucketCount, entry->hash);
-                entry->next = newBuckets[index];
-                newBuckets[index] = entry;
-                entry = next;
+        for (i = 0; i < table->slotCount; i++) {
+            Slot* slot = &table->slots[i];
+            int hash = slotHash(slot);
+            if (hash != 0) {
+                size_t index = calculateIndex(newSlotCount, hash);
+                while (atomic_load_explicit(&newTable->slots[index].hash,
+                        memory_order_relaxed) != 0) {
+                    index = (index + 1) & (newSlotCount - 1);
+                }
+                setSlot(&newTable->slots[index], hash, slotKey(slot), slotValue(slot));
             }
         }
 
-        // Copy over internals.
-        free(map->buckets);
-        map->buckets = newBuckets;
-        map->bucketCount = newBucketCount;
+        newTable->retired = table;
+        atomic_store_explicit(&map->table, (uintptr_t) newTable, memory_order_release);
     }
+    return true;
 }
 
 void hashmapLock(Hashmap* map) {
@@ -141,16 +256,12 @@ void hashmapUnlock(Hashmap* map) {
 }
 
 void hashmapFree(Hashmap* map) {
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry* next = entry->next;
-            free(entry);
-            entry = next;
-        }
+    Table* table = currentTable(map);
+    while (table != NULL) {
+        Table* retired = table->retired;
+        free(table);
+        table = retired;
     }
-    free(map->buckets);
     mutex_destroy(&map->lock);
     free(map);
 }
@@ -170,177 +281,150 @@ int hashmapHash(void* key, size_t keySize) {
     return h;
 }
 
-static Entry* createEntry(void* key, int hash, void* value) {
-    Entry* entry = malloc(sizeof(Entry));
-    if (entry == NULL) {
-        return NULL;
-    }
-    entry->key = key;
-    entry->hash = hash;
-    entry->value = value;
-    entry->next = NULL;
-    return entry;
-}
-
-static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
-        bool (*equals)(void*, void*)) {
-    if (keyA == keyB) {
-        return true;
-    }
-    if (hashA != hashB) {
-        return false;
-    }
-    return equals(keyA, keyB);
-}
-
 void* hashmapPut(Hashmap* map, void* key, void* value) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, value);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            map->size++;
-            expandIfNecessary(map);
-            return NULL;
-        }
-
-        // Replace existing entry.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* oldValue = current->value;
-            current->value = value;
-            return oldValue;
-        }
+    Table* table = currentTable(map);
+    Slot* slot = findSlot(map, table, key, hash);
+
+    // Replace existing entry.
+    if (slotHash(slot) != 0) {
+        void* oldValue = slotValue(slot);
+        atomic_store_explicit(&slot->value, (uintptr_t) value, memory_order_release);
+        return oldValue;
+    }
 
-        // Move to next entry.
-        p = &current->next;
+    // Add a new entry.
+    if (!reserve(map)) {
+        errno = ENOMEM;
+        return NULL;
     }
+    if (currentTable(map) != table) {
+        slot = findSlot(map, currentTable(map), key, hash);
+    }
+    setSlot(slot, hash, key, value);
+    map->size++;
+    return NULL;
 }
 
 void* hashmapGet(Hashmap* map, void* key) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return entry->value;
-        }
-        entry = entry->next;
-    }
-
-    return NULL;
+    void* value;
+    lookup(map, key, &value);
+    return value;
 }
 
 bool hashmapContainsKey(Hashmap* map, void* key) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return true;
-        }
-        entry = entry->next;
-    }
-
-    return false;
+    void* value;
+    return lookup(map, key, &value);
 }
 
-void* hashmapMemoize(Hashmap* map, void* key, 
+void* hashmapMemoize(Hashmap* map, void* key,
         void* (*initialValue)(void* key, void* context), void* context) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, NULL);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            void* value = initialValue(key, context);
-            (*p)->value = value;
-            map->size++;
-            expandIfNecessary(map);
-            return value;
-        }
+    Table* table = currentTable(map);
+    Slot* slot = findSlot(map, table, key, hash);
 
-        // Return existing value.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            return current->value;
-        }
+    // Return existing value.
+    if (slotHash(slot) != 0) {
+        return slotValue(slot);
+    }
 
-        // Move to next entry.
-        p = &current->next;
+    // Add a new entry.
+    if (!reserve(map)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void* value = initialValue(key, context);
+    if (currentTable(map) != table) {
+        slot = findSlot(map, currentTable(map), key, hash);
     }
+    setSlot(slot, hash, key, value);
+    map->size++;
+    return value;
 }
 
 void* hashmapRemove(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    // Pointer to the current entry.
-    Entry** p = &(map->buckets[index]);
-    Entry* current;
-    while ((current = *p) != NULL) {
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* value = current->value;
-            *p = current->next;
-            free(current);
-            map->size--;
-            return value;
+    Table* table = currentTable(map);
+    Slot* slot = findSlot(map, table, key, hash);
+    if (slotHash(slot) == 0) {
+        return NULL;
+    }
+    void* value = slotValue(slot);
+
+    // Shift later members of the cluster back, so probes never need
+    // tombstones.
+    size_t mask = table->slotCount - 1;
+    size_t hole = slot - table->slots;
+    size_t next;
+    beginMove(map);
+    for (next = (hole + 1) & mask; ; next = (next + 1) & mask) {
+        Slot* candidate = &table->slots[next];
+        int h = atomic_load_explicit(&candidate->hash, memory_order_relaxed);
+        if (h == 0) {
+            break;
+        }
+        size_t home = calculateIndex(table->slotCount, h);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            Slot* target = &table->slots[hole];
+            atomic_store_explicit(&target->key, atomic_load_explicit(&candidate->key,
+                    memory_order_relaxed), memory_order_relaxed);
+            atomic_store_explicit(&target->value, atomic_load_explicit(&candidate->value,
+                    memory_order_relaxed), memory_order_relaxed);
+            atomic_store_explicit(&target->hash, h, memory_order_relaxed);
+            hole = next;
         }
-
-        p = &current->next;
     }
+    atomic_store_explicit(&table->slots[hole].hash, 0, memory_order_relaxed);
+    atomic_store_explicit(&table->slots[hole].key, 0, memory_order_relaxed);
+    atomic_store_explicit(&table->slots[hole].value, 0, memory_order_relaxed);
+    endMove(map);
 
-    return NULL;
+    map->size--;
+    return value;
 }
 
-void hashmapForEach(Hashmap* map, 
+void hashmapForEach(Hashmap* map,
         bool (*callback)(void* key, void* value, void* context),
         void* context) {
-    size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry *next = entry->next;
-            if (!callback(entry->key, entry->value, context)) {
+    Table* table = currentTable(map);
+    size_t mask = table->slotCount - 1;
+    size_t start = 0;
+    size_t visited;
+
+    // Start right after an empty slot: removing the current entry then only
+    // ever shifts entries we have not seen yet into its slot.
+    while (slotHash(&table->slots[start]) != 0) {
+        start++;
+    }
+    for (visited = 1; visited < table->slotCount; visited++) {
+        Slot* slot = &table->slots[(start + visited) & mask];
+        void* key;
+        while (slotHash(slot) != 0) {
+            key = slotKey(slot);
+            if (!callback(key, slotValue(slot), context)) {
                 return;
             }
-            entry = next;
+            if (slotHash(slot) != 0 && slotKey(slot) == key) {
+                break;
+            }
+            // The callback removed this entry, and another took its place.
         }
     }
 }
 
 size_t hashmapCurrentCapacity(Hashmap* map) {
-    size_t bucketCount = map->bucketCount;
-    return bucketCount * 3 / 4;
+    size_t slotCount = currentTable(map)->slotCount;
+    return slotCount * 3 / 4;
 }
 
 size_t hashmapCountCollisions(Hashmap* map) {
+    Table* table = currentTable(map);
     size_t collisions = 0;
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            if (entry->next != NULL) {
-                collisions++;
-            }
-            entry = entry->next;
+    for (i = 0; i < table->slotCount; i++) {
+        int hash = slotHash(&table->slots[i]);
+        if (hash != 0 && calculateIndex(table->slotCount, hash) != i) {
+            collisions++;
         }
     }
     return collisions;
@@ -106,20 +106,86 @@ int32_t property_get_int32(const char *key, int32_t default_value) {
 
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
+#include <private/android_property_service.h>
+
+/* Reads or writes all |size| bytes; returns 0 if it did. */
+static int read_write_fully(int fd, void *data, size_t size, int writing)
+{
+    char *p = data;
+
+    while (size > 0) {
+        ssize_t n = writing ? TEMP_FAILURE_RETRY(write(fd, p, size))
+                            : TEMP_FAILURE_RETRY(read(fd, p, size));
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
 
 int property_set(const char *key, const char *value)
 {
     return __system_property_set(key, value);
 }
 
-int property_get(const char *key, char *value, const char *default_value)
+int property_set_many(const char * const *keys, const char * const *values, size_t count,
+                      int *results)
 {
-    int len;
+    prop_msg_setprops_header *header;
+    prop_msg_setprops_entry *entries;
+    int32_t replies[PROP_MSG_SETPROPS_MAX];
+    size_t size;
+    size_t i;
+    char *msg;
+    int fd;
+    int ret = -1;
 
-    len = __system_property_get(key, value);
-    if(len > 0) {
-        return len;
+    if (count == 0 || count > PROP_MSG_SETPROPS_MAX) {
+        return -1;
+    }
+
+    size = sizeof(*header) + count * sizeof(*entries);
+    msg = calloc(1, size);
+    if (!msg) {
+        return -1;
+    }
+    header = (prop_msg_setprops_header *) msg;
+    header->cmd = PROP_MSG_SETPROPS;
+    header->count = count;
+    entries = (prop_msg_setprops_entry *) (msg + sizeof(*header));
+    for (i = 0; i < count; i++) {
+        if (strlen(keys[i]) >= PROP_NAME_MAX || strlen(values[i]) >= PROP_VALUE_MAX) {
+            goto out;
+        }
+        strcpy(entries[i].name, keys[i]);
+        strcpy(entries[i].value, values[i]);
+    }
+
+    fd = socket_local_client(PROP_SERVICE_NAME, ANDROID_SOCKET_NAMESPACE_RESERVED,
+                             SOCK_STREAM);
+    if (fd < 0) {
+        goto out;
     }
+    if (read_write_fully(fd, msg, size, 1) == 0 &&
+            read_write_fully(fd, replies, count * sizeof(replies[0]), 0) == 0) {
+        for (i = 0; i < count; i++) {
+            results[i] = replies[i];
+        }
+        ret = 0;
+    }
+    close(fd);
+
+out:
+    free(msg);
+    return ret;
+}
+
+static int property_get_default(char *value, const char *default_value)
+{
+    int len = 0;
+
     if(default_value) {
         len = strlen(default_value);
         if (len >= PROPERTY_VALUE_MAX) {
@@ -131,6 +197,17 @@ int property_get(const char *key, char *value, const char *default_value)
     return len;
 }
 
+int property_get(const char *key, char *value, const char *default_value)
+{
+    int len;
+
+    len = __system_property_get(key, value);
+    if(len > 0) {
+        return len;
+    }
+    return property_get_default(value, default_value);
+}
+
 struct property_list_callback_data
 {
     void (*propfn)(const char *key, const char *value, void *cookie);
@@ -154,3 +231,188 @@ int property_list(
     struct property_list_callback_data data = { propfn, cookie };
     return __system_property_foreach(property_list_callback, &data);
 }
+
+struct property_snapshot_entry
+{
+    char name[PROP_NAME_MAX];
+    char value[PROP_VALUE_MAX];
+};
+
+struct property_snapshot
+{
+    uint32_t serial;
+    size_t count;
+    size_t capacity;
+    struct property_snapshot_entry *entries;
+    const char *prefix;
+    size_t prefix_len;
+    bool failed;
+};
+
+// Passes over the property area before a snapshot settles for one that
+// properties kept changing under.
+#define PROPERTY_SNAPSHOT_TRIES 8
+
+static void property_snapshot_callback(const prop_info *pi, void *cookie)
+{
+    struct property_snapshot *snapshot = cookie;
+    struct property_snapshot_entry *entry;
+
+    if (snapshot->failed) {
+        return;
+    }
+    if (snapshot->count == snapshot->capacity) {
+        size_t capacity = snapshot->capacity ? snapshot->capacity * 2 : 16;
+        entry = realloc(snapshot->entries, capacity * sizeof(*entry));
+        if (entry == NULL) {
+            snapshot->failed = true;
+            return;
+        }
+        snapshot->entries = entry;
+        snapshot->capacity = capacity;
+    }
+
+    entry = &snapshot->entries[snapshot->count];
+    __system_property_read(pi, entry->name, entry->value);
+    if (!strncmp(entry->name, snapshot->prefix, snapshot->prefix_len)) {
+        snapshot->count++;
+    }
+}
+
+static int property_snapshot_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct property_snapshot_entry *)a)->name,
+                  ((const struct property_snapshot_entry *)b)->name);
+}
+
+struct property_snapshot *property_snapshot_create(const char *prefix)
+{
+    struct property_snapshot *snapshot = calloc(1, sizeof(*snapshot));
+    int tries;
+
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->prefix = prefix ? prefix : "";
+    snapshot->prefix_len = strlen(snapshot->prefix);
+
+    for (tries = 0; tries < PROPERTY_SNAPSHOT_TRIES; tries++) {
+        snapshot->serial = __system_property_area_serial();
+        snapshot->count = 0;
+        __system_property_foreach(property_snapshot_callback, snapshot);
+        if (snapshot->failed || __system_property_area_serial() == snapshot->serial) {
+            break;
+        }
+    }
+    if (snapshot->failed) {
+        property_snapshot_free(snapshot);
+        return NULL;
+    }
+    if (snapshot->count > 0) {
+        qsort(snapshot->entries, snapshot->count, sizeof(snapshot->entries[0]),
+              property_snapshot_compare);
+    }
+    snapshot->prefix = NULL;
+    return snapshot;
+}
+
+void property_snapshot_free(struct property_snapshot *snapshot)
+{
+    if (snapshot) {
+        free(snapshot->entries);
+        free(snapshot);
+    }
+}
+
+size_t property_snapshot_count(const struct property_snapshot *snapshot)
+{
+    return snapshot->count;
+}
+
+const char *property_snapshot_name(const struct property_snapshot *snapshot, size_t i)
+{
+    return i < snapshot->count ? snapshot->entries[i].name : NULL;
+}
+
+const char *property_snapshot_value(const struct property_snapshot *snapshot, size_t i)
+{
+    return i < snapshot->count ? snapshot->entries[i].value : NULL;
+}
+
+int property_snapshot_get(const struct property_snapshot *snapshot, const char *key,
+                          char *value, const char *default_value)
+{
+    struct property_snapshot_entry probe;
+    const struct property_snapshot_entry *entry = NULL;
+    int len = 0;
+
+    if (key && strlen(key) < sizeof(probe.name)) {
+        strcpy(probe.name, key);
+        entry = bsearch(&probe, snapshot->entries, snapshot->count,
+                        sizeof(snapshot->entries[0]), property_snapshot_compare);
+    }
+    if (entry) {
+        len = strlen(entry->value);
+        memcpy(value, entry->value, len + 1);
+    }
+    if (len > 0) {
+        return len;
+    }
+    return property_get_default(value, default_value);
+}
+
+uint32_t property_snapshot_serial(const struct property_snapshot *snapshot)
+{
+    return snapshot->serial;
+}
+
+void property_snapshot_wait(const struct property_snapshot *snapshot)
+{
+    __system_property_wait_any(snapshot->serial);
+}
+
+static uint32_t property_watch_serial(struct property_watch *watch)
+{
+    if (watch->pi == NULL) {
+        watch->pi = __system_property_find(watch->key);
+        if (watch->pi == NULL) {
+            return 0;
+        }
+    }
+    return __system_property_serial(watch->pi);
+}
+
+void property_watch_init(struct property_watch *watch, const char *key)
+{
+    watch->key = key;
+    watch->pi = NULL;
+    watch->serial = property_watch_serial(watch);
+    watch->changed = 0;
+}
+
+int property_wait_for_change(struct property_watch *watches, size_t count)
+{
+    for (;;) {
+        // Taken before looking, so that a set which comes in after the
+        // look makes the wait below return straight away.
+        uint32_t area_serial = __system_property_area_serial();
+        bool was_missing;
+        uint32_t serial;
+        int changed = 0;
+        size_t i;
+
+        for (i = 0; i < count; i++) {
+            was_missing = watches[i].pi == NULL;
+            serial = property_watch_serial(&watches[i]);
+            watches[i].changed = serial != watches[i].serial ||
+                    (was_missing && watches[i].pi != NULL);
+            watches[i].serial = serial;
+            changed += watches[i].changed;
+        }
+        if (changed > 0 || count == 0) {
+            return changed;
+        }
+
+        __system_property_wait_any(area_serial);
+    }
+}
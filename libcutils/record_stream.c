@@ -26,94 +26,254 @@
 #include <winsock2.h>   /* for ntohl */
 #else
 #include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <cutils/ashmem.h>
 #endif
 
 #define HEADER_SIZE 4
 
+/*
+ * Records are read into a ring buffer several records long, so that one
+ * read() usually brings in many records, and records are handed out where
+ * they lie instead of being moved to the front first.
+ */
 struct RecordStream {
     int fd;
     size_t maxRecordLen;
 
     unsigned char *buffer;
+    size_t capacity;    /* power of 2 */
+
+    /* Free-running offsets: [head, tail) is read but not yet handed out. */
+    size_t head;
+    size_t tail;
 
-    unsigned char *unconsumed;
-    unsigned char *read_end;
-    unsigned char *buffer_end;
+    /* Nonzero if buffer is mapped twice in a row, so that records which
+     * wrap around the end of the ring are contiguous anyway. */
+    size_t mappedSize;
+
+    /* Otherwise such records are copied here. */
+    unsigned char *scratch;
 };
 
+static size_t ring_capacity(size_t maxRecordLen, size_t minimum)
+{
+    size_t capacity = minimum;
 
-extern RecordStream *record_stream_new(int fd, size_t maxRecordLen)
+    /* Room for two records at least, so one can be read while the other is
+     * handed out. */
+    while (capacity < 2 * (maxRecordLen + HEADER_SIZE)) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+static RecordStream *record_stream_alloc(int fd, size_t maxRecordLen)
 {
     RecordStream *ret;
 
     assert (maxRecordLen <= 0xffff);
 
     ret = (RecordStream *)calloc(1, sizeof(RecordStream));
+    if (ret == NULL) {
+        return NULL;
+    }
 
     ret->fd = fd;
     ret->maxRecordLen = maxRecordLen;
-    ret->buffer = (unsigned char *)malloc (maxRecordLen + HEADER_SIZE);
-    
-    ret->unconsumed = ret->buffer;
-    ret->read_end = ret->buffer;
-    ret->buffer_end = ret->buffer + maxRecordLen + HEADER_SIZE;
+    return ret;
+}
 
+static RecordStream *record_stream_alloc_buffers(RecordStream *ret)
+{
+    ret->capacity = ring_capacity(ret->maxRecordLen, 4096);
+    ret->buffer = (unsigned char *)malloc(ret->capacity);
+    ret->scratch = (unsigned char *)malloc(ret->maxRecordLen + 1);
+    if (ret->buffer == NULL || ret->scratch == NULL) {
+        record_stream_free(ret);
+        return NULL;
+    }
     return ret;
 }
 
+extern RecordStream *record_stream_new(int fd, size_t maxRecordLen)
+{
+    RecordStream *ret = record_stream_alloc(fd, maxRecordLen);
+
+    return ret != NULL ? record_stream_alloc_buffers(ret) : NULL;
+}
+
+#if !defined(_WIN32)
+/* Maps the same size bytes of shared memory at base and base + size. */
+static unsigned char *map_twice(size_t size)
+{
+    unsigned char *base;
+    int fd;
+
+    fd = ashmem_create_region("record_stream", size);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED
+        || mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * size);
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+    return base;
+}
+#endif
+
+extern RecordStream *record_stream_new_mapped(int fd, size_t maxRecordLen)
+{
+    RecordStream *ret = record_stream_alloc(fd, maxRecordLen);
+
+    if (ret == NULL) {
+        return NULL;
+    }
+
+#if !defined(_WIN32)
+    ret->capacity = ring_capacity(maxRecordLen, getpagesize());
+    ret->buffer = map_twice(ret->capacity);
+    if (ret->buffer != NULL) {
+        ret->mappedSize = 2 * ret->capacity;
+        return ret;
+    }
+#endif
+
+    return record_stream_alloc_buffers(ret);
+}
+
 
 extern void record_stream_free(RecordStream *rs)
 {
-    free(rs->buffer);
+    if (rs->mappedSize) {
+#if !defined(_WIN32)
+        munmap(rs->buffer, rs->mappedSize);
+#endif
+    } else {
+        free(rs->buffer);
+    }
+    free(rs->scratch);
     free(rs);
 }
 
 
-/* returns NULL; if there isn't a full record in the buffer */
-static unsigned char * getEndOfRecord (unsigned char *p_begin,
-                                            unsigned char *p_end)
+/*
+ * Finds the record at the head of the buffer.
+ *
+ * Returns 1 and hands out the record if it is all there, 0 if not, and
+ * -1 / errno = EFBIG if it is longer than maxRecordLen.
+ *
+ * A record that wraps around the end of an unmapped ring is copied to the
+ * scratch buffer, unless allowCopy is false, in which case 0 is returned.
+ */
+static int getNextRecord (RecordStream *p_rs, int allowCopy,
+                          void **p_outRecord, size_t *p_outRecordLen)
 {
-    size_t len;
-    unsigned char * p_ret;
+    size_t mask = p_rs->capacity - 1;
+    size_t available = p_rs->tail - p_rs->head;
+    size_t offset, len, i;
+    unsigned char header[HEADER_SIZE];
+    uint32_t netLen;
 
-    if (p_end < p_begin + HEADER_SIZE) {
-        return NULL;
+    if (available < HEADER_SIZE) {
+        return 0;
     }
 
     //First four bytes are length
-    len = ntohl(*((uint32_t *)p_begin));
+    offset = p_rs->head & mask;
+    if (p_rs->mappedSize || offset + HEADER_SIZE <= p_rs->capacity) {
+        memcpy(&netLen, p_rs->buffer + offset, sizeof(netLen));
+    } else {
+        for (i = 0; i < HEADER_SIZE; i++) {
+            header[i] = p_rs->buffer[(offset + i) & mask];
+        }
+        memcpy(&netLen, header, sizeof(netLen));
+    }
+    len = ntohl(netLen);
 
-    p_ret = p_begin + HEADER_SIZE + len;
+    if (len > p_rs->maxRecordLen) {
+        // this should never happen
+        //ALOGE("max record length exceeded\n");
+        assert (0);
+        errno = EFBIG;
+        return -1;
+    }
 
-    if (p_end < p_ret) {
-        return NULL;
+    if (available < HEADER_SIZE + len) {
+        return 0;
+    }
+
+    offset = (p_rs->head + HEADER_SIZE) & mask;
+    if (p_rs->mappedSize || offset + len <= p_rs->capacity) {
+        *p_outRecord = p_rs->buffer + offset;
+    } else if (allowCopy) {
+        size_t first = p_rs->capacity - offset;
+        memcpy(p_rs->scratch, p_rs->buffer + offset, first);
+        memcpy(p_rs->scratch + first, p_rs->buffer, len - first);
+        *p_outRecord = p_rs->scratch;
+    } else {
+        return 0;
     }
 
-    return p_ret;
+    p_rs->head += HEADER_SIZE + len;
+    *p_outRecordLen = len;
+    return 1;
 }
 
-static void *getNextRecord (RecordStream *p_rs, size_t *p_outRecordLen)
+/* Reads as much as fits into the free part of the ring, with one call. */
+static ssize_t fillBuffer (RecordStream *p_rs)
 {
-    unsigned char *record_start, *record_end;
-
-    record_end = getEndOfRecord (p_rs->unconsumed, p_rs->read_end);
-
-    if (record_end != NULL) {
-        /* one full line in the buffer */
-        record_start = p_rs->unconsumed + HEADER_SIZE;
-        p_rs->unconsumed = record_end;
+    size_t mask = p_rs->capacity - 1;
+    size_t space, offset, first;
+    ssize_t countRead;
 
-        *p_outRecordLen = record_end - record_start;
+    if (p_rs->head == p_rs->tail) {
+        /* Empty: start over at the front, for the longest possible read. */
+        p_rs->head = p_rs->tail = 0;
+    }
 
-        return record_start;
+    space = p_rs->capacity - (p_rs->tail - p_rs->head);
+    offset = p_rs->tail & mask;
+    first = p_rs->capacity - offset;
+
+    if (p_rs->mappedSize || space <= first) {
+        countRead = read (p_rs->fd, p_rs->buffer + offset, space);
+    } else {
+#if !defined(_WIN32)
+        struct iovec iov[2];
+
+        iov[0].iov_base = p_rs->buffer + offset;
+        iov[0].iov_len = first;
+        iov[1].iov_base = p_rs->buffer;
+        iov[1].iov_len = space - first;
+        countRead = readv (p_rs->fd, iov, 2);
+#else
+        countRead = read (p_rs->fd, p_rs->buffer + offset, first);
+#endif
     }
 
-    return NULL;
+    if (countRead > 0) {
+        p_rs->tail += countRead;
+    }
+    return countRead;
 }
 
 /**
  * Reads the next record from stream fd
- * Records are prefixed by a 16-bit big endian length value
+ * Records are prefixed by a 32-bit big endian length value
  * Records may not be larger than maxRecordLen
  *
  * Doesn't guard against EINTR
@@ -127,60 +287,92 @@ static void *getNextRecord (RecordStream *p_rs, size_t *p_outRecordLen)
 int record_stream_get_next (RecordStream *p_rs, void ** p_outRecord, 
                                     size_t *p_outRecordLen)
 {
-    void *ret;
-
     ssize_t countRead;
+    int found;
 
     /* is there one record already in the buffer? */
-    ret = getNextRecord (p_rs, p_outRecordLen);
+    found = getNextRecord (p_rs, 1, p_outRecord, p_outRecordLen);
 
-    if (ret != NULL) {
-        *p_outRecord = ret;
-        return 0;
+    if (found != 0) {
+        return found > 0 ? 0 : -1;
     }
 
-    // if the buffer is full and we don't have a full record
-    if (p_rs->unconsumed == p_rs->buffer 
-        && p_rs->read_end == p_rs->buffer_end
-    ) {
-        // this should never happen
-        //ALOGE("max record length exceeded\n");
-        assert (0);
-        errno = EFBIG;
+    countRead = fillBuffer (p_rs);
+
+    if (countRead <= 0) {
+        /* note: end-of-stream drops through here too */
+        *p_outRecord = NULL;
+        return countRead;
+    }
+
+    found = getNextRecord (p_rs, 1, p_outRecord, p_outRecordLen);
+
+    if (found == 0) {
+        /* not enough of a buffer to for a whole command */
+        errno = EAGAIN;
         return -1;
     }
 
-    if (p_rs->unconsumed != p_rs->buffer) {
-        // move remainder to the beginning of the buffer
-        size_t toMove;
+    return found > 0 ? 0 : -1;
+}
+
+/* Hands out whole records until maxRecords or the first that would need a
+ * second copy to the scratch buffer. */
+static int getRecords (RecordStream *p_rs, struct record_stream_record *p_records,
+                       size_t maxRecords, size_t *p_count)
+{
+    int found = 1;
 
-        toMove = p_rs->read_end - p_rs->unconsumed;
-        if (toMove) {
-            memmove(p_rs->buffer, p_rs->unconsumed, toMove);
+    while (*p_count < maxRecords) {
+        struct record_stream_record *r = &p_records[*p_count];
+        found = getNextRecord (p_rs, *p_count == 0, &r->data, &r->len);
+        if (found <= 0) {
+            break;
         }
+        ++*p_count;
+        if (r->data == p_rs->scratch) {
+            break;
+        }
+    }
 
-        p_rs->read_end = p_rs->buffer + toMove;
-        p_rs->unconsumed = p_rs->buffer;
+    /* Errors wait for the next call if there are records to return first. */
+    return *p_count > 0 ? 0 : found;
+}
+
+int record_stream_get_batch (RecordStream *p_rs,
+                             struct record_stream_record *p_records,
+                             size_t maxRecords, size_t *p_count)
+{
+    ssize_t countRead;
+    int found;
+
+    *p_count = 0;
+    if (maxRecords == 0) {
+        return 0;
     }
 
-    countRead = read (p_rs->fd, p_rs->read_end, p_rs->buffer_end - p_rs->read_end);
+    found = getRecords (p_rs, p_records, maxRecords, p_count);
+
+    if (found != 0) {
+        return found > 0 ? 0 : -1;
+    }
+    if (*p_count > 0) {
+        return 0;
+    }
+
+    countRead = fillBuffer (p_rs);
 
     if (countRead <= 0) {
-        /* note: end-of-stream drops through here too */
-        *p_outRecord = NULL;
+        /* end of stream, or the error from read() */
         return countRead;
     }
 
-    p_rs->read_end += countRead;
+    found = getRecords (p_rs, p_records, maxRecords, p_count);
 
-    ret = getNextRecord (p_rs, p_outRecordLen);
-
-    if (ret == NULL) {
-        /* not enough of a buffer to for a whole command */
+    if (found == 0 && *p_count == 0) {
         errno = EAGAIN;
         return -1;
     }
 
-    *p_outRecord = ret;        
-    return 0;
+    return found >= 0 ? 0 : -1;
 }
@@ -39,9 +39,13 @@ static inline SchedPolicy _policy(SchedPolicy p)
 
 #if defined(__ANDROID__)
 
+#include <dirent.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sched.h>
+#include <stdbool.h>
 #include <sys/prctl.h>
+#include <time.h>
 
 #define POLICY_DEBUG 0
 
@@ -52,20 +56,102 @@ static inline SchedPolicy _policy(SchedPolicy p)
 #define TIMER_SLACK_BG 40000000
 #define TIMER_SLACK_FG 50000
 
+// cgroup writes slower than this are logged
+#define SLOW_WRITE_NS 50000000LL
+
 static pthread_once_t the_once = PTHREAD_ONCE_INIT;
 
+// Guards the policy cache and the stats.
+static pthread_mutex_t the_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Prepended to /dev and /proc paths; tests point it at a mocked tree.
+static char root_dir[PATH_MAX / 2];
+
 static int __sys_supports_schedgroups = -1;
 
 // File descriptors open to /dev/cpuctl/../tasks, setup by initialize, or -1 on error.
 static int bg_cgroup_fd = -1;
 static int fg_cgroup_fd = -1;
+// Same for /dev/cpuctl/../cgroup.procs, which moves whole processes.
+static int bg_cgroup_procs_fd = -1;
+static int fg_cgroup_procs_fd = -1;
 
 #ifdef USE_CPUSETS
 // File descriptors open to /dev/cpuset/../tasks, setup by initialize, or -1 on error
 static int bg_cpuset_fd = -1;
 static int fg_cpuset_fd = -1;
+static int bg_cpuset_procs_fd = -1;
+static int fg_cpuset_procs_fd = -1;
 #endif
 
+enum { CGROUP_CPUCTL, CGROUP_CPUSET, CGROUP_CNT };
+enum { GROUP_NONE = -1, GROUP_BG = 0, GROUP_FG = 1 };
+
+// The group this process last moved each thread to, so that batch moves can
+// skip threads already in place. Direct mapped on the tid; a tid of 0 marks
+// an unused entry.
+#define POLICY_CACHE_SIZE 1024
+struct policy_cache_entry {
+    int tid;
+    signed char group[CGROUP_CNT];
+};
+static struct policy_cache_entry policy_cache[POLICY_CACHE_SIZE];
+
+static struct sched_policy_stats stats;
+
+static int policy_group(SchedPolicy policy)
+{
+    switch (policy) {
+    case SP_BACKGROUND:
+        return GROUP_BG;
+    case SP_FOREGROUND:
+    case SP_AUDIO_APP:
+    case SP_AUDIO_SYS:
+        return GROUP_FG;
+    default:
+        return GROUP_NONE;
+    }
+}
+
+static bool is_cached(int cgroup, int tid, int group)
+{
+    const struct policy_cache_entry *e = &policy_cache[tid % POLICY_CACHE_SIZE];
+    bool cached;
+
+    pthread_mutex_lock(&the_lock);
+    cached = group != GROUP_NONE && e->tid == tid && e->group[cgroup] == group;
+    pthread_mutex_unlock(&the_lock);
+    return cached;
+}
+
+static void set_cached(int cgroup, int tid, int group)
+{
+    struct policy_cache_entry *e = &policy_cache[tid % POLICY_CACHE_SIZE];
+
+    pthread_mutex_lock(&the_lock);
+    if (e->tid != tid) {
+        e->tid = tid;
+        memset(e->group, GROUP_NONE, sizeof(e->group));
+    }
+    e->group[cgroup] = group;
+    pthread_mutex_unlock(&the_lock);
+}
+
+static void count_moves(uint64_t moves, uint64_t skipped)
+{
+    pthread_mutex_lock(&the_lock);
+    stats.moves += moves;
+    stats.skipped += skipped;
+    pthread_mutex_unlock(&the_lock);
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 /* Add tid to the scheduling group defined by the policy */
 static int add_tid_to_cgroup(int tid, int fd)
 {
@@ -76,24 +162,50 @@ static int add_tid_to_cgroup(int tid, int fd)
     }
 
     // specialized itoa -- works for tid > 0
+    // The kernel ignores the trailing newline.
     char text[22];
     char *end = text + sizeof(text) - 1;
     char *ptr = end;
     *ptr = '\0';
+    *--ptr = '\n';
     while (tid > 0) {
         *--ptr = '0' + (tid % 10);
         tid = tid / 10;
     }
 
-    if (write(fd, ptr, end - ptr) < 0) {
+    int64_t start = now_ns();
+    ssize_t rc = write(fd, ptr, end - ptr);
+    int saved_errno = errno;
+    int64_t elapsed = now_ns() - start;
+
+    pthread_mutex_lock(&the_lock);
+    stats.writes++;
+    stats.write_ns += elapsed;
+    if ((uint64_t)elapsed > stats.max_write_ns) {
+        stats.max_write_ns = elapsed;
+    }
+    if (rc < 0 && saved_errno != ESRCH) {
+        stats.errors++;
+    }
+    pthread_mutex_unlock(&the_lock);
+
+    if (elapsed > SLOW_WRITE_NS) {
+        *(end - 1) = '\0';
+        SLOGW("add_tid_to_cgroup of %s took %lld ms; fd=%d\n",
+              ptr, (long long)(elapsed / 1000000), fd);
+        *(end - 1) = '\n';
+    }
+
+    if (rc < 0) {
         /*
          * If the thread is in the process of exiting,
          * don't flag an error
          */
-        if (errno == ESRCH)
+        if (saved_errno == ESRCH)
                 return 0;
+        *(end - 1) = '\0';
         SLOGW("add_tid_to_cgroup failed to write '%s' (%s); fd=%d\n",
-              ptr, strerror(errno), fd);
+              ptr, strerror(saved_errno), fd);
         errno = EINVAL;
         return -1;
     }
@@ -101,38 +213,91 @@ static int add_tid_to_cgroup(int tid, int fd)
     return 0;
 }
 
+static int open_under_root(const char *path)
+{
+    char filename[PATH_MAX];
+
+    snprintf(filename, sizeof(filename), "%s%s", root_dir, path);
+    return open(filename, O_WRONLY | O_CLOEXEC);
+}
+
+static bool exists_under_root(const char *path)
+{
+    char filename[PATH_MAX];
+
+    snprintf(filename, sizeof(filename), "%s%s", root_dir, path);
+    return !access(filename, F_OK);
+}
+
 static void __initialize(void) {
-    char* filename;
-    if (!access("/dev/cpuctl/tasks", F_OK)) {
+    const char* filename;
+    if (exists_under_root("/dev/cpuctl/tasks")) {
         __sys_supports_schedgroups = 1;
 
         filename = "/dev/cpuctl/tasks";
-        fg_cgroup_fd = open(filename, O_WRONLY | O_CLOEXEC);
+        fg_cgroup_fd = open_under_root(filename);
         if (fg_cgroup_fd < 0) {
             SLOGE("open of %s failed: %s\n", filename, strerror(errno));
         }
 
         filename = "/dev/cpuctl/bg_non_interactive/tasks";
-        bg_cgroup_fd = open(filename, O_WRONLY | O_CLOEXEC);
+        bg_cgroup_fd = open_under_root(filename);
         if (bg_cgroup_fd < 0) {
             SLOGE("open of %s failed: %s\n", filename, strerror(errno));
         }
+
+        // Optional: whole processes are moved thread by thread without them.
+        fg_cgroup_procs_fd = open_under_root("/dev/cpuctl/cgroup.procs");
+        bg_cgroup_procs_fd = open_under_root("/dev/cpuctl/bg_non_interactive/cgroup.procs");
     } else {
         __sys_supports_schedgroups = 0;
     }
 
 #ifdef USE_CPUSETS
-    if (!access("/dev/cpuset/tasks", F_OK)) {
+    if (exists_under_root("/dev/cpuset/tasks")) {
 
         filename = "/dev/cpuset/foreground/tasks";
-        fg_cpuset_fd = open(filename, O_WRONLY | O_CLOEXEC);
+        fg_cpuset_fd = open_under_root(filename);
         filename = "/dev/cpuset/background/tasks";
-        bg_cpuset_fd = open(filename, O_WRONLY | O_CLOEXEC);
+        bg_cpuset_fd = open_under_root(filename);
+        fg_cpuset_procs_fd = open_under_root("/dev/cpuset/foreground/cgroup.procs");
+        bg_cpuset_procs_fd = open_under_root("/dev/cpuset/background/cgroup.procs");
     }
 #endif
 
 }
 
+static void close_fd(int *fd)
+{
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+/* For tests only: looks for /dev and /proc under |root| from now on, and
+ * forgets what earlier calls did. Must not race with other calls.
+ */
+void __set_sched_policy_root(const char *root)
+{
+    pthread_once(&the_once, __initialize);
+
+    close_fd(&fg_cgroup_fd);
+    close_fd(&bg_cgroup_fd);
+    close_fd(&fg_cgroup_procs_fd);
+    close_fd(&bg_cgroup_procs_fd);
+#ifdef USE_CPUSETS
+    close_fd(&fg_cpuset_fd);
+    close_fd(&bg_cpuset_fd);
+    close_fd(&fg_cpuset_procs_fd);
+    close_fd(&bg_cpuset_procs_fd);
+#endif
+    snprintf(root_dir, sizeof(root_dir), "%s", root ? root : "");
+    memset(policy_cache, 0, sizeof(policy_cache));
+    memset(&stats, 0, sizeof(stats));
+    __initialize();
+}
+
 /*
  * Try to get the scheduler group.
  *
@@ -146,29 +311,37 @@ static void __initialize(void) {
  */
 static int getSchedulerGroup(int tid, char* buf, size_t bufLen)
 {
-#if defined(__ANDROID__)
-    char pathBuf[32];
-    char lineBuf[256];
-    FILE *fp;
+    char pathBuf[PATH_MAX];
+    char data[1024];
+    char *next;
+    char *line;
+    ssize_t n;
+    int fd;
 
-    snprintf(pathBuf, sizeof(pathBuf), "/proc/%d/cgroup", tid);
-    if (!(fp = fopen(pathBuf, "r"))) {
+    snprintf(pathBuf, sizeof(pathBuf), "%s/proc/%d/cgroup", root_dir, tid);
+    if ((fd = open(pathBuf, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    // One read: the file is a handful of short lines.
+    n = TEMP_FAILURE_RETRY(read(fd, data, sizeof(data) - 1));
+    close(fd);
+    if (n < 0) {
         return -1;
     }
+    data[n] = '\0';
 
-    while(fgets(lineBuf, sizeof(lineBuf) -1, fp)) {
-        char *next = lineBuf;
+    next = data;
+    while ((line = strsep(&next, "\n")) != NULL && *line) {
+        char *field = line;
         char *subsys;
         char *grp;
         size_t len;
 
         /* Junk the first field */
-        if (!strsep(&next, ":")) {
-            goto out_bad_data;
-        }
-
-        if (!(subsys = strsep(&next, ":"))) {
-            goto out_bad_data;
+        if (!strsep(&field, ":") || !(subsys = strsep(&field, ":")) || !field ||
+                *field != '/') {
+            SLOGE("Bad cgroup data {%s}", line);
+            return -1;
         }
 
         if (strcmp(subsys, "cpu")) {
@@ -176,33 +349,18 @@ static int getSchedulerGroup(int tid, char* buf, size_t bufLen)
             continue;
         }
 
-        if (!(grp = strsep(&next, ":"))) {
-            goto out_bad_data;
-        }
-        grp++; /* Drop the leading '/' */
+        grp = field + 1; /* Drop the leading '/' */
         len = strlen(grp);
-        grp[len-1] = '\0'; /* Drop the trailing '\n' */
-
         if (bufLen <= len) {
             len = bufLen - 1;
         }
         strncpy(buf, grp, len);
         buf[len] = '\0';
-        fclose(fp);
         return 0;
     }
 
     SLOGE("Failed to find cpu subsys");
-    fclose(fp);
-    return -1;
- out_bad_data:
-    SLOGE("Bad cgroup data {%s}", lineBuf);
-    fclose(fp);
-    return -1;
-#else
-    errno = ENOSYS;
     return -1;
-#endif
 }
 
 int get_sched_policy(int tid, SchedPolicy *policy)
@@ -240,6 +398,183 @@ int get_sched_policy(int tid, SchedPolicy *policy)
     return 0;
 }
 
+static int cgroup_fd(int cgroup, int group, bool procs)
+{
+    if (group == GROUP_NONE) {
+        return -1;
+    }
+    if (cgroup == CGROUP_CPUCTL) {
+        if (procs) {
+            return group == GROUP_BG ? bg_cgroup_procs_fd : fg_cgroup_procs_fd;
+        }
+        return group == GROUP_BG ? bg_cgroup_fd : fg_cgroup_fd;
+    }
+#ifdef USE_CPUSETS
+    if (procs) {
+        return group == GROUP_BG ? bg_cpuset_procs_fd : fg_cpuset_procs_fd;
+    }
+    return group == GROUP_BG ? bg_cpuset_fd : fg_cpuset_fd;
+#else
+    return -1;
+#endif
+}
+
+static void set_timer_slack(int tid, SchedPolicy policy)
+{
+    prctl(PR_SET_TIMERSLACK_PID,
+          policy == SP_BACKGROUND ? TIMER_SLACK_BG : TIMER_SLACK_FG, tid);
+}
+
+/* Moves one thread to the cpuset for the policy. */
+static int cpuset_move_tid(int tid, SchedPolicy policy)
+{
+    int group = policy_group(policy);
+
+    if (add_tid_to_cgroup(tid, cgroup_fd(CGROUP_CPUSET, group, false)) != 0) {
+        if (errno != ESRCH && errno != ENOENT)
+            return -errno;
+    }
+    set_cached(CGROUP_CPUSET, tid, group);
+
+    return 0;
+}
+
+/* Moves one thread to the scheduling group for the policy. */
+static int sched_move_tid(int tid, SchedPolicy policy)
+{
+    if (__sys_supports_schedgroups) {
+        int group = policy_group(policy);
+        if (add_tid_to_cgroup(tid, cgroup_fd(CGROUP_CPUCTL, group, false)) != 0) {
+            if (errno != ESRCH && errno != ENOENT)
+                return -errno;
+        }
+        set_cached(CGROUP_CPUCTL, tid, group);
+    } else {
+        struct sched_param param;
+
+        param.sched_priority = 0;
+        sched_setscheduler(tid,
+                           (policy == SP_BACKGROUND) ?
+                           SCHED_BATCH : SCHED_NORMAL,
+                           &param);
+    }
+
+    set_timer_slack(tid, policy);
+
+    return 0;
+}
+
+static int move_tids(int cgroup, const int *tids, size_t count, SchedPolicy policy)
+{
+    int group = policy_group(policy);
+    bool cacheable = cgroup == CGROUP_CPUSET || __sys_supports_schedgroups;
+    uint64_t skipped = 0;
+    int result = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int tid = tids[i] ? tids[i] : gettid();
+        int rc;
+
+        if (cacheable && is_cached(cgroup, tid, group)) {
+            skipped++;
+            continue;
+        }
+        rc = cgroup == CGROUP_CPUSET ? cpuset_move_tid(tid, policy)
+                                     : sched_move_tid(tid, policy);
+        if (rc != 0 && result == 0) {
+            result = rc;
+        }
+    }
+    count_moves(count, skipped);
+    return result;
+}
+
+/* Lists the threads of a process. Returns the count, or -1 with errno set. */
+static int list_tids(int pid, int **tids)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    size_t count = 0, alloc = 0;
+    DIR *d;
+
+    snprintf(path, sizeof(path), "%s/proc/%d/task", root_dir, pid);
+    if (!(d = opendir(path))) {
+        return -1;
+    }
+    *tids = NULL;
+    while ((de = readdir(d)) != NULL) {
+        int tid = atoi(de->d_name);
+        if (tid <= 0) {
+            continue;
+        }
+        if (count == alloc) {
+            int *grown;
+            alloc = alloc ? alloc * 2 : 64;
+            grown = realloc(*tids, alloc * sizeof(**tids));
+            if (!grown) {
+                free(*tids);
+                closedir(d);
+                errno = ENOMEM;
+                return -1;
+            }
+            *tids = grown;
+        }
+        (*tids)[count++] = tid;
+    }
+    closedir(d);
+    return count;
+}
+
+static int move_process(int cgroup, int pid, SchedPolicy policy)
+{
+    int group = policy_group(policy);
+    bool cacheable = cgroup == CGROUP_CPUSET || __sys_supports_schedgroups;
+    int *tids;
+    int count, i, fd, result = 0;
+    bool in_place = cacheable;
+
+    if (pid == 0) {
+        pid = getpid();
+    }
+    if ((count = list_tids(pid, &tids)) < 0) {
+        return errno == ENOENT ? 0 : -errno;
+    }
+
+    for (i = 0; i < count && in_place; i++) {
+        in_place = is_cached(cgroup, tids[i], group);
+    }
+    if (in_place) {
+        count_moves(1, 1);
+        free(tids);
+        return 0;
+    }
+    count_moves(1, 0);
+
+    fd = cacheable ? cgroup_fd(cgroup, group, true) : -1;
+    if (fd >= 0 && group != GROUP_NONE) {
+        if (add_tid_to_cgroup(pid, fd) != 0 && errno != ESRCH && errno != ENOENT) {
+            result = -errno;
+        }
+        for (i = 0; i < count && result == 0; i++) {
+            set_cached(cgroup, tids[i], group);
+            if (cgroup == CGROUP_CPUCTL) {
+                set_timer_slack(tids[i], policy);
+            }
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            int rc = cgroup == CGROUP_CPUSET ? cpuset_move_tid(tids[i], policy)
+                                             : sched_move_tid(tids[i], policy);
+            if (rc != 0 && result == 0) {
+                result = rc;
+            }
+        }
+    }
+    free(tids);
+    return result;
+}
+
 int set_cpuset_policy(int tid, SchedPolicy policy)
 {
     // in the absence of cpusets, use the old sched policy
@@ -252,27 +587,32 @@ int set_cpuset_policy(int tid, SchedPolicy policy)
     policy = _policy(policy);
     pthread_once(&the_once, __initialize);
 
-    int fd;
-    switch (policy) {
-    case SP_BACKGROUND:
-        fd = bg_cpuset_fd;
-        break;
-    case SP_FOREGROUND:
-    case SP_AUDIO_APP:
-    case SP_AUDIO_SYS:
-        fd = fg_cpuset_fd;
-        break;
-    default:
-        fd = -1;
-        break;
-    }
+    count_moves(1, 0);
+    return cpuset_move_tid(tid, policy);
+#endif
+}
 
-    if (add_tid_to_cgroup(tid, fd) != 0) {
-        if (errno != ESRCH && errno != ENOENT)
-            return -errno;
-    }
+int set_cpuset_policy_tids(const int *tids, size_t count, SchedPolicy policy)
+{
+#ifndef USE_CPUSETS
+    return set_sched_policy_tids(tids, count, policy);
+#else
+    policy = _policy(policy);
+    pthread_once(&the_once, __initialize);
 
-    return 0;
+    return move_tids(CGROUP_CPUSET, tids, count, policy);
+#endif
+}
+
+int set_process_cpuset_policy(int pid, SchedPolicy policy)
+{
+#ifndef USE_CPUSETS
+    return set_process_sched_policy(pid, policy);
+#else
+    policy = _policy(policy);
+    pthread_once(&the_once, __initialize);
+
+    return move_process(CGROUP_CPUSET, pid, policy);
 #endif
 }
 
@@ -325,41 +665,38 @@ int set_sched_policy(int tid, SchedPolicy policy)
     }
 #endif
 
-    if (__sys_supports_schedgroups) {
-        int fd;
-        switch (policy) {
-        case SP_BACKGROUND:
-            fd = bg_cgroup_fd;
-            break;
-        case SP_FOREGROUND:
-        case SP_AUDIO_APP:
-        case SP_AUDIO_SYS:
-            fd = fg_cgroup_fd;
-            break;
-        default:
-            fd = -1;
-            break;
-        }
+    count_moves(1, 0);
+    return sched_move_tid(tid, policy);
+}
 
+int set_sched_policy_tids(const int *tids, size_t count, SchedPolicy policy)
+{
+    policy = _policy(policy);
+    pthread_once(&the_once, __initialize);
 
-        if (add_tid_to_cgroup(tid, fd) != 0) {
-            if (errno != ESRCH && errno != ENOENT)
-                return -errno;
-        }
-    } else {
-        struct sched_param param;
+    return move_tids(CGROUP_CPUCTL, tids, count, policy);
+}
 
-        param.sched_priority = 0;
-        sched_setscheduler(tid,
-                           (policy == SP_BACKGROUND) ?
-                           SCHED_BATCH : SCHED_NORMAL,
-                           &param);
-    }
+int set_process_sched_policy(int pid, SchedPolicy policy)
+{
+    policy = _policy(policy);
+    pthread_once(&the_once, __initialize);
 
-    prctl(PR_SET_TIMERSLACK_PID,
-          policy == SP_BACKGROUND ? TIMER_SLACK_BG : TIMER_SLACK_FG, tid);
+    return move_process(CGROUP_CPUCTL, pid, policy);
+}
 
-    return 0;
+void get_sched_policy_stats(struct sched_policy_stats *out)
+{
+    pthread_mutex_lock(&the_lock);
+    *out = stats;
+    pthread_mutex_unlock(&the_lock);
+}
+
+void reset_sched_policy_stats(void)
+{
+    pthread_mutex_lock(&the_lock);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&the_lock);
 }
 
 #else
@@ -377,6 +714,37 @@ int get_sched_policy(int tid UNUSED, SchedPolicy *policy)
     return 0;
 }
 
+int set_sched_policy_tids(const int *tids UNUSED, size_t count UNUSED,
+                          SchedPolicy policy UNUSED)
+{
+    return 0;
+}
+
+int set_cpuset_policy_tids(const int *tids UNUSED, size_t count UNUSED,
+                           SchedPolicy policy UNUSED)
+{
+    return 0;
+}
+
+int set_process_sched_policy(int pid UNUSED, SchedPolicy policy UNUSED)
+{
+    return 0;
+}
+
+int set_process_cpuset_policy(int pid UNUSED, SchedPolicy policy UNUSED)
+{
+    return 0;
+}
+
+void get_sched_policy_stats(struct sched_policy_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void reset_sched_policy_stats(void)
+{
+}
+
 #endif
 
 const char *get_sched_policy_name(SchedPolicy policy)
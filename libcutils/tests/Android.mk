@@ -15,11 +15,16 @@
 LOCAL_PATH := $(call my-dir)
 
 test_src_files := \
+    FsConfigTest.cpp \
+    HashmapTest.cpp \
+    RecordStreamTest.cpp \
     test_str_parms.cpp \
 
 test_target_only_src_files := \
     MemsetTest.cpp \
     PropertiesTest.cpp \
+    SchedPolicyTest.cpp \
+    TraceTest.cpp \
 
 test_libraries := libcutils liblog
 
@@ -71,3 +76,24 @@ LOCAL_MULTILIB := both
 LOCAL_MODULE_STEM_32 := $(LOCAL_MODULE)32
 LOCAL_MODULE_STEM_64 := $(LOCAL_MODULE)64
 include $(BUILD_HOST_NATIVE_TEST)
+
+
+#
+# Benchmarks.
+#
+
+# Build the benchmarks. Run with:
+#   adb shell libcutils_benchmarks
+include $(CLEAR_VARS)
+LOCAL_MODULE := libcutils_benchmarks
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../liblog/tests
+LOCAL_SRC_FILES := \
+    ../../liblog/tests/benchmark_main.cpp \
+    FsConfig_benchmark.cpp \
+    Hashmap_benchmark.cpp \
+    RecordStream_benchmark.cpp \
+    SchedPolicy_benchmark.cpp \
+    Trace_benchmark.cpp \
+
+LOCAL_SHARED_LIBRARIES := $(test_libraries)
+include $(BUILD_NATIVE_TEST)
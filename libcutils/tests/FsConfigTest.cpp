@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <private/android_filesystem_config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+struct Result {
+    unsigned uid;
+    unsigned gid;
+    unsigned mode;
+    uint64_t capabilities;
+};
+
+static Result Lookup(const char* path, bool dir, const char* target_out_path = nullptr) {
+    Result r;
+    r.mode = dir ? S_IFDIR : S_IFREG;
+    fs_config(path, dir, target_out_path, &r.uid, &r.gid, &r.mode, &r.capabilities);
+    return r;
+}
+
+// A scratch target_out_path with its own etc/fs_config_{dirs,files}.
+class FsConfigTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        const char* tmpdir = getenv("TMPDIR");
+        root_ = std::string(tmpdir ? tmpdir : "/tmp") + "/fs_config_test.XXXXXX";
+        ASSERT_TRUE(mkdtemp(&root_[0]) != nullptr);
+        ASSERT_EQ(0, mkdir((root_ + "/etc").c_str(), 0755));
+        // Empty files keep the device's own /system/etc ones out of the way.
+        WriteRules(false, {});
+        WriteRules(true, {});
+    }
+
+    virtual void TearDown() {
+        unlink((root_ + "/etc/fs_config_files").c_str());
+        unlink((root_ + "/etc/fs_config_dirs").c_str());
+        rmdir((root_ + "/etc").c_str());
+        rmdir(root_.c_str());
+    }
+
+    // Writes the rules through a temporary file and rename, the way build
+    // tools replace them.
+    void WriteRules(bool dir, const std::vector<fs_path_config>& rules) {
+        std::string data;
+        for (const fs_path_config& pc : rules) {
+            char buffer[256];
+            ssize_t len = fs_config_generate(buffer, sizeof(buffer), &pc);
+            ASSERT_GT(len, 0);
+            data.append(buffer, len);
+        }
+        std::string name = root_ + (dir ? "/etc/fs_config_dirs" : "/etc/fs_config_files");
+        FILE* fp = fopen((name + ".tmp").c_str(), "w");
+        ASSERT_TRUE(fp != nullptr);
+        ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), fp));
+        ASSERT_EQ(0, fclose(fp));
+        ASSERT_EQ(0, rename((name + ".tmp").c_str(), name.c_str()));
+    }
+
+    const char* target() { return root_.c_str(); }
+
+    std::string root_;
+};
+
+TEST_F(FsConfigTest, BuiltinRules) {
+    Result r = Lookup("system/bin/run-as", false, target());
+    EXPECT_EQ(unsigned(AID_ROOT), r.uid);
+    EXPECT_EQ(unsigned(AID_SHELL), r.gid);
+    EXPECT_EQ(unsigned(S_IFREG | 00750), r.mode);
+    EXPECT_EQ(CAP_MASK_LONG(CAP_SETUID) | CAP_MASK_LONG(CAP_SETGID), r.capabilities);
+
+    // Wildcard, and the more specific rule listed first.
+    EXPECT_EQ(unsigned(S_IFREG | 00755), Lookup("/system/bin/ls", false, target()).mode);
+    EXPECT_EQ(unsigned(S_IFREG | 00750), Lookup("system/bin/uncrypt", false, target()).mode);
+    // Exact rules do not match longer paths.
+    EXPECT_EQ(unsigned(S_IFREG | 00755), Lookup("system/bin/uncrypt2", false, target()).mode);
+    // Catch-all.
+    EXPECT_EQ(unsigned(S_IFREG | 00644), Lookup("system/framework/a.jar", false, target()).mode);
+
+    // Directory rules are plain string prefixes, first match wins.
+    EXPECT_EQ(unsigned(AID_SHELL), Lookup("data/local/tmp/x", true, target()).uid);
+    EXPECT_EQ(unsigned(AID_SYSTEM), Lookup("data/apps", true, target()).uid);
+    EXPECT_EQ(unsigned(S_IFDIR | 00755), Lookup("", true, target()).mode);
+}
+
+TEST_F(FsConfigTest, ConfigFileComesFirst) {
+    WriteRules(false, {
+        { 00700, AID_SYSTEM, AID_SYSTEM, 7, "system/bin/ls" },
+        { 00711, AID_SYSTEM, AID_SHELL, 0, "system/bin/sh*" },
+        { 00722, AID_SHELL, AID_SHELL, 0, "system/bin/sh" },
+    });
+    WriteRules(true, {
+        { 00700, AID_SYSTEM, AID_SYSTEM, 0, "system/b" },
+    });
+
+    Result r = Lookup("system/bin/ls", false, target());
+    EXPECT_EQ(unsigned(AID_SYSTEM), r.uid);
+    EXPECT_EQ(unsigned(S_IFREG | 00700), r.mode);
+    EXPECT_EQ(7U, r.capabilities);
+    // The earlier wildcard beats the later exact rule.
+    EXPECT_EQ(unsigned(S_IFREG | 00711), Lookup("system/bin/sh", false, target()).mode);
+    EXPECT_EQ(unsigned(S_IFREG | 00711), Lookup("system/bin/shell", false, target()).mode);
+    // Paths the file does not cover fall back to the built-in rules.
+    EXPECT_EQ(unsigned(S_IFREG | 00750), Lookup("system/bin/uncrypt", false, target()).mode);
+
+    EXPECT_EQ(unsigned(S_IFDIR | 00700), Lookup("system/bin", true, target()).mode);
+    EXPECT_EQ(unsigned(S_IFDIR | 00755), Lookup("system/xbin", true, target()).mode);
+}
+
+TEST_F(FsConfigTest, ConfigFileChangesAreSeen) {
+    WriteRules(false, { { 00700, AID_SYSTEM, AID_SYSTEM, 0, "system/app/*" } });
+    EXPECT_EQ(unsigned(S_IFREG | 00700), Lookup("system/app/a.apk", false, target()).mode);
+
+    WriteRules(false, { { 00600, AID_SYSTEM, AID_SYSTEM, 0, "system/app/*" } });
+    EXPECT_EQ(unsigned(S_IFREG | 00600), Lookup("system/app/a.apk", false, target()).mode);
+
+    WriteRules(false, {});
+    EXPECT_EQ(unsigned(S_IFREG | 00644), Lookup("system/app/a.apk", false, target()).mode);
+}
+
+TEST_F(FsConfigTest, CorruptRecordEndsTheFile) {
+    WriteRules(false, {
+        { 00700, AID_SYSTEM, AID_SYSTEM, 0, "system/app/a.apk" },
+        { 00600, AID_SYSTEM, AID_SYSTEM, 0, "system/app/b.apk" },
+    });
+    // Cut the second record short.
+    std::string name = root_ + "/etc/fs_config_files";
+    struct stat st;
+    ASSERT_EQ(0, stat(name.c_str(), &st));
+    ASSERT_EQ(0, truncate(name.c_str(), st.st_size - 4));
+
+    EXPECT_EQ(unsigned(S_IFREG | 00700), Lookup("system/app/a.apk", false, target()).mode);
+    EXPECT_EQ(unsigned(S_IFREG | 00644), Lookup("system/app/b.apk", false, target()).mode);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <private/android_filesystem_config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+// A file list shaped like a system image: a few thousand files, mostly
+// under app/, priv-app/, lib/, framework/ and bin/.
+static std::vector<std::string> SystemImagePaths() {
+    static const char* kDirs[] = {
+        "system/app/%d/%d.apk", "system/priv-app/%d/%d.apk", "system/lib/lib%d%d.so",
+        "system/lib64/lib%d%d.so", "system/framework/f%d_%d.jar", "system/bin/tool%d%d",
+        "system/xbin/x%d%d", "system/etc/permissions/p%d_%d.xml", "system/usr/share/z%d/%d",
+        "system/fonts/Font%d-%d.ttf", "system/media/audio/a%d/%d.ogg", "system/vendor/lib/v%d%d.so",
+    };
+    std::vector<std::string> paths;
+    char buf[128];
+    for (int i = 0; i < 400; i++) {
+        for (const char* pattern : kDirs) {
+            snprintf(buf, sizeof(buf), pattern, i, i);
+            paths.push_back(buf);
+        }
+    }
+    return paths;
+}
+
+// A scratch target_out_path whose etc/fs_config_files has |rules| rules for
+// directories under system/priv-app/, and whose etc/fs_config_dirs is empty.
+class ScratchTarget {
+public:
+    explicit ScratchTarget(int rules) {
+        const char* tmpdir = getenv("TMPDIR");
+        root_ = std::string(tmpdir ? tmpdir : "/tmp") + "/fs_config_benchmark.XXXXXX";
+        if (mkdtemp(&root_[0]) == nullptr) {
+            abort();
+        }
+        mkdir((root_ + "/etc").c_str(), 0755);
+
+        std::string data;
+        for (int i = 0; i < rules; i++) {
+            std::string prefix = "system/priv-app/" + std::to_string(i * 7) + "/*";
+            fs_path_config pc = { 00700, AID_SYSTEM, AID_SYSTEM, 0, prefix.c_str() };
+            char buffer[256];
+            ssize_t len = fs_config_generate(buffer, sizeof(buffer), &pc);
+            if (len <= 0) {
+                abort();
+            }
+            data.append(buffer, len);
+        }
+        Write("/etc/fs_config_files", data);
+        Write("/etc/fs_config_dirs", "");
+    }
+
+    ~ScratchTarget() {
+        unlink((root_ + "/etc/fs_config_files").c_str());
+        unlink((root_ + "/etc/fs_config_dirs").c_str());
+        rmdir((root_ + "/etc").c_str());
+        rmdir(root_.c_str());
+    }
+
+    const char* path() const { return root_.c_str(); }
+
+private:
+    void Write(const char* name, const std::string& data) {
+        FILE* fp = fopen((root_ + name).c_str(), "w");
+        if (fp == nullptr || fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+            abort();
+        }
+        fclose(fp);
+    }
+
+    std::string root_;
+};
+
+// Looks up the files of a system image one after the other, as image
+// builders do, with |rules| rules in the target's config file.
+static void BM_fs_config_system_image(int iters, int rules) {
+    std::vector<std::string> paths = SystemImagePaths();
+    ScratchTarget target(rules);
+    unsigned uid, gid, mode;
+    uint64_t capabilities;
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        mode = S_IFREG;
+        fs_config(paths[i % paths.size()].c_str(), false, target.path(), &uid, &gid, &mode,
+                  &capabilities);
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_fs_config_system_image)->Arg(0)->Arg(40);
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cutils/hashmap.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int ConstantHash(void*) {
+    return 42;
+}
+
+// Keys 0..n-1, so tests can hand out stable pointers.
+static std::vector<int> MakeKeys(int n) {
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; i++) {
+        keys[i] = i;
+    }
+    return keys;
+}
+
+static void* AsValue(int i) {
+    return reinterpret_cast<void*>(static_cast<intptr_t>(i));
+}
+
+TEST(HashmapTest, PutGetRemove) {
+    std::vector<int> keys = MakeKeys(1000);
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    ASSERT_TRUE(map != NULL);
+
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(NULL, hashmapPut(map, &keys[i], AsValue(i + 1)));
+    }
+    EXPECT_EQ(1000U, hashmapSize(map));
+    EXPECT_GE(hashmapCurrentCapacity(map), 1000U);
+
+    for (int i = 0; i < 1000; i++) {
+        int probe = i;  // equal, but not the same pointer
+        EXPECT_EQ(AsValue(i + 1), hashmapGet(map, &probe));
+        EXPECT_TRUE(hashmapContainsKey(map, &probe));
+    }
+    int missing = 1000;
+    EXPECT_EQ(NULL, hashmapGet(map, &missing));
+    EXPECT_FALSE(hashmapContainsKey(map, &missing));
+
+    EXPECT_EQ(AsValue(8), hashmapPut(map, &keys[7], AsValue(-7)));
+    EXPECT_EQ(AsValue(-7), hashmapGet(map, &keys[7]));
+    EXPECT_EQ(1000U, hashmapSize(map));
+
+    for (int i = 0; i < 1000; i += 2) {
+        EXPECT_EQ(AsValue(i + 1), hashmapRemove(map, &keys[i]));
+    }
+    EXPECT_EQ(NULL, hashmapRemove(map, &keys[0]));
+    EXPECT_EQ(500U, hashmapSize(map));
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(i % 2 == 1, hashmapContainsKey(map, &keys[i]));
+    }
+    hashmapFree(map);
+}
+
+TEST(HashmapTest, CollidingKeys) {
+    std::vector<int> keys = MakeKeys(64);
+    Hashmap* map = hashmapCreate(0, ConstantHash, hashmapIntEquals);
+    for (int i = 0; i < 64; i++) {
+        hashmapPut(map, &keys[i], AsValue(i));
+    }
+    EXPECT_EQ(63U, hashmapCountCollisions(map));
+
+    // Removing from the middle of the cluster must keep the rest reachable.
+    for (int i = 0; i < 64; i += 3) {
+        hashmapRemove(map, &keys[i]);
+    }
+    for (int i = 0; i < 64; i++) {
+        EXPECT_EQ(i % 3 != 0, hashmapContainsKey(map, &keys[i]));
+        if (i % 3 != 0) {
+            EXPECT_EQ(AsValue(i), hashmapGet(map, &keys[i]));
+        }
+    }
+    hashmapFree(map);
+}
+
+static void* Memoized(void* key, void* context) {
+    ++*static_cast<int*>(context);
+    return AsValue(*static_cast<int*>(key) * 10);
+}
+
+TEST(HashmapTest, Memoize) {
+    std::vector<int> keys = MakeKeys(100);
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    int calls = 0;
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 100; i++) {
+            EXPECT_EQ(AsValue(i * 10), hashmapMemoize(map, &keys[i], Memoized, &calls));
+        }
+    }
+    EXPECT_EQ(100, calls);
+    EXPECT_EQ(100U, hashmapSize(map));
+    hashmapFree(map);
+}
+
+struct RemoveContext {
+    Hashmap* map;
+    std::map<int, int> seen;
+};
+
+static bool RemoveEven(void* key, void* value, void* context) {
+    RemoveContext* ctx = static_cast<RemoveContext*>(context);
+    int k = *static_cast<int*>(key);
+    ctx->seen[k]++;
+    EXPECT_EQ(AsValue(k), value);
+    if (k % 2 == 0) {
+        hashmapRemove(ctx->map, key);
+    }
+    return true;
+}
+
+// str_parms and sdcard remove entries from inside the callback.
+TEST(HashmapTest, ForEachVisitsEachEntryOnceWhileRemoving) {
+    std::vector<int> keys = MakeKeys(500);
+    for (int (*hash)(void*) : { hashmapIntHash, ConstantHash }) {
+        RemoveContext ctx;
+        ctx.map = hashmapCreate(0, hash, hashmapIntEquals);
+        for (int i = 0; i < 500; i++) {
+            hashmapPut(ctx.map, &keys[i], AsValue(i));
+        }
+        hashmapForEach(ctx.map, RemoveEven, &ctx);
+        ASSERT_EQ(500U, ctx.seen.size());
+        for (auto& entry : ctx.seen) {
+            EXPECT_EQ(1, entry.second) << entry.first;
+        }
+        EXPECT_EQ(250U, hashmapSize(ctx.map));
+        hashmapFree(ctx.map);
+    }
+}
+
+static bool StopAtThree(void*, void*, void* context) {
+    return ++*static_cast<int*>(context) < 3;
+}
+
+TEST(HashmapTest, ForEachStops) {
+    std::vector<int> keys = MakeKeys(10);
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    for (int i = 0; i < 10; i++) {
+        hashmapPut(map, &keys[i], NULL);
+    }
+    int calls = 0;
+    hashmapForEach(map, StopAtThree, &calls);
+    EXPECT_EQ(3, calls);
+    hashmapFree(map);
+}
+
+TEST(HashmapTest, TypedHashmap) {
+    android::TypedHashmap<std::string, int> map;
+    ASSERT_TRUE(map.isValid());
+    std::string a("a"), b("b");
+    int one = 1, two = 2;
+    EXPECT_EQ(NULL, map.put(&a, &one));
+    EXPECT_EQ(NULL, map.put(&b, &two));
+    EXPECT_EQ(&one, map.get(std::string("a")));
+    EXPECT_TRUE(map.contains(std::string("b")));
+    EXPECT_FALSE(map.contains(std::string("c")));
+
+    int sum = 0;
+    map.forEach([&sum](std::string*, int* value) { sum += *value; return true; });
+    EXPECT_EQ(3, sum);
+
+    EXPECT_EQ(&two, map.remove(b));
+    EXPECT_EQ(1U, map.size());
+}
+
+// One writer keeps inserting, replacing and removing, growing the table as
+// it goes, while readers check that present keys always map to their value.
+TEST(HashmapTest, ConcurrentReaders) {
+    static const int kKeys = 20000;
+    static const int kReaders = 3;
+    std::vector<int> keys = MakeKeys(kKeys);
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    // The first half stays in the map from the start.
+    for (int i = 0; i < kKeys / 2; i++) {
+        hashmapPut(map, &keys[i], AsValue(i));
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < kReaders; r++) {
+        readers.emplace_back([&, r]() {
+            unsigned int i = r;
+            while (!done.load()) {
+                int key = (i = i * 1103515245 + 12345) % kKeys;
+                void* value = hashmapGet(map, &key);
+                bool stable = key < kKeys / 2;
+                if ((stable && value != AsValue(key)) ||
+                        (!stable && value != NULL && value != AsValue(key))) {
+                    errors.fetch_add(1);
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < 5; round++) {
+        hashmapLock(map);
+        for (int i = kKeys / 2; i < kKeys; i++) {
+            hashmapPut(map, &keys[i], AsValue(i));
+        }
+        for (int i = 0; i < kKeys / 2; i++) {
+            hashmapPut(map, &keys[i], AsValue(i));
+        }
+        for (int i = kKeys / 2; i < kKeys; i++) {
+            hashmapRemove(map, &keys[i]);
+        }
+        hashmapUnlock(map);
+    }
+    done.store(true);
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(0, errors.load());
+    EXPECT_EQ(size_t(kKeys / 2), hashmapSize(map));
+    hashmapFree(map);
+}
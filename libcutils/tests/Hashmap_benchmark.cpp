@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "benchmark.h"
+
+static const int kKeys = 100000;
+
+// Keys 0..kKeys-1, with stable addresses for the map to point at.
+static std::vector<int> MakeKeys() {
+    std::vector<int> keys(kKeys);
+    for (int i = 0; i < kKeys; i++) {
+        keys[i] = i;
+    }
+    return keys;
+}
+
+static void* AsValue(int i) {
+    return reinterpret_cast<void*>(static_cast<intptr_t>(i));
+}
+
+// Puts into a map that starts empty and grows to kKeys entries, over and over.
+static void BM_hashmap_put(int iters) {
+    std::vector<int> keys = MakeKeys();
+
+    for (int done = 0; done < iters; done += kKeys) {
+        Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+        int n = std::min(kKeys, iters - done);
+        StartBenchmarkTiming();
+        for (int i = 0; i < n; i++) {
+            hashmapPut(map, &keys[i], AsValue(i));
+        }
+        StopBenchmarkTiming();
+        hashmapFree(map);
+    }
+}
+BENCHMARK(BM_hashmap_put);
+
+// Random lookups in a map of kKeys entries from |threads| threads, which share
+// |iters| lookups between them. With |locked|, every lookup holds
+// hashmapLock(), as every reader had to before reads were lock-free.
+static void Lookups(int iters, int threads, bool locked) {
+    std::vector<int> keys = MakeKeys();
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    for (int i = 0; i < kKeys; i++) {
+        hashmapPut(map, &keys[i], AsValue(i));
+    }
+
+    StartBenchmarkTiming();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([=]() {
+            unsigned int i = t;
+            for (int n = t; n < iters; n += threads) {
+                int key = (i = i * 1103515245 + 12345) % kKeys;
+                if (locked) hashmapLock(map);
+                hashmapGet(map, &key);
+                if (locked) hashmapUnlock(map);
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    StopBenchmarkTiming();
+    hashmapFree(map);
+}
+
+static void BM_hashmap_get_lock_free(int iters, int threads) {
+    Lookups(iters, threads, false);
+}
+BENCHMARK(BM_hashmap_get_lock_free)->Arg(1)->Arg(4);
+
+static void BM_hashmap_get_locked(int iters, int threads) {
+    Lookups(iters, threads, true);
+}
+BENCHMARK(BM_hashmap_get_locked)->Arg(1)->Arg(4);
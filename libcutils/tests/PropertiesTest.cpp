@@ -19,10 +19,14 @@
 #include <gtest/gtest.h>
 
 #include <cutils/properties.h>
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
 #include <limits.h>
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <thread>
+#include <unistd.h>
 
 namespace android {
 
@@ -306,4 +310,118 @@ TEST_F(PropertiesTest, GetInt32) {
     }
 }
 
+TEST_F(PropertiesTest, SnapshotByPrefix) {
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY ".b", "2"));
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY ".a", "1"));
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY ".c", "3"));
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "not in the prefix"));
+
+    struct property_snapshot* snapshot = property_snapshot_create(PROPERTY_TEST_KEY ".");
+    ASSERT_TRUE(snapshot != NULL);
+    ASSERT_EQ(3U, property_snapshot_count(snapshot));
+    // Sorted by name, whatever order they were added in.
+    EXPECT_STREQ(PROPERTY_TEST_KEY ".a", property_snapshot_name(snapshot, 0));
+    EXPECT_STREQ("1", property_snapshot_value(snapshot, 0));
+    EXPECT_STREQ(PROPERTY_TEST_KEY ".c", property_snapshot_name(snapshot, 2));
+    EXPECT_EQ(NULL, property_snapshot_name(snapshot, 3));
+
+    // It is a copy: later sets do not show through.
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY ".b", "22"));
+    EXPECT_EQ(1, property_snapshot_get(snapshot, PROPERTY_TEST_KEY ".b", mValue, "x"));
+    EXPECT_STREQ("2", mValue);
+    EXPECT_EQ(strlen(PROPERTY_TEST_VALUE_DEFAULT),
+              property_snapshot_get(snapshot, PROPERTY_TEST_KEY, mValue,
+                                    PROPERTY_TEST_VALUE_DEFAULT));
+    EXPECT_STREQ(PROPERTY_TEST_VALUE_DEFAULT, mValue);
+    EXPECT_NE(__system_property_area_serial(), property_snapshot_serial(snapshot));
+    // Stale already, so this returns straight away.
+    property_snapshot_wait(snapshot);
+    property_snapshot_free(snapshot);
+
+    // Everything, in agreement with property_get() for the ones no one
+    // else is setting.
+    snapshot = property_snapshot_create("");
+    ASSERT_TRUE(snapshot != NULL);
+    EXPECT_LE(4U, property_snapshot_count(snapshot));
+    for (size_t i = 0; i < property_snapshot_count(snapshot); i++) {
+        if (strncmp(PROPERTY_TEST_KEY, property_snapshot_name(snapshot, i),
+                    strlen(PROPERTY_TEST_KEY))) {
+            continue;
+        }
+        char value[PROPERTY_VALUE_MAX];
+        property_get(property_snapshot_name(snapshot, i), value, "");
+        EXPECT_STREQ(value, property_snapshot_value(snapshot, i))
+                << property_snapshot_name(snapshot, i);
+    }
+    property_snapshot_free(snapshot);
+}
+
+TEST_F(PropertiesTest, WaitForChange) {
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY ".watched", "0"));
+    std::string missing = PROPERTY_TEST_KEY ".new" + ToString(getpid());
+
+    struct property_watch watches[2];
+    property_watch_init(&watches[0], PROPERTY_TEST_KEY ".watched");
+    property_watch_init(&watches[1], missing.c_str());
+    EXPECT_TRUE(watches[1].pi == NULL);
+
+    // Unrelated sets wake the waiter up but do not make it return.
+    std::thread setter([&missing]() {
+        for (int i = 0; i < 5; i++) {
+            usleep(10000);
+            property_set(PROPERTY_TEST_KEY ".unrelated", ToString(i).c_str());
+        }
+        property_set(PROPERTY_TEST_KEY ".watched", "1");
+    });
+    EXPECT_EQ(1, property_wait_for_change(watches, 2));
+    setter.join();
+    EXPECT_TRUE(watches[0].changed);
+    EXPECT_FALSE(watches[1].changed);
+    char value[PROPERTY_VALUE_MAX];
+    property_get(PROPERTY_TEST_KEY ".unrelated", value, "");
+    EXPECT_STREQ("4", value);
+
+    // A property that did not exist yet counts once it is created, even
+    // with an empty value.
+    std::thread creator([&missing]() {
+        usleep(10000);
+        property_set(missing.c_str(), "");
+    });
+    EXPECT_EQ(1, property_wait_for_change(watches, 2));
+    creator.join();
+    EXPECT_FALSE(watches[0].changed);
+    EXPECT_TRUE(watches[1].changed);
+
+    // Sets made between calls are not missed.
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY ".watched", "2"));
+    ASSERT_OK(property_set(missing.c_str(), "x"));
+    EXPECT_EQ(2, property_wait_for_change(watches, 2));
+}
+
+TEST_F(PropertiesTest, SetMany) {
+    const char* keys[] = {
+        PROPERTY_TEST_KEY ".many.a",
+        "ro.build.type",             // already set, so read-only
+        PROPERTY_TEST_KEY "..many",  // illegal
+        PROPERTY_TEST_KEY ".many.b",
+    };
+    const char* values[] = { "1", "changed", "x", "2" };
+    int results[4] = { 1, 1, 1, 1 };
+    ASSERT_OK(property_set_many(keys, values, 4, results));
+    EXPECT_EQ(0, results[0]);
+    EXPECT_EQ(-1, results[1]);
+    EXPECT_EQ(-1, results[2]);
+    EXPECT_EQ(0, results[3]);
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get(PROPERTY_TEST_KEY ".many.a", value, "");
+    EXPECT_STREQ("1", value);
+    property_get(PROPERTY_TEST_KEY ".many.b", value, "");
+    EXPECT_STREQ("2", value);
+    property_get("ro.build.type", value, "");
+    EXPECT_STRNE("changed", value);
+
+    EXPECT_GT(0, property_set_many(keys, values, 0, results));
+}
+
 } // namespace android
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cutils/record_stream.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+static const size_t kMaxRecordLen = 8192;
+
+// Length-prefixed records with recognizable contents.
+static std::string Record(size_t len, int seed) {
+    std::string record(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        record[i] = static_cast<char>(seed * 31 + i);
+    }
+    return record;
+}
+
+static std::string Frame(const std::string& record) {
+    uint32_t len = htonl(record.size());
+    return std::string(reinterpret_cast<const char*>(&len), sizeof(len)) + record;
+}
+
+static bool WriteAll(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, data.data() + done, data.size() - done));
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+class RecordStreamTest : public ::testing::TestWithParam<bool> {
+protected:
+    virtual void SetUp() {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds_));
+        rs_ = GetParam() ? record_stream_new_mapped(fds_[0], kMaxRecordLen)
+                         : record_stream_new(fds_[0], kMaxRecordLen);
+        ASSERT_TRUE(rs_ != nullptr);
+    }
+
+    virtual void TearDown() {
+        record_stream_free(rs_);
+        close(fds_[0]);
+        if (fds_[1] != -1) close(fds_[1]);
+    }
+
+    void CloseWriter() {
+        close(fds_[1]);
+        fds_[1] = -1;
+    }
+
+    int fds_[2];
+    RecordStream* rs_;
+};
+
+// Sizes are picked so records keep landing across the end of the ring.
+TEST_P(RecordStreamTest, RecordsRoundTrip) {
+    std::vector<std::string> records;
+    for (int i = 0; i < 300; i++) {
+        records.push_back(Record((i * 977) % (kMaxRecordLen + 1), i));
+    }
+    std::thread writer([&]() {
+        for (const std::string& record : records) {
+            ASSERT_TRUE(WriteAll(fds_[1], Frame(record)));
+        }
+        CloseWriter();
+    });
+
+    size_t next = 0;
+    for (;;) {
+        void* data;
+        size_t len;
+        int ret = record_stream_get_next(rs_, &data, &len);
+        if (ret == 0 && data == nullptr) {
+            break;
+        }
+        if (ret < 0) {
+            ASSERT_EQ(EAGAIN, errno);
+            continue;
+        }
+        ASSERT_LT(next, records.size());
+        ASSERT_EQ(records[next], std::string(static_cast<char*>(data), len)) << next;
+        next++;
+    }
+    writer.join();
+    EXPECT_EQ(records.size(), next);
+}
+
+TEST_P(RecordStreamTest, PartialRecordsNeedAnotherRead) {
+    std::string framed = Frame(Record(100, 1));
+    ASSERT_TRUE(WriteAll(fds_[1], framed.substr(0, 2)));
+
+    void* data;
+    size_t len;
+    EXPECT_EQ(-1, record_stream_get_next(rs_, &data, &len));
+    EXPECT_EQ(EAGAIN, errno);
+
+    ASSERT_TRUE(WriteAll(fds_[1], framed.substr(2, 50)));
+    EXPECT_EQ(-1, record_stream_get_next(rs_, &data, &len));
+    EXPECT_EQ(EAGAIN, errno);
+
+    ASSERT_TRUE(WriteAll(fds_[1], framed.substr(52) + Frame("")));
+    ASSERT_EQ(0, record_stream_get_next(rs_, &data, &len));
+    EXPECT_EQ(Record(100, 1), std::string(static_cast<char*>(data), len));
+    // The empty record came in with the same read.
+    ASSERT_EQ(0, record_stream_get_next(rs_, &data, &len));
+    EXPECT_TRUE(data != nullptr);
+    EXPECT_EQ(0U, len);
+
+    CloseWriter();
+    EXPECT_EQ(0, record_stream_get_next(rs_, &data, &len));
+    EXPECT_EQ(nullptr, data);
+}
+
+TEST_P(RecordStreamTest, BatchReturnsEveryBufferedRecord) {
+    std::string data;
+    for (int i = 0; i < 10; i++) {
+        data += Frame(Record(10 + i, i));
+    }
+    ASSERT_TRUE(WriteAll(fds_[1], data));
+    CloseWriter();
+
+    record_stream_record records[4];
+    size_t count;
+    int seen = 0;
+    for (;;) {
+        ASSERT_EQ(0, record_stream_get_batch(rs_, records, 4, &count));
+        if (count == 0) {
+            break;
+        }
+        for (size_t i = 0; i < count; i++, seen++) {
+            EXPECT_EQ(Record(10 + seen, seen),
+                      std::string(static_cast<char*>(records[i].data), records[i].len));
+        }
+    }
+    EXPECT_EQ(10, seen);
+}
+
+TEST_P(RecordStreamTest, BatchAcrossTheEndOfTheRing) {
+    std::vector<std::string> records;
+    for (int i = 0; i < 500; i++) {
+        records.push_back(Record(i % 7 == 0 ? 3000 : 50 + i % 300, i));
+    }
+    std::thread writer([&]() {
+        for (const std::string& record : records) {
+            ASSERT_TRUE(WriteAll(fds_[1], Frame(record)));
+        }
+        CloseWriter();
+    });
+
+    record_stream_record batch[64];
+    size_t next = 0, count;
+    for (;;) {
+        int ret = record_stream_get_batch(rs_, batch, 64, &count);
+        if (ret < 0) {
+            ASSERT_EQ(EAGAIN, errno);
+            continue;
+        }
+        if (count == 0) {
+            break;
+        }
+        for (size_t i = 0; i < count; i++, next++) {
+            ASSERT_LT(next, records.size());
+            ASSERT_EQ(records[next],
+                      std::string(static_cast<char*>(batch[i].data), batch[i].len)) << next;
+        }
+    }
+    writer.join();
+    EXPECT_EQ(records.size(), next);
+}
+
+INSTANTIATE_TEST_CASE_P(Buffers, RecordStreamTest, ::testing::Values(false, true));
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/record_stream.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include "benchmark.h"
+
+static const size_t kMaxRecordLen = 8192;
+
+// Writes |count| framed |len|-byte records to |fd| in 64 KiB chunks, then
+// closes it.
+static void WriteRecords(int fd, size_t len, size_t count) {
+    uint32_t header = htonl(len);
+    std::string frame(reinterpret_cast<const char*>(&header), sizeof(header));
+    frame.append(len, 'r');
+    std::string chunk;
+    while (chunk.size() < 64 * 1024) {
+        chunk += frame;
+    }
+    size_t per_chunk = chunk.size() / frame.size();
+
+    for (size_t sent = 0; sent < count; sent += per_chunk) {
+        size_t bytes = std::min(per_chunk, count - sent) * frame.size();
+        for (size_t done = 0; done < bytes;) {
+            ssize_t n = TEMP_FAILURE_RETRY(write(fd, chunk.data() + done, bytes - done));
+            if (n <= 0) break;
+            done += n;
+        }
+    }
+    close(fd);
+}
+
+// Streams |iters| |len|-byte records through a socket, the way a RIL socket
+// listener consumes them.
+static void Stream(int iters, size_t len, bool mapped, bool batch) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    RecordStream* rs = mapped ? record_stream_new_mapped(fds[0], kMaxRecordLen)
+                              : record_stream_new(fds[0], kMaxRecordLen);
+
+    StartBenchmarkTiming();
+    std::thread writer(WriteRecords, fds[1], len, iters);
+    volatile unsigned char sink = 0;
+    if (batch) {
+        record_stream_record out[256];
+        size_t n;
+        for (;;) {
+            int ret = record_stream_get_batch(rs, out, 256, &n);
+            if (ret == 0 && n == 0) break;
+            for (size_t i = 0; i < n; i++) sink += static_cast<unsigned char*>(out[i].data)[0];
+        }
+    } else {
+        for (;;) {
+            void* data;
+            size_t n;
+            int ret = record_stream_get_next(rs, &data, &n);
+            if (ret == 0 && data == nullptr) break;
+            if (ret == 0) sink += static_cast<unsigned char*>(data)[0];
+        }
+    }
+    StopBenchmarkTiming();
+    SetBenchmarkBytesProcessed(uint64_t(iters) * (len + 4));
+
+    writer.join();
+    record_stream_free(rs);
+    close(fds[0]);
+}
+
+static void BM_record_stream_get_next(int iters, int len) {
+    Stream(iters, len, false, false);
+}
+BENCHMARK(BM_record_stream_get_next)->Arg(64)->Arg(1024)->Arg(8000);
+
+static void BM_record_stream_get_batch(int iters, int len) {
+    Stream(iters, len, false, true);
+}
+BENCHMARK(BM_record_stream_get_batch)->Arg(64)->Arg(1024)->Arg(8000);
+
+static void BM_record_stream_get_batch_mapped(int iters, int len) {
+    Stream(iters, len, true, true);
+}
+BENCHMARK(BM_record_stream_get_batch_mapped)->Arg(64)->Arg(1024)->Arg(8000);
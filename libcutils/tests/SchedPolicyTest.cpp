@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cutils/sched_policy.h>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+extern "C" void __set_sched_policy_root(const char* root);
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+// Points sched_policy at a mocked /dev/cpuctl, /dev/cpuset and /proc made
+// of plain files: each move shows up as a line in a tasks or cgroup.procs
+// file.
+class SchedPolicyTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        const char* tmpdir = getenv("TMPDIR");
+        root_ = std::string(tmpdir ? tmpdir : "/data/local/tmp") + "/sched_policy_test.XXXXXX";
+        ASSERT_TRUE(mkdtemp(&root_[0]) != nullptr);
+        for (const char* dir : { "/dev", "/dev/cpuctl", "/dev/cpuctl/bg_non_interactive",
+                                 "/dev/cpuset", "/dev/cpuset/foreground",
+                                 "/dev/cpuset/background", "/proc" }) {
+            ASSERT_EQ(0, mkdir((root_ + dir).c_str(), 0755));
+        }
+        for (const char* file : { "/dev/cpuctl/tasks", "/dev/cpuctl/cgroup.procs",
+                                  "/dev/cpuctl/bg_non_interactive/tasks",
+                                  "/dev/cpuctl/bg_non_interactive/cgroup.procs",
+                                  "/dev/cpuset/tasks",
+                                  "/dev/cpuset/foreground/tasks",
+                                  "/dev/cpuset/foreground/cgroup.procs",
+                                  "/dev/cpuset/background/tasks",
+                                  "/dev/cpuset/background/cgroup.procs" }) {
+            WriteFile(file, "");
+        }
+    }
+
+    virtual void TearDown() {
+        __set_sched_policy_root(nullptr);
+        nftw(root_.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    void WriteFile(const std::string& path, const std::string& data) {
+        FILE* fp = fopen((root_ + path).c_str(), "w");
+        ASSERT_TRUE(fp != nullptr);
+        fputs(data.c_str(), fp);
+        fclose(fp);
+    }
+
+    std::string ReadFile(const std::string& path) {
+        std::string data;
+        FILE* fp = fopen((root_ + path).c_str(), "r");
+        if (fp != nullptr) {
+            char buf[256];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+                data.append(buf, n);
+            }
+            fclose(fp);
+        }
+        return data;
+    }
+
+    void AddProcess(int pid, const std::vector<int>& tids) {
+        std::string dir = "/proc/" + std::to_string(pid);
+        ASSERT_EQ(0, mkdir((root_ + dir).c_str(), 0755));
+        ASSERT_EQ(0, mkdir((root_ + dir + "/task").c_str(), 0755));
+        for (int tid : tids) {
+            ASSERT_EQ(0, mkdir((root_ + dir + "/task/" + std::to_string(tid)).c_str(), 0755));
+        }
+    }
+
+    void UseMockedTree() { __set_sched_policy_root(root_.c_str()); }
+
+    std::string root_;
+};
+
+TEST_F(SchedPolicyTest, SetSchedPolicyWritesTid) {
+    UseMockedTree();
+    EXPECT_EQ(0, set_sched_policy(123, SP_BACKGROUND));
+    EXPECT_EQ(0, set_sched_policy(124, SP_AUDIO_APP));
+    EXPECT_EQ("123\n", ReadFile("/dev/cpuctl/bg_non_interactive/tasks"));
+    EXPECT_EQ("124\n", ReadFile("/dev/cpuctl/tasks"));
+    EXPECT_EQ(-EINVAL, set_sched_policy(125, SP_SYSTEM));
+
+    sched_policy_stats stats;
+    get_sched_policy_stats(&stats);
+    EXPECT_EQ(3U, stats.moves);
+    EXPECT_EQ(2U, stats.writes);
+    EXPECT_EQ(0U, stats.skipped);
+}
+
+TEST_F(SchedPolicyTest, BatchSkipsThreadsAlreadyInPlace) {
+    UseMockedTree();
+    const int tids[] = { 10, 11, 12 };
+    EXPECT_EQ(0, set_sched_policy_tids(tids, 3, SP_BACKGROUND));
+    EXPECT_EQ(0, set_sched_policy_tids(tids, 3, SP_BACKGROUND));
+    EXPECT_EQ("10\n11\n12\n", ReadFile("/dev/cpuctl/bg_non_interactive/tasks"));
+
+    sched_policy_stats stats;
+    get_sched_policy_stats(&stats);
+    EXPECT_EQ(6U, stats.moves);
+    EXPECT_EQ(3U, stats.skipped);
+    EXPECT_EQ(3U, stats.writes);
+
+    // set_sched_policy() always writes, and updates what batches skip.
+    EXPECT_EQ(0, set_sched_policy(11, SP_FOREGROUND));
+    EXPECT_EQ(0, set_sched_policy_tids(tids, 3, SP_FOREGROUND));
+    EXPECT_EQ("11\n10\n12\n", ReadFile("/dev/cpuctl/tasks"));
+
+    reset_sched_policy_stats();
+    get_sched_policy_stats(&stats);
+    EXPECT_EQ(0U, stats.moves);
+}
+
+TEST_F(SchedPolicyTest, ProcessMovesWithOneWrite) {
+    AddProcess(500, { 500, 501, 502 });
+    UseMockedTree();
+    EXPECT_EQ(0, set_process_sched_policy(500, SP_BACKGROUND));
+    EXPECT_EQ("500\n", ReadFile("/dev/cpuctl/bg_non_interactive/cgroup.procs"));
+    EXPECT_EQ("", ReadFile("/dev/cpuctl/bg_non_interactive/tasks"));
+
+    // All its threads are known to be in place now.
+    EXPECT_EQ(0, set_process_sched_policy(500, SP_BACKGROUND));
+    const int tid = 502;
+    EXPECT_EQ(0, set_sched_policy_tids(&tid, 1, SP_BACKGROUND));
+    sched_policy_stats stats;
+    get_sched_policy_stats(&stats);
+    EXPECT_EQ(1U, stats.writes);
+    EXPECT_EQ(2U, stats.skipped);
+
+    // A thread moved on its own makes the next process move write again.
+    EXPECT_EQ(0, set_sched_policy(501, SP_FOREGROUND));
+    EXPECT_EQ(0, set_process_sched_policy(500, SP_BACKGROUND));
+    EXPECT_EQ("500\n500\n", ReadFile("/dev/cpuctl/bg_non_interactive/cgroup.procs"));
+
+    // Processes that are gone are not an error.
+    EXPECT_EQ(0, set_process_sched_policy(999, SP_BACKGROUND));
+}
+
+TEST_F(SchedPolicyTest, ProcessFallsBackToTasks) {
+    ASSERT_EQ(0, unlink((root_ + "/dev/cpuctl/cgroup.procs").c_str()));
+    AddProcess(600, { 600, 601 });
+    UseMockedTree();
+    EXPECT_EQ(0, set_process_sched_policy(600, SP_FOREGROUND));
+    std::string tasks = ReadFile("/dev/cpuctl/tasks");
+    EXPECT_TRUE(tasks == "600\n601\n" || tasks == "601\n600\n") << tasks;
+}
+
+TEST_F(SchedPolicyTest, CpusetBatch) {
+    UseMockedTree();
+    const int tids[] = { 20, 21 };
+    EXPECT_EQ(0, set_cpuset_policy_tids(tids, 2, SP_FOREGROUND));
+    // Without USE_CPUSETS the cpuset calls fall back to the cpu cgroup.
+    std::string cpuset = ReadFile("/dev/cpuset/foreground/tasks");
+    std::string cpuctl = ReadFile("/dev/cpuctl/tasks");
+    EXPECT_TRUE((cpuset == "20\n21\n" && cpuctl == "") ||
+                (cpuset == "" && cpuctl == "20\n21\n")) << cpuset << "|" << cpuctl;
+}
+
+TEST_F(SchedPolicyTest, GetSchedPolicy) {
+    ASSERT_EQ(0, mkdir((root_ + "/proc/42").c_str(), 0755));
+    ASSERT_EQ(0, mkdir((root_ + "/proc/43").c_str(), 0755));
+    WriteFile("/proc/42/cgroup", "3:cpuset:/foreground\n2:cpu:/bg_non_interactive\n1:cpuacct:/\n");
+    WriteFile("/proc/43/cgroup", "2:cpu:/\n1:cpuacct:/\n");
+    UseMockedTree();
+
+    SchedPolicy policy;
+    ASSERT_EQ(0, get_sched_policy(42, &policy));
+    EXPECT_EQ(SP_BACKGROUND, policy);
+    ASSERT_EQ(0, get_sched_policy(43, &policy));
+    EXPECT_EQ(SP_FOREGROUND, policy);
+    EXPECT_EQ(-1, get_sched_policy(44, &policy));
+}
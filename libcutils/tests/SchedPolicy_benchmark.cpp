@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/sched_policy.h>
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+extern "C" void __set_sched_policy_root(const char* root);
+
+static const int kPid = 1000;
+static const int kThreads = 100;
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+// A mocked /dev/cpuctl, /dev/cpuset and /proc made of plain files, holding one
+// process with kThreads threads. Against it, a switch costs the library's
+// overhead and its syscalls; the kernel's cgroup locking comes on top on a
+// device.
+class MockedTree {
+public:
+    MockedTree() {
+        const char* tmpdir = getenv("TMPDIR");
+        root_ = std::string(tmpdir ? tmpdir : "/data/local/tmp") + "/sched_policy_benchmark.XXXXXX";
+        if (mkdtemp(&root_[0]) == nullptr) {
+            abort();
+        }
+        for (const char* dir : { "/dev", "/dev/cpuctl", "/dev/cpuctl/bg_non_interactive",
+                                 "/dev/cpuset", "/dev/cpuset/foreground",
+                                 "/dev/cpuset/background", "/proc" }) {
+            MakeDir(dir);
+        }
+        for (const char* file : { "/dev/cpuctl/tasks", "/dev/cpuctl/cgroup.procs",
+                                  "/dev/cpuctl/bg_non_interactive/tasks",
+                                  "/dev/cpuctl/bg_non_interactive/cgroup.procs",
+                                  "/dev/cpuset/tasks",
+                                  "/dev/cpuset/foreground/tasks",
+                                  "/dev/cpuset/foreground/cgroup.procs",
+                                  "/dev/cpuset/background/tasks",
+                                  "/dev/cpuset/background/cgroup.procs" }) {
+            FILE* fp = fopen((root_ + file).c_str(), "w");
+            if (fp == nullptr) {
+                abort();
+            }
+            fclose(fp);
+        }
+
+        std::string dir = "/proc/" + std::to_string(kPid);
+        MakeDir(dir);
+        MakeDir(dir + "/task");
+        for (int i = 0; i < kThreads; i++) {
+            tids.push_back(kPid + i);
+            MakeDir(dir + "/task/" + std::to_string(kPid + i));
+        }
+        __set_sched_policy_root(root_.c_str());
+    }
+
+    ~MockedTree() {
+        __set_sched_policy_root(nullptr);
+        nftw(root_.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    std::vector<int> tids;
+
+private:
+    void MakeDir(const std::string& dir) {
+        if (mkdir((root_ + dir).c_str(), 0755) != 0) {
+            abort();
+        }
+    }
+
+    std::string root_;
+};
+
+// The three ways of moving a whole process between groups.
+typedef void (*SwitchFn)(const std::vector<int>& tids, SchedPolicy policy);
+
+static void PerThread(const std::vector<int>& tids, SchedPolicy policy) {
+    for (int tid : tids) {
+        set_sched_policy(tid, policy);
+    }
+}
+
+static void Tids(const std::vector<int>& tids, SchedPolicy policy) {
+    set_sched_policy_tids(tids.data(), tids.size(), policy);
+}
+
+static void Process(const std::vector<int>& tids, SchedPolicy policy) {
+    set_process_sched_policy(tids[0], policy);
+}
+
+// Moves the process back and forth between foreground and background.
+static void BM_sched_policy_switch(int iters, SwitchFn fn) {
+    MockedTree tree;
+    fn(tree.tids, SP_BACKGROUND);
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        fn(tree.tids, i % 2 ? SP_BACKGROUND : SP_FOREGROUND);
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_sched_policy_switch)
+        ->Arg("per_thread", PerThread)->Arg("tids", Tids)->Arg("process", Process);
+
+// Moves the process to the group it is already in.
+static void BM_sched_policy_no_op(int iters, SwitchFn fn) {
+    MockedTree tree;
+    fn(tree.tids, SP_FOREGROUND);
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        fn(tree.tids, SP_FOREGROUND);
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_sched_policy_no_op)
+        ->Arg("per_thread", PerThread)->Arg("tids", Tids)->Arg("process", Process);
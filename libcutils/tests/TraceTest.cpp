@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cutils/trace.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The bodies are what the ATRACE_* macros call once a tag is enabled.
+extern "C" {
+void atrace_begin_body(const char*);
+void atrace_end_body();
+void atrace_int_body(const char*, int32_t);
+void atrace_async_begin_body(const char*, int32_t);
+}
+
+struct ParsedEvent {
+    pid_t tid;
+    atrace_event event;
+    std::string name;
+};
+
+// Decodes a buffered trace stream, checking that every id was named first.
+static bool Parse(const std::string& data, std::vector<ParsedEvent>* events,
+                  size_t* name_batches) {
+    std::map<std::pair<pid_t, uint32_t>, std::string> names;
+    size_t pos = 0;
+    *name_batches = 0;
+    while (pos < data.size()) {
+        atrace_batch_header header;
+        if (data.size() - pos < sizeof(header)) return false;
+        memcpy(&header, data.data() + pos, sizeof(header));
+        pos += sizeof(header);
+        if (header.magic != ATRACE_BATCH_MAGIC || data.size() - pos < header.size) return false;
+
+        if (header.kind == ATRACE_BATCH_NAME) {
+            uint32_t id;
+            memcpy(&id, data.data() + pos, sizeof(id));
+            names[std::make_pair(header.pid, id)] =
+                    data.substr(pos + sizeof(id), header.size - sizeof(id));
+            ++*name_batches;
+        } else if (header.kind == ATRACE_BATCH_EVENTS) {
+            for (size_t i = 0; i < header.size / sizeof(atrace_event); i++) {
+                ParsedEvent parsed;
+                parsed.tid = header.tid;
+                memcpy(&parsed.event, data.data() + pos + i * sizeof(atrace_event),
+                       sizeof(atrace_event));
+                if (parsed.event.name_id != 0) {
+                    auto it = names.find(std::make_pair(header.pid, parsed.event.name_id));
+                    if (it == names.end()) return false;
+                    parsed.name = it->second;
+                }
+                events->push_back(parsed);
+            }
+        } else {
+            return false;
+        }
+        pos += header.size;
+    }
+    return true;
+}
+
+static std::string ReadAll(int fd) {
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    while ((n = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf)))) > 0) {
+        data.append(buf, n);
+    }
+    return data;
+}
+
+TEST(TraceTest, BufferedEventsRoundTrip) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(0, atrace_buffered_start(fds[1]));
+    close(fds[1]);
+
+    atrace_begin_body("outer");
+    atrace_int_body("counter", 7);
+    atrace_begin_body("inner");
+    atrace_end_body();
+    atrace_async_begin_body("async", 42);
+    atrace_end_body();
+    atrace_begin_body("outer");
+    atrace_end_body();
+    atrace_buffered_flush();
+    atrace_buffered_stop();
+
+    std::vector<ParsedEvent> events;
+    size_t name_batches;
+    ASSERT_TRUE(Parse(ReadAll(fds[0]), &events, &name_batches));
+    close(fds[0]);
+
+    // Each distinct name is sent once.
+    EXPECT_EQ(4U, name_batches);
+    const char kTypes[] = "BCBESEBE";
+    const char* kNames[] = { "outer", "counter", "inner", "", "async", "", "outer", "" };
+    ASSERT_EQ(strlen(kTypes), events.size());
+    for (size_t i = 0; i < events.size(); i++) {
+        SCOPED_TRACE(i);
+        EXPECT_EQ(kTypes[i], events[i].event.type);
+        EXPECT_EQ(kNames[i], events[i].name);
+        EXPECT_EQ(gettid(), events[i].tid);
+        if (i > 0) {
+            EXPECT_LE(events[i - 1].event.timestamp_ns, events[i].event.timestamp_ns);
+        }
+    }
+    EXPECT_EQ(7, events[1].event.value);
+    EXPECT_EQ(42, events[4].event.value);
+}
+
+TEST(TraceTest, RestartSendsNamesAgainAndDropsUnflushedEvents) {
+    int first[2], second[2];
+    ASSERT_EQ(0, pipe(first));
+    ASSERT_EQ(0, pipe(second));
+
+    ASSERT_EQ(0, atrace_buffered_start(first[1]));
+    close(first[1]);
+    atrace_begin_body("restart");
+    atrace_buffered_flush();
+    atrace_end_body();  // never flushed
+
+    ASSERT_EQ(0, atrace_buffered_start(second[1]));
+    close(second[1]);
+    atrace_begin_body("restart");
+    atrace_buffered_flush();
+    atrace_buffered_stop();
+
+    std::vector<ParsedEvent> events;
+    size_t name_batches;
+    ASSERT_TRUE(Parse(ReadAll(first[0]), &events, &name_batches));
+    ASSERT_EQ(1U, events.size());
+    EXPECT_EQ('B', events[0].event.type);
+
+    events.clear();
+    ASSERT_TRUE(Parse(ReadAll(second[0]), &events, &name_batches));
+    EXPECT_EQ(1U, name_batches);
+    ASSERT_EQ(1U, events.size());
+    EXPECT_EQ("restart", events[0].name);
+    close(first[0]);
+    close(second[0]);
+}
+
+TEST(TraceTest, BatchesFromThreadsDoNotInterleave) {
+    static const int kThreads = 4;
+    static const int kEvents = 5000;
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(0, atrace_buffered_start(fds[1]));
+    close(fds[1]);
+
+    std::string data;
+    std::thread reader([&]() { data = ReadAll(fds[0]); });
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([t]() {
+            std::string name = "thread " + std::to_string(t);
+            for (int i = 0; i < kEvents; i++) {
+                atrace_int_body(name.c_str(), i);
+            }
+            // Thread exit flushes what is left.
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    atrace_buffered_stop();
+    reader.join();
+    close(fds[0]);
+
+    std::vector<ParsedEvent> events;
+    size_t name_batches;
+    ASSERT_TRUE(Parse(data, &events, &name_batches));
+    std::map<pid_t, std::vector<int64_t>> values;
+    for (const ParsedEvent& e : events) {
+        values[e.tid].push_back(e.event.value);
+    }
+    ASSERT_EQ(size_t(kThreads), values.size());
+    for (auto& v : values) {
+        ASSERT_EQ(size_t(kEvents), v.second.size());
+        for (int i = 0; i < kEvents; i++) {
+            ASSERT_EQ(i, v.second[i]);
+        }
+    }
+}
+
+TEST(TraceTest, RestartWhileTracingDoesNotWriteToReusedFds) {
+    static const int kThreads = 4;
+    static const int kRestarts = 200;
+    int unrelated[2];
+    ASSERT_EQ(0, pipe2(unrelated, O_NONBLOCK));
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&done]() {
+            for (int i = 0; !done.load(); i++) {
+                atrace_int_body("restart race", i);
+            }
+        });
+    }
+    for (int i = 0; i < kRestarts; i++) {
+        int fds[2];
+        ASSERT_EQ(0, pipe2(fds, O_NONBLOCK));
+        ASSERT_EQ(0, atrace_buffered_start(fds[1]));
+        usleep(100);
+        atrace_buffered_stop();
+        // Takes the lowest free number, which is where a freed stream fd
+        // would be.
+        int w = dup(unrelated[1]);
+        ASSERT_NE(-1, w);
+        usleep(100);
+        close(w);
+        close(fds[0]);
+        close(fds[1]);
+    }
+    done = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    char c;
+    EXPECT_EQ(-1, read(unrelated[0], &c, 1));
+    EXPECT_EQ(EAGAIN, errno);
+    close(unrelated[0]);
+    close(unrelated[1]);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/trace.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "benchmark.h"
+
+// What the ATRACE_* macros call once a tag is enabled.
+extern "C" {
+void atrace_begin_body(const char*);
+void atrace_end_body();
+}
+
+// Times |iters| begin/end pairs written to |path|.
+static void BeginEnd(int iters, const char* path, bool buffered) {
+    int saved_marker_fd = atrace_marker_fd;
+    atrace_marker_fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (atrace_marker_fd == -1) {
+        // Reported as 0 ns where the file isn't there.
+        atrace_marker_fd = saved_marker_fd;
+        return;
+    }
+    if (buffered && atrace_buffered_start(atrace_marker_fd) != 0) {
+        close(atrace_marker_fd);
+        atrace_marker_fd = saved_marker_fd;
+        return;
+    }
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        atrace_begin_body("Trace_benchmark");
+        atrace_end_body();
+    }
+    StopBenchmarkTiming();
+
+    if (buffered) {
+        atrace_buffered_stop();
+    }
+    close(atrace_marker_fd);
+    atrace_marker_fd = saved_marker_fd;
+}
+
+// /dev/null leaves out the cost of the kernel trace buffer itself.
+static void BM_trace_begin_end_text(int iters) {
+    BeginEnd(iters, "/dev/null", false);
+}
+BENCHMARK(BM_trace_begin_end_text);
+
+static void BM_trace_begin_end_buffered(int iters) {
+    BeginEnd(iters, "/dev/null", true);
+}
+BENCHMARK(BM_trace_begin_end_buffered);
+
+static void BM_trace_begin_end_trace_marker(int iters) {
+    BeginEnd(iters, "/sys/kernel/debug/tracing/trace_marker", false);
+}
+BENCHMARK(BM_trace_begin_end_trace_marker);
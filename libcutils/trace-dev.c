@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <cutils/compiler.h>
 #include <cutils/properties.h>
 #include <cutils/trace.h>
@@ -191,21 +193,379 @@ void atrace_setup()
     pthread_once(&atrace_once_control, atrace_init_once);
 }
 
+// --- Buffered tracing ---
+
+#define ATRACE_BUFFER_EVENTS \
+    ((PIPE_BUF - sizeof(struct atrace_batch_header)) / sizeof(struct atrace_event))
+// Longest name a single ATRACE_BATCH_NAME batch can carry; longer ones are cut.
+#define ATRACE_NAME_MAX \
+    (PIPE_BUF - sizeof(struct atrace_batch_header) - sizeof(uint32_t))
+// Intern table size. Past ATRACE_NAME_CACHED names, new names get a fresh id
+// and are sent again on every use.
+#define ATRACE_NAME_SLOTS   1024
+#define ATRACE_NAME_CACHED  768
+
+struct atrace_name {
+    uint32_t hash;
+    uint32_t id;
+    // Generation of the stream this name was last sent to.
+    atomic_uint announced;
+    size_t length;
+    char name[0];
+};
+
+struct atrace_thread_buffer {
+    uint32_t generation;
+    pid_t pid;
+    pid_t tid;
+    size_t count;
+    struct atrace_event events[ATRACE_BUFFER_EVENTS];
+};
+
+static atomic_int       atrace_buffered_fd         = ATOMIC_VAR_INIT(-1);
+// The fd number behind atrace_buffered_fd. A thread may load the fd just
+// before a start or stop and write to it after, so the number is kept for
+// the life of the process and only what it refers to changes.
+static int              atrace_buffered_stream     = -1;
+static pthread_mutex_t  atrace_buffered_mutex      = PTHREAD_MUTEX_INITIALIZER;
+// Bumped by start, stop and fork, so threads drop events meant for an
+// earlier stream and names are sent again.
+static atomic_uint      atrace_buffered_generation = ATOMIC_VAR_INIT(1);
+static pthread_once_t   atrace_buffer_once         = PTHREAD_ONCE_INIT;
+static pthread_key_t    atrace_buffer_key;
+// Entries are published once and never freed, so lookups take no lock.
+static atomic_uintptr_t atrace_names[ATRACE_NAME_SLOTS];
+static pthread_mutex_t  atrace_names_mutex         = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t         atrace_name_count          = 0;
+static uint32_t         atrace_last_name_id        = 0;
+
+static void atrace_flush_buffer(struct atrace_thread_buffer* buffer, int fd)
+{
+    struct atrace_batch_header header;
+    struct iovec iov[2];
+
+    if (buffer->count == 0) {
+        return;
+    }
+    header.magic = ATRACE_BATCH_MAGIC;
+    header.kind = ATRACE_BATCH_EVENTS;
+    header.reserved = 0;
+    header.pid = buffer->pid;
+    header.tid = buffer->tid;
+    header.size = buffer->count * sizeof(struct atrace_event);
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = buffer->events;
+    iov[1].iov_len = header.size;
+    TEMP_FAILURE_RETRY(writev(fd, iov, 2));
+    buffer->count = 0;
+}
+
+static void atrace_thread_buffer_destroy(void* arg)
+{
+    struct atrace_thread_buffer* buffer = arg;
+    int fd = atomic_load_explicit(&atrace_buffered_fd, memory_order_acquire);
+
+    if (fd != -1 && buffer->generation ==
+            atomic_load_explicit(&atrace_buffered_generation, memory_order_acquire)) {
+        atrace_flush_buffer(buffer, fd);
+    }
+    free(buffer);
+}
+
+// Keep the name table consistent across fork.
+static void atrace_buffered_atfork_prepare()
+{
+    pthread_mutex_lock(&atrace_names_mutex);
+}
+
+static void atrace_buffered_atfork_parent()
+{
+    pthread_mutex_unlock(&atrace_names_mutex);
+}
+
+// Events buffered before a fork belong to the parent, and the child has to
+// send the names it uses under its own pid.
+static void atrace_buffered_atfork_child()
+{
+    atomic_fetch_add_explicit(&atrace_buffered_generation, 1, memory_order_release);
+    pthread_mutex_unlock(&atrace_names_mutex);
+}
+
+static void atrace_buffer_init_once()
+{
+    if (pthread_key_create(&atrace_buffer_key, atrace_thread_buffer_destroy) != 0) {
+        ALOGE("Error creating trace buffer key");
+        return;
+    }
+    pthread_atfork(atrace_buffered_atfork_prepare, atrace_buffered_atfork_parent,
+            atrace_buffered_atfork_child);
+}
+
+static struct atrace_thread_buffer* atrace_get_thread_buffer(uint32_t generation)
+{
+    struct atrace_thread_buffer* buffer;
+
+    pthread_once(&atrace_buffer_once, atrace_buffer_init_once);
+    buffer = pthread_getspecific(atrace_buffer_key);
+    if (CC_UNLIKELY(buffer == NULL)) {
+        buffer = malloc(sizeof(*buffer));
+        if (buffer == NULL) {
+            return NULL;
+        }
+        buffer->generation = 0;
+        pthread_setspecific(atrace_buffer_key, buffer);
+    }
+    if (CC_UNLIKELY(buffer->generation != generation)) {
+        buffer->generation = generation;
+        buffer->pid = getpid();
+        buffer->tid = gettid();
+        buffer->count = 0;
+    }
+    return buffer;
+}
+
+// Caller holds atrace_names_mutex.
+static void atrace_send_name(int fd, uint32_t id, const char* name, size_t length)
+{
+    struct atrace_batch_header header;
+    struct iovec iov[3];
+
+    header.magic = ATRACE_BATCH_MAGIC;
+    header.kind = ATRACE_BATCH_NAME;
+    header.reserved = 0;
+    header.pid = getpid();
+    header.tid = 0;
+    header.size = sizeof(id) + length;
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = &id;
+    iov[1].iov_len = sizeof(id);
+    iov[2].iov_base = (void*) name;
+    iov[2].iov_len = length;
+    TEMP_FAILURE_RETRY(writev(fd, iov, 3));
+}
+
+static void atrace_announce_name(struct atrace_name* entry, int fd, uint32_t generation)
+{
+    pthread_mutex_lock(&atrace_names_mutex);
+    if (atomic_load_explicit(&entry->announced, memory_order_relaxed) != generation) {
+        atrace_send_name(fd, entry->id, entry->name, entry->length);
+        atomic_store_explicit(&entry->announced, generation, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&atrace_names_mutex);
+}
+
+static struct atrace_name* atrace_find_name(const char* name, size_t length, uint32_t hash)
+{
+    size_t i;
+    struct atrace_name* entry;
+
+    for (i = hash % ATRACE_NAME_SLOTS; ; i = (i + 1) % ATRACE_NAME_SLOTS) {
+        entry = (struct atrace_name*) atomic_load_explicit(&atrace_names[i],
+                memory_order_acquire);
+        if (entry == NULL ||
+                (entry->hash == hash && entry->length == length &&
+                 memcmp(entry->name, name, length) == 0)) {
+            return entry;
+        }
+    }
+}
+
+static uint32_t atrace_intern_slow(const char* name, size_t length, uint32_t hash, int fd,
+        uint32_t generation)
+{
+    struct atrace_name* entry;
+    uint32_t id;
+    size_t i;
+
+    pthread_mutex_lock(&atrace_names_mutex);
+    // Another thread may have added it meanwhile.
+    entry = atrace_find_name(name, length, hash);
+    if (entry == NULL && atrace_name_count < ATRACE_NAME_CACHED) {
+        entry = malloc(sizeof(*entry) + length);
+        if (entry != NULL) {
+            entry->hash = hash;
+            entry->id = ++atrace_last_name_id;
+            atomic_init(&entry->announced, 0);
+            entry->length = length;
+            memcpy(entry->name, name, length);
+            for (i = hash % ATRACE_NAME_SLOTS; atomic_load_explicit(&atrace_names[i],
+                    memory_order_relaxed) != 0; i = (i + 1) % ATRACE_NAME_SLOTS) {
+            }
+            atomic_store_explicit(&atrace_names[i], (uintptr_t) entry, memory_order_release);
+            atrace_name_count++;
+        }
+    }
+    if (entry != NULL) {
+        if (atomic_load_explicit(&entry->announced, memory_order_relaxed) != generation) {
+            atrace_send_name(fd, entry->id, entry->name, entry->length);
+            atomic_store_explicit(&entry->announced, generation, memory_order_relaxed);
+        }
+        id = entry->id;
+    } else {
+        id = ++atrace_last_name_id;
+        atrace_send_name(fd, id, name, length);
+    }
+    pthread_mutex_unlock(&atrace_names_mutex);
+    return id;
+}
+
+static uint32_t atrace_intern(const char* name, int fd, uint32_t generation)
+{
+    // FNV-1a over the name, which also finds its length.
+    uint32_t hash = 2166136261u;
+    size_t length = 0;
+    struct atrace_name* entry;
+
+    while (name[length] != '\0' && length < ATRACE_NAME_MAX) {
+        hash = (hash ^ (uint8_t) name[length]) * 16777619u;
+        length++;
+    }
+
+    entry = atrace_find_name(name, length, hash);
+    if (CC_LIKELY(entry != NULL)) {
+        if (CC_UNLIKELY(atomic_load_explicit(&entry->announced, memory_order_relaxed) !=
+                generation)) {
+            atrace_announce_name(entry, fd, generation);
+        }
+        return entry->id;
+    }
+    return atrace_intern_slow(name, length, hash, fd, generation);
+}
+
+static void atrace_buffered_event(char type, const char* name, int64_t value)
+{
+    int fd = atomic_load_explicit(&atrace_buffered_fd, memory_order_acquire);
+    uint32_t generation = atomic_load_explicit(&atrace_buffered_generation,
+            memory_order_acquire);
+    struct atrace_thread_buffer* buffer;
+    struct atrace_event* event;
+    struct timespec ts;
+
+    if (fd == -1) {
+        return;
+    }
+    buffer = atrace_get_thread_buffer(generation);
+    if (buffer == NULL) {
+        return;
+    }
+
+    event = &buffer->events[buffer->count];
+    event->name_id = name != NULL ? atrace_intern(name, fd, generation) : 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    event->timestamp_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    event->type = type;
+    memset(event->reserved, 0, sizeof(event->reserved));
+    event->value = value;
+    if (++buffer->count == ATRACE_BUFFER_EVENTS) {
+        atrace_flush_buffer(buffer, fd);
+    }
+}
+
+static inline bool atrace_is_buffered()
+{
+    return atomic_load_explicit(&atrace_buffered_fd, memory_order_relaxed) != -1;
+}
+
+int atrace_buffered_start(int fd)
+{
+    int result = 0;
+
+    pthread_mutex_lock(&atrace_buffered_mutex);
+    if (atrace_buffered_stream == -1) {
+        atrace_buffered_stream = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (atrace_buffered_stream == -1) {
+            result = -errno;
+        }
+    } else if (fd != atrace_buffered_stream &&
+            TEMP_FAILURE_RETRY(dup3(fd, atrace_buffered_stream, O_CLOEXEC)) == -1) {
+        result = -errno;
+    }
+    if (result == 0) {
+        atomic_fetch_add_explicit(&atrace_buffered_generation, 1, memory_order_release);
+        atomic_store_explicit(&atrace_buffered_fd, atrace_buffered_stream,
+                memory_order_release);
+    }
+    pthread_mutex_unlock(&atrace_buffered_mutex);
+    return result;
+}
+
+void atrace_buffered_stop()
+{
+    int null_fd;
+
+    pthread_mutex_lock(&atrace_buffered_mutex);
+    atomic_store_explicit(&atrace_buffered_fd, -1, memory_order_release);
+    atomic_fetch_add_explicit(&atrace_buffered_generation, 1, memory_order_release);
+    // Let go of the collector's stream without freeing the number: late
+    // writes from threads that loaded it before the store go to /dev/null.
+    if (atrace_buffered_stream != -1) {
+        null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (null_fd == -1) {
+            ALOGE("Error opening /dev/null: %s (%d)", strerror(errno), errno);
+        } else {
+            TEMP_FAILURE_RETRY(dup3(null_fd, atrace_buffered_stream, O_CLOEXEC));
+            close(null_fd);
+        }
+    }
+    pthread_mutex_unlock(&atrace_buffered_mutex);
+}
+
+void atrace_buffered_flush()
+{
+    int fd = atomic_load_explicit(&atrace_buffered_fd, memory_order_acquire);
+    struct atrace_thread_buffer* buffer;
+
+    if (fd == -1) {
+        return;
+    }
+    pthread_once(&atrace_buffer_once, atrace_buffer_init_once);
+    buffer = pthread_getspecific(atrace_buffer_key);
+    if (buffer != NULL && buffer->generation ==
+            atomic_load_explicit(&atrace_buffered_generation, memory_order_acquire)) {
+        atrace_flush_buffer(buffer, fd);
+    }
+}
+
+// --- Trace events ---
+
 void atrace_begin_body(const char* name)
 {
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_is_buffered()) {
+        atrace_buffered_event('B', name, 0);
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "B|%d|%s", getpid(), name);
     write(atrace_marker_fd, buf, len);
 }
 
+void atrace_end_body()
+{
+    char c = 'E';
+
+    if (atrace_is_buffered()) {
+        atrace_buffered_event('E', NULL, 0);
+        return;
+    }
+
+    write(atrace_marker_fd, &c, 1);
+}
 
 void atrace_async_begin_body(const char* name, int32_t cookie)
 {
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_is_buffered()) {
+        atrace_buffered_event('S', name, cookie);
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "S|%d|%s|%" PRId32,
             getpid(), name, cookie);
     write(atrace_marker_fd, buf, len);
@@ -216,6 +576,11 @@ void atrace_async_end_body(const char* name, int32_t cookie)
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_is_buffered()) {
+        atrace_buffered_event('F', name, cookie);
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "F|%d|%s|%" PRId32,
             getpid(), name, cookie);
     write(atrace_marker_fd, buf, len);
@@ -226,6 +591,11 @@ void atrace_int_body(const char* name, int32_t value)
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_is_buffered()) {
+        atrace_buffered_event('C', name, value);
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "C|%d|%s|%" PRId32,
             getpid(), name, value);
     write(atrace_marker_fd, buf, len);
@@ -236,6 +606,11 @@ void atrace_int64_body(const char* name, int64_t value)
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_is_buffered()) {
+        atrace_buffered_event('C', name, value);
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "C|%d|%s|%" PRId64,
             getpid(), name, value);
     write(atrace_marker_fd, buf, len);
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+
 #include <cutils/trace.h>
 
 #ifndef __unused
@@ -28,7 +30,11 @@ void atrace_set_debuggable(bool debuggable __unused) { }
 void atrace_set_tracing_enabled(bool enabled __unused) { }
 void atrace_update_tags() { }
 void atrace_setup() { }
+int atrace_buffered_start(int fd __unused) { return -ENOSYS; }
+void atrace_buffered_stop() { }
+void atrace_buffered_flush() { }
 void atrace_begin_body(const char* name __unused) { }
+void atrace_end_body() { }
 void atrace_async_begin_body(const char* name __unused, int32_t cookie __unused) { }
 void atrace_async_end_body(const char* name __unused, int32_t cookie __unused) { }
 void atrace_int_body(const char* name __unused, int32_t value __unused) { }
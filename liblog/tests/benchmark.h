@@ -134,6 +134,7 @@ static inline void BenchmarkAddArg(::testing::Benchmark* b, const char* name, T
 }
 
 void SetBenchmarkBytesProcessed(uint64_t);
+void SetBenchmarkAllocations(uint64_t);
 void ResetBenchmarkTiming(void);
 void StopBenchmarkTiming(void);
 void StartBenchmarkTiming(void);
@@ -27,6 +27,7 @@
 #include <vector>
 
 static uint64_t gBytesProcessed;
+static int64_t gAllocations;
 static uint64_t gBenchmarkTotalTimeNs;
 static uint64_t gBenchmarkTotalTimeNsSquared;
 static uint64_t gBenchmarkNum;
@@ -107,6 +108,7 @@ void BenchmarkRegister(Benchmark* b) {
 
 void RunRepeatedly(Benchmark* b, int iterations) {
   gBytesProcessed = 0;
+  gAllocations = -1;
   ResetBenchmarkTiming();
   uint64_t StartTimeNs = NanoTime();
   b->RunFn(iterations);
@@ -145,6 +147,11 @@ void Run(Benchmark* b) {
     double seconds = static_cast<double>(gBenchmarkTotalTimeNs)/1e9;
     snprintf(throughput, sizeof(throughput), " %8.2f MiB/s", mib_processed/seconds);
   }
+  if (gAllocations >= 0) {
+    size_t used = strlen(throughput);
+    snprintf(throughput + used, sizeof(throughput) - used, " %8.2f allocs/op",
+             static_cast<double>(gAllocations)/iterations);
+  }
 
   char full_name[100];
   snprintf(full_name, sizeof(full_name), "%s%s%s", b->Name(),
@@ -175,6 +182,10 @@ void SetBenchmarkBytesProcessed(uint64_t x) {
   gBytesProcessed = x;
 }
 
+void SetBenchmarkAllocations(uint64_t x) {
+  gAllocations = x;
+}
+
 void ResetBenchmarkTiming() {
   gBenchmarkStartTimeNs = 0;
   gBenchmarkTotalTimeNs = 0;
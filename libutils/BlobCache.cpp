@@ -23,6 +23,7 @@
 
 #include <utils/BlobCache.h>
 #include <utils/Errors.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 
 #include <cutils/properties.h>
@@ -42,16 +43,25 @@ BlobCache::BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize
         mMaxKeySize(maxKeySize),
         mMaxValueSize(maxValueSize),
         mMaxTotalSize(maxTotalSize),
-        mTotalSize(0) {
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-#ifdef _WIN32
-    srand(now);
-#else
-    mRandState[0] = (now >> 0) & 0xFFFF;
-    mRandState[1] = (now >> 16) & 0xFFFF;
-    mRandState[2] = (now >> 32) & 0xFFFF;
-#endif
-    ALOGV("initializing random seed using %lld", (unsigned long long)now);
+        mLowWatermark(maxTotalSize / 2),
+        mTotalSize(0),
+        mOldest(NULL),
+        mYoungest(NULL) {
+}
+
+BlobCache::BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize,
+        size_t lowWatermark):
+        mMaxKeySize(maxKeySize),
+        mMaxValueSize(maxValueSize),
+        mMaxTotalSize(maxTotalSize),
+        mLowWatermark(lowWatermark < maxTotalSize ? lowWatermark : maxTotalSize),
+        mTotalSize(0),
+        mOldest(NULL),
+        mYoungest(NULL) {
+}
+
+BlobCache::~BlobCache() {
+    clear();
 }
 
 void BlobCache::set(const void* key, size_t keySize, const void* value,
@@ -80,20 +90,17 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
         return;
     }
 
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
+    Entry dummyEntry(key, keySize);
 
     while (true) {
-        ssize_t index = mCacheEntries.indexOf(dummyEntry);
-        if (index < 0) {
+        EntrySet::iterator it = mEntries.find(&dummyEntry);
+        if (it == mEntries.end()) {
             // Create a new cache entry.
-            sp<Blob> keyBlob(new Blob(key, keySize, true));
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
             size_t newTotalSize = mTotalSize + keySize + valueSize;
             if (mMaxTotalSize < newTotalSize) {
-                if (isCleanable()) {
+                if (isCleanable(keySize + valueSize)) {
                     // Clean the cache and try again.
-                    clean();
+                    clean(keySize + valueSize);
                     continue;
                 } else {
                     ALOGV("set: not caching new key/value pair because the "
@@ -103,19 +110,30 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
                     break;
                 }
             }
-            mCacheEntries.add(CacheEntry(keyBlob, valueBlob));
+            Entry* entry = Entry::create(key, keySize, value, valueSize);
+            if (entry == NULL) {
+                ALOGE("set: not caching new key/value pair: out of memory");
+                break;
+            }
+            mEntries.insert(entry);
+            attach(entry);
             mTotalSize = newTotalSize;
             ALOGV("set: created new cache entry with %zu byte key and %zu byte value",
                     keySize, valueSize);
         } else {
-            // Update the existing cache entry.
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
-            sp<Blob> oldValueBlob(mCacheEntries[index].getValue());
-            size_t newTotalSize = mTotalSize + valueSize - oldValueBlob->getSize();
+            // Update the existing cache entry, making it the most recently
+            // used so that cleaning to make room evicts it last.
+            Entry* entry = *it;
+            detach(entry);
+            attach(entry);
+            size_t newTotalSize = mTotalSize + valueSize - entry->getValueSize();
             if (mMaxTotalSize < newTotalSize) {
-                if (isCleanable()) {
+                // Only the growth of the value needs room.  If cleaning
+                // evicts this entry too, the next pass re-creates it.
+                size_t needed = valueSize - entry->getValueSize();
+                if (isCleanable(needed)) {
                     // Clean the cache and try again.
-                    clean();
+                    clean(needed);
                     continue;
                 } else {
                     ALOGV("set: not caching new value because the total cache "
@@ -124,7 +142,10 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
                     break;
                 }
             }
-            mCacheEntries.editItemAt(index).setValue(valueBlob);
+            if (!entry->setValue(value, valueSize)) {
+                ALOGE("set: not caching new value: out of memory");
+                break;
+            }
             mTotalSize = newTotalSize;
             ALOGV("set: updated existing cache entry with %zu byte key and %zu byte "
                     "value", keySize, valueSize);
@@ -140,21 +161,24 @@ size_t BlobCache::get(const void* key, size_t keySize, void* value,
                 keySize, mMaxKeySize);
         return 0;
     }
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
-    ssize_t index = mCacheEntries.indexOf(dummyEntry);
-    if (index < 0) {
+    Entry dummyEntry(key, keySize);
+    EntrySet::iterator it = mEntries.find(&dummyEntry);
+    if (it == mEntries.end()) {
         ALOGV("get: no cache entry found for key of size %zu", keySize);
         return 0;
     }
 
     // The key was found. Return the value if the caller's buffer is large
     // enough.
-    sp<Blob> valueBlob(mCacheEntries[index].getValue());
-    size_t valueBlobSize = valueBlob->getSize();
+    Entry* entry = *it;
+    if (entry != mYoungest) {
+        detach(entry);
+        attach(entry);
+    }
+    size_t valueBlobSize = entry->getValueSize();
     if (valueBlobSize <= valueSize) {
         ALOGV("get: copying %zu bytes to caller's buffer", valueBlobSize);
-        memcpy(value, valueBlob->getData(), valueBlobSize);
+        memcpy(value, entry->getValue(), valueBlobSize);
     } else {
         ALOGV("get: caller's buffer is too small for value: %zu (needs %zu)",
                 valueSize, valueBlobSize);
@@ -168,12 +192,8 @@ static inline size_t align4(size_t size) {
 
 size_t BlobCache::getFlattenedSize() const {
     size_t size = align4(sizeof(Header) + PROPERTY_VALUE_MAX);
-    for (size_t i = 0; i < mCacheEntries.size(); i++) {
-        const CacheEntry& e(mCacheEntries[i]);
-        sp<Blob> keyBlob = e.getKey();
-        sp<Blob> valueBlob = e.getValue();
-        size += align4(sizeof(EntryHeader) + keyBlob->getSize() +
-                       valueBlob->getSize());
+    for (const Entry* e = mOldest; e != NULL; e = e->mYounger) {
+        size += align4(sizeof(EntryHeader) + e->getKeySize() + e->getValueSize());
     }
     return size;
 }
@@ -188,20 +208,17 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
     header->mMagicNumber = blobCacheMagic;
     header->mBlobCacheVersion = blobCacheVersion;
     header->mDeviceVersion = blobCacheDeviceVersion;
-    header->mNumEntries = mCacheEntries.size();
+    header->mNumEntries = mEntries.size();
     char buildId[PROPERTY_VALUE_MAX];
     header->mBuildIdLength = property_get("ro.build.id", buildId, "");
     memcpy(header->mBuildId, buildId, header->mBuildIdLength);
 
-    // Write cache entries
+    // Write cache entries, least recently used first.
     uint8_t* byteBuffer = reinterpret_cast<uint8_t*>(buffer);
     off_t byteOffset = align4(sizeof(Header) + header->mBuildIdLength);
-    for (size_t i = 0; i < mCacheEntries.size(); i++) {
-        const CacheEntry& e(mCacheEntries[i]);
-        sp<Blob> keyBlob = e.getKey();
-        sp<Blob> valueBlob = e.getValue();
-        size_t keySize = keyBlob->getSize();
-        size_t valueSize = valueBlob->getSize();
+    for (const Entry* e = mOldest; e != NULL; e = e->mYounger) {
+        size_t keySize = e->getKeySize();
+        size_t valueSize = e->getValueSize();
 
         size_t entrySize = sizeof(EntryHeader) + keySize + valueSize;
         size_t totalSize = align4(entrySize);
@@ -215,8 +232,8 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
         eheader->mKeySize = keySize;
         eheader->mValueSize = valueSize;
 
-        memcpy(eheader->mData, keyBlob->getData(), keySize);
-        memcpy(eheader->mData + keySize, valueBlob->getData(), valueSize);
+        memcpy(eheader->mData, e->getKey(), keySize);
+        memcpy(eheader->mData + keySize, e->getValue(), valueSize);
 
         if (totalSize > entrySize) {
             // We have padding bytes. Those will get written to storage, and contribute to the CRC,
@@ -232,7 +249,7 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
 
 status_t BlobCache::unflatten(void const* buffer, size_t size) {
     // All errors should result in the BlobCache being in an empty state.
-    mCacheEntries.clear();
+    clear();
 
     // Read the cache header
     if (size < sizeof(Header)) {
@@ -260,7 +277,7 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
     size_t numEntries = header->mNumEntries;
     for (size_t i = 0; i < numEntries; i++) {
         if (byteOffset + sizeof(EntryHeader) > size) {
-            mCacheEntries.clear();
+            clear();
             ALOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
@@ -273,7 +290,7 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
 
         size_t totalSize = align4(entrySize);
         if (byteOffset + totalSize > size) {
-            mCacheEntries.clear();
+            clear();
             ALOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
@@ -287,93 +304,116 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
     return OK;
 }
 
-long int BlobCache::blob_random() {
-#ifdef _WIN32
-    return rand();
-#else
-    return nrand48(mRandState);
-#endif
-}
-
-void BlobCache::clean() {
-    // Remove a random cache entry until the total cache size gets below half
-    // the maximum total cache size.
-    while (mTotalSize > mMaxTotalSize / 2) {
-        size_t i = size_t(blob_random() % (mCacheEntries.size()));
-        const CacheEntry& entry(mCacheEntries[i]);
-        mTotalSize -= entry.getKey()->getSize() + entry.getValue()->getSize();
-        mCacheEntries.removeAt(i);
+void BlobCache::clean(size_t needed) {
+    // Remove the least recently used entries until the total cache size is
+    // no more than the low watermark, and small enough to take 'needed'.
+    const size_t target = cleanTarget(needed);
+    while (mTotalSize > target && mOldest != NULL) {
+        Entry* entry = mOldest;
+        detach(entry);
+        mEntries.erase(entry);
+        mTotalSize -= entry->getKeySize() + entry->getValueSize();
+        delete entry;
     }
 }
 
-bool BlobCache::isCleanable() const {
-    return mTotalSize > mMaxTotalSize / 2;
+bool BlobCache::isCleanable(size_t needed) const {
+    return mTotalSize > cleanTarget(needed);
 }
 
-BlobCache::Blob::Blob(const void* data, size_t size, bool copyData):
-        mData(copyData ? malloc(size) : data),
-        mSize(size),
-        mOwnsData(copyData) {
-    if (data != NULL && copyData) {
-        memcpy(const_cast<void*>(mData), data, size);
-    }
+size_t BlobCache::cleanTarget(size_t needed) const {
+    // set() never asks for more than mMaxTotalSize.
+    const size_t room = mMaxTotalSize - needed;
+    return room < mLowWatermark ? room : mLowWatermark;
 }
 
-BlobCache::Blob::~Blob() {
-    if (mOwnsData) {
-        free(const_cast<void*>(mData));
+void BlobCache::clear() {
+    Entry* entry = mOldest;
+    while (entry != NULL) {
+        Entry* next = entry->mYounger;
+        delete entry;
+        entry = next;
     }
+    mEntries.clear();
+    mOldest = NULL;
+    mYoungest = NULL;
+    mTotalSize = 0;
 }
 
-bool BlobCache::Blob::operator<(const Blob& rhs) const {
-    if (mSize == rhs.mSize) {
-        return memcmp(mData, rhs.mData, mSize) < 0;
+void BlobCache::attach(Entry* entry) {
+    entry->mOlder = mYoungest;
+    entry->mYounger = NULL;
+    if (mYoungest != NULL) {
+        mYoungest->mYounger = entry;
     } else {
-        return mSize < rhs.mSize;
+        mOldest = entry;
     }
+    mYoungest = entry;
 }
 
-const void* BlobCache::Blob::getData() const {
-    return mData;
-}
-
-size_t BlobCache::Blob::getSize() const {
-    return mSize;
-}
-
-BlobCache::CacheEntry::CacheEntry() {
+void BlobCache::detach(Entry* entry) {
+    if (entry->mOlder != NULL) {
+        entry->mOlder->mYounger = entry->mYounger;
+    } else {
+        mOldest = entry->mYounger;
+    }
+    if (entry->mYounger != NULL) {
+        entry->mYounger->mOlder = entry->mOlder;
+    } else {
+        mYoungest = entry->mOlder;
+    }
+    entry->mOlder = entry->mYounger = NULL;
 }
 
-BlobCache::CacheEntry::CacheEntry(const sp<Blob>& key, const sp<Blob>& value):
+BlobCache::Entry::Entry(const void* key, size_t keySize):
+        mOlder(NULL),
+        mYounger(NULL),
         mKey(key),
-        mValue(value) {
+        mKeySize(keySize),
+        mValue(NULL),
+        mValueSize(0),
+        mData(NULL),
+        mHash(JenkinsHashWhiten(JenkinsHashMixBytes(0,
+                static_cast<const uint8_t*>(key), keySize))) {
 }
 
-BlobCache::CacheEntry::CacheEntry(const CacheEntry& ce):
-        mKey(ce.mKey),
-        mValue(ce.mValue) {
+BlobCache::Entry::~Entry() {
+    free(mData);
 }
 
-bool BlobCache::CacheEntry::operator<(const CacheEntry& rhs) const {
-    return *mKey < *rhs.mKey;
-}
-
-const BlobCache::CacheEntry& BlobCache::CacheEntry::operator=(const CacheEntry& rhs) {
-    mKey = rhs.mKey;
-    mValue = rhs.mValue;
-    return *this;
-}
-
-sp<BlobCache::Blob> BlobCache::CacheEntry::getKey() const {
-    return mKey;
+BlobCache::Entry* BlobCache::Entry::create(const void* key, size_t keySize,
+        const void* value, size_t valueSize) {
+    uint8_t* data = static_cast<uint8_t*>(malloc(keySize + valueSize));
+    if (data == NULL) {
+        return NULL;
+    }
+    memcpy(data, key, keySize);
+    memcpy(data + keySize, value, valueSize);
+
+    Entry* entry = new Entry(data, keySize);
+    entry->mData = data;
+    entry->mValue = data + keySize;
+    entry->mValueSize = valueSize;
+    return entry;
 }
 
-sp<BlobCache::Blob> BlobCache::CacheEntry::getValue() const {
-    return mValue;
+bool BlobCache::Entry::setValue(const void* value, size_t valueSize) {
+    uint8_t* data = static_cast<uint8_t*>(realloc(mData, mKeySize + valueSize));
+    if (data == NULL) {
+        return false;
+    }
+    memcpy(data + mKeySize, value, valueSize);
+    mData = data;
+    mKey = data;
+    mValue = data + mKeySize;
+    mValueSize = valueSize;
+    return true;
 }
 
-void BlobCache::CacheEntry::setValue(const sp<Blob>& value) {
-    mValue = value;
+bool BlobCache::EqualityForEntries::operator()(const Entry* lhs, const Entry* rhs) const {
+    return lhs->getHash() == rhs->getHash() &&
+            lhs->getKeySize() == rhs->getKeySize() &&
+            memcmp(lhs->getKey(), rhs->getKey(), lhs->getKeySize()) == 0;
 }
 
 } // namespace android
@@ -25,6 +25,8 @@
 #include <sys/eventfd.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <functional>
 
 namespace android {
 
@@ -65,13 +67,14 @@ int SimpleLooperCallback::handleEvent(int fd, int events, void* data) {
 static const int EPOLL_SIZE_HINT = 8;
 
 // Maximum number of file descriptors for which to retrieve poll events each iteration.
-static const int EPOLL_MAX_EVENTS = 16;
+// Loopers that watch many fds see bursts of events, so collect them in few syscalls.
+static const int EPOLL_MAX_EVENTS = 64;
 
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
 Looper::Looper(bool allowNonCallbacks) :
-        mAllowNonCallbacks(allowNonCallbacks), mSendingMessage(false),
+        mAllowNonCallbacks(allowNonCallbacks), mNextMessageSeq(0), mSendingMessage(false),
         mPolling(false), mEpollFd(-1), mEpollRebuildRequired(false),
         mNextRequestSeq(0), mResponseIndex(0), mNextMessageUptime(LLONG_MAX) {
     mWakeEventFd = eventfd(0, EFD_NONBLOCK);
@@ -161,8 +164,8 @@ void Looper::rebuildEpollLocked() {
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake event fd to epoll instance: %s",
                         strerror(errno));
 
-    for (size_t i = 0; i < mRequests.size(); i++) {
-        const Request& request = mRequests.valueAt(i);
+    for (const auto& entry : mRequests) {
+        const Request& request = entry.second;
         struct epoll_event eventItem;
         request.initEventItem(&eventItem);
 
@@ -188,7 +191,7 @@ int Looper::pollOnce(int timeoutMillis, int* outFd, int* outEvents, void** outDa
     int result = 0;
     for (;;) {
         while (mResponseIndex < mResponses.size()) {
-            const Response& response = mResponses.itemAt(mResponseIndex++);
+            const Response& response = mResponses[mResponseIndex++];
             int ident = response.request.ident;
             if (ident >= 0) {
                 int fd = response.request.fd;
@@ -297,14 +300,14 @@ int Looper::pollInner(int timeoutMillis) {
                 ALOGW("Ignoring unexpected epoll events 0x%x on wake event fd.", epollEvents);
             }
         } else {
-            ssize_t requestIndex = mRequests.indexOfKey(fd);
-            if (requestIndex >= 0) {
+            auto requestIt = mRequests.find(fd);
+            if (requestIt != mRequests.end()) {
                 int events = 0;
                 if (epollEvents & EPOLLIN) events |= EVENT_INPUT;
                 if (epollEvents & EPOLLOUT) events |= EVENT_OUTPUT;
                 if (epollEvents & EPOLLERR) events |= EVENT_ERROR;
                 if (epollEvents & EPOLLHUP) events |= EVENT_HANGUP;
-                pushResponse(events, mRequests.valueAt(requestIndex));
+                pushResponse(events, requestIt->second);
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x on fd %d that is "
                         "no longer registered.", epollEvents, fd);
@@ -315,9 +318,9 @@ Done: ;
 
     // Invoke pending message callbacks.
     mNextMessageUptime = LLONG_MAX;
-    while (mMessageEnvelopes.size() != 0) {
+    while (!mMessageEnvelopes.empty()) {
         nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
-        const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(0);
+        const MessageEnvelope& messageEnvelope = mMessageEnvelopes.front();
         if (messageEnvelope.uptime <= now) {
             // Remove the envelope from the list.
             // We keep a strong reference to the handler until the call to handleMessage
@@ -326,7 +329,9 @@ Done: ;
             { // obtain handler
                 sp<MessageHandler> handler = messageEnvelope.handler;
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                std::pop_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                        std::greater<MessageEnvelope>());
+                mMessageEnvelopes.pop_back();
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -352,7 +357,7 @@ Done: ;
 
     // Invoke all response callbacks.
     for (size_t i = 0; i < mResponses.size(); i++) {
-        Response& response = mResponses.editItemAt(i);
+        Response& response = mResponses[i];
         if (response.request.ident == POLL_CALLBACK) {
             int fd = response.request.fd;
             int events = response.events;
@@ -428,10 +433,10 @@ void Looper::awoken() {
 }
 
 void Looper::pushResponse(int events, const Request& request) {
-    Response response;
+    mResponses.push_back(Response());
+    Response& response = mResponses.back();
     response.events = events;
     response.request = request;
-    mResponses.push(response);
 }
 
 int Looper::addFd(int fd, int ident, int events, Looper_callbackFunc callback, void* data) {
@@ -444,80 +449,109 @@ int Looper::addFd(int fd, int ident, int events, const sp<LooperCallback>& callb
             events, callback.get(), data);
 #endif
 
+    if (!checkFdArgs(ident, callback)) {
+        return -1;
+    }
+
+    AutoMutex _l(mLock);
+    return addFdLocked(fd, ident, events, callback, data);
+}
+
+size_t Looper::addFds(const FdRegistration* registrations, size_t count) {
+#if DEBUG_CALLBACKS
+    ALOGD("%p ~ addFds - count=%zu", this, count);
+#endif
+
+    size_t added = 0;
+    AutoMutex _l(mLock);
+    mRequests.reserve(mRequests.size() + count);
+    for (size_t i = 0; i < count; i++) {
+        const FdRegistration& r = registrations[i];
+        if (checkFdArgs(r.ident, r.callback)
+                && addFdLocked(r.fd, r.ident, r.events, r.callback, r.data) == 1) {
+            added++;
+        }
+    }
+    return added;
+}
+
+bool Looper::checkFdArgs(int ident, const sp<LooperCallback>& callback) const {
     if (!callback.get()) {
         if (! mAllowNonCallbacks) {
             ALOGE("Invalid attempt to set NULL callback but not allowed for this looper.");
-            return -1;
+            return false;
         }
 
         if (ident < 0) {
             ALOGE("Invalid attempt to set NULL callback with ident < 0.");
-            return -1;
+            return false;
         }
-    } else {
-        ident = POLL_CALLBACK;
     }
+    return true;
+}
 
-    { // acquire lock
-        AutoMutex _l(mLock);
+int Looper::addFdLocked(int fd, int ident, int events, const sp<LooperCallback>& callback,
+        void* data) {
+    if (callback.get()) {
+        ident = POLL_CALLBACK;
+    }
 
-        Request request;
-        request.fd = fd;
-        request.ident = ident;
-        request.events = events;
-        request.seq = mNextRequestSeq++;
-        request.callback = callback;
-        request.data = data;
-        if (mNextRequestSeq == -1) mNextRequestSeq = 0; // reserve sequence number -1
+    Request request;
+    request.fd = fd;
+    request.ident = ident;
+    request.events = events;
+    request.seq = mNextRequestSeq++;
+    request.callback = callback;
+    request.data = data;
+    if (mNextRequestSeq == -1) mNextRequestSeq = 0; // reserve sequence number -1
 
-        struct epoll_event eventItem;
-        request.initEventItem(&eventItem);
+    struct epoll_event eventItem;
+    request.initEventItem(&eventItem);
 
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
-        if (requestIndex < 0) {
-            int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, & eventItem);
-            if (epollResult < 0) {
-                ALOGE("Error adding epoll events for fd %d: %s", fd, strerror(errno));
-                return -1;
-            }
-            mRequests.add(fd, request);
-        } else {
-            int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, & eventItem);
-            if (epollResult < 0) {
-                if (errno == ENOENT) {
-                    // Tolerate ENOENT because it means that an older file descriptor was
-                    // closed before its callback was unregistered and meanwhile a new
-                    // file descriptor with the same number has been created and is now
-                    // being registered for the first time.  This error may occur naturally
-                    // when a callback has the side-effect of closing the file descriptor
-                    // before returning and unregistering itself.  Callback sequence number
-                    // checks further ensure that the race is benign.
-                    //
-                    // Unfortunately due to kernel limitations we need to rebuild the epoll
-                    // set from scratch because it may contain an old file handle that we are
-                    // now unable to remove since its file descriptor is no longer valid.
-                    // No such problem would have occurred if we were using the poll system
-                    // call instead, but that approach carries others disadvantages.
+    auto requestIt = mRequests.find(fd);
+    if (requestIt == mRequests.end()) {
+        int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, & eventItem);
+        if (epollResult < 0) {
+            ALOGE("Error adding epoll events for fd %d: %s", fd, strerror(errno));
+            return -1;
+        }
+        mRequests.emplace(fd, request);
+    } else {
+        int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, & eventItem);
+        if (epollResult < 0) {
+            if (errno == ENOENT) {
+                // Tolerate ENOENT because it means that an older file descriptor was
+                // closed before its callback was unregistered and meanwhile a new
+                // file descriptor with the same number has been created and is now
+                // being registered for the first time.  This error may occur naturally
+                // when a callback has the side-effect of closing the file descriptor
+                // before returning and unregistering itself.  Callback sequence number
+                // checks further ensure that the race is benign.
+                //
+                // Unfortunately due to kernel limitations we need to rebuild the epoll
+                // set from scratch because it may contain an old file handle that we are
+                // now unable to remove since its file descriptor is no longer valid.
+                // No such problem would have occurred if we were using the poll system
+                // call instead, but that approach carries others disadvantages.
 #if DEBUG_CALLBACKS
-                    ALOGD("%p ~ addFd - EPOLL_CTL_MOD failed due to file descriptor "
-                            "being recycled, falling back on EPOLL_CTL_ADD: %s",
-                            this, strerror(errno));
+                ALOGD("%p ~ addFd - EPOLL_CTL_MOD failed due to file descriptor "
+                        "being recycled, falling back on EPOLL_CTL_ADD: %s",
+                        this, strerror(errno));
 #endif
-                    epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, & eventItem);
-                    if (epollResult < 0) {
-                        ALOGE("Error modifying or adding epoll events for fd %d: %s",
-                                fd, strerror(errno));
-                        return -1;
-                    }
-                    scheduleEpollRebuildLocked();
-                } else {
-                    ALOGE("Error modifying epoll events for fd %d: %s", fd, strerror(errno));
+                epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, & eventItem);
+                if (epollResult < 0) {
+                    ALOGE("Error modifying or adding epoll events for fd %d: %s",
+                            fd, strerror(errno));
                     return -1;
                 }
+                scheduleEpollRebuildLocked();
+            } else {
+                ALOGE("Error modifying epoll events for fd %d: %s", fd, strerror(errno));
+                return -1;
             }
-            mRequests.replaceValueAt(requestIndex, request);
         }
-    } // release lock
+        requestIt->second = request;
+    }
     return 1;
 }
 
@@ -532,23 +566,23 @@ int Looper::removeFd(int fd, int seq) {
 
     { // acquire lock
         AutoMutex _l(mLock);
-        ssize_t requestIndex = mRequests.indexOfKey(fd);
-        if (requestIndex < 0) {
+        auto requestIt = mRequests.find(fd);
+        if (requestIt == mRequests.end()) {
             return 0;
         }
 
         // Check the sequence number if one was given.
-        if (seq != -1 && mRequests.valueAt(requestIndex).seq != seq) {
+        if (seq != -1 && requestIt->second.seq != seq) {
 #if DEBUG_CALLBACKS
             ALOGD("%p ~ removeFd - sequence number mismatch, oldSeq=%d",
-                    this, mRequests.valueAt(requestIndex).seq);
+                    this, requestIt->second.seq);
 #endif
             return 0;
         }
 
         // Always remove the FD from the request map even if an error occurs while
         // updating the epoll set so that we avoid accidentally leaking callbacks.
-        mRequests.removeItemsAt(requestIndex);
+        mRequests.erase(requestIt);
 
         int epollResult = epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL);
         if (epollResult < 0) {
@@ -601,17 +635,15 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    bool atHead;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        uint64_t seq = mNextMessageSeq++;
+        mMessageEnvelopes.push_back(MessageEnvelope(uptime, seq, handler, message));
+        std::push_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                std::greater<MessageEnvelope>());
+        atHead = mMessageEnvelopes.front().seq == seq;
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
@@ -623,11 +655,23 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
     } // release lock
 
     // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
+    if (atHead) {
         wake();
     }
 }
 
+template <typename Predicate>
+void Looper::removeMessagesLocked(Predicate shouldRemove) {
+    // Compact the survivors in one pass, then restore the heap in linear time,
+    // rather than shifting the array once per removed message.
+    auto end = std::remove_if(mMessageEnvelopes.begin(), mMessageEnvelopes.end(), shouldRemove);
+    if (end != mMessageEnvelopes.end()) {
+        mMessageEnvelopes.erase(end, mMessageEnvelopes.end());
+        std::make_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                std::greater<MessageEnvelope>());
+    }
+}
+
 void Looper::removeMessages(const sp<MessageHandler>& handler) {
 #if DEBUG_CALLBACKS
     ALOGD("%p ~ removeMessages - handler=%p", this, handler.get());
@@ -636,12 +680,9 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        removeMessagesLocked([&handler](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler;
+        });
     } // release lock
 }
 
@@ -653,13 +694,9 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        removeMessagesLocked([&handler, what](const MessageEnvelope& messageEnvelope) {
+            return messageEnvelope.handler == handler && messageEnvelope.message.what == what;
+        });
     } // release lock
 }
 
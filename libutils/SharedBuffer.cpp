@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
+
 #include <log/log.h>
 #include <utils/Atomic.h>
 
@@ -28,6 +30,56 @@
 
 namespace android {
 
+// Buffers handed out by allocCached(). Contents hash to a set of
+// kCacheWays slots. A slot is filled once, by the first contents that land
+// on it, and then holds a reference on that buffer for good, so lookups
+// never race with a buffer being freed and cost a few loads and compares.
+// Once a set is full, other contents that hash to it are allocated as
+// before. At most kCacheSets * kCacheWays small buffers are kept.
+static const size_t kCacheSets = 64;
+static const size_t kCacheWays = 4;
+static std::atomic<SharedBuffer*> gCache[kCacheSets][kCacheWays];
+
+#ifdef __clang__
+__attribute__((no_sanitize("integer")))
+#endif
+static size_t cacheSet(const void* data, size_t size)
+{
+    // Mixes in eight bytes at a time; the last, partial word is read so that
+    // it overlaps the previous one rather than byte by byte.
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + size;
+    uint64_t hash = size;
+    uint64_t word;
+    if (size >= sizeof(word)) {
+        for (; p + sizeof(word) < end; p += sizeof(word)) {
+            memcpy(&word, p, sizeof(word));
+            hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        }
+        memcpy(&word, end - sizeof(word), sizeof(word));
+    } else if (size >= sizeof(uint32_t)) {
+        uint32_t first, last;
+        memcpy(&first, p, sizeof(first));
+        memcpy(&last, end - sizeof(last), sizeof(last));
+        word = first | (uint64_t(last) << 32);
+    } else {
+        word = 0;
+        for (; p < end; p++) {
+            word = (word << 8) | *p;
+        }
+    }
+    hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+    return (hash >> 32) % kCacheSets;
+}
+
+static bool isZero(const uint8_t* bytes, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (bytes[i] != 0) return false;
+    }
+    return true;
+}
+
 SharedBuffer* SharedBuffer::alloc(size_t size)
 {
     // Don't overflow if the combined size of the buffer / header is larger than
@@ -43,6 +95,41 @@ SharedBuffer* SharedBuffer::alloc(size_t size)
     return sb;
 }
 
+SharedBuffer* SharedBuffer::allocCached(const void* data, size_t size, size_t padding)
+{
+    const size_t total = size + padding;
+    std::atomic<SharedBuffer*>* set = NULL;
+    size_t way = kCacheWays;
+    if (total <= kMaxCachedSize) {
+        set = gCache[cacheSet(data, size)];
+        for (way = 0; way < kCacheWays; way++) {
+            SharedBuffer* cached = set[way].load(std::memory_order_acquire);
+            if (!cached) {
+                break;
+            }
+            if (cached->mSize == total && memcmp(cached->data(), data, size) == 0 &&
+                    isZero(static_cast<const uint8_t*>(cached->data()) + size, padding)) {
+                cached->acquire();
+                return cached;
+            }
+        }
+    }
+
+    SharedBuffer* sb = alloc(total);
+    if (sb) {
+        memcpy(sb->data(), data, size);
+        memset(static_cast<uint8_t*>(sb->data()) + size, 0, padding);
+        if (way < kCacheWays) {
+            SharedBuffer* empty = NULL;
+            sb->acquire();
+            if (!set[way].compare_exchange_strong(empty, sb, std::memory_order_release)) {
+                // Someone else filled the slot first; try again next time.
+                sb->release();
+            }
+        }
+    }
+    return sb;
+}
 
 ssize_t SharedBuffer::dealloc(const SharedBuffer* released)
 {
@@ -33,10 +33,23 @@ public:
         eKeepStorage = 0x00000001
     };
 
+    /* largest total size allocCached() looks up in its cache */
+    enum {
+        kMaxCachedSize = 32
+    };
+
     /*! allocate a buffer of size 'size' and acquire() it.
      *  call release() to free it.
      */
     static          SharedBuffer*           alloc(size_t size);
+
+    /*! return an acquire()d buffer holding a copy of the 'size' bytes at
+     * 'data' followed by 'padding' zero bytes. Small contents come from a
+     * cache and may be shared with other callers, so the buffer must only
+     * be modified through edit(), editResize() or reset(), never in place.
+     */
+    static          SharedBuffer*           allocCached(const void* data, size_t size,
+                                                        size_t padding = 0);
     
     /*! free the memory associated with the SharedBuffer.
      * Fails if there are any users associated with this SharedBuffer.
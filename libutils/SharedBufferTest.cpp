@@ -20,6 +20,8 @@
 
 #include <memory>
 #include <stdint.h>
+#include <thread>
+#include <vector>
 
 #include "SharedBuffer.h"
 
@@ -56,3 +58,50 @@ TEST(SharedBufferTest, TestEditResize) {
   ASSERT_EQ(0U, buf->size());
   buf->release();
 }
+
+TEST(SharedBufferTest, TestAllocCached) {
+  const char small[] = "persist.sys.locale";
+  android::SharedBuffer* a = android::SharedBuffer::allocCached(small, sizeof(small));
+  android::SharedBuffer* b = android::SharedBuffer::allocCached(small, sizeof(small));
+  ASSERT_FALSE(NULL == a);
+  ASSERT_EQ(a, b);
+  ASSERT_EQ(sizeof(small), a->size());
+  ASSERT_EQ(0, memcmp(small, a->data(), sizeof(small)));
+
+  // Editing a shared buffer must copy it, leaving the cached one alone.
+  android::SharedBuffer* edited = b->edit();
+  ASSERT_NE(a, edited);
+  static_cast<char*>(edited->data())[0] = 'P';
+  ASSERT_EQ(0, memcmp(small, a->data(), sizeof(small)));
+  edited->release();
+  a->release();
+
+  char large[android::SharedBuffer::kMaxCachedSize + 1];
+  memset(large, 'x', sizeof(large));
+  a = android::SharedBuffer::allocCached(large, sizeof(large));
+  b = android::SharedBuffer::allocCached(large, sizeof(large));
+  ASSERT_NE(a, b);
+  ASSERT_EQ(0, memcmp(large, b->data(), sizeof(large)));
+  a->release();
+  b->release();
+}
+
+TEST(SharedBufferTest, TestAllocCachedConcurrently) {
+  const char text[] = "sys.usb.config";
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&text]() {
+      for (int i = 0; i < 10000; i++) {
+        android::SharedBuffer* buf =
+            android::SharedBuffer::allocCached(text, sizeof(text) - 1, 1);
+        ASSERT_FALSE(NULL == buf);
+        ASSERT_EQ(sizeof(text), buf->size());
+        ASSERT_STREQ(text, static_cast<const char*>(buf->data()));
+        buf->release();
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+}
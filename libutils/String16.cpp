@@ -67,6 +67,16 @@ static char16_t* allocFromUTF8(const char* u8str, size_t u8len)
         return getEmptyString();
     }
 
+    if (size_t(u16len) < SharedBuffer::kMaxCachedSize/sizeof(char16_t)) {
+        // Short enough to be looked up in the SharedBuffer cache, which
+        // needs the converted contents.
+        char16_t tmp[SharedBuffer::kMaxCachedSize/sizeof(char16_t)];
+        utf8_to_utf16(u8cur, u8len, tmp);
+        SharedBuffer* buf = SharedBuffer::allocCached(tmp, sizeof(char16_t)*u16len,
+                sizeof(char16_t));
+        return buf ? (char16_t*)buf->data() : getEmptyString();
+    }
+
     SharedBuffer* buf = SharedBuffer::alloc(sizeof(char16_t)*(u16len+1));
     if (buf) {
         u8cur = (const uint8_t*) u8str;
@@ -84,6 +94,29 @@ static char16_t* allocFromUTF8(const char* u8str, size_t u8len)
     return getEmptyString();
 }
 
+static char16_t* allocFromUTF16(const char16_t* u16str, size_t u16len)
+{
+    // Short strings are shared with any other string that has the same
+    // contents, instead of each getting a buffer of its own.
+    SharedBuffer* buf = SharedBuffer::allocCached(u16str, u16len*sizeof(char16_t),
+            sizeof(char16_t));
+    ALOG_ASSERT(buf, "Unable to allocate shared buffer");
+    return buf ? (char16_t*)buf->data() : getEmptyString();
+}
+
+// If [chrs, chrs+len) lies inside str, returns a reference on str's buffer,
+// which the caller releases once it is done reading chrs.
+static const SharedBuffer* pinIfInside(const char16_t* str, const char16_t* chrs, size_t len)
+{
+    const SharedBuffer* buf = SharedBuffer::bufferFromData(str);
+    const char16_t* end = str + buf->size()/sizeof(char16_t);
+    if (chrs + len > str && chrs < end) {
+        buf->acquire();
+        return buf;
+    }
+    return NULL;
+}
+
 // ---------------------------------------------------------------------------
 
 String16::String16()
@@ -117,33 +150,13 @@ String16::String16(const String16& o, size_t len, size_t begin)
 }
 
 String16::String16(const char16_t* o)
+    : mString(allocFromUTF16(o, strlen16(o)))
 {
-    size_t len = strlen16(o);
-    SharedBuffer* buf = SharedBuffer::alloc((len+1)*sizeof(char16_t));
-    ALOG_ASSERT(buf, "Unable to allocate shared buffer");
-    if (buf) {
-        char16_t* str = (char16_t*)buf->data();
-        strcpy16(str, o);
-        mString = str;
-        return;
-    }
-    
-    mString = getEmptyString();
 }
 
 String16::String16(const char16_t* o, size_t len)
+    : mString(allocFromUTF16(o, len))
 {
-    SharedBuffer* buf = SharedBuffer::alloc((len+1)*sizeof(char16_t));
-    ALOG_ASSERT(buf, "Unable to allocate shared buffer");
-    if (buf) {
-        char16_t* str = (char16_t*)buf->data();
-        memcpy(str, o, len*sizeof(char16_t));
-        str[len] = 0;
-        mString = str;
-        return;
-    }
-    
-    mString = getEmptyString();
 }
 
 String16::String16(const String8& o)
@@ -192,10 +205,6 @@ status_t String16::setTo(const String16& other, size_t len, size_t begin)
         return NO_ERROR;
     }
 
-    if (&other == this) {
-        LOG_ALWAYS_FATAL("Not implemented");
-    }
-
     return setTo(other.string()+begin, len);
 }
 
@@ -206,6 +215,7 @@ status_t String16::setTo(const char16_t* other)
 
 status_t String16::setTo(const char16_t* other, size_t len)
 {
+    const SharedBuffer* source = pinIfInside(mString, other, len);
     SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
         ->editResize((len+1)*sizeof(char16_t));
     if (buf) {
@@ -213,9 +223,11 @@ status_t String16::setTo(const char16_t* other, size_t len)
         memmove(str, other, len*sizeof(char16_t));
         str[len] = 0;
         mString = str;
-        return NO_ERROR;
     }
-    return NO_MEMORY;
+    if (source) {
+        source->release();
+    }
+    return buf ? NO_ERROR : NO_MEMORY;
 }
 
 status_t String16::append(const String16& other)
@@ -229,15 +241,18 @@ status_t String16::append(const String16& other)
         return NO_ERROR;
     }
     
+    const SharedBuffer* source = pinIfInside(mString, other.string(), otherLen);
     SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
         ->editResize((myLen+otherLen+1)*sizeof(char16_t));
     if (buf) {
         char16_t* str = (char16_t*)buf->data();
         memcpy(str+myLen, other, (otherLen+1)*sizeof(char16_t));
         mString = str;
-        return NO_ERROR;
     }
-    return NO_MEMORY;
+    if (source) {
+        source->release();
+    }
+    return buf ? NO_ERROR : NO_MEMORY;
 }
 
 status_t String16::append(const char16_t* chrs, size_t otherLen)
@@ -250,6 +265,7 @@ status_t String16::append(const char16_t* chrs, size_t otherLen)
         return NO_ERROR;
     }
     
+    const SharedBuffer* source = pinIfInside(mString, chrs, otherLen);
     SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
         ->editResize((myLen+otherLen+1)*sizeof(char16_t));
     if (buf) {
@@ -257,9 +273,11 @@ status_t String16::append(const char16_t* chrs, size_t otherLen)
         memcpy(str+myLen, chrs, otherLen*sizeof(char16_t));
         str[myLen+otherLen] = 0;
         mString = str;
-        return NO_ERROR;
     }
-    return NO_MEMORY;
+    if (source) {
+        source->release();
+    }
+    return buf ? NO_ERROR : NO_MEMORY;
 }
 
 status_t String16::insert(size_t pos, const char16_t* chrs)
@@ -285,6 +303,7 @@ status_t String16::insert(size_t pos, const char16_t* chrs, size_t len)
            len, myLen, String8(chrs, len).string());
     #endif
 
+    const SharedBuffer* source = pinIfInside(mString, chrs, len);
     SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
         ->editResize((myLen+len+1)*sizeof(char16_t));
     if (buf) {
@@ -298,9 +317,11 @@ status_t String16::insert(size_t pos, const char16_t* chrs, size_t len)
         #if 0
         printf("Result (%d chrs): %s\n", size(), String8(*this).string());
         #endif
-        return NO_ERROR;
     }
-    return NO_MEMORY;
+    if (source) {
+        source->release();
+    }
+    return buf ? NO_ERROR : NO_MEMORY;
 }
 
 ssize_t String16::findFirst(char16_t c) const
@@ -86,13 +86,12 @@ static char* allocFromUTF8(const char* in, size_t len)
         if (len == SIZE_MAX) {
             return NULL;
         }
-        SharedBuffer* buf = SharedBuffer::alloc(len+1);
+        // Short strings are shared with any other string that has the same
+        // contents, instead of each getting a buffer of its own.
+        SharedBuffer* buf = SharedBuffer::allocCached(in, len, 1);
         ALOG_ASSERT(buf, "Unable to allocate shared buffer");
         if (buf) {
-            char* str = (char*)buf->data();
-            memcpy(str, in, len);
-            str[len] = 0;
-            return str;
+            return (char*)buf->data();
         }
         return NULL;
     }
@@ -362,7 +361,15 @@ status_t String8::appendFormatV(const char* fmt, va_list args)
 status_t String8::real_append(const char* other, size_t otherLen)
 {
     const size_t myLen = bytes();
-    
+
+    // If other is part of this string, keep the old buffer alive until it
+    // has been copied.
+    const SharedBuffer* source = NULL;
+    if (other >= mString && other <= mString + myLen) {
+        source = SharedBuffer::bufferFromData(mString);
+        source->acquire();
+    }
+
     SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
         ->editResize(myLen+otherLen+1);
     if (buf) {
@@ -371,9 +378,11 @@ status_t String8::real_append(const char* other, size_t otherLen)
         str += myLen;
         memcpy(str, other, otherLen);
         str[otherLen] = '\0';
-        return NO_ERROR;
     }
-    return NO_MEMORY;
+    if (source) {
+        source->release();
+    }
+    return buf ? NO_ERROR : NO_MEMORY;
 }
 
 char* String8::lockBuffer(size_t size)
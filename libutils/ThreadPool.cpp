@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ThreadPool"
+
+#include <utils/ThreadPool.h>
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <system/thread_defs.h>
+#include <utils/AndroidThreads.h>
+
+namespace android {
+
+// How long a pool thread waiting on a task sleeps before looking for other
+// work again. Completion of the task itself wakes it at once.
+static const nsecs_t kHelpInterval = ms2ns(1);
+
+static const int kPriorityNice[ThreadPool::PRIORITY_COUNT] = {
+    ANDROID_PRIORITY_FOREGROUND,
+    ANDROID_PRIORITY_NORMAL,
+    ANDROID_PRIORITY_BACKGROUND,
+};
+
+static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gTLSKey = 0;
+
+static void initTLSKey() {
+    int result = pthread_key_create(&gTLSKey, NULL);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not allocate TLS key.");
+}
+
+// Best effort: raising the priority again needs privileges the process may
+// not have.
+static void setCurrentThreadNice(int nice) {
+#if defined(__ANDROID__)
+    androidSetThreadPriority(gettid(), nice);
+#else
+    setpriority(PRIO_PROCESS, 0, nice);
+#endif
+}
+
+// --- Task ---
+
+Task::Task() : mState(STATE_IDLE), mPriority(ThreadPool::PRIORITY_NORMAL) {
+}
+
+Task::~Task() {
+}
+
+void Task::wait() {
+    ThreadPool::Worker* worker = ThreadPool::currentWorker();
+    if (worker != NULL) {
+        while (!isDone()) {
+            if (!worker->pool->runOneTask(worker)) {
+                AutoMutex _l(mLock);
+                if (!isDone()) {
+                    mDoneCondition.waitRelative(mLock, kHelpInterval);
+                }
+            }
+        }
+        return;
+    }
+
+    AutoMutex _l(mLock);
+    while (!isDone()) {
+        mDoneCondition.wait(mLock);
+    }
+}
+
+status_t Task::waitRelative(nsecs_t timeout) {
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + timeout;
+    ThreadPool::Worker* worker = ThreadPool::currentWorker();
+    while (!isDone()) {
+        nsecs_t remaining = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+        if (remaining <= 0) {
+            return TIMED_OUT;
+        }
+        if (worker != NULL) {
+            if (worker->pool->runOneTask(worker)) {
+                continue;
+            }
+            remaining = remaining < kHelpInterval ? remaining : kHelpInterval;
+        }
+        AutoMutex _l(mLock);
+        if (!isDone()) {
+            mDoneCondition.waitRelative(mLock, remaining);
+        }
+    }
+    return OK;
+}
+
+bool Task::isDone() const {
+    int state = mState.load(std::memory_order_acquire);
+    return state == STATE_DONE || state == STATE_CANCELLED;
+}
+
+bool Task::cancel() {
+    int state = mState.load(std::memory_order_relaxed);
+    while (state == STATE_IDLE || state == STATE_QUEUED) {
+        if (mState.compare_exchange_weak(state, STATE_CANCELLED)) {
+            // A queued task stays in its queue, and is dropped when a thread
+            // dequeues it.
+            finish(STATE_CANCELLED);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Task::isCancelled() const {
+    return mState.load(std::memory_order_acquire) == STATE_CANCELLED;
+}
+
+void Task::setCompletionMessage(const sp<Looper>& looper, const sp<MessageHandler>& handler,
+        const Message& message) {
+    mLooper = looper;
+    mHandler = handler;
+    mMessage = message;
+}
+
+void Task::execute() {
+    int state = STATE_QUEUED;
+    if (!mState.compare_exchange_strong(state, STATE_RUNNING)) {
+        return;  // cancelled
+    }
+    run();
+    finish(STATE_DONE);
+}
+
+void Task::finish(int state) {
+    // Take the completion target first: once waiters see the task done they
+    // may drop their references to it.
+    sp<Looper> looper = mLooper;
+    sp<MessageHandler> handler = mHandler;
+    Message message = mMessage;
+    mLooper.clear();
+    mHandler.clear();
+    {
+        AutoMutex _l(mLock);
+        mState.store(state, std::memory_order_release);
+        mDoneCondition.broadcast();
+    }
+    if (looper != NULL) {
+        looper->sendMessage(handler, message);
+    }
+}
+
+// --- ThreadPool ---
+
+static size_t onlineCpuCount() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 1 ? count : 1;
+}
+
+ThreadPool::ThreadPool(size_t threadCount, const char* name) :
+        mThreadCount(threadCount ? threadCount : onlineCpuCount()),
+        mWorkers(new Worker[mThreadCount]), mNextWorker(0), mIdleCount(0),
+        mStopping(false), mSubmitters(0), mJoined(false) {
+    for (size_t i = 0; i < PRIORITY_COUNT; i++) {
+        mPending[i].store(0);
+    }
+
+    int result = pthread_once(&gTLSOnce, initTLSKey);
+    LOG_ALWAYS_FATAL_IF(result != 0, "pthread_once failed");
+
+    for (size_t i = 0; i < mThreadCount; i++) {
+        Worker& worker = mWorkers[i];
+        worker.pool = this;
+        worker.index = i;
+        worker.nice = ANDROID_PRIORITY_NORMAL;
+        worker.name = String8::format("%s%zu", name, i);
+        result = pthread_create(&worker.thread, NULL, threadMain, &worker);
+        LOG_ALWAYS_FATAL_IF(result != 0, "Could not create pool thread: %s", strerror(result));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    status_t result = shutdown();
+    LOG_ALWAYS_FATAL_IF(result != OK, "ThreadPool destroyed by one of its own threads");
+}
+
+ThreadPool* ThreadPool::getForThread() {
+    Worker* worker = currentWorker();
+    return worker != NULL ? worker->pool : NULL;
+}
+
+ThreadPool::Worker* ThreadPool::currentWorker() {
+    int result = pthread_once(&gTLSOnce, initTLSKey);
+    LOG_ALWAYS_FATAL_IF(result != 0, "pthread_once failed");
+
+    return static_cast<Worker*>(pthread_getspecific(gTLSKey));
+}
+
+void* ThreadPool::threadMain(void* arg) {
+    Worker* worker = static_cast<Worker*>(arg);
+    pthread_setspecific(gTLSKey, worker);
+    androidSetThreadName(worker->name.string());
+    worker->nice = getpriority(PRIO_PROCESS, 0);
+    worker->pool->loop(worker);
+    return NULL;
+}
+
+status_t ThreadPool::submit(const sp<Task>& task, Priority priority) {
+    if (task == NULL || priority < 0 || priority >= PRIORITY_COUNT) {
+        return BAD_VALUE;
+    }
+
+    Worker* self = currentWorker();
+    bool inPool = self != NULL && self->pool == this;
+    if (!inPool) {
+        mSubmitters.fetch_add(1);
+        if (mStopping.load()) {
+            mSubmitters.fetch_sub(1);
+            return INVALID_OPERATION;
+        }
+    }
+
+    status_t result = INVALID_OPERATION;
+    int state = Task::STATE_IDLE;
+    if (task->mState.compare_exchange_strong(state, Task::STATE_QUEUED)) {
+        task->mPriority = priority;
+        Worker* target = inPool ? self
+                : &mWorkers[mNextWorker.fetch_add(1, std::memory_order_relaxed) % mThreadCount];
+        // Count the task before it becomes visible, so the count never
+        // drops below zero when another thread takes it right away.
+        mPending[priority].fetch_add(1);
+        {
+            AutoMutex _l(target->lock);
+            target->queues[priority].push_back(task);
+        }
+        if (mIdleCount.load() != 0) {
+            AutoMutex _l(mIdleLock);
+            mIdleCondition.signal();
+        }
+        result = OK;
+    }
+
+    if (!inPool) {
+        mSubmitters.fetch_sub(1);
+    }
+    return result;
+}
+
+status_t ThreadPool::shutdown() {
+    Worker* self = currentWorker();
+    if (self != NULL && self->pool == this) {
+        return WOULD_BLOCK;
+    }
+
+    AutoMutex _l(mShutdownLock);
+    if (mJoined) {
+        return OK;
+    }
+    mStopping.store(true);
+    while (mSubmitters.load() != 0) {
+        sched_yield();
+    }
+    {
+        AutoMutex _l(mIdleLock);
+        mIdleCondition.broadcast();
+    }
+    for (size_t i = 0; i < mThreadCount; i++) {
+        pthread_join(mWorkers[i].thread, NULL);
+    }
+    mJoined = true;
+    return OK;
+}
+
+void ThreadPool::loop(Worker* worker) {
+    for (;;) {
+        if (runOneTask(worker)) {
+            continue;
+        }
+
+        AutoMutex _l(mIdleLock);
+        // Pairs with submit(): either it sees us idle and signals, or we see
+        // its task counted.
+        mIdleCount.fetch_add(1);
+        while (pendingCount() == 0 && !mStopping.load()) {
+            mIdleCondition.wait(mIdleLock);
+        }
+        mIdleCount.fetch_sub(1);
+        if (pendingCount() == 0 && mStopping.load()) {
+            return;
+        }
+    }
+}
+
+sp<Task> ThreadPool::takeTask(Worker* worker) {
+    for (size_t p = 0; p < PRIORITY_COUNT; p++) {
+        if (mPending[p].load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+
+        sp<Task> task;
+        {
+            AutoMutex _l(worker->lock);
+            std::deque<sp<Task>>& queue = worker->queues[p];
+            if (!queue.empty()) {
+                task = queue.back();
+                queue.pop_back();
+            }
+        }
+        for (size_t i = 1; task == NULL && i < mThreadCount; i++) {
+            Worker& victim = mWorkers[(worker->index + i) % mThreadCount];
+            AutoMutex _l(victim.lock);
+            std::deque<sp<Task>>& queue = victim.queues[p];
+            if (!queue.empty()) {
+                task = queue.front();
+                queue.pop_front();
+            }
+        }
+        if (task != NULL) {
+            mPending[p].fetch_sub(1);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+bool ThreadPool::runOneTask(Worker* worker) {
+    sp<Task> task = takeTask(worker);
+    if (task == NULL) {
+        return false;
+    }
+    int nice = kPriorityNice[task->mPriority];
+    if (worker->nice != nice && !task->isDone()) {
+        setCurrentThreadNice(nice);
+        worker->nice = nice;
+    }
+    task->execute();
+    return true;
+}
+
+size_t ThreadPool::pendingCount() const {
+    size_t count = 0;
+    for (size_t p = 0; p < PRIORITY_COUNT; p++) {
+        count += mPending[p].load();
+    }
+    return count;
+}
+
+} // namespace android
@@ -17,6 +17,15 @@
 #include <utils/Unicode.h>
 
 #include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define UNICODE_SIMD 1
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+# include <arm_neon.h>
+# define UNICODE_SIMD 1
+#endif
 
 #if defined(_WIN32)
 # undef  nhtol
@@ -62,6 +71,189 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+#if defined(UNICODE_SIMD)
+// --------------------------------------------------------------------------
+// Vector helpers
+// --------------------------------------------------------------------------
+
+// The converters below hand whole 16-byte blocks to these helpers when the
+// block is plain ASCII (or, for UTF-16, free of surrogates) and run the
+// scalar code over any block that is not, so validation and error handling
+// are exactly those of the scalar code.
+
+static const size_t kSimdBytes = 16;
+static const size_t kSimdUnits = 8;
+
+#if defined(__SSE2__)
+
+static inline bool simd_is_ascii_u8(const uint8_t* p)
+{
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) p)) == 0;
+}
+
+// Widens kSimdBytes ASCII bytes to as many UTF-16 units.
+static inline void simd_widen_u8(const uint8_t* p, char16_t* out)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i*) p);
+    const __m128i zero = _mm_setzero_si128();
+    _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi8(v, zero));
+    _mm_storeu_si128((__m128i*) (out + 8), _mm_unpackhi_epi8(v, zero));
+}
+
+// Returns a mask with one bit set for each unit whose bits under |mask|
+// equal |value|.
+static inline unsigned simd_match_u16(__m128i v, uint16_t mask, uint16_t value)
+{
+    const __m128i m = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(mask)),
+            _mm_set1_epi16(value));
+    // movemask yields two bits per 16-bit lane; keep one of them.
+    return _mm_movemask_epi8(m) & 0x5555;
+}
+
+// Counts the lanes set in a simd_match_u16() result.
+static inline size_t simd_count_u16(unsigned m)
+{
+    m = (m & 0x3333) + ((m >> 2) & 0x3333);
+    m = (m & 0x0f0f) + ((m >> 4) & 0x0f0f);
+    return (m & 0xff) + (m >> 8);
+}
+
+static inline bool simd_is_ascii_u16(const char16_t* p)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i*) p);
+    return simd_match_u16(v, 0xff80, 0) == 0x5555;
+}
+
+static inline bool simd_has_surrogate_u16(const char16_t* p)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i*) p);
+    return simd_match_u16(v, 0xf800, 0xd800) != 0;
+}
+
+// Narrows kSimdUnits ASCII units to as many bytes.
+static inline void simd_narrow_u16(const char16_t* p, uint8_t* out)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i*) p);
+    _mm_storel_epi64((__m128i*) out, _mm_packus_epi16(v, v));
+}
+
+// Returns the UTF-8 length of kSimdUnits units, or -1 if any of them is a
+// surrogate.
+static inline ssize_t simd_utf8_length_bmp(const char16_t* p)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i*) p);
+    const unsigned asciiLanes = simd_match_u16(v, 0xff80, 0);
+    if (asciiLanes == 0x5555) {
+        return kSimdUnits;
+    }
+    if (simd_match_u16(v, 0xf800, 0xd800) != 0) {
+        return -1;
+    }
+    const size_t ascii = simd_count_u16(asciiLanes);
+    const size_t twoByte = simd_count_u16(simd_match_u16(v, 0xf800, 0));
+    // Every unit takes one byte, plus one unless ASCII, plus one more
+    // unless it fits in two.
+    return 3 * kSimdUnits - ascii - twoByte;
+}
+
+// Whether the aligned block at p holds neither NUL nor non-ASCII bytes.
+// May read past the terminator; see utf8_ascii_blocks_length.
+__attribute__((no_sanitize_address))
+static inline bool simd_is_ascii_nonzero_aligned(const char* p)
+{
+    const __m128i v = _mm_load_si128((const __m128i*) p);
+    const __m128i nul = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+    return _mm_movemask_epi8(_mm_or_si128(v, nul)) == 0;
+}
+
+#else  // NEON
+
+static inline bool simd_any_u8(uint8x16_t v)
+{
+    const uint64x2_t w = vreinterpretq_u64_u8(v);
+    return (vgetq_lane_u64(w, 0) | vgetq_lane_u64(w, 1)) != 0;
+}
+
+static inline bool simd_any_u16(uint16x8_t v)
+{
+    return simd_any_u8(vreinterpretq_u8_u16(v));
+}
+
+static inline bool simd_is_ascii_u8(const uint8_t* p)
+{
+    return !simd_any_u8(vandq_u8(vld1q_u8(p), vdupq_n_u8(0x80)));
+}
+
+static inline void simd_widen_u8(const uint8_t* p, char16_t* out)
+{
+    const uint8x16_t v = vld1q_u8(p);
+    vst1q_u16((uint16_t*) out, vmovl_u8(vget_low_u8(v)));
+    vst1q_u16((uint16_t*) (out + 8), vmovl_u8(vget_high_u8(v)));
+}
+
+static inline bool simd_is_ascii_u16(const char16_t* p)
+{
+    const uint16x8_t v = vld1q_u16((const uint16_t*) p);
+    return !simd_any_u16(vandq_u16(v, vdupq_n_u16(0xff80)));
+}
+
+static inline void simd_narrow_u16(const char16_t* p, uint8_t* out)
+{
+    vst1_u8(out, vmovn_u16(vld1q_u16((const uint16_t*) p)));
+}
+
+static inline uint16x8_t simd_surrogates_u16(uint16x8_t v)
+{
+    return vceqq_u16(vandq_u16(v, vdupq_n_u16(0xf800)), vdupq_n_u16(0xd800));
+}
+
+static inline bool simd_has_surrogate_u16(const char16_t* p)
+{
+    return simd_any_u16(simd_surrogates_u16(vld1q_u16((const uint16_t*) p)));
+}
+
+static inline ssize_t simd_utf8_length_bmp(const char16_t* p)
+{
+    const uint16x8_t v = vld1q_u16((const uint16_t*) p);
+    if (simd_any_u16(simd_surrogates_u16(v))) {
+        return -1;
+    }
+    // Each unit takes 1 byte, plus 1 from 0x80 up and 1 more from 0x800 up.
+    uint16x8_t bytes = vdupq_n_u16(1);
+    bytes = vsubq_u16(bytes, vcgeq_u16(v, vdupq_n_u16(0x80)));
+    bytes = vsubq_u16(bytes, vcgeq_u16(v, vdupq_n_u16(0x800)));
+    const uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(bytes));
+    return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+}
+
+__attribute__((no_sanitize_address))
+static inline bool simd_is_ascii_nonzero_aligned(const char* p)
+{
+    const uint8x16_t v = vld1q_u8((const uint8_t*) p);
+    const uint8x16_t bad = vorrq_u8(vandq_u8(v, vdupq_n_u8(0x80)),
+            vceqq_u8(v, vdupq_n_u8(0)));
+    return !simd_any_u8(bad);
+}
+
+#endif
+
+// Returns the length of the run of whole ASCII blocks, free of NULs, at
+// the aligned address s.  Aligned loads never cross into an unmapped page,
+// but they may read past the terminator, which AddressSanitizer would
+// otherwise report.  simd_is_ascii_nonzero_aligned carries the same
+// attribute, since it is not necessarily inlined.
+__attribute__((no_sanitize_address))
+static size_t utf8_ascii_blocks_length(const char* s)
+{
+    const char* p = s;
+    while (simd_is_ascii_nonzero_aligned(p)) {
+        p += kSimdBytes;
+    }
+    return p - s;
+}
+
+#endif // UNICODE_SIMD
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -334,19 +526,50 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst)
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
-        char32_t utf32;
-        // surrogate pairs
-        if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
-                && (*(cur_utf16 + 1) & 0xFC00) == 0xDC00) {
-            utf32 = (*cur_utf16++ - 0xD800) << 10;
-            utf32 |= *cur_utf16++ - 0xDC00;
-            utf32 += 0x10000;
-        } else {
-            utf32 = (char32_t) *cur_utf16++;
+        const char16_t* stop = end_utf16;
+#if defined(UNICODE_SIMD)
+        if ((size_t)(end_utf16 - cur_utf16) >= kSimdUnits) {
+            if (!simd_has_surrogate_u16(cur_utf16)) {
+                if (simd_is_ascii_u16(cur_utf16)) {
+                    simd_narrow_u16(cur_utf16, (uint8_t*)cur);
+                    cur_utf16 += kSimdUnits;
+                    cur += kSimdUnits;
+                    continue;
+                }
+                // Each unit is a code point by itself.
+                for (size_t i = 0; i < kSimdUnits; i++) {
+                    const char16_t unit = *cur_utf16++;
+                    if (unit < 0x80) {
+                        *cur++ = (char) unit;
+                    } else if (unit < 0x800) {
+                        *cur++ = (char) (0xC0 | (unit >> 6));
+                        *cur++ = (char) (0x80 | (unit & 0x3F));
+                    } else {
+                        *cur++ = (char) (0xE0 | (unit >> 12));
+                        *cur++ = (char) (0x80 | ((unit >> 6) & 0x3F));
+                        *cur++ = (char) (0x80 | (unit & 0x3F));
+                    }
+                }
+                continue;
+            }
+            stop = cur_utf16 + kSimdUnits;
+        }
+#endif
+        while (cur_utf16 < stop) {
+            char32_t utf32;
+            // surrogate pairs
+            if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
+                    && (*(cur_utf16 + 1) & 0xFC00) == 0xDC00) {
+                utf32 = (*cur_utf16++ - 0xD800) << 10;
+                utf32 |= *cur_utf16++ - 0xDC00;
+                utf32 += 0x10000;
+            } else {
+                utf32 = (char32_t) *cur_utf16++;
+            }
+            const size_t len = utf32_codepoint_utf8_length(utf32);
+            utf32_codepoint_to_utf8((uint8_t*)cur, utf32, len);
+            cur += len;
         }
-        const size_t len = utf32_codepoint_utf8_length(utf32);
-        utf32_codepoint_to_utf8((uint8_t*)cur, utf32, len);
-        cur += len;
     }
     *cur = '\0';
 }
@@ -360,9 +583,16 @@ ssize_t utf8_length(const char *src)
     const char *cur = src;
     size_t ret = 0;
     while (*cur != '\0') {
-        const char first_char = *cur++;
+        const uint8_t first_char = *cur++;
         if ((first_char & 0x80) == 0) { // ASCII
             ret += 1;
+#if defined(UNICODE_SIMD)
+            if (((uintptr_t) cur & (kSimdBytes - 1)) == 0) {
+                const size_t ascii = utf8_ascii_blocks_length(cur);
+                ret += ascii;
+                cur += ascii;
+            }
+#endif
             continue;
         }
         // (UTF-8's character must not be like 10xxxxxx,
@@ -407,13 +637,27 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     size_t ret = 0;
     const char16_t* const end = src + src_len;
     while (src < end) {
-        if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
-                && (*++src & 0xFC00) == 0xDC00) {
-            // surrogate pairs are always 4 bytes.
-            ret += 4;
-            src++;
-        } else {
-            ret += utf32_codepoint_utf8_length((char32_t) *src++);
+        const char16_t* stop = end;
+#if defined(UNICODE_SIMD)
+        if ((size_t)(end - src) >= kSimdUnits) {
+            const ssize_t len = simd_utf8_length_bmp(src);
+            if (len >= 0) {
+                ret += len;
+                src += kSimdUnits;
+                continue;
+            }
+            stop = src + kSimdUnits;
+        }
+#endif
+        while (src < stop) {
+            if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
+                    && (*++src & 0xFC00) == 0xDC00) {
+                // surrogate pairs are always 4 bytes.
+                ret += 4;
+                src++;
+            } else {
+                ret += utf32_codepoint_utf8_length((char32_t) *src++);
+            }
         }
     }
     return ret;
@@ -519,11 +763,24 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len)
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
-        u16measuredLen++;
-        int u8charLen = utf8_codepoint_len(*u8cur);
-        uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8charLen);
-        if (codepoint > 0xFFFF) u16measuredLen++; // this will be a surrogate pair in utf16
-        u8cur += u8charLen;
+        const uint8_t* stop = u8end;
+#if defined(UNICODE_SIMD)
+        if ((size_t)(u8end - u8cur) >= kSimdBytes) {
+            if (simd_is_ascii_u8(u8cur)) {
+                u16measuredLen += kSimdBytes;
+                u8cur += kSimdBytes;
+                continue;
+            }
+            stop = u8cur + kSimdBytes;
+        }
+#endif
+        while (u8cur < stop) {
+            u16measuredLen++;
+            int u8charLen = utf8_codepoint_len(*u8cur);
+            uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8charLen);
+            if (codepoint > 0xFFFF) u16measuredLen++; // this will be a surrogate pair in utf16
+            u8cur += u8charLen;
+        }
     }
 
     /**
@@ -544,21 +801,35 @@ char16_t* utf8_to_utf16_no_null_terminator(const uint8_t* u8str, size_t u8len, c
     char16_t* u16cur = u16str;
 
     while (u8cur < u8end) {
-        size_t u8len = utf8_codepoint_len(*u8cur);
-        uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
-
-        // Convert the UTF32 codepoint to one or more UTF16 codepoints
-        if (codepoint <= 0xFFFF) {
-            // Single UTF16 character
-            *u16cur++ = (char16_t) codepoint;
-        } else {
-            // Multiple UTF16 characters with surrogates
-            codepoint = codepoint - 0x10000;
-            *u16cur++ = (char16_t) ((codepoint >> 10) + 0xD800);
-            *u16cur++ = (char16_t) ((codepoint & 0x3FF) + 0xDC00);
+        const uint8_t* stop = u8end;
+#if defined(UNICODE_SIMD)
+        if ((size_t)(u8end - u8cur) >= kSimdBytes) {
+            if (simd_is_ascii_u8(u8cur)) {
+                simd_widen_u8(u8cur, u16cur);
+                u8cur += kSimdBytes;
+                u16cur += kSimdBytes;
+                continue;
+            }
+            stop = u8cur + kSimdBytes;
         }
+#endif
+        while (u8cur < stop) {
+            size_t u8len = utf8_codepoint_len(*u8cur);
+            uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
+
+            // Convert the UTF32 codepoint to one or more UTF16 codepoints
+            if (codepoint <= 0xFFFF) {
+                // Single UTF16 character
+                *u16cur++ = (char16_t) codepoint;
+            } else {
+                // Multiple UTF16 characters with surrogates
+                codepoint = codepoint - 0x10000;
+                *u16cur++ = (char16_t) ((codepoint >> 10) + 0xD800);
+                *u16cur++ = (char16_t) ((codepoint & 0x3FF) + 0xDC00);
+            }
 
-        u8cur += u8len;
+            u8cur += u8len;
+        }
     }
     return u16cur;
 }
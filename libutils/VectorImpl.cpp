@@ -37,10 +37,42 @@ namespace android {
 
 const size_t kMinVectorCapacity = 4;
 
+// Geometric growth policy: a vector that runs out of room is given this many
+// percent of the size it needs, plus one item.  The default of 150 keeps the
+// historical (x + x/2 + 1) behavior.  Larger values trade memory for fewer
+// reallocations.  Shrinking leaves the same headroom, and only happens when
+// it gives back at least half of the storage, so alternating pushes and pops
+// around a boundary do not reallocate every time.
+#ifndef LIBUTILS_VECTOR_GROWTH_PERCENT
+#define LIBUTILS_VECTOR_GROWTH_PERCENT 150
+#endif
+
+static_assert(LIBUTILS_VECTOR_GROWTH_PERCENT > 100,
+        "LIBUTILS_VECTOR_GROWTH_PERCENT must be greater than 100");
+
 static inline size_t max(size_t a, size_t b) {
     return a>b ? a : b;
 }
 
+static size_t growCapacity(size_t size) {
+    const size_t extraPercent = LIBUTILS_VECTOR_GROWTH_PERCENT - 100;
+    // size * extraPercent / 100, without overflowing the intermediate product.
+    const size_t extra = (size / 100) * extraPercent + ((size % 100) * extraPercent) / 100;
+    size_t capacity = 0;
+    LOG_ALWAYS_FATAL_IF(!safe_add(&capacity, size, extra), "new_capacity overflow");
+    LOG_ALWAYS_FATAL_IF(!safe_add(&capacity, capacity, static_cast<size_t>(1u)),
+                        "new_capacity overflow");
+    return max(kMinVectorCapacity, capacity);
+}
+
+// Whether |storage| may be resized with realloc(): nobody else shares it, and
+// its items can be relocated with a plain memory copy.
+static bool canRealloc(uint32_t flags, const void* storage) {
+    const bool relocatable = (flags & VectorImpl::HAS_TRIVIAL_MOVE) ||
+            ((flags & VectorImpl::HAS_TRIVIAL_COPY) && (flags & VectorImpl::HAS_TRIVIAL_DTOR));
+    return relocatable && SharedBuffer::bufferFromData(storage)->onlyOwner();
+}
+
 // ----------------------------------------------------------------------------
 
 VectorImpl::VectorImpl(size_t itemSize, uint32_t flags)
@@ -343,6 +375,15 @@ ssize_t VectorImpl::setCapacity(size_t new_capacity)
 
     size_t new_allocation_size = 0;
     LOG_ALWAYS_FATAL_IF(!safe_mul(&new_allocation_size, new_capacity, mItemSize));
+    if (mStorage && canRealloc(mFlags, mStorage)) {
+        const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
+        SharedBuffer* sb = cur_sb->editResize(new_allocation_size);
+        if (!sb) {
+            return NO_MEMORY;
+        }
+        mStorage = sb->data();
+        return new_capacity;
+    }
     SharedBuffer* sb = SharedBuffer::alloc(new_allocation_size);
     if (sb) {
         void* array = sb->data();
@@ -389,30 +430,14 @@ void* VectorImpl::_grow(size_t where, size_t amount)
     LOG_ALWAYS_FATAL_IF(!safe_add(&new_size, mCount, amount), "new_size overflow");
 
     if (capacity() < new_size) {
-        // NOTE: This implementation used to resize vectors as per ((3*x + 1) / 2)
-        // (sigh..). Also note, the " + 1" was necessary to handle the special case
-        // where x == 1, where the resized_capacity will be equal to the old
-        // capacity without the +1. The old calculation wouldn't work properly
-        // if x was zero.
-        //
-        // This approximates the old calculation, using (x + (x/2) + 1) instead.
-        size_t new_capacity = 0;
-        LOG_ALWAYS_FATAL_IF(!safe_add(&new_capacity, new_size, (new_size / 2)),
-                            "new_capacity overflow");
-        LOG_ALWAYS_FATAL_IF(!safe_add(&new_capacity, new_capacity, static_cast<size_t>(1u)),
-                            "new_capacity overflow");
-        new_capacity = max(kMinVectorCapacity, new_capacity);
+        const size_t new_capacity = growCapacity(new_size);
 
         size_t new_alloc_size = 0;
         LOG_ALWAYS_FATAL_IF(!safe_mul(&new_alloc_size, new_capacity, mItemSize),
                             "new_alloc_size overflow");
 
 //        ALOGV("grow vector %p, new_capacity=%d", this, (int)new_capacity);
-        if ((mStorage) &&
-            (mCount==where) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
-        {
+        if (mStorage && canRealloc(mFlags, mStorage)) {
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_alloc_size);
             if (sb) {
@@ -420,6 +445,11 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             } else {
                 return NULL;
             }
+            if (where != mCount) {
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* to = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                _do_move_forward(to, from, mCount - where);
+            }
         } else {
             SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
             if (sb) {
@@ -466,27 +496,31 @@ void VectorImpl::_shrink(size_t where, size_t amount)
     size_t new_size;
     LOG_ALWAYS_FATAL_IF(!safe_sub(&new_size, mCount, amount));
 
-    if (new_size < (capacity() / 2)) {
-        // NOTE: (new_size * 2) is safe because capacity didn't overflow and
-        // new_size < (capacity / 2)).
-        const size_t new_capacity = max(kMinVectorCapacity, new_size * 2);
-
+    // Shrink back down to what _grow() would have picked for the new size,
+    // but only if that frees at least half of the storage.
+    const size_t new_capacity = growCapacity(new_size);
+    if (new_capacity <= (capacity() / 2)) {
         // NOTE: (new_capacity * mItemSize), (where * mItemSize) and
         // ((where + amount) * mItemSize) beyond this point are safe because
         // we are always reducing the capacity of the underlying SharedBuffer.
         // In other words, (old_capacity * mItemSize) did not overflow, and
         // where < (where + amount) < new_capacity < old_capacity.
-        if ((where == new_size) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
-        {
+        if (canRealloc(mFlags, mStorage)) {
+            // Close the gap while the storage is still large enough to
+            // hold everything, then give back the tail.
+            void* array = mStorage;
+            void* to = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
+            _do_destroy(to, amount);
+            if (where != new_size) {
+                const void* from = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
+                _do_move_backward(to, from, new_size - where);
+            }
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
             if (sb) {
                 mStorage = sb->data();
-            } else {
-                return;
             }
+            // On failure the larger buffer is still valid.
         } else {
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
@@ -26,8 +26,11 @@ LOCAL_SRC_FILES := \
     BitSet_test.cpp \
     Looper_test.cpp \
     LruCache_test.cpp \
+    RefBase_test.cpp \
     String8_test.cpp \
+    String16_test.cpp \
     StrongPointer_test.cpp \
+    ThreadPool_test.cpp \
     Unicode_test.cpp \
     Vector_test.cpp \
 
@@ -46,3 +49,29 @@ LOCAL_SRC_FILES := Vector_test.cpp
 LOCAL_STATIC_LIBRARIES := libutils liblog
 
 include $(BUILD_HOST_NATIVE_TEST)
+
+# Build the benchmarks. Run with:
+#   adb shell libutils_benchmarks
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libutils_benchmarks
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../liblog/tests
+
+LOCAL_SRC_FILES := \
+    ../../liblog/tests/benchmark_main.cpp \
+    BlobCache_benchmark.cpp \
+    Looper_benchmark.cpp \
+    LruCache_benchmark.cpp \
+    RefBase_benchmark.cpp \
+    String8_benchmark.cpp \
+    ThreadPool_benchmark.cpp \
+    Unicode_benchmark.cpp \
+    Vector_benchmark.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+    liblog \
+    libcutils \
+    libutils \
+
+include $(BUILD_NATIVE_TEST)
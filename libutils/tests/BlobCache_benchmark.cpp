@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <utils/BlobCache.h>
+
+#include "benchmark.h"
+
+using namespace android;
+
+// Draws key ranks from a Zipf distribution, so a few keys are very hot and
+// most are cold, the way shader and pipeline caches are used.
+class ZipfGenerator {
+public:
+    ZipfGenerator(size_t n, double s) : mCdf(n), mRandom(42) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / pow(double(i + 1), s);
+            mCdf[i] = sum;
+        }
+        for (double& c : mCdf) {
+            c /= sum;
+        }
+    }
+
+    size_t next() {
+        double u = std::uniform_real_distribution<double>(0, 1)(mRandom);
+        return std::lower_bound(mCdf.begin(), mCdf.end(), u) - mCdf.begin();
+    }
+
+private:
+    std::vector<double> mCdf;
+    std::mt19937 mRandom;
+};
+
+struct ZipfWorkload {
+    double skew;
+    // Percentage of the maximum size that eviction goes down to.
+    int watermark;
+};
+
+static const ZipfWorkload kS080Evict50 = { 0.8, 50 };
+static const ZipfWorkload kS080Evict90 = { 0.8, 90 };
+static const ZipfWorkload kS099Evict50 = { 0.99, 50 };
+static const ZipfWorkload kS099Evict90 = { 0.99, 90 };
+static const ZipfWorkload kS120Evict50 = { 1.2, 50 };
+static const ZipfWorkload kS120Evict90 = { 1.2, 90 };
+
+// A read-through access over 20000 keys: every miss is followed by a set of
+// the missing value.  The cache holds about a fifth of the keys.
+static void BM_blobcache_zipf(int iters, const ZipfWorkload* workload) {
+    static const size_t kKeys = 20000;
+    static const size_t kValueSize = 512;
+    static const size_t kMaxTotalSize = 2 * 1024 * 1024;
+
+    std::vector<uint8_t> value(kValueSize, 0x5a);
+    sp<BlobCache> cache = new BlobCache(64, kValueSize, kMaxTotalSize,
+            kMaxTotalSize * workload->watermark / 100);
+    // Drawn up front, so that the timing covers only the cache.
+    ZipfGenerator zipf(kKeys, workload->skew);
+    std::vector<uint64_t> keys(1 << 20);
+    for (uint64_t& key : keys) {
+        key = zipf.next();
+    }
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        uint64_t key = keys[i & (keys.size() - 1)];
+        if (cache->get(&key, sizeof(key), value.data(), kValueSize) == 0) {
+            cache->set(&key, sizeof(key), value.data(), kValueSize);
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_blobcache_zipf)
+        ->Arg("s0.80/evict50", &kS080Evict50)->Arg("s0.80/evict90", &kS080Evict90)
+        ->Arg("s0.99/evict50", &kS099Evict50)->Arg("s0.99/evict90", &kS099Evict90)
+        ->Arg("s1.20/evict50", &kS120Evict50)->Arg("s1.20/evict90", &kS120Evict90);
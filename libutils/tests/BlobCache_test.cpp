@@ -258,6 +258,75 @@ TEST_F(BlobCacheTest, ExceedingTotalLimitHalvesCacheSize) {
     ASSERT_EQ(maxEntries/2 + 1, numCached);
 }
 
+TEST_F(BlobCacheTest, EvictionKeepsRecentlyUsedEntries) {
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, "x", 1);
+    }
+    // Touch the oldest entry, then overflow the cache.
+    uint8_t k = 0;
+    ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+    k = maxEntries;
+    mBC->set(&k, 1, "x", 1);
+
+    // The three least recently used entries made way.
+    for (int i = 0; i <= maxEntries; i++) {
+        SCOPED_TRACE(i);
+        uint8_t k = i;
+        bool evicted = i >= 1 && i <= 3;
+        ASSERT_EQ(size_t(evicted ? 0 : 1), mBC->get(&k, 1, NULL, 0));
+    }
+}
+
+TEST_F(BlobCacheTest, LowWatermarkLimitsEviction) {
+    mBC = new BlobCache(MAX_KEY_SIZE, MAX_VALUE_SIZE, MAX_TOTAL_SIZE, 10);
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i <= maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, "x", 1);
+    }
+    // Only the oldest entry was evicted, to get down to 10 bytes.
+    int numCached = 0;
+    for (int i = 0; i <= maxEntries; i++) {
+        uint8_t k = i;
+        if (mBC->get(&k, 1, NULL, 0) == 1) {
+            numCached++;
+        }
+    }
+    ASSERT_EQ(maxEntries, numCached);
+    uint8_t k = 0;
+    ASSERT_EQ(size_t(0), mBC->get(&k, 1, NULL, 0));
+}
+
+TEST_F(BlobCacheTest, EvictionMakesRoomAboveLowWatermark) {
+    mBC = new BlobCache(4, 40, 100, 90);
+    // 85 bytes: below the watermark, but without room for another 20.
+    for (uint32_t k = 0; k < 5; k++) {
+        mBC->set(&k, 4, "0123456789abc", 13);
+    }
+    uint32_t k = 5;
+    mBC->set(&k, 4, "0123456789abcdef", 16);
+    ASSERT_EQ(size_t(16), mBC->get(&k, 4, NULL, 0));
+    // Only the oldest entry had to go.
+    k = 0;
+    ASSERT_EQ(size_t(0), mBC->get(&k, 4, NULL, 0));
+    k = 1;
+    ASSERT_EQ(size_t(13), mBC->get(&k, 4, NULL, 0));
+}
+
+TEST_F(BlobCacheTest, LargeEntryEvictsBelowLowWatermark) {
+    // The default watermark is half of MAX_TOTAL_SIZE, which isn't enough
+    // room for a maximum size entry.
+    uint8_t k = 0;
+    mBC->set(&k, 1, "abcde", 5);
+    char key[MAX_KEY_SIZE] = { 1 };
+    char value[MAX_VALUE_SIZE] = {};
+    mBC->set(key, sizeof(key), value, MAX_TOTAL_SIZE - sizeof(key));
+    ASSERT_EQ(size_t(MAX_TOTAL_SIZE - MAX_KEY_SIZE), mBC->get(key, sizeof(key), NULL, 0));
+    ASSERT_EQ(size_t(0), mBC->get(&k, 1, NULL, 0));
+}
+
 class BlobCacheFlattenTest : public BlobCacheTest {
 protected:
     virtual void SetUp() {
@@ -418,4 +487,23 @@ TEST_F(BlobCacheFlattenTest, UnflattenCatchesBufferTooSmall) {
     ASSERT_EQ(size_t(0), mBC2->get("abcd", 4, buf, 4));
 }
 
+TEST_F(BlobCacheFlattenTest, UnflattenRestoresRecency) {
+    const int maxEntries = MAX_TOTAL_SIZE / 2;
+    for (int i = 0; i < maxEntries; i++) {
+        uint8_t k = i;
+        mBC->set(&k, 1, &k, 1);
+    }
+    uint8_t k = 0;
+    ASSERT_EQ(size_t(1), mBC->get(&k, 1, NULL, 0));
+
+    roundTrip();
+
+    k = maxEntries;
+    mBC2->set(&k, 1, &k, 1);
+    k = 0;
+    ASSERT_EQ(size_t(1), mBC2->get(&k, 1, NULL, 0));
+    k = 1;
+    ASSERT_EQ(size_t(0), mBC2->get(&k, 1, NULL, 0));
+}
+
 } // namespace android
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/Looper.h>
+#include <utils/Timers.h>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "benchmark.h"
+
+using namespace android;
+
+class NullMessageHandler : public MessageHandler {
+public:
+    virtual void handleMessage(const Message&) { }
+};
+
+// Uptimes spread pseudo-randomly over the second starting at |base|.
+class UptimeSequence {
+public:
+    explicit UptimeSequence(nsecs_t base) : mBase(base), mRandom(1) { }
+
+    nsecs_t next() {
+        mRandom = mRandom * 1103515245 + 12345;
+        return mBase + (mRandom >> 8) % ms2ns(1000);
+    }
+
+private:
+    nsecs_t mBase;
+    uint32_t mRandom;
+};
+
+// Queues a message behind |depth| others, at a random position among them.
+static void BM_looper_sendMessageAtTime(int iters, int depth) {
+    sp<Looper> looper = new Looper(true);
+    sp<MessageHandler> resident = new NullMessageHandler();
+    sp<MessageHandler> handler = new NullMessageHandler();
+    // Far enough ahead that nothing is delivered.
+    UptimeSequence uptimes(systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(3600 * 1000));
+    for (int i = 0; i < depth; i++) {
+        looper->sendMessageAtTime(uptimes.next(), resident, Message(i));
+    }
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        looper->sendMessageAtTime(uptimes.next(), handler, Message(i));
+        // Keep the queue between |depth| and twice that.
+        if ((i + 1) % depth == 0) {
+            StopBenchmarkTiming();
+            looper->removeMessages(handler);
+            StartBenchmarkTiming();
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_looper_sendMessageAtTime)->Arg(1000)->Arg(10000)->Arg(100000);
+
+// Sends a message that is already due and delivers it, with |depth| messages
+// pending behind it.
+static void BM_looper_deliver(int iters, int depth) {
+    sp<Looper> looper = new Looper(true);
+    sp<MessageHandler> resident = new NullMessageHandler();
+    sp<MessageHandler> handler = new NullMessageHandler();
+    UptimeSequence uptimes(systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(3600 * 1000));
+    for (int i = 0; i < depth; i++) {
+        looper->sendMessageAtTime(uptimes.next(), resident, Message(i));
+    }
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        looper->sendMessage(handler, Message(i));
+        looper->pollOnce(0);
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_looper_deliver)->Arg(1000)->Arg(10000)->Arg(100000);
+
+// Removes a quarter of |depth| pending messages, spread through the queue.
+static void BM_looper_removeMessages(int iters, int depth) {
+    sp<Looper> looper = new Looper(true);
+    sp<MessageHandler> handler = new NullMessageHandler();
+    sp<MessageHandler> doomed = new NullMessageHandler();
+    UptimeSequence uptimes(systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(3600 * 1000));
+
+    for (int i = 0; i < iters; i++) {
+        looper->removeMessages(handler);
+        for (int j = 0; j < depth; j++) {
+            looper->sendMessageAtTime(uptimes.next(), j % 4 ? handler : doomed, Message(j));
+        }
+        StartBenchmarkTiming();
+        looper->removeMessages(doomed);
+        StopBenchmarkTiming();
+    }
+}
+BENCHMARK(BM_looper_removeMessages)->Arg(1000)->Arg(10000)->Arg(100000);
+
+class CountingLooperCallback : public LooperCallback {
+public:
+    CountingLooperCallback() : callbackCount(0) { }
+
+    virtual int handleEvent(int fd, int, void*) {
+        uint64_t value;
+        read(fd, &value, sizeof(value));
+        callbackCount += 1;
+        return 1;
+    }
+
+    size_t callbackCount;
+};
+
+// |count| eventfds, all reporting to one callback.
+class EventFds {
+public:
+    explicit EventFds(int count) : callback(new CountingLooperCallback()) {
+        for (int i = 0; i < count; i++) {
+            int fd = eventfd(0, EFD_NONBLOCK);
+            fds.push_back(fd);
+            registrations.push_back(Looper::FdRegistration(fd, 0, Looper::EVENT_INPUT,
+                    callback, NULL));
+        }
+    }
+
+    ~EventFds() {
+        for (int fd : fds) {
+            close(fd);
+        }
+    }
+
+    void addTo(const sp<Looper>& looper) {
+        looper->addFds(registrations.data(), registrations.size());
+    }
+
+    void removeFrom(const sp<Looper>& looper) {
+        for (int fd : fds) {
+            looper->removeFd(fd);
+        }
+    }
+
+    void signal(int fd) {
+        uint64_t one = 1;
+        write(fd, &one, sizeof(one));
+    }
+
+    sp<CountingLooperCallback> callback;
+    std::vector<int> fds;
+    std::vector<Looper::FdRegistration> registrations;
+};
+
+// Registers |count| fds in one addFds() call.
+static void BM_looper_addFds(int iters, int count) {
+    sp<Looper> looper = new Looper(true);
+    EventFds fds(count);
+
+    for (int i = 0; i < iters; i++) {
+        StartBenchmarkTiming();
+        fds.addTo(looper);
+        StopBenchmarkTiming();
+        fds.removeFrom(looper);
+    }
+}
+BENCHMARK(BM_looper_addFds)->Arg(1000);
+
+// Removes |count| registered fds one at a time.
+static void BM_looper_removeFd(int iters, int count) {
+    sp<Looper> looper = new Looper(true);
+    EventFds fds(count);
+
+    for (int i = 0; i < iters; i++) {
+        fds.addTo(looper);
+        StartBenchmarkTiming();
+        fds.removeFrom(looper);
+        StopBenchmarkTiming();
+    }
+}
+BENCHMARK(BM_looper_removeFd)->Arg(1000);
+
+// Every one of |count| fds becomes readable at once, as when a burst of input
+// arrives on all channels, and is polled until all callbacks have run.
+static void BM_looper_pollOnce_burst(int iters, int count) {
+    sp<Looper> looper = new Looper(true);
+    EventFds fds(count);
+    fds.addTo(looper);
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        for (int fd : fds.fds) {
+            fds.signal(fd);
+        }
+        size_t expected = size_t(i + 1) * count;
+        while (fds.callback->callbackCount < expected) {
+            looper->pollOnce(0);
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_looper_pollOnce_burst)->Arg(1000);
+
+// One of |count| fds becomes readable, so each wakeup carries a single event.
+static void BM_looper_pollOnce_single(int iters, int count) {
+    sp<Looper> looper = new Looper(true);
+    EventFds fds(count);
+    fds.addTo(looper);
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        fds.signal(fds.fds[(size_t(i) * 7919) % count]);
+        looper->pollOnce(0);
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_looper_pollOnce_single)->Arg(1000);
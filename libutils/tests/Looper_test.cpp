@@ -98,6 +98,20 @@ public:
     }
 };
 
+class CountingLooperCallback : public LooperCallback {
+public:
+    size_t callbackCount;
+
+    CountingLooperCallback() : callbackCount(0) { }
+
+    virtual int handleEvent(int fd, int /*events*/, void* /*data*/) {
+        uint64_t value;
+        read(fd, &value, sizeof(value));
+        callbackCount += 1;
+        return 1;
+    }
+};
+
 class LooperTest : public testing::Test {
 protected:
     sp<Looper> mLooper;
@@ -387,6 +401,23 @@ TEST_F(LooperTest, AddFd_WhenNoCallbackAndAllowNonCallbacksIsFalse_ReturnsError)
             << "addFd should return -1 because arguments were invalid";
 }
 
+TEST_F(LooperTest, AddFds_WhenSomeEntriesAreInvalid_AddsTheOthers) {
+    Pipe pipe1, pipe2, pipe3;
+    sp<CountingLooperCallback> callback = new CountingLooperCallback();
+    Looper::FdRegistration registrations[] = {
+        Looper::FdRegistration(pipe1.receiveFd, 0, Looper::EVENT_INPUT, callback, NULL),
+        Looper::FdRegistration(pipe2.receiveFd, -1, Looper::EVENT_INPUT, NULL, NULL),
+        Looper::FdRegistration(pipe3.receiveFd, 7, Looper::EVENT_INPUT, NULL, NULL),
+    };
+    size_t result = mLooper->addFds(registrations, 3);
+
+    EXPECT_EQ(size_t(2), result)
+            << "addFds should skip the entry with a negative ident and no callback";
+    EXPECT_EQ(1, mLooper->removeFd(pipe1.receiveFd));
+    EXPECT_EQ(0, mLooper->removeFd(pipe2.receiveFd));
+    EXPECT_EQ(1, mLooper->removeFd(pipe3.receiveFd));
+}
+
 TEST_F(LooperTest, RemoveFd_WhenCallbackNotAdded_ReturnsZero) {
     int result = mLooper->removeFd(1);
 
@@ -690,4 +721,56 @@ TEST_F(LooperTest, RemoveMessage_WhenRemovingSomeMessagesForHandler_ShouldRemove
             << "no more messages to handle";
 }
 
+
+TEST_F(LooperTest, SendMessageAtTime_WhenSentOutOfOrder_ShouldInvokeHandlersInUptimeOrderAndFifoForTies) {
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    // Pairs of (uptime offset, what); messages with the same uptime must be
+    // delivered in the order they were sent.
+    const int offsets[] = { 5, 1, 3, 1, 5, 2, 1, 4, 3, 2 };
+    for (int i = 0; i < 10; i++) {
+        mLooper->sendMessageAtTime(now - ms2ns(10 - offsets[i]), handler, Message(i));
+    }
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(10), handler->messages.size())
+            << "handled messages";
+    const int expected[] = { 1, 3, 6, 5, 9, 2, 8, 7, 0, 4 };
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(expected[i], handler->messages[i].what)
+                << "handled message " << i;
+    }
+}
+
+TEST_F(LooperTest, RemoveMessage_WhenInterleavedWithOtherHandlers_ShouldKeepOrderOfOthers) {
+    sp<StubMessageHandler> handler1 = new StubMessageHandler();
+    sp<StubMessageHandler> handler2 = new StubMessageHandler();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < 100; i++) {
+        // Uptimes descend so that every insertion lands at the head.
+        mLooper->sendMessageAtTime(now - ms2ns(i), i % 3 ? handler1 : handler2, Message(i));
+    }
+    mLooper->removeMessages(handler2);
+    mLooper->removeMessages(handler1, 50);
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    EXPECT_EQ(size_t(0), handler2->messages.size())
+            << "all messages for handler2 were removed";
+    ASSERT_EQ(size_t(65), handler1->messages.size())
+            << "handled messages";
+    int previous = 100;
+    for (size_t i = 0; i < handler1->messages.size(); i++) {
+        int what = handler1->messages[i].what;
+        EXPECT_LT(what, previous) << "messages should arrive oldest first";
+        EXPECT_NE(50, what) << "removed message was delivered";
+        previous = what;
+    }
+}
+
 } // namespace android
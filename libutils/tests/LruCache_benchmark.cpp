@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include <utils/FixedLruCache.h>
+#include <utils/LruCache.h>
+
+#include "benchmark.h"
+
+using namespace android;
+
+// A get of a random one of |numKeys| keys, followed by a put when it misses,
+// against a cache that holds 4096 entries.
+template <typename Cache>
+static void churn(int iters, int numKeys) {
+    Cache cache(4096);
+    // Drawn up front, so that the timing covers only the cache.
+    srandom(12345);
+    std::vector<int> keys(1 << 20);
+    for (int& key : keys) {
+        key = random() % numKeys;
+    }
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        int key = keys[i & (keys.size() - 1)];
+        if (cache.get(key) == 0) {
+            cache.put(key, key + 1);
+        }
+    }
+    StopBenchmarkTiming();
+}
+
+static void BM_lrucache_churn(int iters, int numKeys) {
+    churn<LruCache<int, int>>(iters, numKeys);
+}
+BENCHMARK(BM_lrucache_churn)->Arg(4608)->Arg(16384)->Arg(262144);
+
+static void BM_fixedlrucache_churn(int iters, int numKeys) {
+    churn<FixedLruCache<int, int>>(iters, numKeys);
+}
+BENCHMARK(BM_fixedlrucache_churn)->Arg(4608)->Arg(16384)->Arg(262144);
@@ -15,11 +15,14 @@
  */
 
 #include <stdlib.h>
+#include <utils/FixedLruCache.h>
 #include <utils/JenkinsHash.h>
 #include <utils/LruCache.h>
 #include <cutils/log.h>
 #include <gtest/gtest.h>
 
+#include <vector>
+
 namespace {
 
 typedef int SimpleKey;
@@ -399,4 +402,136 @@ TEST_F(LruCacheTest, RemoveNonMember) {
     EXPECT_EQ(std::unordered_set<int>({ 4, 5, 6 }), returnedValues);
 }
 
+typedef FixedLruCache<ComplexKey, ComplexValue> FixedComplexCache;
+
+TEST_F(LruCacheTest, FixedMaxCapacity) {
+    FixedLruCache<SimpleKey, StringValue> cache(2);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    cache.put(3, "three");
+    EXPECT_EQ(NULL, cache.get(1));
+    EXPECT_STREQ("two", cache.get(2));
+    EXPECT_STREQ("three", cache.get(3));
+    EXPECT_EQ(2u, cache.size());
+}
+
+TEST_F(LruCacheTest, FixedGetUpdatesLru) {
+    FixedLruCache<SimpleKey, StringValue> cache(3);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    cache.put(3, "three");
+    EXPECT_STREQ("one", cache.get(1));
+    cache.put(4, "four");
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_EQ(NULL, cache.get(2));
+    EXPECT_STREQ("three", cache.get(3));
+    EXPECT_STREQ("four", cache.get(4));
+    EXPECT_STREQ("one", cache.peekOldestValue());
+}
+
+TEST_F(LruCacheTest, FixedPutExistingKeyKeepsEntries) {
+    FixedLruCache<SimpleKey, StringValue> cache(2);
+    EntryRemovedCallback callback;
+    cache.setOnEntryRemovedListener(&callback);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    EXPECT_FALSE(cache.put(2, "deux"));
+    EXPECT_EQ(0, callback.callbackCount);
+    EXPECT_STREQ("one", cache.get(1));
+    EXPECT_STREQ("two", cache.get(2));
+}
+
+TEST_F(LruCacheTest, FixedCallback) {
+    FixedLruCache<SimpleKey, StringValue> cache(2);
+    EntryRemovedCallback callback;
+    cache.setOnEntryRemovedListener(&callback);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    cache.put(3, "three");
+    EXPECT_EQ(1, callback.callbackCount);
+    EXPECT_EQ(1, callback.lastKey);
+    EXPECT_STREQ("one", callback.lastValue);
+    cache.remove(3);
+    EXPECT_EQ(2, callback.callbackCount);
+    EXPECT_EQ(3, callback.lastKey);
+    cache.clear();
+    EXPECT_EQ(3, callback.callbackCount);
+    EXPECT_EQ(0u, cache.size());
+}
+
+TEST_F(LruCacheTest, FixedNoLeak) {
+    {
+        FixedComplexCache cache(2);
+
+        cache.put(ComplexKey(0), ComplexValue(0));
+        cache.put(ComplexKey(1), ComplexValue(1));
+        cache.put(ComplexKey(2), ComplexValue(2));
+        assertInstanceCount(2, 3);  // the member mNullValue counts as an instance
+        cache.remove(ComplexKey(2));
+        assertInstanceCount(1, 2);
+        cache.clear();
+        assertInstanceCount(0, 1);
+        cache.put(ComplexKey(3), ComplexValue(3));
+        assertInstanceCount(1, 2);
+    }
+    assertInstanceCount(0, 0);
+}
+
+TEST_F(LruCacheTest, FixedIteratorWalksOldestFirst) {
+    FixedLruCache<int, int> cache(100);
+
+    FixedLruCache<int, int>::Iterator none(cache);
+    EXPECT_FALSE(none.next());
+
+    cache.put(1, 4);
+    cache.put(2, 5);
+    cache.put(3, 6);
+    cache.get(1);
+
+    FixedLruCache<int, int>::Iterator it(cache);
+    std::vector<int> keys;
+    while (it.next()) {
+        keys.push_back(it.key());
+    }
+    EXPECT_EQ(std::vector<int>({ 2, 3, 1 }), keys);
+}
+
+// Checks the open-addressed table against LruCache through a long run of
+// puts, gets and removes on colliding keys.
+TEST_F(LruCacheTest, FixedMatchesLruCache) {
+    const size_t kCacheSize = 300;
+    LruCache<SimpleKey, StringValue> reference(kCacheSize);
+    FixedLruCache<SimpleKey, StringValue> cache(kCacheSize);
+    static const char* const kValues[] = { "a", "b", "c" };
+
+    srandom(54321);
+    for (size_t i = 0; i < 200000; i++) {
+        // Multiples of 1024 all land near each other without mixing.
+        SimpleKey key = (random() % 1000) * 1024;
+        StringValue value = kValues[i % 3];
+        switch (random() % 4) {
+        case 0:
+            ASSERT_EQ(reference.remove(key), cache.remove(key));
+            break;
+        case 1:
+            ASSERT_EQ(reference.get(key), cache.get(key));
+            break;
+        default:
+            if (reference.get(key) == NULL) {
+                reference.put(key, value);
+            }
+            if (cache.get(key) == NULL) {
+                cache.put(key, value);
+            }
+            break;
+        }
+        ASSERT_EQ(reference.size(), cache.size());
+        ASSERT_EQ(reference.peekOldestValue(), cache.peekOldestValue());
+    }
+}
+
 }
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/RefBase.h>
+#include <utils/StrongPointer.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "benchmark.h"
+
+using namespace android;
+
+class BenchRefBase : public RefBase {
+};
+
+class BenchLightRefBase : public LightRefBase<BenchLightRefBase> {
+};
+
+// Times |iters| sp<> copies plus destructions on each of |threadCount|
+// threads, either each on its own object or all on one shared object.
+template <typename T>
+static void copyDestroy(int iters, int threadCount, bool shared) {
+    sp<T> common = new T();
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++) {
+        threads.emplace_back([&]() {
+            sp<T> source = shared ? common : sp<T>(new T());
+            ready.fetch_add(1);
+            while (!go.load()) { }
+            for (int n = 0; n < iters; n++) {
+                sp<T> copy(source);
+            }
+        });
+    }
+    while (ready.load() != threadCount) { }
+
+    StartBenchmarkTiming();
+    go.store(true);
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    StopBenchmarkTiming();
+}
+
+static void BM_refbase_copy_private(int iters, int threads) {
+    copyDestroy<BenchRefBase>(iters, threads, false);
+}
+BENCHMARK(BM_refbase_copy_private)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
+static void BM_refbase_copy_shared(int iters, int threads) {
+    copyDestroy<BenchRefBase>(iters, threads, true);
+}
+BENCHMARK(BM_refbase_copy_shared)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
+static void BM_lightrefbase_copy_private(int iters, int threads) {
+    copyDestroy<BenchLightRefBase>(iters, threads, false);
+}
+BENCHMARK(BM_lightrefbase_copy_private)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
+static void BM_lightrefbase_copy_shared(int iters, int threads) {
+    copyDestroy<BenchLightRefBase>(iters, threads, true);
+}
+BENCHMARK(BM_lightrefbase_copy_shared)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <utils/RefBase.h>
+#include <utils/StrongPointer.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace android;
+
+class Bar : public RefBase {
+public:
+    Bar(std::atomic<int>* deleted) : mDeleted(deleted) { }
+
+    ~Bar() {
+        mDeleted->fetch_add(1);
+    }
+
+private:
+    std::atomic<int>* mDeleted;
+};
+
+class LightBar : public LightRefBase<LightBar> {
+};
+
+TEST(RefBase, PromoteAfterLastStrongRefFails) {
+    std::atomic<int> deleted(0);
+    sp<Bar> strong = new Bar(&deleted);
+    wp<Bar> weak = strong;
+    ASSERT_NE(nullptr, weak.promote().get());
+    strong.clear();
+    EXPECT_EQ(1, deleted.load());
+    EXPECT_EQ(nullptr, weak.promote().get());
+}
+
+TEST(RefBase, PromoteWithoutPriorStrongRef) {
+    std::atomic<int> deleted(0);
+    Bar* bar = new Bar(&deleted);
+    wp<Bar> weak = bar;
+    {
+        sp<Bar> strong = weak.promote();
+        ASSERT_EQ(bar, strong.get());
+        EXPECT_EQ(1, bar->getStrongCount());
+    }
+    EXPECT_EQ(1, deleted.load());
+}
+
+// Several threads race to take the first strong reference through a weak one.
+// Exactly one of them must remove the initial bias from the strong count.
+TEST(RefBase, ConcurrentFirstPromotion) {
+    static const int kThreads = 8;
+    for (int iteration = 0; iteration < 200; iteration++) {
+        std::atomic<int> deleted(0);
+        Bar* bar = new Bar(&deleted);
+        wp<Bar> weak = bar;
+        std::vector<sp<Bar>> promoted(kThreads);
+        std::atomic<bool> go(false);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; i++) {
+            threads.emplace_back([&, i]() {
+                while (!go.load()) { }
+                promoted[i] = weak.promote();
+            });
+        }
+        go.store(true);
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        for (const sp<Bar>& p : promoted) {
+            ASSERT_EQ(bar, p.get());
+        }
+        ASSERT_EQ(kThreads, bar->getStrongCount());
+        promoted.clear();
+        ASSERT_EQ(1, deleted.load());
+    }
+}
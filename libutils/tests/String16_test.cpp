@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+static String8 narrow(const String16& s) {
+    return String8(s);
+}
+
+// Lengths either side of the point where strings stop being shared.
+TEST(String16Test, SharedBoundary) {
+    char text[40];
+    for (size_t len = 0; len < sizeof(text) - 1; len++) {
+        memset(text, 'a' + len % 26, len);
+        text[len] = 0;
+        String16 s(text);
+        EXPECT_EQ(len, s.size());
+        EXPECT_STREQ(text, narrow(s).string());
+
+        String16 copy(s);
+        EXPECT_TRUE(copy == s);
+
+        s.append(String16("!"));
+        EXPECT_EQ(len + 1, s.size());
+        EXPECT_EQ(u'!', s.string()[len]);
+        EXPECT_EQ(0, s.string()[len + 1]);
+        EXPECT_STREQ(text, narrow(copy).string());
+    }
+}
+
+TEST(String16Test, EditsDoNotLeakIntoCopies) {
+    String16 a("Some Mixed Case Text Too Long To Be Shared");
+    String16 b(a);
+    b.makeLower();
+    b.replaceAll(u' ', u'_');
+    EXPECT_STREQ("Some Mixed Case Text Too Long To Be Shared", narrow(a).string());
+    EXPECT_STREQ("some_mixed_case_text_too_long_to_be_shared", narrow(b).string());
+
+    String16 c("Short");
+    String16 d(c);
+    d.makeLower();
+    EXPECT_STREQ("Short", narrow(c).string());
+    EXPECT_STREQ("short", narrow(d).string());
+}
+
+TEST(String16Test, InsertAndRemoveAcrossBoundary) {
+    String16 s("0123");
+    s.insert(2, String16("abcdefghijklmnop").string());
+    EXPECT_STREQ("01abcdefghijklmnop23", narrow(s).string());
+    s.remove(3, 1);
+    EXPECT_STREQ("1ab", narrow(s).string());
+    s.remove(10, 5);
+    EXPECT_EQ(0U, s.size());
+}
+
+TEST(String16Test, SourceInsideThisString) {
+    String16 s("0123456789");
+    s.append(s);
+    EXPECT_STREQ("01234567890123456789", narrow(s).string());
+    s.append(s.string() + 15, 5);
+    EXPECT_STREQ("0123456789012345678956789", narrow(s).string());
+    s.insert(0, s.string() + 20, 5);
+    EXPECT_STREQ("567890123456789012345678956789", narrow(s).string());
+    s.setTo(s, 4, 2);
+    EXPECT_STREQ("7890", narrow(s).string());
+}
+
+}
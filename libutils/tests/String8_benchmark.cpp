@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
+
+#include <new>
+#include <string>
+
+#include "benchmark.h"
+
+using namespace android;
+
+// Strings are made in batches so that the buffers behind them can be counted
+// while they are all alive.
+static const int kBatch = 1000;
+
+// Returns the number of buffers behind |strings| other than |existing|'s,
+// which is how many allocations making them took.
+static size_t countNewBuffers(const String8* strings, int count, const String8& existing) {
+    SortedVector<const char*> buffers;
+    for (int i = 0; i < count; i++) {
+        if (strings[i].string() != existing.string()) {
+            buffers.add(strings[i].string());
+        }
+    }
+    return buffers.size();
+}
+
+// Makes a String8 from a C string |length| bytes long.
+static void BM_string8_construct(int iters, int length) {
+    std::string text(length, 'x');
+    String8 existing(text.c_str());
+    String8* batch = static_cast<String8*>(operator new(kBatch * sizeof(String8)));
+    uint64_t allocations = 0;
+
+    for (int i = 0; i < iters; i += kBatch) {
+        int count = std::min(kBatch, iters - i);
+        StartBenchmarkTiming();
+        for (int j = 0; j < count; j++) {
+            new (&batch[j]) String8(text.c_str());
+        }
+        StopBenchmarkTiming();
+        allocations += countNewBuffers(batch, count, existing);
+        for (int j = 0; j < count; j++) {
+            batch[j].~String8();
+        }
+    }
+    operator delete(batch);
+    SetBenchmarkAllocations(allocations);
+}
+BENCHMARK(BM_string8_construct)->Arg(0)->Arg(2)->Arg(12)->Arg(18)->Arg(44);
+
+// Copies a String8 |length| bytes long.
+static void BM_string8_copy(int iters, int length) {
+    std::string text(length, 'x');
+    String8 source(text.c_str());
+    String8* batch = static_cast<String8*>(operator new(kBatch * sizeof(String8)));
+    uint64_t allocations = 0;
+
+    for (int i = 0; i < iters; i += kBatch) {
+        int count = std::min(kBatch, iters - i);
+        StartBenchmarkTiming();
+        for (int j = 0; j < count; j++) {
+            new (&batch[j]) String8(source);
+        }
+        StopBenchmarkTiming();
+        allocations += countNewBuffers(batch, count, source);
+        for (int j = 0; j < count; j++) {
+            batch[j].~String8();
+        }
+    }
+    operator delete(batch);
+    SetBenchmarkAllocations(allocations);
+}
+BENCHMARK(BM_string8_copy)->Arg(0)->Arg(2)->Arg(12)->Arg(18)->Arg(44);
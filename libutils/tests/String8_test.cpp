@@ -17,9 +17,14 @@
 #define LOG_TAG "String8_test"
 #include <utils/Log.h>
 #include <utils/String8.h>
+#include <utils/String16.h>
+#include <utils/SortedVector.h>
+#include <utils/Vector.h>
 
 #include <gtest/gtest.h>
 
+#include <string.h>
+
 namespace android {
 
 class String8Test : public testing::Test {
@@ -72,4 +77,130 @@ TEST_F(String8Test, OperatorPlusEquals) {
     EXPECT_STREQ(src3, " Verify me.");
 }
 
+// Lengths either side of the point where strings stop being shared.
+TEST_F(String8Test, SharedBoundary) {
+    char text[64];
+    for (size_t len = 0; len < sizeof(text) - 1; len++) {
+        memset(text, 'a' + len % 26, len);
+        text[len] = 0;
+        String8 s(text);
+        EXPECT_EQ(len, s.length());
+        EXPECT_STREQ(text, s.string());
+
+        String8 copy(s);
+        EXPECT_EQ(len, copy.length());
+        EXPECT_STREQ(text, copy.string());
+        EXPECT_TRUE(copy == s);
+
+        s.append("!");
+        EXPECT_EQ(len + 1, s.length());
+        EXPECT_EQ('!', s.string()[len]);
+        EXPECT_STREQ(text, copy.string());
+    }
+}
+
+TEST_F(String8Test, CopiesOfLongStringsShareStorage) {
+    String8 a("a string too long to be shared by contents");
+    String8 b(a);
+    EXPECT_EQ(a.string(), b.string());
+
+    b.toUpper();
+    EXPECT_STREQ("a string too long to be shared by contents", a.string());
+    EXPECT_STREQ("A STRING TOO LONG TO BE SHARED BY CONTENTS", b.string());
+}
+
+TEST_F(String8Test, LockBufferGrowAndShrink) {
+    String8 s("short");
+    char* buf = s.lockBuffer(100);
+    ASSERT_TRUE(buf != NULL);
+    EXPECT_STREQ("short", buf);
+    memset(buf, 'x', 100);
+    buf[100] = 0;
+    s.unlockBuffer();
+    EXPECT_EQ(100U, s.length());
+
+    // Shrinking back keeps the leading bytes.
+    buf = s.lockBuffer(3);
+    ASSERT_TRUE(buf != NULL);
+    EXPECT_EQ(0, memcmp("xxx", buf, 3));
+    s.unlockBuffer(2);
+    EXPECT_STREQ("xx", s.string());
+    EXPECT_EQ(2U, s.length());
+}
+
+TEST_F(String8Test, AppendSelf) {
+    String8 s("abc");
+    for (int i = 0; i < 5; i++) {
+        s.append(s);
+    }
+    EXPECT_EQ(96U, s.length());
+    EXPECT_EQ(0, strncmp("abcabcabc", s.string(), 9));
+
+    String8 t("0123456789");
+    t.append(t.string() + 5);
+    t.append(t.string() + 10);
+    EXPECT_STREQ("01234567895678956789", t.string());
+
+    t.setTo(t.string() + 2, 4);
+    EXPECT_STREQ("2345", t.string());
+}
+
+TEST_F(String8Test, FormatAndConvert) {
+    String8 s = String8::format("%d-%s", 42, "short");
+    EXPECT_STREQ("42-short", s.string());
+    s.appendFormat(" and then a much longer tail %d", 7);
+    EXPECT_STREQ("42-short and then a much longer tail 7", s.string());
+
+    String16 wide("cafe");
+    EXPECT_STREQ("cafe", String8(wide).string());
+    s.setTo(wide.string(), wide.size());
+    EXPECT_STREQ("cafe", s.string());
+
+    s.clear();
+    EXPECT_TRUE(s.isEmpty());
+    EXPECT_STREQ("", s.string());
+}
+
+// Counts the buffers behind a set of live strings. Each distinct buffer
+// was one allocation.
+static size_t countBuffers(const Vector<String8>& strings) {
+    SortedVector<const char*> buffers;
+    for (size_t i = 0; i < strings.size(); i++) {
+        buffers.add(strings[i].string());
+    }
+    return buffers.size();
+}
+
+TEST_F(String8Test, ShortStringsShareBuffers) {
+    static const char* const kKeys[] = {
+        "ro.build.type", "persist.sys.locale", "ro.product.model", "sys.boot_completed",
+    };
+    static const size_t kCopies = 100;
+
+    Vector<String8> strings;
+    for (size_t i = 0; i < kCopies; i++) {
+        for (const char* key : kKeys) {
+            String8 s(key);
+            EXPECT_STREQ(key, s.string());
+            strings.add(s);
+        }
+    }
+    // One allocation per distinct key rather than one per string.
+    EXPECT_EQ(sizeof(kKeys) / sizeof(kKeys[0]), countBuffers(strings));
+
+    // Longer strings still get a buffer each.
+    strings.clear();
+    for (size_t i = 0; i < kCopies; i++) {
+        strings.add(String8("/data/data/com.example.app/cache/image_cache"));
+    }
+    EXPECT_EQ(kCopies, countBuffers(strings));
+
+    // Editing one of the shared strings leaves the others alone.
+    String8 a("ro.build.type");
+    String8 b("ro.build.type");
+    b.toUpper();
+    EXPECT_STREQ("ro.build.type", a.string());
+    EXPECT_STREQ("RO.BUILD.TYPE", b.string());
+}
+
 }
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/ThreadPool.h>
+
+#include <vector>
+
+#include "benchmark.h"
+
+using namespace android;
+
+// Enough work per task that it is not all overhead, but still fine grained.
+static const int kWork = 200;
+
+static void spin(int iterations) {
+    for (volatile int i = 0; i < iterations; i++) {
+    }
+}
+
+// Splits [begin, end) in halves down to single items, the way parallel loops
+// are usually written on top of a work-stealing pool.
+static void parallelFor(ThreadPool* pool, int begin, int end) {
+    if (end - begin == 1) {
+        spin(kWork);
+        return;
+    }
+    int middle = begin + (end - begin) / 2;
+    auto left = pool->async([=]() { parallelFor(pool, begin, middle); });
+    parallelFor(pool, middle, end);
+    left->get();
+}
+
+// The work alone, for comparison with the pool's per-task cost.
+static void BM_threadpool_inline(int iters) {
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        spin(kWork);
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_threadpool_inline);
+
+// |iters| tasks split recursively inside a pool of |threads| threads.
+static void BM_threadpool_recursive(int iters, int threads) {
+    sp<ThreadPool> pool = new ThreadPool(threads);
+
+    StartBenchmarkTiming();
+    pool->async([&pool, iters]() { parallelFor(pool.get(), 0, iters); })->get();
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_threadpool_recursive)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
+// |iters| tasks submitted one by one from outside a pool of |threads| threads.
+static void BM_threadpool_external(int iters, int threads) {
+    sp<ThreadPool> pool = new ThreadPool(threads);
+    std::vector<sp<FutureTask<void>>> tasks;
+    tasks.reserve(iters);
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        tasks.push_back(pool->async([]() { spin(kWork); }));
+    }
+    for (const sp<FutureTask<void>>& task : tasks) {
+        task->wait();
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_threadpool_external)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
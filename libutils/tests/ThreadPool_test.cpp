@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <utils/Looper.h>
+#include <utils/ThreadPool.h>
+#include <utils/Timers.h>
+
+#include <sched.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+using namespace android;
+
+// Keeps a pool thread busy until open() is called.
+class Gate {
+public:
+    Gate() : mOpen(false), mEntered(false) { }
+
+    std::function<void()> blocker() {
+        return [this]() {
+            mEntered.store(true);
+            while (!mOpen.load()) {
+                sched_yield();
+            }
+        };
+    }
+
+    void waitUntilBlocking() {
+        while (!mEntered.load()) {
+            sched_yield();
+        }
+    }
+
+    void open() { mOpen.store(true); }
+
+private:
+    std::atomic<bool> mOpen;
+    std::atomic<bool> mEntered;
+};
+
+static int fib(ThreadPool* pool, int n) {
+    if (n < 2) {
+        return n;
+    }
+    auto left = pool->async([pool, n]() { return fib(pool, n - 1); });
+    int right = fib(pool, n - 2);
+    return left->get() + right;
+}
+
+TEST(ThreadPool, RunsEveryTask) {
+    sp<ThreadPool> pool = new ThreadPool(4);
+    std::vector<sp<FutureTask<int>>> tasks;
+    for (int i = 0; i < 1000; i++) {
+        tasks.push_back(pool->async([i]() { return i * 2; }));
+    }
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_EQ(i * 2, tasks[i]->get());
+    }
+}
+
+TEST(ThreadPool, TasksCanWaitOnTasksTheySubmit) {
+    // Fewer threads than nested waits: waiting threads must help out.
+    sp<ThreadPool> pool = new ThreadPool(2);
+    auto task = pool->async([&pool]() { return fib(pool.get(), 18); });
+    EXPECT_EQ(2584, task->get());
+}
+
+TEST(ThreadPool, MostUrgentClassRunsFirst) {
+    sp<ThreadPool> pool = new ThreadPool(1);
+    Gate gate;
+    pool->async(gate.blocker());
+    gate.waitUntilBlocking();
+
+    std::mutex lock;
+    std::vector<int> order;
+    auto record = [&](int what) {
+        return [&, what]() {
+            std::lock_guard<std::mutex> _l(lock);
+            order.push_back(what);
+        };
+    };
+    pool->async(record(ThreadPool::PRIORITY_BACKGROUND), ThreadPool::PRIORITY_BACKGROUND);
+    pool->async(record(ThreadPool::PRIORITY_NORMAL), ThreadPool::PRIORITY_NORMAL);
+    pool->async(record(ThreadPool::PRIORITY_FOREGROUND), ThreadPool::PRIORITY_FOREGROUND);
+    gate.open();
+    pool->shutdown();
+
+    EXPECT_EQ(std::vector<int>({ ThreadPool::PRIORITY_FOREGROUND, ThreadPool::PRIORITY_NORMAL,
+            ThreadPool::PRIORITY_BACKGROUND }), order);
+}
+
+TEST(ThreadPool, CancelledTaskDoesNotRun) {
+    sp<ThreadPool> pool = new ThreadPool(1);
+    Gate gate;
+    sp<Task> blocker = pool->async(gate.blocker());
+    gate.waitUntilBlocking();
+
+    bool ran = false;
+    auto task = pool->async([&ran]() { ran = true; });
+    EXPECT_TRUE(task->cancel());
+    EXPECT_TRUE(task->isDone());
+    EXPECT_TRUE(task->isCancelled());
+    EXPECT_FALSE(blocker->cancel());
+
+    gate.open();
+    blocker->wait();
+    pool->shutdown();
+    EXPECT_FALSE(ran);
+}
+
+TEST(ThreadPool, TaskCanOnlyBeSubmittedOnce) {
+    sp<ThreadPool> pool = new ThreadPool(1);
+    sp<FutureTask<int>> task = new FutureTask<int>([]() { return 1; });
+    EXPECT_EQ(OK, pool->submit(task));
+    EXPECT_EQ(INVALID_OPERATION, pool->submit(task));
+    EXPECT_EQ(1, task->get());
+}
+
+TEST(ThreadPool, WaitRelativeTimesOut) {
+    sp<ThreadPool> pool = new ThreadPool(1);
+    Gate gate;
+    auto task = pool->async(gate.blocker());
+    EXPECT_EQ(TIMED_OUT, task->waitRelative(ms2ns(10)));
+    gate.open();
+    EXPECT_EQ(OK, task->waitRelative(s2ns(10)));
+}
+
+TEST(ThreadPool, ShutdownRunsQueuedTasks) {
+    sp<ThreadPool> pool = new ThreadPool(2);
+    std::atomic<int> count(0);
+    for (int i = 0; i < 100; i++) {
+        pool->async([&count, &pool]() {
+            // Work queued while draining still runs.
+            pool->async([&count]() { count.fetch_add(1); });
+            count.fetch_add(1);
+        });
+    }
+    EXPECT_EQ(OK, pool->shutdown());
+    EXPECT_EQ(200, count.load());
+    EXPECT_EQ(NULL, pool->async([]() { }).get());
+    EXPECT_EQ(OK, pool->shutdown());
+}
+
+TEST(ThreadPool, GetForThread) {
+    sp<ThreadPool> pool = new ThreadPool(1);
+    EXPECT_EQ(NULL, ThreadPool::getForThread());
+    auto task = pool->async([]() { return ThreadPool::getForThread(); });
+    EXPECT_EQ(pool.get(), task->get());
+    EXPECT_EQ(WOULD_BLOCK, pool->async([&pool]() { return pool->shutdown(); })->get());
+}
+
+class CompletionHandler : public MessageHandler {
+public:
+    CompletionHandler() : mWhat(-1) { }
+    virtual void handleMessage(const Message& message) { mWhat = message.what; }
+    int mWhat;
+};
+
+TEST(ThreadPool, CompletionIsPostedToLooper) {
+    sp<ThreadPool> pool = new ThreadPool(2);
+    sp<Looper> looper = new Looper(true);
+    sp<CompletionHandler> handler = new CompletionHandler();
+
+    sp<FutureTask<int>> task = new FutureTask<int>([]() { return 42; });
+    task->setCompletionMessage(looper, handler, Message(7));
+    ASSERT_EQ(OK, pool->submit(task));
+
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + s2ns(10);
+    while (handler->mWhat == -1 && systemTime(SYSTEM_TIME_MONOTONIC) < deadline) {
+        looper->pollOnce(100);
+    }
+    EXPECT_EQ(7, handler->mWhat);
+    EXPECT_TRUE(task->isDone());
+    EXPECT_EQ(42, task->get());
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/Unicode.h>
+
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+static const char kAscii[] = "The quick brown fox jumps over the lazy dog. ";
+static const char kLatin[] = "D\xC3\xA9j\xC3\xA0 vu, na\xC3\xAFve caf\xC3\xA9 ";
+static const char kCjk[] = "\xE4\xB8\xAD\xE6\x96\x87\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E";
+static const char kEmoji[] = "\xF0\x9F\x98\x80\xF0\x9F\x8E\x89\xF0\x9F\x91\x8D";
+
+// 64KiB of UTF-8 made by repeating |pattern|.
+static std::string makeText(const char* pattern) {
+    std::string text;
+    while (text.size() < 64 * 1024) {
+        text.append(pattern);
+    }
+    return text;
+}
+
+static void BM_unicode_utf8_length(int iters, const char* pattern) {
+    std::string text = makeText(pattern);
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        utf8_length(text.c_str());
+    }
+    StopBenchmarkTiming();
+    SetBenchmarkBytesProcessed(uint64_t(iters) * text.size());
+}
+BENCHMARK(BM_unicode_utf8_length)->Arg("ascii", kAscii)->Arg("latin", kLatin)
+        ->Arg("cjk", kCjk)->Arg("emoji", kEmoji);
+
+static void BM_unicode_utf8_to_utf16(int iters, const char* pattern) {
+    std::string text = makeText(pattern);
+    const uint8_t* u8 = reinterpret_cast<const uint8_t*>(text.data());
+    std::vector<char16_t> utf16(utf8_to_utf16_length(u8, text.size()) + 1);
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        utf8_to_utf16_length(u8, text.size());
+        utf8_to_utf16(u8, text.size(), utf16.data());
+    }
+    StopBenchmarkTiming();
+    SetBenchmarkBytesProcessed(uint64_t(iters) * text.size());
+}
+BENCHMARK(BM_unicode_utf8_to_utf16)->Arg("ascii", kAscii)->Arg("latin", kLatin)
+        ->Arg("cjk", kCjk)->Arg("emoji", kEmoji);
+
+static void BM_unicode_utf16_to_utf8(int iters, const char* pattern) {
+    std::string text = makeText(pattern);
+    const uint8_t* u8 = reinterpret_cast<const uint8_t*>(text.data());
+    std::vector<char16_t> utf16(utf8_to_utf16_length(u8, text.size()) + 1);
+    utf8_to_utf16(u8, text.size(), utf16.data());
+    std::vector<char> utf8(text.size() + 1);
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        utf16_to_utf8_length(utf16.data(), utf16.size() - 1);
+        utf16_to_utf8(utf16.data(), utf16.size() - 1, utf8.data());
+    }
+    StopBenchmarkTiming();
+    SetBenchmarkBytesProcessed(uint64_t(iters) * text.size());
+}
+BENCHMARK(BM_unicode_utf16_to_utf8)->Arg("ascii", kAscii)->Arg("latin", kLatin)
+        ->Arg("cjk", kCjk)->Arg("emoji", kEmoji);
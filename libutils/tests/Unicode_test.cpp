@@ -20,6 +20,9 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
+#include <vector>
+
 namespace android {
 
 class UnicodeTest : public testing::Test {
@@ -112,4 +115,87 @@ TEST_F(UnicodeTest, UTF8toUTF16Normal) {
             << "should be NULL terminated";
 }
 
+// Builds text from |count| code points, cycling through |pattern| and
+// putting a run of ASCII of varying length before each one, so that
+// multi-byte characters land at every offset within a vector block.
+static std::string mixedText(const char* const* pattern, size_t patternSize, size_t count) {
+    std::string text;
+    for (size_t i = 0; i < count; i++) {
+        text.append(i % 37, 'a' + i % 26);
+        text.append(pattern[i % patternSize]);
+    }
+    return text;
+}
+
+TEST_F(UnicodeTest, MixedTextMatchesPerCodepointConversion) {
+    static const char* const kPattern[] = {
+        "\xC4\x80",         // U+0100
+        "\xE2\x8C\xA3",     // U+2323
+        "\xF0\x90\x80\x80", // U+10000
+        "\xE4\xB8\xAD",     // U+4E2D
+        "\x7F",
+    };
+    const std::string text = mixedText(kPattern, 5, 200);
+    const uint8_t* u8 = reinterpret_cast<const uint8_t*>(text.data());
+
+    // Convert one code point at a time, too short for the vector paths.
+    std::vector<char16_t> expected;
+    for (size_t i = 0; i < text.size(); ) {
+        size_t len = 1;
+        while (i + len < text.size() && (text[i + len] & 0xC0) == 0x80) {
+            len++;
+        }
+        char16_t units[3];
+        ASSERT_LT(0, utf8_to_utf16_length(u8 + i, len));
+        char16_t* end = utf8_to_utf16_no_null_terminator(u8 + i, len, units);
+        expected.insert(expected.end(), units, end);
+        i += len;
+    }
+
+    EXPECT_EQ(ssize_t(text.size()), utf8_length(text.c_str()));
+    ASSERT_EQ(ssize_t(expected.size()), utf8_to_utf16_length(u8, text.size()));
+    std::vector<char16_t> utf16(expected.size() + 1);
+    utf8_to_utf16(u8, text.size(), utf16.data());
+    EXPECT_EQ(0, utf16.back());
+    utf16.pop_back();
+    EXPECT_TRUE(expected == utf16);
+
+    ASSERT_EQ(ssize_t(text.size()), utf16_to_utf8_length(utf16.data(), utf16.size()));
+    std::vector<char> utf8(text.size() + 1);
+    utf16_to_utf8(utf16.data(), utf16.size(), utf8.data());
+    EXPECT_STREQ(text.c_str(), utf8.data());
+}
+
+TEST_F(UnicodeTest, InvalidUTF8AfterLongASCIIRun) {
+    std::string text(40, 'x');
+    text.append("\xE2\x8C");
+    EXPECT_EQ(-1, utf8_to_utf16_length(
+            reinterpret_cast<const uint8_t*>(text.data()), text.size()));
+
+    text.assign(40, 'x');
+    text.append("\x80");
+    text.append(20, 'y');
+    EXPECT_EQ(-1, utf8_length(text.c_str()));
+}
+
+TEST_F(UnicodeTest, UTF8LengthOfShortHeapStrings) {
+    // The aligned block loads run past the end of these allocations, which
+    // AddressSanitizer must not report.
+    for (size_t n = 1; n <= 48; n++) {
+        std::vector<char> text(n + 1, 'x');
+        text[n] = '\0';
+        EXPECT_EQ(ssize_t(n), utf8_length(text.data()));
+    }
+}
+
+TEST_F(UnicodeTest, UnpairedSurrogateInUTF16Block) {
+    // The lone high surrogate produces nothing, as it always has.
+    const char16_t str[] = { 'a', 'b', 'c', 0xD800, 'd', 'e', 'f', 'g', 'h', 'i', 'j' };
+    const size_t n = sizeof(str) / sizeof(str[0]);
+    EXPECT_EQ(10, utf16_to_utf8_length(str, n));
+    char out[16];
+    utf16_to_utf8(str, n, out);
+    EXPECT_STREQ("abcdefghij", out);
+}
+
 }
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include "benchmark.h"
+
+using namespace android;
+
+// Pushes |count| items onto an empty vector, then pops them all off again.
+template <typename T>
+static void pushPop(int iters, int count, const T& item) {
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        Vector<T> vector;
+        for (int n = 0; n < count; n++) {
+            vector.push(item);
+        }
+        while (!vector.isEmpty()) {
+            vector.pop();
+        }
+    }
+    StopBenchmarkTiming();
+}
+
+static void BM_vector_pushPop_int(int iters, int count) {
+    pushPop<int>(iters, count, 42);
+}
+BENCHMARK(BM_vector_pushPop_int)->Arg(1000)->Arg(100000)->Arg(1000000);
+
+static void BM_vector_pushPop_String8(int iters, int count) {
+    pushPop<String8>(iters, count,
+            String8("a string that is long enough to be worth not copying"));
+}
+BENCHMARK(BM_vector_pushPop_String8)->Arg(1000)->Arg(100000)->Arg(1000000);
@@ -18,6 +18,7 @@
 
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 #include <cutils/log.h>
 #include <gtest/gtest.h>
@@ -149,4 +150,58 @@ TEST_F(VectorTest, editArray_Shared) {
   }
 }
 
+TEST_F(VectorTest, Grow_TriviallyMovable_SharedStorageIsCopied) {
+  Vector<String8> vector1;
+  for (int i = 0; i < 4; ++i) {
+    vector1.add(String8::format("item %d", i));
+  }
+  Vector<String8> vector2 = vector1;
+
+  // vector1 has to copy the shared storage when it grows; vector2 keeps it.
+  for (int i = 4; i < 100; ++i) {
+    vector1.insertAt(String8::format("item %d", i), 2);
+  }
+  ASSERT_EQ(4U, vector2.size());
+  for (size_t i = 0; i < vector2.size(); ++i) {
+    EXPECT_STREQ(String8::format("item %zu", i).string(), vector2[i].string());
+  }
+
+  // Now that vector1 owns its storage, it grows and shrinks in place.
+  for (int i = 100; i < 1000; ++i) {
+    vector1.insertAt(String8::format("item %d", i), 2);
+  }
+  ASSERT_EQ(1000U, vector1.size());
+  EXPECT_STREQ("item 0", vector1[0].string());
+  EXPECT_STREQ("item 1", vector1[1].string());
+  EXPECT_STREQ("item 999", vector1[2].string());
+  EXPECT_STREQ("item 4", vector1[997].string());
+  EXPECT_STREQ("item 2", vector1[998].string());
+  EXPECT_STREQ("item 3", vector1[999].string());
+  vector1.removeItemsAt(1, 990);
+  ASSERT_EQ(10U, vector1.size());
+  EXPECT_STREQ("item 0", vector1[0].string());
+  EXPECT_STREQ("item 10", vector1[1].string());
+  EXPECT_STREQ("item 3", vector1[9].string());
+}
+
+TEST_F(VectorTest, Shrink_PopAll_ResizesLogarithmically) {
+  Vector<int> vector;
+  for (int i = 0; i < 10000; ++i) {
+    vector.push(i);
+  }
+
+  // Each shrink must be paid for by many pops, rather than the storage
+  // being resized again on every pop once it has shrunk once.
+  size_t resizes = 0;
+  size_t capacity = vector.capacity();
+  while (!vector.isEmpty()) {
+    vector.pop();
+    if (vector.capacity() != capacity) {
+      ++resizes;
+      capacity = vector.capacity();
+    }
+  }
+  EXPECT_LT(resizes, 20U);
+}
+
 } // namespace android